@@ -0,0 +1,558 @@
+// NOTE(vincent): Microbenchmarks for the hot loops that don't need a running server.
+// Usage: bench_linux [--json] [--compare baseline.json] [name filter]
+// Each benchmark is warmed up, sized so that one batch of operations takes BENCH_BATCH_SECONDS, then timed
+// over BENCH_SAMPLES batches. The table shows the fastest and the median batch per operation, the spread
+// of the batches, and the median in TSC ticks, which count at the CPU's nominal frequency whatever its
+// actual clock. --json prints the same numbers as JSON, one benchmark per line, and --compare reads such
+// a file back and reports the medians that moved by more than BENCH_REGRESSION_PERCENT.
+// Numbers are only comparable on the same machine: run with the server stopped and the CPU frequency fixed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "common.h"
+#include "md5_hash.cpp"
+#include "server_htpasswd.cpp"
+#include "server_http_parsing.cpp"
+
+#define BENCH_SAMPLES 51
+#define BENCH_BATCH_SECONDS 0.002
+#define BENCH_WARMUP_SECONDS 0.05
+#define BENCH_REGRESSION_PERCENT 5.0
+#define BENCH_MAX_RESULTS 64
+
+// NOTE(vincent): Makes the compiler assume Value is read and memory is clobbered, so it can't hoist
+// the work out of the loop or drop it.
+#define BenchKeep(Value) asm volatile("" : : "g"(Value) : "memory")
+
+typedef u32 bench_function(u64 Operations);
+
+struct bench_result
+{
+    char *Name;
+    u32 BytesPerOperation;    // 0 when a byte rate means nothing
+    u64 BatchSize;            // operations per sample
+    f64 MinimumNanoseconds;   // per operation
+    f64 MedianNanoseconds;
+    f64 MeanNanoseconds;
+    f64 DeviationNanoseconds;
+    f64 MedianTicks;
+};
+
+inline f64
+BenchSeconds()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (f64)Now.tv_sec + (f64)Now.tv_nsec*1e-9;
+}
+
+internal void
+SortF64(f64 *Values, u32 Count)
+{
+    for (u32 Index = 1; Index < Count; Index++)
+    {
+        f64 Value = Values[Index];
+        u32 Slot = Index;
+        for (; Slot > 0 && Values[Slot - 1] > Value; Slot--)
+            Values[Slot] = Values[Slot - 1];
+        Values[Slot] = Value;
+    }
+}
+
+internal u32 BenchSink;   // everything the benchmarks return ends up here, printed at the end
+
+internal bench_result
+RunBenchmark(char *Name, bench_function *Function, u32 BytesPerOperation)
+{
+    // NOTE(vincent): Warm-up doubles the batch until it takes BENCH_BATCH_SECONDS, and goes on with that
+    // batch until BENCH_WARMUP_SECONDS passed: caches, branch predictors and the CPU clock settle meanwhile.
+    u64 BatchSize = 1;
+    f64 WarmupStart = BenchSeconds();
+    for (;;)
+    {
+        f64 Start = BenchSeconds();
+        BenchSink += Function(BatchSize);
+        f64 End = BenchSeconds();
+        if (End - Start < BENCH_BATCH_SECONDS)
+            BatchSize *= 2;
+        else if (End - WarmupStart >= BENCH_WARMUP_SECONDS)
+            break;
+    }
+    
+    f64 Nanoseconds[BENCH_SAMPLES];
+    f64 Ticks[BENCH_SAMPLES];
+    for (u32 Sample = 0; Sample < BENCH_SAMPLES; Sample++)
+    {
+        f64 Start = BenchSeconds();
+        u64 StartTicks = __rdtsc();
+        BenchSink += Function(BatchSize);
+        u64 EndTicks = __rdtsc();
+        f64 End = BenchSeconds();
+        Nanoseconds[Sample] = (End - Start)*1e9 / (f64)BatchSize;
+        Ticks[Sample] = (f64)(EndTicks - StartTicks) / (f64)BatchSize;
+    }
+    SortF64(Nanoseconds, BENCH_SAMPLES);
+    SortF64(Ticks, BENCH_SAMPLES);
+    
+    bench_result Result = {};
+    Result.Name = Name;
+    Result.BytesPerOperation = BytesPerOperation;
+    Result.BatchSize = BatchSize;
+    Result.MinimumNanoseconds = Nanoseconds[0];
+    Result.MedianNanoseconds = Nanoseconds[BENCH_SAMPLES / 2];
+    Result.MedianTicks = Ticks[BENCH_SAMPLES / 2];
+    for (u32 Sample = 0; Sample < BENCH_SAMPLES; Sample++)
+        Result.MeanNanoseconds += Nanoseconds[Sample] / BENCH_SAMPLES;
+    f64 Variance = 0;
+    for (u32 Sample = 0; Sample < BENCH_SAMPLES; Sample++)
+    {
+        f64 Difference = Nanoseconds[Sample] - Result.MeanNanoseconds;
+        Variance += Difference*Difference / (BENCH_SAMPLES - 1);
+    }
+    Result.DeviationNanoseconds = sqrt(Variance);
+    return Result;
+}
+
+//
+// NOTE(vincent): Fixtures. Sources live in writable globals so that the compiler can't constant-fold them.
+//
+
+internal char StatusLine[] = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 9621\r\n";
+internal char PathA[] = "assets/css/images/overlay-pattern.png";
+internal char PathB[] = "assets/css/images/overlay-pattern.png";
+internal char HeaderLine[] = "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\nAccept: */*";
+internal char Output[1 << 16];
+internal u8 ArenaStorage[1 << 16];
+
+// NOTE(vincent): What Firefox sends for a page behind Basic auth.
+internal char RequestHead[] =
+    "GET /assets/css/../css/main.css HTTP/1.1\r\n"
+    "Host: dopetrope\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Authorization: Basic dXNlcjp1c2Vy\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://dopetrope/index.html\r\n"
+    "If-None-Match: \"5f3a2b1c4d\"\r\n"
+    "\r\n";
+internal char Credentials[] = "dXNlcjp1c2Vy";
+
+#define HTPASSWD_FIXTURE_USERS 100
+internal char HtpasswdText[HTPASSWD_FIXTURE_USERS*48];
+internal u32 HtpasswdSize;
+internal htpasswd_table *HtpasswdTable;
+internal htpasswd_credentials HtpasswdUser;
+internal u8 HtpasswdArenaStorage[Megabytes(1)];
+
+internal char Base64Original[3*16384];
+internal char Base64Encoded[4*16384];
+internal u32 Base64EncodedLength;
+internal u8 MD5Messages[MD5_MAX_LANES][64 + 72];
+internal u8 *MD5Sources[MD5_MAX_LANES];
+internal u32 MD5Lengths[MD5_MAX_LANES];
+
+internal void
+SetUpFixtures()
+{
+    u32 Random = 0x2545F491;
+    for (u32 Byte = 0; Byte < ArrayCount(Base64Original); Byte++)
+    {
+        Random ^= Random << 13; Random ^= Random >> 17; Random ^= Random << 5;
+        Base64Original[Byte] = (char)Random;
+    }
+    Base64EncodedLength = ToBase64(Base64Original, Base64Encoded, ArrayCount(Base64Original));
+    
+    // NOTE(vincent): Passwords are short, one block each, like the auth checks of the server.
+    for (u32 Lane = 0; Lane < MD5_MAX_LANES; Lane++)
+    {
+        MD5Sources[Lane] = MD5Messages[Lane];
+        MD5Lengths[Lane] = 8;
+        for (u32 Byte = 0; Byte < MD5Lengths[Lane]; Byte++)
+            MD5Messages[Lane][Byte] = (u8)('a' + (Lane + Byte) % 26);
+    }
+    
+    // NOTE(vincent): A .htpasswd of HTPASSWD_FIXTURE_USERS users, looked up for the last one.
+    char *Hexits = "0123456789abcdef";
+    for (u32 User = 0; User < HTPASSWD_FIXTURE_USERS; User++)
+    {
+        HtpasswdSize += sprintf(HtpasswdText + HtpasswdSize, "user%u:", User);
+        for (u32 Hexit = 0; Hexit < 2*HTPASSWD_DIGEST_SIZE; Hexit++)
+            HtpasswdText[HtpasswdSize++] = Hexits[(User*7 + Hexit) & 0xF];
+        HtpasswdText[HtpasswdSize++] = '\n';
+    }
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(HtpasswdArenaStorage), HtpasswdArenaStorage);
+    HtpasswdTable = CompileHtpasswd(&Arena, HtpasswdText, HtpasswdSize);
+    HtpasswdUser.User = StringFromLiteral("user99");
+    HtpasswdUser.Valid = HtpasswdUser.Present = true;
+    char Digest[2*HTPASSWD_DIGEST_SIZE];
+    for (u32 Hexit = 0; Hexit < 2*HTPASSWD_DIGEST_SIZE; Hexit++)
+        Digest[Hexit] = Hexits[(99*7 + Hexit) & 0xF];
+    ParseHexDigest(StringBaseLength(Digest, sizeof(Digest)), HtpasswdUser.Digest);
+    Assert(HtpasswdTable && HtpasswdGrantsAccess(HtpasswdTable, &HtpasswdUser));
+}
+
+//
+// NOTE(vincent): Benchmarks. Each runs Operations operations and returns something that depends on them.
+//
+
+internal u32
+BenchSprint(u64 Operations)
+{
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += Sprint(Output, StatusLine);
+        BenchKeep(Output);
+    }
+    return Sink;
+}
+
+internal u32
+BenchSprintNoNull(u64 Operations)
+{
+    string Source = StringBaseLength(StatusLine, sizeof(StatusLine) - 1);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += SprintNoNull(Output, Source);
+        BenchKeep(Output);
+    }
+    return Sink;
+}
+
+internal u32
+BenchStringsAreEqual(u64 Operations)
+{
+    string A = StringBaseLength(PathA, sizeof(PathA) - 1);
+    string B = StringBaseLength(PathB, sizeof(PathB) - 1);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += StringsAreEqual(A, B);
+        BenchKeep(PathA);
+    }
+    return Sink;
+}
+
+internal u32
+BenchStringBaseEnder(u64 Operations)
+{
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += StringBaseEnder(HeaderLine, '\r').Length;
+        BenchKeep(HeaderLine);
+    }
+    return Sink;
+}
+
+internal u32
+BenchPushSize(u64 Operations)
+{
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(ArenaStorage), ArenaStorage);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        if (Arena.Used + 64 > Arena.Size)
+            Arena.Used = 0;
+        u8 *Pushed = (u8 *)PushSize_(&Arena, 64);
+        BenchKeep(Pushed);
+        Sink += (u32)(Pushed - ArenaStorage);
+    }
+    return Sink;
+}
+
+internal u32
+BenchSprintInt(u64 Operations)
+{
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += SprintInt(Output, 1000000 + (int)(Operation & 0xFFFF));
+        BenchKeep(Output);
+    }
+    return Sink;
+}
+
+internal u32
+BenchFindByte(u64 Operations, string_path Path)
+{
+    // NOTE(vincent): A 1KB scan that finds nothing, like a long header line without the field we want.
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += FindBytePath((char *)ArenaStorage, 1024, '\n', Path);
+        BenchKeep(ArenaStorage);
+    }
+    return Sink;
+}
+internal u32 BenchFindByteScalar(u64 Operations) { return BenchFindByte(Operations, StringPath_Scalar); }
+internal u32 BenchFindByteSSE2(u64 Operations) { return BenchFindByte(Operations, StringPath_SSE2); }
+internal u32 BenchFindByteAVX2(u64 Operations) { return BenchFindByte(Operations, StringPath_AVX2); }
+
+internal u32
+BenchParseHTTPRequest(u64 Operations)
+{
+    // NOTE(vincent): Parsing rewrites the request path in place, so each operation copies the head first.
+    // The copy is a few percent of the time.
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        memcpy(Output, RequestHead, sizeof(RequestHead));
+        http_request Request = ParseHTTPRequest(Output, sizeof(RequestHead) - 1);
+        Sink += Request.IsValid + Request.RequestPath.Length + Request.AuthString.Length;
+        BenchKeep(Output);
+    }
+    return Sink;
+}
+
+internal u32
+BenchFromBase64Credentials(u64 Operations)
+{
+    string Source = StringBaseLength(Credentials, sizeof(Credentials) - 1);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += FromBase64(Source, Output).Length;
+        BenchKeep(Output);
+    }
+    return Sink;
+}
+
+internal u32
+BenchFromBase64(u64 Operations, base64_path Path)
+{
+    // NOTE(vincent): 48KB of random bytes, 64KB encoded.
+    string Source = StringBaseLength(Base64Encoded, Base64EncodedLength);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        string Result = FromBase64Path(Source, Output, Path);
+        Sink += Result.Length + (u8)Result.Base[Operation & 0xFF];
+    }
+    return Sink;
+}
+internal u32 BenchFromBase64Scalar(u64 Operations) { return BenchFromBase64(Operations, Base64Path_Scalar); }
+internal u32 BenchFromBase64SSSE3(u64 Operations) { return BenchFromBase64(Operations, Base64Path_SSSE3); }
+internal u32 BenchFromBase64AVX2(u64 Operations) { return BenchFromBase64(Operations, Base64Path_AVX2); }
+
+internal u32
+BenchMD5(u64 Operations, u32 LaneCount)
+{
+    // NOTE(vincent): One operation is one hash, the lane paths do LaneCount of them per call.
+    md5_result Results[MD5_MAX_LANES];
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation += LaneCount)
+    {
+        if (LaneCount == 1)
+            Results[0] = MD5(MD5Sources[0], MD5Lengths[0]);
+        else if (LaneCount == 4)
+            MD5Lanes4(MD5Sources, MD5Lengths, 4, Results);
+        else
+            MD5Lanes8(MD5Sources, MD5Lengths, 8, Results);
+        Sink += Results[0].a;
+        MD5Messages[0][0] = (u8)Sink;
+    }
+    return Sink;
+}
+internal u32 BenchMD5Scalar(u64 Operations) { return BenchMD5(Operations, 1); }
+internal u32 BenchMD5Lanes4(u64 Operations) { return BenchMD5(Operations, 4); }
+internal u32 BenchMD5Lanes8(u64 Operations) { return BenchMD5(Operations, 8); }
+
+internal u32
+BenchCompileHtpasswd(u64 Operations)
+{
+    // NOTE(vincent): What LoadHtpasswd() does on a cache miss, minus reading the file.
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(HtpasswdArenaStorage), HtpasswdArenaStorage);
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Arena.Used = 0;
+        htpasswd_table *Table = CompileHtpasswd(&Arena, HtpasswdText, HtpasswdSize);
+        Sink += Table->UserCount;
+    }
+    HtpasswdTable = CompileHtpasswd(&Arena, HtpasswdText, HtpasswdSize);
+    return Sink;
+}
+
+internal u32
+BenchHtpasswdGrantsAccess(u64 Operations)
+{
+    // NOTE(vincent): What LoadHtpasswd() does on a cache hit, minus the lock.
+    u32 Sink = 0;
+    for (u64 Operation = 0; Operation < Operations; Operation++)
+    {
+        Sink += HtpasswdGrantsAccess(HtpasswdTable, &HtpasswdUser) + 1;
+        BenchKeep(&HtpasswdUser);
+    }
+    return Sink;
+}
+
+//
+// NOTE(vincent): Output and comparison.
+//
+
+internal void
+PrintResultRow(bench_result *Result)
+{
+    printf("%-28s %10.2f %10.2f %7.1f%% %10.1f", Result->Name, Result->MinimumNanoseconds,
+           Result->MedianNanoseconds, 100.0*Result->DeviationNanoseconds / Result->MeanNanoseconds,
+           Result->MedianTicks);
+    if (Result->BytesPerOperation)
+        printf(" %9.2f GB/s", (f64)Result->BytesPerOperation / Result->MedianNanoseconds);
+    printf("\n");
+}
+
+internal void
+PrintResultJSON(bench_result *Result, b32 Last)
+{
+    // NOTE(vincent): One benchmark per line, the --compare parser relies on it.
+    printf("{\"name\": \"%s\", \"batch\": %llu, \"bytes_per_op\": %u, \"ns_min\": %.3f, \"ns_median\": %.3f, "
+           "\"ns_mean\": %.3f, \"ns_stddev\": %.3f, \"ticks_median\": %.3f}%s\n",
+           Result->Name, (unsigned long long)Result->BatchSize, Result->BytesPerOperation,
+           Result->MinimumNanoseconds, Result->MedianNanoseconds, Result->MeanNanoseconds,
+           Result->DeviationNanoseconds, Result->MedianTicks, Last ? "" : ",");
+}
+
+internal u32
+CompareWithBaseline(FILE *Out, char *Filename, bench_result *Results, u32 ResultCount)
+{
+    // NOTE(vincent): Returns how many benchmarks got slower than the baseline by more than the threshold.
+    FILE *File = fopen(Filename, "r");
+    if (!File)
+    {
+        fprintf(stderr, "Couldn't open %s\n", Filename);
+        return 1;
+    }
+    
+    fprintf(Out, "\n%-28s %10s %10s %8s\n", "vs baseline", "old ns", "new ns", "change");
+    u32 Regressions = 0;
+    char Line[1024];
+    while (fgets(Line, sizeof(Line), File))
+    {
+        char *Name = strstr(Line, "\"name\": \"");
+        char *Median = strstr(Line, "\"ns_median\": ");
+        if (!Name || !Median)
+            continue;
+        Name += StringLength("\"name\": \"");
+        char *NameEnd = strchr(Name, '"');
+        if (!NameEnd)
+            continue;
+        *NameEnd = 0;
+        f64 Old = atof(Median + StringLength("\"ns_median\": "));
+        for (u32 ResultIndex = 0; ResultIndex < ResultCount; ResultIndex++)
+        {
+            bench_result *Result = Results + ResultIndex;
+            if (StringsAreEqual(Result->Name, Name) && Old > 0)
+            {
+                f64 Change = 100.0*(Result->MedianNanoseconds - Old) / Old;
+                char *Verdict = "";
+                if (Change > BENCH_REGRESSION_PERCENT)
+                {
+                    Verdict = "  slower";
+                    Regressions++;
+                }
+                else if (Change < -BENCH_REGRESSION_PERCENT)
+                    Verdict = "  faster";
+                fprintf(Out, "%-28s %10.2f %10.2f %+7.1f%%%s\n", Name, Old, Result->MedianNanoseconds, Change, Verdict);
+            }
+        }
+    }
+    fclose(File);
+    return Regressions;
+}
+
+int
+main(int ArgumentCount, char **Arguments)
+{
+    b32 JSON = false;
+    char *Baseline = 0;
+    char *Filter = 0;
+    for (int ArgumentIndex = 1; ArgumentIndex < ArgumentCount; ArgumentIndex++)
+    {
+        char *Argument = Arguments[ArgumentIndex];
+        if (StringsAreEqual(Argument, "--json"))
+            JSON = true;
+        else if (StringsAreEqual(Argument, "--compare") && ArgumentIndex + 1 < ArgumentCount)
+            Baseline = Arguments[++ArgumentIndex];
+        else
+            Filter = Argument;
+    }
+    
+    struct
+    {
+        char *Name;
+        bench_function *Function;
+        u32 BytesPerOperation;
+        b32 Supported;
+    } Benchmarks[] =
+    {
+        {"sprint status line", BenchSprint, sizeof(StatusLine) - 1, true},
+        {"sprintnonull status line", BenchSprintNoNull, sizeof(StatusLine) - 1, true},
+        {"strings are equal path", BenchStringsAreEqual, sizeof(PathA) - 1, true},
+        {"string base ender header", BenchStringBaseEnder, 0, true},
+        {"pushsize 64B", BenchPushSize, 0, true},
+        {"sprintint 7 digits", BenchSprintInt, 0, true},
+        {"find byte 1KB scalar", BenchFindByteScalar, 1024, true},
+        {"find byte 1KB sse2", BenchFindByteSSE2, 1024, true},
+        {"find byte 1KB avx2", BenchFindByteAVX2, 1024, CPUSupportsAVX2()},
+        {"parse http request", BenchParseHTTPRequest, sizeof(RequestHead) - 1, true},
+        {"base64 decode credentials", BenchFromBase64Credentials, 0, true},
+        {"base64 decode scalar", BenchFromBase64Scalar, 4*16384, true},
+        {"base64 decode ssse3", BenchFromBase64SSSE3, 4*16384, CPUSupportsSSSE3()},
+        {"base64 decode avx2", BenchFromBase64AVX2, 4*16384, CPUSupportsAVX2()},
+        {"md5 scalar", BenchMD5Scalar, 0, true},
+        {"md5 sse2 x4", BenchMD5Lanes4, 0, true},
+        {"md5 avx2 x8", BenchMD5Lanes8, 0, CPUSupportsAVX2()},
+        {"htpasswd compile 100 users", BenchCompileHtpasswd, 0, true},
+        {"htpasswd grants access", BenchHtpasswdGrantsAccess, 0, true},
+    };
+    
+    InitializeStringPath();
+    SetUpFixtures();
+    bench_result Results[BENCH_MAX_RESULTS];
+    u32 ResultCount = 0;
+    if (JSON)
+        printf("{\"samples\": %u, \"benchmarks\": [\n", BENCH_SAMPLES);
+    else
+        printf("%-28s %10s %10s %8s %10s\n", "", "min ns", "median ns", "stddev", "ticks");
+    for (u32 BenchmarkIndex = 0; BenchmarkIndex < ArrayCount(Benchmarks); BenchmarkIndex++)
+    {
+        char *Name = Benchmarks[BenchmarkIndex].Name;
+        if (Filter && !strstr(Name, Filter))
+            continue;
+        if (!Benchmarks[BenchmarkIndex].Supported)
+        {
+            fprintf(stderr, "%s: skipped, the CPU doesn't support it\n", Name);
+            continue;
+        }
+        Results[ResultCount] = RunBenchmark(Name, Benchmarks[BenchmarkIndex].Function,
+                                            Benchmarks[BenchmarkIndex].BytesPerOperation);
+        if (!JSON)
+            PrintResultRow(Results + ResultCount);
+        ResultCount++;
+    }
+    if (JSON)
+    {
+        for (u32 ResultIndex = 0; ResultIndex < ResultCount; ResultIndex++)
+            PrintResultJSON(Results + ResultIndex, ResultIndex == ResultCount - 1);
+        printf("], \"sink\": %u}\n", BenchSink);
+    }
+    else
+        printf("(sink %u)\n", BenchSink);
+    
+    // NOTE(vincent): With --json, stdout stays valid JSON.
+    FILE *Out = JSON ? stderr : stdout;
+    u32 Regressions = Baseline ? CompareWithBaseline(Out, Baseline, Results, ResultCount) : 0;
+    return Regressions ? 1 : 0;
+}
@@ -1,8 +1,16 @@
 #!/bin/bash
 COMPILER_FLAGS="-g -DDEBUG=0 -Ofast -DCOMPILER_GCC -Wall -Werror -Wpedantic -Wextra -Wno-unused-parameter -Wno-unused-function -Wno-unused-but-set-variable -Wno-write-strings"
+# ./build.sh profile keeps the frame pointers, for complete stacks from /server-profile (see fold_profile.sh)
+if [ "$1" == "profile" ]; then
+    COMPILER_FLAGS="$COMPILER_FLAGS -fno-omit-frame-pointer -mno-omit-leaf-frame-pointer"
+fi
 
 mkdir -p ../build
 g++ server_linux.cpp -o ../build/server_linux $COMPILER_FLAGS -lpthread
+g++ site_packer.cpp -o ../build/site_packer $COMPILER_FLAGS
+g++ bench_linux.cpp -o ../build/bench_linux $COMPILER_FLAGS
+g++ replay_linux.cpp -o ../build/replay_linux $COMPILER_FLAGS -lpthread
+g++ fuzz_linux.cpp -o ../build/fuzz_linux $COMPILER_FLAGS
 
 
 # in case carriage return characters are confusing bash, remove them with:
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <errno.h>
 
 #if !defined(COMPILER_MSVC)
 #define COMPILER_MSVC 0
@@ -29,13 +30,21 @@
 #define Gigabytes(Value) (Megabytes(Value) * 1000LL)
 #define Terabytes(Value) (Gigabytes(Value) * 1000LL)
 
-#define SERVER_STORAGE_SIZE Megabytes(64)
+#define SERVER_STORAGE_SIZE Megabytes(16)   // shared state, requests use per-thread arenas
+#define TASK_ARENA_SIZE Kilobytes(4)
 
 #define NUMBER_OF_THREADS 4
 // NOTE(vincent): Needs to be at least 1, ideally <= the number of cores on the machine.
 // TODO(vincent): maybe we can ask the OS to query how many cores we have
+#define TASK_COUNT (NUMBER_OF_THREADS*16)   // accepted connections in flight, running or queued
 
 #define DEFAULT_SERVER_PORT "80"  // the port users will be connecting to
+#define DEFAULT_HEADER_TIMEOUT_SECONDS 10   // to receive the whole request head
+#define DEFAULT_SEND_TIMEOUT_SECONDS 60     // to send the whole response
+#define DEFAULT_LISTEN_BACKLOG 128
+#define DEFAULT_SEND_LOW_WATERMARK Kilobytes(128)   // unsent bytes the kernel holds per socket, see below
+#define DEFAULT_RETRY_AFTER_SECONDS 1       // in the 503 answered when shedding load
+#define DEFAULT_DRAIN_TIMEOUT_SECONDS 30    // for the connections in flight, when stopping or upgrading
 
 
 #if DEBUG
@@ -64,6 +73,465 @@ typedef int b32;
 typedef float f32;
 typedef double f64;
 
+// NOTE(vincent): Atomics used by the platform-independent code. Only what we actually need.
+#if COMPILER_MSVC
+#define AtomicIncrementU32(Pointer) ((u32)InterlockedIncrement((LONG volatile *)(Pointer)))
+#define AtomicDecrementU32(Pointer) ((u32)InterlockedDecrement((LONG volatile *)(Pointer)))
+#define AtomicAddU64(Pointer, Value) ((u64)InterlockedExchangeAdd64((LONG64 volatile *)(Pointer), (Value)))
+#define AtomicCompareExchangeU32(Pointer, New, Expected) \
+    ((u32)InterlockedCompareExchange((LONG volatile *)(Pointer), (New), (Expected)))
+#define AtomicCompareExchangeS64(Pointer, New, Expected) \
+    ((s64)InterlockedCompareExchange64((LONG64 volatile *)(Pointer), (New), (Expected)))
+#define CompletePreviousWritesBeforeFutureWrites _WriteBarrier()
+#define CompletePreviousReadsBeforeFutureReads _ReadBarrier()
+#define FullMemoryBarrier MemoryBarrier()
+#define SpinPause() _mm_pause()
+#else
+#define AtomicIncrementU32(Pointer) __sync_add_and_fetch((Pointer), 1)
+#define AtomicDecrementU32(Pointer) __sync_sub_and_fetch((Pointer), 1)
+#define AtomicAddU64(Pointer, Value) __sync_fetch_and_add((Pointer), (Value))   // returns the previous value
+#define AtomicCompareExchangeU32(Pointer, New, Expected) __sync_val_compare_and_swap((Pointer), (Expected), (New))
+#define AtomicCompareExchangeS64(Pointer, New, Expected) __sync_val_compare_and_swap((Pointer), (Expected), (New))
+#define CompletePreviousWritesBeforeFutureWrites asm volatile("" ::: "memory")
+#define CompletePreviousReadsBeforeFutureReads asm volatile("" ::: "memory")
+#define FullMemoryBarrier __sync_synchronize()
+#define SpinPause() __builtin_ia32_pause()
+#endif
+// NOTE(vincent): The barriers above only stop the compiler from reordering: x86 doesn't reorder stores
+// with stores or loads with loads. FullMemoryBarrier is a real fence, for the store-then-load cases.
+// The compare-exchanges return the value that was there before.
+
+// NOTE(vincent): SIMD code paths. x64 always has SSE2, anything above is compiled per function
+// with TARGET_SSSE3 or TARGET_AVX2 (MSVC doesn't need the attributes) and only called after checking the CPU at runtime.
+#if COMPILER_MSVC
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+#if COMPILER_MSVC
+#define TARGET_SSSE3
+#define TARGET_AVX2
+internal b32
+CPUSupportsSSSE3()
+{
+    int Info[4];
+    __cpuid(Info, 1);
+    b32 Result = (Info[2] >> 9) & 1;
+    return Result;
+}
+
+internal b32
+CPUSupportsAVX2()
+{
+    static s32 Cached = -1;
+    if (Cached == -1)
+    {
+        int Info[4];
+        __cpuid(Info, 1);
+        b32 OSSavesYMM = ((Info[2] >> 27) & 1) && ((_xgetbv(0) & 6) == 6);
+        __cpuidex(Info, 7, 0);
+        Cached = OSSavesYMM && ((Info[1] >> 5) & 1);
+    }
+    return Cached;
+}
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+inline b32
+CPUSupportsSSSE3()
+{
+    b32 Result = __builtin_cpu_supports("ssse3");
+    return Result;
+}
+
+inline b32
+CPUSupportsAVX2()
+{
+    b32 Result = __builtin_cpu_supports("avx2");
+    return Result;
+}
+#endif
+
+// NOTE(vincent): Byte scans, compares and fills, 16 or 32 bytes at a time. SSE2 comes with x64, AVX2 gets
+// picked at startup by InitializeStringPath(). The versions that take a string_path are for the tests and
+// the benchmarks. Scans of null-terminated strings load aligned blocks: those may start before the string
+// and end past its terminator, but never cross into the next page, and the bytes outside are ignored.
+// Scans with a length never read past it.
+enum string_path
+{
+    StringPath_Scalar,
+    StringPath_SSE2,
+    StringPath_AVX2,
+};
+
+internal string_path DefaultStringPath = StringPath_SSE2;
+
+internal void
+InitializeStringPath()
+{
+    DefaultStringPath = CPUSupportsAVX2() ? StringPath_AVX2 : StringPath_SSE2;
+}
+
+// NOTE(vincent): GCC tracks which array a pointer points into and rejects the aligned loads that go past it,
+// though they can't fault. This makes it forget.
+#if COMPILER_MSVC
+#define ForgetPointerOrigin(Pointer)
+#else
+#define ForgetPointerOrigin(Pointer) asm("" : "+r"(Pointer))
+#endif
+
+// NOTE(vincent): AddressSanitizer reports those loads too, in the fuzz driver. The functions doing them opt out.
+#if COMPILER_MSVC
+#define NO_SANITIZE_ADDRESS
+#else
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+
+inline u32
+LowestSetBit(u32 Mask)
+{
+    // NOTE(vincent): Mask isn't zero.
+#if COMPILER_MSVC
+    unsigned long Index;
+    _BitScanForward(&Index, Mask);
+    return (u32)Index;
+#else
+    return (u32)__builtin_ctz(Mask);
+#endif
+}
+
+inline u32
+ByteMask16(__m128i Block, __m128i Wanted)
+{
+    u32 Result = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(Block, Wanted));
+    return Result;
+}
+
+TARGET_AVX2 inline u32
+ByteMask32(__m256i Block, __m256i Wanted)
+{
+    u32 Result = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Block, Wanted));
+    return Result;
+}
+
+NO_SANITIZE_ADDRESS TARGET_AVX2 internal char *
+FindByteOrNullAVX2(char *Base, char Byte)
+{
+    __m256i Zero = _mm256_setzero_si256();
+    __m256i Wanted = _mm256_set1_epi8(Byte);
+    u32 Offset = (u32)((size_t)Base & 31);
+    char *Block = Base - Offset;
+    ForgetPointerOrigin(Block);
+    __m256i Bytes = _mm256_load_si256((__m256i *)Block);
+    u32 Mask = (ByteMask32(Bytes, Zero) | ByteMask32(Bytes, Wanted)) & (0xFFFFFFFFu << Offset);
+    while (!Mask)
+    {
+        Block += 32;
+        Bytes = _mm256_load_si256((__m256i *)Block);
+        Mask = ByteMask32(Bytes, Zero) | ByteMask32(Bytes, Wanted);
+    }
+    char *Result = Block + LowestSetBit(Mask);
+    return Result;
+}
+
+NO_SANITIZE_ADDRESS internal char *
+FindByteOrNullPath(char *Base, char Byte, string_path Path)
+{
+    // NOTE(vincent): The first Byte or the terminator, whichever comes first.
+    char *Result = Base;
+    if (Path == StringPath_AVX2)
+    {
+        Result = FindByteOrNullAVX2(Base, Byte);
+    }
+    else if (Path == StringPath_SSE2)
+    {
+        __m128i Zero = _mm_setzero_si128();
+        __m128i Wanted = _mm_set1_epi8(Byte);
+        u32 Offset = (u32)((size_t)Base & 15);
+        char *Block = Base - Offset;
+        ForgetPointerOrigin(Block);
+        __m128i Bytes = _mm_load_si128((__m128i *)Block);
+        u32 Mask = (ByteMask16(Bytes, Zero) | ByteMask16(Bytes, Wanted)) & (0xFFFFu << Offset);
+        while (!Mask)
+        {
+            Block += 16;
+            Bytes = _mm_load_si128((__m128i *)Block);
+            Mask = ByteMask16(Bytes, Zero) | ByteMask16(Bytes, Wanted);
+        }
+        Result = Block + LowestSetBit(Mask);
+    }
+    else
+    {
+        while (*Result && *Result != Byte)
+            Result++;
+    }
+    return Result;
+}
+
+TARGET_AVX2 internal u32
+FindByteAVX2(char *Base, u32 Length, char Byte)
+{
+    // NOTE(vincent): Past the last whole block, one more load ends at Length and overlaps what we checked.
+    __m256i Wanted = _mm256_set1_epi8(Byte);
+    u32 Result = Length;
+    u32 Index = 0;
+    for (; Index + 32 <= Length; Index += 32)
+    {
+        u32 Mask = ByteMask32(_mm256_loadu_si256((__m256i *)(Base + Index)), Wanted);
+        if (Mask)
+            return Index + LowestSetBit(Mask);
+    }
+    if (Index < Length)
+    {
+        u32 Last = Length - 32;
+        u32 Mask = ByteMask32(_mm256_loadu_si256((__m256i *)(Base + Last)), Wanted) >> (Index - Last);
+        if (Mask)
+            Result = Index + LowestSetBit(Mask);
+    }
+    return Result;
+}
+
+internal u32
+FindBytePath(char *Base, u32 Length, char Byte, string_path Path)
+{
+    // NOTE(vincent): The index of the first Byte, Length when there's none.
+    u32 Result = Length;
+    if (Path == StringPath_AVX2 && Length >= 32)
+    {
+        Result = FindByteAVX2(Base, Length, Byte);
+    }
+    else if (Path != StringPath_Scalar && Length >= 16)
+    {
+        __m128i Wanted = _mm_set1_epi8(Byte);
+        u32 Index = 0;
+        for (; Index + 16 <= Length; Index += 16)
+        {
+            u32 Mask = ByteMask16(_mm_loadu_si128((__m128i *)(Base + Index)), Wanted);
+            if (Mask)
+                return Index + LowestSetBit(Mask);
+        }
+        if (Index < Length)
+        {
+            u32 Last = Length - 16;
+            u32 Mask = ByteMask16(_mm_loadu_si128((__m128i *)(Base + Last)), Wanted) >> (Index - Last);
+            if (Mask)
+                Result = Index + LowestSetBit(Mask);
+        }
+    }
+    else
+    {
+        for (u32 Index = 0; Index < Length; Index++)
+        {
+            if (Base[Index] == Byte)
+            {
+                Result = Index;
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+TARGET_AVX2 internal b32
+BytesAreEqualAVX2(char *A, char *B, u32 Length)
+{
+    u32 Index = 0;
+    for (; Index + 32 <= Length; Index += 32)
+    {
+        __m256i BlockA = _mm256_loadu_si256((__m256i *)(A + Index));
+        __m256i BlockB = _mm256_loadu_si256((__m256i *)(B + Index));
+        if (ByteMask32(BlockA, BlockB) != 0xFFFFFFFFu)
+            return false;
+    }
+    b32 Result = true;
+    if (Index < Length)
+    {
+        __m256i BlockA = _mm256_loadu_si256((__m256i *)(A + Length - 32));
+        __m256i BlockB = _mm256_loadu_si256((__m256i *)(B + Length - 32));
+        Result = (ByteMask32(BlockA, BlockB) == 0xFFFFFFFFu);
+    }
+    return Result;
+}
+
+internal b32
+BytesAreEqualPath(char *A, char *B, u32 Length, string_path Path)
+{
+    b32 Result = true;
+    if (Path == StringPath_AVX2 && Length >= 32)
+    {
+        // NOTE(vincent): GCC can't tell that Length fits the arrays when a scan computed it.
+        ForgetPointerOrigin(A);
+        ForgetPointerOrigin(B);
+        Result = BytesAreEqualAVX2(A, B, Length);
+    }
+    else if (Path != StringPath_Scalar && Length >= 16)
+    {
+        ForgetPointerOrigin(A);
+        ForgetPointerOrigin(B);
+        u32 Index = 0;
+        for (; Result && Index + 16 <= Length; Index += 16)
+        {
+            __m128i BlockA = _mm_loadu_si128((__m128i *)(A + Index));
+            __m128i BlockB = _mm_loadu_si128((__m128i *)(B + Index));
+            Result = (ByteMask16(BlockA, BlockB) == 0xFFFF);
+        }
+        if (Result && Index < Length)
+        {
+            __m128i BlockA = _mm_loadu_si128((__m128i *)(A + Length - 16));
+            __m128i BlockB = _mm_loadu_si128((__m128i *)(B + Length - 16));
+            Result = (ByteMask16(BlockA, BlockB) == 0xFFFF);
+        }
+    }
+    else
+    {
+        for (u32 Index = 0; Index < Length; Index++)
+        {
+            if (A[Index] != B[Index])
+            {
+                Result = false;
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+TARGET_AVX2 internal void
+ZeroBytesAVX2(char *Buffer, u32 Count)
+{
+    __m256i Zero = _mm256_setzero_si256();
+    for (u32 Index = 0; Index + 32 <= Count; Index += 32)
+        _mm256_storeu_si256((__m256i *)(Buffer + Index), Zero);
+    _mm256_storeu_si256((__m256i *)(Buffer + Count - 32), Zero);
+}
+
+internal void
+ZeroBytesPath(char *Buffer, u32 Count, string_path Path)
+{
+    if (Path == StringPath_AVX2 && Count >= 32)
+    {
+        ZeroBytesAVX2(Buffer, Count);
+    }
+    else if (Path != StringPath_Scalar && Count >= 16)
+    {
+        __m128i Zero = _mm_setzero_si128();
+        for (u32 Index = 0; Index + 16 <= Count; Index += 16)
+            _mm_storeu_si128((__m128i *)(Buffer + Index), Zero);
+        _mm_storeu_si128((__m128i *)(Buffer + Count - 16), Zero);
+    }
+    else
+    {
+        for (u32 Byte = 0; Byte < Count; Byte++)
+            Buffer[Byte] = 0;
+    }
+}
+
+inline char *
+FindByteOrNull(char *Base, char Byte)
+{
+    char *Result = FindByteOrNullPath(Base, Byte, DefaultStringPath);
+    return Result;
+}
+
+inline u32
+FindByte(char *Base, u32 Length, char Byte)
+{
+    u32 Result = FindBytePath(Base, Length, Byte, DefaultStringPath);
+    return Result;
+}
+
+inline b32
+BytesAreEqual(char *A, char *B, u32 Length)
+{
+    b32 Result = BytesAreEqualPath(A, B, Length, DefaultStringPath);
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestStringPaths()
+{
+    // NOTE(vincent): Every path against the scalar one, for every alignment, length and match position,
+    // with decoys before the string and past its end.
+    alignas(32) static char Buffer[160];
+    alignas(32) static char Other[160];
+    for (u32 Path = StringPath_SSE2; Path <= StringPath_AVX2; Path++)
+    {
+        if (Path == StringPath_AVX2 && !CPUSupportsAVX2())
+            continue;
+        string_path Tested = (string_path)Path;
+        for (u32 Offset = 0; Offset < 32; Offset++)
+        {
+            for (u32 Length = 0; Length <= 80; Length++)
+            {
+                for (u32 Position = 0; Position <= Length; Position++)
+                {
+                    for (u32 Byte = 0; Byte < sizeof(Buffer); Byte++)
+                        Buffer[Byte] = (Byte % 3) ? 'x' : 0;
+                    char *Base = Buffer + Offset;
+                    for (u32 Byte = 0; Byte < Length; Byte++)
+                        Base[Byte] = (char)('a' + Byte % 23);
+                    if (Position < Length)
+                        Base[Position] = '/';
+                    
+                    // NOTE(vincent): Decoys: the byte we look for right before and past the end.
+                    Base[Length] = '/';
+                    if (Offset)
+                        Base[-1] = '/';
+                    u32 Expected = FindBytePath(Base, Length, '/', StringPath_Scalar);
+                    Assert(Expected == Position);
+                    Assert(FindBytePath(Base, Length, '/', Tested) == Expected);
+                    
+                    Base[Length] = 0;
+                    Assert(FindByteOrNullPath(Base, '/', Tested) == Base + Position);
+                    Assert(FindByteOrNullPath(Base, 0, Tested) == Base + Length);
+                    
+                    // NOTE(vincent): The same bytes at another alignment, different around them.
+                    char *OtherBase = Other + (31 - Offset);
+                    for (u32 Byte = 0; Byte < sizeof(Other); Byte++)
+                        Other[Byte] = 'q';
+                    for (u32 Byte = 0; Byte < Length; Byte++)
+                        OtherBase[Byte] = Base[Byte];
+                    Assert(BytesAreEqualPath(Base, OtherBase, Length, Tested));
+                    if (Position < Length)
+                    {
+                        OtherBase[Position]++;
+                        Assert(!BytesAreEqualPath(Base, OtherBase, Length, Tested));
+                    }
+                    
+                    for (u32 Byte = 0; Byte < sizeof(Buffer); Byte++)
+                        Buffer[Byte] = 'z';
+                    ZeroBytesPath(Base, Length, Tested);
+                    for (u32 Byte = 0; Byte < sizeof(Buffer); Byte++)
+                        Assert(Buffer[Byte] == ((Byte >= Offset && Byte < Offset + Length) ? 0 : 'z'));
+                }
+            }
+        }
+    }
+}
+#endif
+
+// NOTE(vincent): Fair spinlock for short critical sections: threads get served in the order they arrived.
+struct ticket_mutex
+{
+    u64 volatile Ticket;
+    u64 volatile Serving;
+};
+
+inline void
+BeginTicketMutex(ticket_mutex *Mutex)
+{
+    u64 Ticket = AtomicAddU64(&Mutex->Ticket, 1);
+    while (Ticket != Mutex->Serving)
+        SpinPause();
+}
+
+inline void
+EndTicketMutex(ticket_mutex *Mutex)
+{
+    AtomicAddU64(&Mutex->Serving, 1);
+}
+
 
 struct memory_arena
 {
@@ -98,10 +566,16 @@ BytesAreZero(char *Buffer, u32 BytesCount)
 
 internal void
 ZeroBytes(char *Buffer, u32 BytesCount)
+{
+    ZeroBytesPath(Buffer, BytesCount, DefaultStringPath);
+}
+
+internal void
+CopyBytes(char *Source, char *Dest, u32 BytesCount)
 {
     for (u32 Byte = 0; Byte < BytesCount; Byte++)
     {
-        Buffer[Byte] = 0;
+        Dest[Byte] = Source[Byte];
     }
 }
 
@@ -162,11 +636,106 @@ typedef int SOCKET;        // This is to make the Linux platform "understand" th
 #define INVALID_SOCKET -1  // Same
 #endif
 
-// NOTE(vincent): forward declaring three functions that the server code needs 
+// NOTE(vincent): forward declaring functions that the server code needs 
 // and that the platform layer has to implement:
 internal b32 HandleReceiveError(int BytesReceived, SOCKET ClientSocket);
+// NOTE(vincent): recv(), tried again when a signal interrupts it before anything arrived.
+internal int ReceiveSome(SOCKET ClientSocket, char *Buffer, u32 Size);
 internal b32 HandleSendError(int BytesSent, SOCKET ClientSocket);
 internal void ShutdownConnection(SOCKET ClientSocket);
+// NOTE(vincent): Bounds on each blocking recv() and send() call, as a backstop to the connection timers.
+internal void SetSocketTimeouts(SOCKET ClientSocket, u32 ReceiveMilliseconds, u32 SendMilliseconds);
+// NOTE(vincent): Shuts both directions down without closing, so a thread blocked on the socket returns
+// and the number can't be reused until that thread calls ShutdownConnection().
+internal void AbortConnection(SOCKET ClientSocket);
+// NOTE(vincent): Sends a short response without ever blocking the caller, then closes the socket.
+// For the acceptor thread, which must not wait on a client.
+internal void RefuseConnection(SOCKET ClientSocket, char *Response, u32 Length);
+// NOTE(vincent): Sends the buffers in order with one system call, like writev(). Returns the number of bytes
+// sent, or -1 on an error.
+struct platform_send_buffer
+{
+    char *Base;
+    u64 Length;
+};
+internal s64 SendGather(SOCKET ClientSocket, platform_send_buffer *Buffers, u32 BufferCount);
+// NOTE(vincent): Caps the bytes that sit in the socket's send buffer without having been sent yet, so that
+// a big response to a slow client doesn't pile up in kernel memory. 0 leaves the system default.
+internal void SetSendLowWatermark(SOCKET ClientSocket, u32 Bytes);
+// NOTE(vincent): How often the platform layer should call ExpireConnectionTimers().
+#define CONNECTION_TIMER_TICK_MILLISECONDS 100
+
+// NOTE(vincent): Read-only mapping of an entire file, kept until UnmapFile().
+// Base is 0 when the file couldn't be mapped.
+struct platform_file_mapping
+{
+    void *Base;
+    u64 Size;
+};
+internal platform_file_mapping MapEntireFileReadOnly(char *Filename);
+internal void UnmapFile(platform_file_mapping Mapping);
+// NOTE(vincent): A file that only grows, created empty. An existing file is never opened, let alone truncated.
+// Each AppendToFile() call lands in one piece at the end, even when several threads append at once.
+// Handle is -1 when the file couldn't be created, or already exists.
+struct platform_append_file
+{
+    s64 Handle;
+};
+internal platform_append_file CreateAppendOnlyFile(char *Filename);
+internal b32 AppendToFile(platform_append_file File, void *Data, u32 Size);
+internal u64 GetMonotonicMilliseconds();
+internal u64 GetMonotonicMicroseconds();
+internal void SleepMilliseconds(u32 Milliseconds);
+
+// NOTE(vincent): The sampling timer of server_profiler.cpp. StartProfiler() returns false where the
+// platform layer can't sample.
+struct cpu_profiler;
+internal b32 StartProfiler(cpu_profiler *Profiler);
+internal void StopProfiler(cpu_profiler *Profiler);
+
+// NOTE(vincent): A directory that files can be opened relative to. The Linux layer keeps a file descriptor
+// and uses openat(), so the kernel doesn't walk the directory's path again for every file.
+// The Win32 layer concatenates Path with the relative path instead.
+struct platform_directory
+{
+    s64 Handle;      // -1 when the directory couldn't be opened
+    char *Path;      // null-terminated, no ending slash
+};
+internal platform_directory OpenDirectory(char *Path);
+internal void CloseDirectory(platform_directory Directory);
+
+struct push_read_entire_file;
+internal push_read_entire_file PushReadEntireFileAt(memory_arena *Arena, platform_directory Directory,
+                                                    char *RelativePath);
+
+struct platform_directory_entry
+{
+    char *Name;                // null-terminated
+    u64 Size;
+    u64 ModificationTime;      // seconds since the unix epoch
+    b32 IsDirectory;
+};
+
+struct platform_directory_listing
+{
+    platform_directory_entry *Entries;   // in no particular order, "." and ".." excluded
+    u32 Count;
+    b32 Success;
+};
+// NOTE(vincent): With StayBeneath, a symlink is listed with what it points to, and left out when that is
+// outside Directory: the listing then only shows what PushReadEntireFileAt() would open.
+internal platform_directory_listing PushDirectoryListing(memory_arena *Arena, platform_directory Directory,
+                                                         char *RelativePath, b32 StayBeneath);
+
+// NOTE(vincent): Enough to tell whether a file changed since we last read it, without reading it.
+struct platform_file_info
+{
+    b32 Exists;
+    u64 Size;
+    u64 ModificationTime;    // platform-specific unit, only compare it for equality
+    u64 Identity;            // inode number on Linux, 0 where the platform has none
+};
+internal platform_file_info GetFileInfoAt(platform_directory Directory, char *RelativePath);
 
 struct platform_work_queue;
 #define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(platform_work_queue *Queue, void *Data)
@@ -185,6 +754,83 @@ struct platform_work_queue_entry
 #define PLATFORM_DO_NEXT_WORK_ENTRY(name) b32 name(platform_work_queue *Queue)
 typedef PLATFORM_DO_NEXT_WORK_ENTRY(platform_do_next_work_entry);
 
+// NOTE(vincent): Every thread that runs jobs, the main thread included, has its own scratch arena.
+// The platform layer allocates it from that thread, after pinning it if asked to, so that the pages
+// land on the thread's NUMA node. Only the calling thread may use the arena GetThreadArena() returns.
+#define THREAD_ARENA_SIZE Megabytes(16)
+#define MAX_PLACEMENT_CPUS 1024
+#define MAX_PLACEMENT_NODES 64
+
+enum thread_placement
+{
+    ThreadPlacement_None,       // threads float, arenas are only first-touched by their own thread
+    ThreadPlacement_Compact,    // thread i on the i-th CPU, filling one NUMA node before the next
+    ThreadPlacement_Spread,     // threads dealt round-robin across NUMA nodes
+};
+
+struct thread_topology
+{
+    u32 NodeCount;                            // nodes with at least one usable CPU
+    u32 CPUCount;
+    u16 CPUs[MAX_PLACEMENT_CPUS];             // grouped by node
+    u16 CPUNodes[MAX_PLACEMENT_CPUS];         // node of each entry of CPUs
+    u16 NodeFirstCPU[MAX_PLACEMENT_NODES];    // index into CPUs
+    u16 NodeCPUCount[MAX_PLACEMENT_NODES];
+    u16 NodeIDs[MAX_PLACEMENT_NODES];         // the OS's number for each node
+};
+
+inline void
+AddTopologyCPU(thread_topology *Topology, u32 NodeID, u32 CPU)
+{
+    // NOTE(vincent): CPUs have to come node by node.
+    if (Topology->CPUCount < MAX_PLACEMENT_CPUS)
+    {
+        if (Topology->NodeCount == 0 || Topology->NodeIDs[Topology->NodeCount - 1] != NodeID)
+        {
+            if (Topology->NodeCount == MAX_PLACEMENT_NODES)
+                return;
+            Topology->NodeIDs[Topology->NodeCount] = (u16)NodeID;
+            Topology->NodeFirstCPU[Topology->NodeCount] = (u16)Topology->CPUCount;
+            Topology->NodeCPUCount[Topology->NodeCount] = 0;
+            Topology->NodeCount++;
+        }
+        Topology->CPUs[Topology->CPUCount] = (u16)CPU;
+        Topology->CPUNodes[Topology->CPUCount] = (u16)NodeID;
+        Topology->CPUCount++;
+        Topology->NodeCPUCount[Topology->NodeCount - 1]++;
+    }
+}
+
+internal u32
+ChooseThreadCPU(thread_topology *Topology, thread_placement Placement, u32 ThreadIndex)
+{
+    // NOTE(vincent): Index into Topology->CPUs. Only meaningful when Placement isn't None.
+    u32 Result = 0;
+    if (Placement == ThreadPlacement_Compact)
+    {
+        Result = ThreadIndex % Topology->CPUCount;
+    }
+    else if (Placement == ThreadPlacement_Spread)
+    {
+        u32 Node = ThreadIndex % Topology->NodeCount;
+        u32 Rank = ThreadIndex / Topology->NodeCount;
+        Result = Topology->NodeFirstCPU[Node] + Rank % Topology->NodeCPUCount[Node];
+    }
+    return Result;
+}
+
+struct platform_placement_stats
+{
+    u32 NodeCount;
+    u32 PinnedThreadCount;
+    u64 LocalPages;       // resident thread arena pages on their thread's node
+    u64 RemotePages;      // and elsewhere
+};
+internal memory_arena *GetThreadArena(platform_work_queue *Queue);
+// NOTE(vincent): 0 on the main thread, then one per worker, below NUMBER_OF_THREADS.
+internal u32 GetThreadIndex(platform_work_queue *Queue);
+internal platform_placement_stats GetPlacementStats(platform_work_queue *Queue);
+
 struct server_memory
 {
     u32 StorageSize;
@@ -231,12 +877,7 @@ StringBaseEnder(char *Base, char Ender)
 {
     string Result;
     Result.Base = Base;
-    char *C = Base;
-    while (*C && *C != Ender)
-    {
-        C++;
-    }
-    Result.Length = (u32)(C - Base);
+    Result.Length = (u32)(FindByteOrNull(Base, Ender) - Base);
     return Result;
 }
 
@@ -245,9 +886,7 @@ StringFromLiteral(const char *Base)
 {
     string Result;
     Result.Base = (char *)Base;
-    while (*Base)
-        Base++;
-    Result.Length = (u32)(Base - Result.Base);
+    Result.Length = (u32)(FindByteOrNull(Result.Base, 0) - Result.Base);
     return Result;
 }
 
@@ -265,12 +904,7 @@ StringPrefixUntil(string String, char Ender)
 {
     string Result;
     Result.Base = String.Base;
-    u32 CharIndex = 0;
-    while (CharIndex < String.Length && String.Base[CharIndex] != Ender)
-    {
-        CharIndex++;
-    }
-    Result.Length = CharIndex;
+    Result.Length = FindByte(String.Base, String.Length, Ender);
     return Result;
 }
 
@@ -281,17 +915,11 @@ StringSuffixAfter(string String, char Opener)
     Result.Base = String.Base + String.Length;
     Result.Length = 0;
     
-    u32 CharIndex = 0;
-    while (CharIndex < String.Length)
+    u32 CharIndex = FindByte(String.Base, String.Length, Opener);
+    if (CharIndex < String.Length)
     {
-        if (String.Base[CharIndex] == Opener)
-        {
-            Result.Base = String.Base + CharIndex + 1;
-            Assert(CharIndex + 1 <= String.Length);
-            Result.Length = String.Length - CharIndex - 1;
-            break;
-        }
-        CharIndex++;
+        Result.Base = String.Base + CharIndex + 1;
+        Result.Length = String.Length - CharIndex - 1;
     }
     
     return Result;
@@ -348,12 +976,7 @@ TruncateStringUntil(string *S, char NewEnd)
 internal u32
 StringLength(char *String)
 {
-    u32 Count = 0;
-    while (*String)
-    {
-        String++;
-        Count++;
-    }
+    u32 Count = (u32)(FindByteOrNull(String, 0) - String);
     return Count;
 }
 
@@ -387,18 +1010,7 @@ StringsAreEqual(string A, const char *B)
 internal b32
 StringsAreEqual(string A, string B)
 {
-    b32 Result = (A.Length == B.Length);
-    if (Result)
-    {
-        for (u32 Byte = 0; Byte < A.Length; Byte++)
-        {
-            if (A.Base[Byte] != B.Base[Byte])
-            {
-                Result = false;
-                break;
-            }
-        }
-    }
+    b32 Result = (A.Length == B.Length) && BytesAreEqual(A.Base, B.Base, A.Length);
     return Result;
 }
 internal b32
@@ -415,6 +1027,40 @@ StringBeginsWith(string A, const char *B)
     return *B == 0;
 }
 
+#define HASH_STRING_SEED 2166136261
+
+inline u32
+HashAppendByte(u32 Hash, u8 Byte)
+{
+    u32 Result = (Hash ^ Byte) * 16777619;
+    return Result;
+}
+
+internal u32
+HashString(string S)
+{
+    // NOTE(vincent): 32-bit FNV-1a. HashAppendByte() lets callers hash strings they don't want to concatenate.
+    u32 Hash = HASH_STRING_SEED;
+    for (u32 Byte = 0; Byte < S.Length; Byte++)
+        Hash = HashAppendByte(Hash, (u8)S.Base[Byte]);
+    return Hash;
+}
+
+internal b32
+StringContains(string A, const char *B)
+{
+    // NOTE(vincent): Only tries the offsets where the first byte of B is.
+    string Needle = StringFromLiteral(B);
+    b32 Result = (Needle.Length == 0);
+    for (u32 Offset = 0; !Result && Offset + Needle.Length <= A.Length; Offset++)
+    {
+        Offset += FindByte(A.Base + Offset, A.Length - Offset, Needle.Base[0]);
+        Result = (Offset + Needle.Length <= A.Length) &&
+            BytesAreEqual(A.Base + Offset, Needle.Base, Needle.Length);
+    }
+    return Result;
+}
+
 internal b32
 IsWhitespace(char C)
 {
@@ -433,6 +1079,14 @@ Minimum(u32 A, u32 B)
     return B;
 }
 
+internal u32
+Maximum(u32 A, u32 B)
+{
+    if (A > B)
+        return A;
+    return B;
+}
+
 internal void
 IntegerToString(u32 Integer, char *Buffer)
 {
@@ -464,13 +1118,9 @@ IntegerToString(u32 Integer, char *Buffer)
 inline u32
 Sprint(char *Dest, char *Source)
 {
-    u32 PrintCount = 0;
-    while (*Source)
-    {
-        *Dest++ = *Source++;
-        PrintCount++;
-    }
-    *Dest = 0;
+    u32 PrintCount = StringLength(Source);
+    CopyBytes(Source, Dest, PrintCount);
+    Dest[PrintCount] = 0;
     return PrintCount;
 }
 
@@ -497,12 +1147,8 @@ SprintNoNull(char *Dest, string Source)
 inline u32
 SprintNoNull(char *Dest, char *Source)
 {
-    u32 PrintCount = 0;
-    while (*Source)
-    {
-        *Dest++ = *Source++;
-        PrintCount++;
-    }
+    u32 PrintCount = StringLength(Source);
+    CopyBytes(Source, Dest, PrintCount);
     return PrintCount;
 }
 
@@ -518,6 +1164,22 @@ SprintBounded(char *Dest, char *Source, u32 MaxBytes)
     return PrintCount;
 }
 
+inline u32
+SprintU64(char *Dest, u64 Integer)
+{
+    char Digits[20];
+    u32 DigitCount = 0;
+    do {
+        Digits[DigitCount++] = (Integer % 10) + '0';
+        Integer /= 10;
+    } while (Integer > 0);
+    
+    for (u32 DigitIndex = 0; DigitIndex < DigitCount; DigitIndex++)
+        Dest[DigitIndex] = Digits[DigitCount - 1 - DigitIndex];
+    Dest[DigitCount] = 0;
+    return DigitCount;
+}
+
 inline u32
 SprintInt(char *Dest, int Integer)
 {
@@ -563,12 +1225,8 @@ StringLineLength(char *String)
 internal u32
 SprintUntilDelimiter(char *Dest, char *Source, char Delimiter)
 {
-    u32 Count = 0;
-    while (*Source && *Source != Delimiter)
-    {
-        *Dest++ = *Source++;
-        Count++;
-    }
+    u32 Count = (u32)(FindByteOrNull(Source, Delimiter) - Source);
+    CopyBytes(Source, Dest, Count);
     return Count;
 }
 
@@ -637,6 +1295,17 @@ struct initialize_server_memory_result
 {
     u32 ParsingErrorCount;
     char *PortString;
+    char **WatchRoots;   // folders the platform layer should watch for changes
+    u32 WatchRootCount;
+    thread_placement ThreadPlacement;
+    u32 Backlog;         // for listen()
+};
+
+struct reload_config_result
+{
+    b32 Success;
+    char **WatchRoots;   // the folders of the new config, valid until the next reload
+    u32 WatchRootCount;
 };
 
 
@@ -645,6 +1314,8 @@ struct push_read_entire_file
     char *Memory;
     size_t Size;
     b32 Success;
+    b32 NotFound;    // the file or one of its directories doesn't exist, as opposed to other failures
+    b32 IsDirectory; // the path names a directory, only set by PushReadEntireFileAt()
 };
 internal push_read_entire_file
 PushReadEntireFile(memory_arena *Arena, char *Filename)
@@ -670,5 +1341,9 @@ PushReadEntireFile(memory_arena *Arena, char *Filename)
         // when you keep reloading the same page after a certain number of times,
         // the server would return 404 errors exclusively.
     }
+    else
+    {
+        Result.NotFound = (errno == ENOENT || errno == ENOTDIR);
+    }
     return Result;
 }
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Turns what /server-profile sent into folded stacks, one "outer;inner count" line per distinct stack,
+# for flamegraph.pl or https://www.speedscope.app. The executable has to be the one that was profiled:
+#   curl -s http://127.0.0.1/server-profile/start
+#   curl -s http://127.0.0.1/server-profile > profile.txt
+#   ./fold_profile.sh ../build/server_linux profile.txt > profile.folded
+# Addresses outside the executable (libc, the vDSO) show up as [unknown].
+EXECUTABLE=$1
+PROFILE=$2
+
+ADDRESSES=$(grep -v '^#' "$PROFILE" | cut -d' ' -f1 | tr ';' '\n' | sort -u)
+echo "$ADDRESSES" | addr2line -f -C -e "$EXECUTABLE" | sed -n 'p;n' | sed 's/(.*//' |
+    paste <(echo "$ADDRESSES") - |
+    awk -F'\t' 'NR == FNR { Name[$1] = ($2 == "??" ? "[unknown]" : $2); next }
+                /^#/ { next }
+                {
+                    split($0, Fields, " ")
+                    FrameCount = split(Fields[1], Frames, ";")
+                    Stack = Name[Frames[1]]
+                    for (Frame = 2; Frame <= FrameCount; Frame++)
+                        Stack = Stack ";" Name[Frames[Frame]]
+                    Count[Stack] += Fields[2]
+                }
+                END { for (Stack in Count) print Stack, Count[Stack] }' - "$PROFILE" | sort
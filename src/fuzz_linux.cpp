@@ -0,0 +1,393 @@
+// NOTE(vincent): Fuzz targets for the code that reads what other people wrote: request heads, Base64
+// credentials and the config file.
+//
+// Built as is (build.sh does it), this is a standalone driver that needs no library:
+// Usage: fuzz_linux [--mutations N] [--seed S] [--target http|base64|config] corpus_folder
+// The corpus folder holds one subfolder per target (see fuzz_corpus/). Every input is run whole, then
+// every prefix of it, then N random mutations of it. Each run gets a copy of the input in a buffer of its
+// exact size, so a build with -fsanitize=address catches any read past the end:
+//   g++ fuzz_linux.cpp -o fuzz_linux -g -O1 -fsanitize=address,undefined -DCOMPILER_GCC -DDEBUG=1
+// Then the driver times each target over the corpus as is, so a rewrite of a parser can be checked
+// for both correctness and speed on the same inputs.
+//
+// Built with -DFUZZ_LIBFUZZER, it's a libFuzzer entry point for one target instead:
+//   clang++ fuzz_linux.cpp -o fuzz_http -g -O1 -fsanitize=fuzzer,address -DCOMPILER_GCC -DDEBUG=1
+//       -DFUZZ_LIBFUZZER -DFUZZ_TARGET=FuzzTarget_HTTPRequest
+//   ./fuzz_http -close_fd_mask=3 fuzz_corpus/http
+// close_fd_mask keeps the config parser's messages out of the way, the driver does the same on its own.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "common.h"
+#include "md5_hash.cpp"
+#include "server_config_loader.cpp"
+#include "server_http_parsing.cpp"
+
+#define FUZZ_MAX_INPUT_SIZE 8192          // the server's receive buffer
+#define FUZZ_MAX_CORPUS_FILES 1024
+#define FUZZ_DEFAULT_MUTATIONS 2000
+#define FUZZ_TIMING_SECONDS 0.25
+
+// NOTE(vincent): Whatever the DEBUG setting, a broken invariant stops the run.
+#define FuzzCheck(Expression) if (!(Expression)) {FuzzFailed(#Expression, __LINE__);}
+
+// NOTE(vincent): Set by the sanitizers when they're linked in, null otherwise.
+extern "C" void __sanitizer_set_report_fd(void *Fd) __attribute__((weak));
+extern "C" void __sanitizer_set_death_callback(void (*Callback)(void)) __attribute__((weak));
+
+enum fuzz_target
+{
+    FuzzTarget_HTTPRequest,
+    FuzzTarget_Base64,
+    FuzzTarget_Config,
+    FuzzTarget_Count,
+};
+
+typedef void fuzz_function(u8 *Data, u32 Size);
+
+// NOTE(vincent): The input being run, saved to a file when it fails.
+internal u8 *CurrentInput;
+internal u32 CurrentSize;
+internal char *CurrentTarget = "";
+internal FILE *Report;
+
+internal void
+SaveCurrentInput()
+{
+    char Filename[64];
+    snprintf(Filename, sizeof(Filename), "fuzz-failure-%s", CurrentTarget);
+    FILE *File = fopen(Filename, "wb");
+    if (File)
+    {
+        fwrite(CurrentInput, 1, CurrentSize, File);
+        fclose(File);
+        fprintf(Report ? Report : stderr, "The failing input (%u bytes) is in %s\n", CurrentSize, Filename);
+    }
+}
+
+internal void
+FuzzFailed(char *Expression, int Line)
+{
+    fprintf(Report ? Report : stderr, "%s: check failed on line %d: %s\n", CurrentTarget, Line, Expression);
+    SaveCurrentInput();
+    abort();
+}
+
+inline b32
+IsWithin(string String, char *Base, u32 Size)
+{
+    b32 Result = (!String.Base && !String.Length) ||
+        (String.Base >= Base && String.Base + String.Length <= Base + Size);
+    return Result;
+}
+
+internal void
+FuzzHTTPRequest(u8 *Data, u32 Size)
+{
+    char *Buffer = (char *)malloc(Size ? Size : 1);
+    memcpy(Buffer, Data, Size);
+    RequestHeadIsComplete(Buffer, (int)Size);
+    http_request Request = ParseHTTPRequest(Buffer, (int)Size);
+    if (Request.IsValid)
+    {
+        FuzzCheck(IsWithin(Request.Host, Buffer, Size));
+        FuzzCheck(IsWithin(Request.AuthString, Buffer, Size));
+        FuzzCheck(IsWithin(Request.IfNoneMatch, Buffer, Size));
+        // NOTE(vincent): The canonical path is null-terminated in place.
+        FuzzCheck(Request.RequestPath.Base && Request.RequestPath.Base >= Buffer &&
+                  Request.RequestPath.Base + Request.RequestPath.Length < Buffer + Size);
+        FuzzCheck(Request.RequestPath.Base[Request.RequestPath.Length] == 0);
+        FuzzCheck(FindByte(Request.RequestPath.Base, Request.RequestPath.Length, 0) == Request.RequestPath.Length);
+    }
+    free(Buffer);
+}
+
+internal void
+FuzzBase64(u8 *Data, u32 Size)
+{
+    // NOTE(vincent): Every path the CPU has must agree with the scalar one, on valid and invalid input.
+    char *Source = (char *)malloc(Size ? Size : 1);
+    memcpy(Source, Data, Size);
+    u32 DestSize = 3*(Size/4) + 1;
+    char *Expected = (char *)malloc(DestSize);
+    char *Dest = (char *)malloc(DestSize);
+    string Scalar = FromBase64Path(StringBaseLength(Source, Size), Expected, Base64Path_Scalar);
+    FuzzCheck(!Scalar.Base || Scalar.Length <= 3*(Size/4));
+    for (u32 Path = Base64Path_SSSE3; Path <= Base64Path_AVX2; Path++)
+    {
+        if ((Path == Base64Path_SSSE3 && !CPUSupportsSSSE3()) || (Path == Base64Path_AVX2 && !CPUSupportsAVX2()))
+            continue;
+        string Decoded = FromBase64Path(StringBaseLength(Source, Size), Dest, (base64_path)Path);
+        FuzzCheck(!Decoded.Base == !Scalar.Base);
+        FuzzCheck(!Decoded.Base || (Decoded.Length == Scalar.Length &&
+                                    memcmp(Decoded.Base, Scalar.Base, Scalar.Length) == 0));
+    }
+    free(Dest);
+    free(Expected);
+    free(Source);
+}
+
+internal void
+FuzzConfig(u8 *Data, u32 Size)
+{
+    static parsed_config_file_result Config;
+    memset(&Config, 0, sizeof(Config));
+    push_read_entire_file Source = {};
+    Source.Memory = (char *)malloc(Size ? Size : 1);
+    Source.Size = Size;
+    Source.Success = true;
+    memcpy(Source.Memory, Data, Size);
+    ParseConfigSource(&Config, Source);
+    FuzzCheck(Config.VirtualHostCount <= ArrayCount(Config.VirtualHosts));
+    FuzzCheck(strnlen(Config.Root, sizeof(Config.Root)) < sizeof(Config.Root));
+    FuzzCheck(strnlen(Config.DefaultHost, sizeof(Config.DefaultHost)) < sizeof(Config.DefaultHost));
+    FuzzCheck(strnlen(Config.PortString, sizeof(Config.PortString)) < sizeof(Config.PortString));
+    free(Source.Memory);
+}
+
+struct
+{
+    char *Name;
+    fuzz_function *Function;
+} FuzzTargets[FuzzTarget_Count] =
+{
+    {"http", FuzzHTTPRequest},
+    {"base64", FuzzBase64},
+    {"config", FuzzConfig},
+};
+
+inline void
+RunInput(fuzz_target Target, u8 *Data, u32 Size)
+{
+    CurrentInput = Data;
+    CurrentSize = Size;
+    FuzzTargets[Target].Function(Data, Size);
+}
+
+#if FUZZ_LIBFUZZER
+extern "C" int
+LLVMFuzzerInitialize(int *ArgumentCount, char ***Arguments)
+{
+    InitializeStringPath();
+    CurrentTarget = FuzzTargets[FUZZ_TARGET].Name;
+    return 0;
+}
+
+extern "C" int
+LLVMFuzzerTestOneInput(const u8 *Data, size_t Size)
+{
+    if (Size <= FUZZ_MAX_INPUT_SIZE)
+        RunInput(FUZZ_TARGET, (u8 *)Data, (u32)Size);
+    return 0;
+}
+#else
+
+struct corpus_input
+{
+    u8 *Data;
+    u32 Size;
+};
+
+internal u32
+LoadCorpus(char *Folder, corpus_input *Inputs, u32 MaxCount)
+{
+    u32 Result = 0;
+    DIR *Directory = opendir(Folder);
+    if (!Directory)
+        return 0;
+    while (struct dirent *Entry = readdir(Directory))
+    {
+        char Path[4096];
+        snprintf(Path, sizeof(Path), "%s/%s", Folder, Entry->d_name);
+        struct stat Stat;
+        if (Entry->d_name[0] == '.' || stat(Path, &Stat) != 0 || !S_ISREG(Stat.st_mode) ||
+            Stat.st_size > FUZZ_MAX_INPUT_SIZE || Result == MaxCount)
+            continue;
+        FILE *File = fopen(Path, "rb");
+        if (!File)
+            continue;
+        corpus_input *Input = Inputs + Result;
+        Input->Size = (u32)Stat.st_size;
+        Input->Data = (u8 *)malloc(Input->Size + 1);
+        if (fread(Input->Data, 1, Input->Size, File) == Input->Size)
+            Result++;
+        fclose(File);
+    }
+    closedir(Directory);
+    return Result;
+}
+
+inline u64
+NextRandom(u64 *State)
+{
+    // NOTE(vincent): xorshift64*, reproducible from --seed.
+    u64 X = *State;
+    X ^= X >> 12;
+    X ^= X << 25;
+    X ^= X >> 27;
+    *State = X;
+    return X * 0x2545F4914F6CDD1Dull;
+}
+
+internal u32
+Mutate(u8 *Dest, u8 *Source, u32 Size, u64 *Random)
+{
+    // NOTE(vincent): A few edits, biased towards the bytes that mean something to the parsers.
+    char Special[] = "\r\n :/%.=\"\t+Basic";
+    memcpy(Dest, Source, Size);
+    u32 EditCount = 1 + NextRandom(Random) % 4;
+    for (u32 Edit = 0; Edit < EditCount; Edit++)
+    {
+        u64 Choice = NextRandom(Random);
+        u32 At = Size ? (u32)(NextRandom(Random) % Size) : 0;
+        u8 Byte = (Choice & 8) ? (u8)Special[(Choice >> 8) % (sizeof(Special) - 1)] : (u8)(Choice >> 16);
+        switch (Choice % 5)
+        {
+            case 0: if (Size) Dest[At] = Byte; break;
+            case 1:
+            if (Size < FUZZ_MAX_INPUT_SIZE)
+            {
+                memmove(Dest + At + 1, Dest + At, Size - At);
+                Dest[At] = Byte;
+                Size++;
+            }
+            break;
+            case 2:
+            if (Size)
+            {
+                memmove(Dest + At, Dest + At + 1, Size - At - 1);
+                Size--;
+            }
+            break;
+            case 3: Size = At; break;
+            case 4:
+            {
+                // NOTE(vincent): Repeat a chunk, lines and headers get duplicated this way.
+                u32 Length = Minimum((u32)(NextRandom(Random) % 64), Size - At);
+                Length = Minimum(Length, FUZZ_MAX_INPUT_SIZE - Size);
+                memmove(Dest + At + Length, Dest + At, Size - At);
+                Size += Length;
+            } break;
+        }
+    }
+    return Size;
+}
+
+inline f64
+FuzzSeconds()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (f64)Now.tv_sec + (f64)Now.tv_nsec*1e-9;
+}
+
+int
+main(int ArgumentCount, char **Arguments)
+{
+    char *CorpusFolder = 0;
+    char *OnlyTarget = 0;
+    u32 Mutations = FUZZ_DEFAULT_MUTATIONS;
+    u64 Seed = 0x9E3779B97F4A7C15ull;
+    for (int ArgumentIndex = 1; ArgumentIndex < ArgumentCount; ArgumentIndex++)
+    {
+        char *Argument = Arguments[ArgumentIndex];
+        b32 HasValue = (ArgumentIndex + 1 < ArgumentCount);
+        if (StringsAreEqual(Argument, "--mutations") && HasValue)
+            Mutations = (u32)atoi(Arguments[++ArgumentIndex]);
+        else if (StringsAreEqual(Argument, "--seed") && HasValue)
+            Seed = strtoull(Arguments[++ArgumentIndex], 0, 0) | 1;
+        else if (StringsAreEqual(Argument, "--target") && HasValue)
+            OnlyTarget = Arguments[++ArgumentIndex];
+        else
+            CorpusFolder = Argument;
+    }
+    if (!CorpusFolder)
+    {
+        fprintf(stderr, "Usage: fuzz_linux [--mutations N] [--seed S] [--target http|base64|config] corpus_folder\n");
+        return 2;
+    }
+    InitializeStringPath();
+    
+    // NOTE(vincent): The config parser prints as it goes. Our own output and the sanitizers' reports go to
+    // a copy of stderr, everything else goes nowhere.
+    Report = fdopen(dup(2), "w");
+    setvbuf(Report, 0, _IOLBF, 0);
+    if (__sanitizer_set_report_fd)
+        __sanitizer_set_report_fd((void *)(size_t)fileno(Report));
+    if (__sanitizer_set_death_callback)
+        __sanitizer_set_death_callback(SaveCurrentInput);
+    int Null = open("/dev/null", O_WRONLY);
+    dup2(Null, 1);
+    dup2(Null, 2);
+    
+    static corpus_input Inputs[FUZZ_MAX_CORPUS_FILES];
+    static u8 Mutated[FUZZ_MAX_INPUT_SIZE];
+    u32 TargetsRun = 0;
+    for (u32 Target = 0; Target < FuzzTarget_Count; Target++)
+    {
+        char *Name = FuzzTargets[Target].Name;
+        if (OnlyTarget && !StringsAreEqual(OnlyTarget, Name))
+            continue;
+        char Folder[2048];
+        snprintf(Folder, sizeof(Folder), "%s/%s", CorpusFolder, Name);
+        u32 InputCount = LoadCorpus(Folder, Inputs, ArrayCount(Inputs));
+        if (!InputCount)
+        {
+            fprintf(Report, "%-7s no inputs in %s\n", Name, Folder);
+            continue;
+        }
+        CurrentTarget = Name;
+        TargetsRun++;
+        
+        u64 Runs = 0;
+        u64 Random = Seed;
+        f64 FuzzStart = FuzzSeconds();
+        for (u32 InputIndex = 0; InputIndex < InputCount; InputIndex++)
+        {
+            corpus_input *Input = Inputs + InputIndex;
+            for (u32 Size = 0; Size <= Input->Size; Size++)
+                RunInput((fuzz_target)Target, Input->Data, Size);
+            for (u32 Mutation = 0; Mutation < Mutations; Mutation++)
+            {
+                u32 Size = Mutate(Mutated, Input->Data, Input->Size, &Random);
+                RunInput((fuzz_target)Target, Mutated, Size);
+            }
+            Runs += Input->Size + 1 + Mutations;
+        }
+        f64 FuzzTime = FuzzSeconds() - FuzzStart;
+        
+        // NOTE(vincent): Throughput over the corpus as is. Each run includes the copy of the input.
+        u64 Passes = 0;
+        u64 Bytes = 0;
+        f64 TimingStart = FuzzSeconds();
+        f64 Elapsed = 0;
+        while (Elapsed < FUZZ_TIMING_SECONDS)
+        {
+            for (u32 InputIndex = 0; InputIndex < InputCount; InputIndex++)
+            {
+                RunInput((fuzz_target)Target, Inputs[InputIndex].Data, Inputs[InputIndex].Size);
+                Bytes += Inputs[InputIndex].Size;
+            }
+            Passes++;
+            Elapsed = FuzzSeconds() - TimingStart;
+        }
+        fprintf(Report, "%-7s %4u inputs, %9llu runs in %6.2fs, no failure. Corpus: %10.0f inputs/s, %8.1f MB/s\n",
+                Name, InputCount, (unsigned long long)Runs, FuzzTime, (f64)(Passes*InputCount) / Elapsed,
+                (f64)Bytes / Elapsed * 1e-6);
+        
+        for (u32 InputIndex = 0; InputIndex < InputCount; InputIndex++)
+            free(Inputs[InputIndex].Data);
+    }
+    
+    int Result = TargetsRun ? 0 : 1;
+    return Result;
+}
+#endif
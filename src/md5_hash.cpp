@@ -26,13 +26,45 @@ struct md5_result
     u32 d;
 };
 
-internal md5_result
-MD5(u8 *Source, u32 MessageLength)
+static constexpr u32 MD5PerRoundShifts[64] = { 
+    7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
+    5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
+    4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
+    6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21
+};
+
+static constexpr u32 MD5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 
+};
+
+#define MD5_INITIAL_A 0x67452301 // 01 23 45 67 in memory order (how you read the bytes when address increases)
+#define MD5_INITIAL_B 0xefcdab89 // 89 ab cd ef
+#define MD5_INITIAL_C 0x98badcfe // fe dc ba 98
+#define MD5_INITIAL_D 0x10325476 // 76 54 32 10
+
+internal u32
+MD5Pad(u8 *Source, u32 MessageLength)
 {
     // NOTE(vincent): MessageLength is in bytes.
     // We assume that the Source buffer is big enough to hold some additional padding at the end.
     // The space required for padding is 1 + 511 + 64 bits = 576 bits = 72 bytes.
     // The padding is not required to be initialized to 0.
+    // Returns the padded length, a multiple of 64 bytes.
     
     Assert(Source[MessageLength + 71] || !Source[MessageLength + 71]);
     
@@ -40,39 +72,6 @@ MD5(u8 *Source, u32 MessageLength)
     // In other words,
     Assert( (((u32)0xFFFFFFFF) / 8) >= MessageLength);
     
-    u32 PerRoundShifts[64] = { 
-        7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
-        5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
-        4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
-        6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21
-    };
-    
-    u32 K[64] = {
-        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-        0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-        0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-        0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-        0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-        0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 
-    };
-    
-    md5_result State;
-    State.a = 0x67452301; // 01 23 45 67 in memory order (how you read the bytes when address increases)
-    State.b = 0xefcdab89; // 89 ab cd ef
-    State.c = 0x98badcfe; // fe dc ba 98
-    State.d = 0x10325476; // 76 54 32 10
-    
-    // padding
     Source[MessageLength] = 0x80; // bits: 1000 0000
     u32 ChunkOffset = MessageLength & 63;
     u32 ZeroBytesCount = (ChunkOffset <= 55 ? 55 - ChunkOffset : 63-(ChunkOffset-56));
@@ -87,7 +86,20 @@ MD5(u8 *Source, u32 MessageLength)
     *WriteSizePtr = OriginalSizeInBits;
     WriteSizePtr[1] = 0;
     
+    return PaddedLength;
+}
+
+internal md5_result
+MD5(u8 *Source, u32 MessageLength)
+{
+    // NOTE(vincent): See MD5Pad() for what Source must hold.
+    md5_result State;
+    State.a = MD5_INITIAL_A;
+    State.b = MD5_INITIAL_B;
+    State.c = MD5_INITIAL_C;
+    State.d = MD5_INITIAL_D;
     
+    u32 PaddedLength = MD5Pad(Source, MessageLength);
     u32 ChunksCount = PaddedLength / 64;
     
     // Process the message in successive 512-bit chunks:
@@ -123,11 +135,11 @@ MD5(u8 *Source, u32 MessageLength)
                 F = C ^ (B | (~D));
                 g = (7*i) & 15;
             }
-            F = F + A + K[i] + M[g];
+            F = F + A + MD5K[i] + M[g];
             A = D;
             D = C;
             C = B;
-            B = B + ((F << PerRoundShifts[i]) | (F >> (32-PerRoundShifts[i]))); // left rotate
+            B = B + ((F << MD5PerRoundShifts[i]) | (F >> (32-MD5PerRoundShifts[i]))); // left rotate
         }
         State.a += A;
         State.b += B;
@@ -138,6 +150,338 @@ MD5(u8 *Source, u32 MessageLength)
     return State;
 }
 
+// NOTE(vincent): Multi-buffer MD5. One message can't be hashed in parallel, every step depends
+// on the previous one, but independent messages can: lane L of each SIMD register holds the state
+// of message L. Messages may have different lengths, a lane that ran out of blocks hashes a zero block
+// and masks out the result, so the cost is that of the longest message. That's fine for passwords.
+
+#define MD5_MAX_LANES 8
+
+static const u32 MD5ZeroBlock[16] = {};
+
+inline __m128i
+MD5RotateLeft4(__m128i X, u32 Shift)
+{
+    __m128i Result = _mm_or_si128(_mm_sll_epi32(X, _mm_cvtsi32_si128(Shift)),
+                                  _mm_srl_epi32(X, _mm_cvtsi32_si128(32 - Shift)));
+    return Result;
+}
+
+internal void
+MD5Lanes4(u8 **Sources, u32 *Lengths, u32 Count, md5_result *Results)
+{
+    // NOTE(vincent): SSE2, up to 4 messages. Same padding contract as MD5() for every source.
+    Assert(Count <= 4);
+    u32 BlockCounts[4] = {};
+    u32 MaxBlockCount = 0;
+    for (u32 Lane = 0; Lane < Count; Lane++)
+    {
+        BlockCounts[Lane] = MD5Pad(Sources[Lane], Lengths[Lane]) / 64;
+        MaxBlockCount = Maximum(MaxBlockCount, BlockCounts[Lane]);
+    }
+    
+    __m128i StateA = _mm_set1_epi32(MD5_INITIAL_A);
+    __m128i StateB = _mm_set1_epi32((s32)MD5_INITIAL_B);
+    __m128i StateC = _mm_set1_epi32((s32)MD5_INITIAL_C);
+    __m128i StateD = _mm_set1_epi32(MD5_INITIAL_D);
+    __m128i AllOnes = _mm_set1_epi32(-1);
+    
+    for (u32 BlockIndex = 0; BlockIndex < MaxBlockCount; BlockIndex++)
+    {
+        u32 *Words[4];
+        u32 ActiveMask[4];
+        for (u32 Lane = 0; Lane < 4; Lane++)
+        {
+            b32 Active = (Lane < Count && BlockIndex < BlockCounts[Lane]);
+            Words[Lane] = Active ? (u32 *)Sources[Lane] + BlockIndex*16 : (u32 *)MD5ZeroBlock;
+            ActiveMask[Lane] = Active ? 0xFFFFFFFF : 0;
+        }
+        __m128i M[16];
+        for (u32 j = 0; j < 16; j++)
+            M[j] = _mm_setr_epi32(Words[0][j], Words[1][j], Words[2][j], Words[3][j]);
+        
+        __m128i A = StateA;
+        __m128i B = StateB;
+        __m128i C = StateC;
+        __m128i D = StateD;
+        for (u32 i = 0; i < 64; i++)
+        {
+            __m128i F;
+            u32 g;
+            if (i <= 15)
+            {
+                F = _mm_or_si128(_mm_and_si128(B, C), _mm_andnot_si128(B, D));
+                g = i;
+            }
+            else if (i <= 31)
+            {
+                F = _mm_or_si128(_mm_and_si128(D, B), _mm_andnot_si128(D, C));
+                g = (5*i + 1) & 15;
+            }
+            else if (i <= 47)
+            {
+                F = _mm_xor_si128(_mm_xor_si128(B, C), D);
+                g = (3*i + 5) & 15;
+            }
+            else
+            {
+                F = _mm_xor_si128(C, _mm_or_si128(B, _mm_xor_si128(D, AllOnes)));
+                g = (7*i) & 15;
+            }
+            F = _mm_add_epi32(_mm_add_epi32(F, A), _mm_add_epi32(_mm_set1_epi32((s32)MD5K[i]), M[g]));
+            A = D;
+            D = C;
+            C = B;
+            B = _mm_add_epi32(B, MD5RotateLeft4(F, MD5PerRoundShifts[i]));
+        }
+        
+        // NOTE(vincent): Lanes without a block this time add zero.
+        __m128i Active = _mm_loadu_si128((__m128i *)ActiveMask);
+        StateA = _mm_add_epi32(StateA, _mm_and_si128(Active, A));
+        StateB = _mm_add_epi32(StateB, _mm_and_si128(Active, B));
+        StateC = _mm_add_epi32(StateC, _mm_and_si128(Active, C));
+        StateD = _mm_add_epi32(StateD, _mm_and_si128(Active, D));
+    }
+    
+    u32 OutA[4], OutB[4], OutC[4], OutD[4];
+    _mm_storeu_si128((__m128i *)OutA, StateA);
+    _mm_storeu_si128((__m128i *)OutB, StateB);
+    _mm_storeu_si128((__m128i *)OutC, StateC);
+    _mm_storeu_si128((__m128i *)OutD, StateD);
+    for (u32 Lane = 0; Lane < Count; Lane++)
+    {
+        Results[Lane].a = OutA[Lane];
+        Results[Lane].b = OutB[Lane];
+        Results[Lane].c = OutC[Lane];
+        Results[Lane].d = OutD[Lane];
+    }
+}
+
+TARGET_AVX2 inline __m256i
+MD5RotateLeft8(__m256i X, u32 Shift)
+{
+    __m256i Result = _mm256_or_si256(_mm256_sll_epi32(X, _mm_cvtsi32_si128(Shift)),
+                                     _mm256_srl_epi32(X, _mm_cvtsi32_si128(32 - Shift)));
+    return Result;
+}
+
+TARGET_AVX2 internal void
+MD5Lanes8(u8 **Sources, u32 *Lengths, u32 Count, md5_result *Results)
+{
+    // NOTE(vincent): AVX2, up to 8 messages. Same as MD5Lanes4() with twice the lanes,
+    // only call it when CPUSupportsAVX2().
+    Assert(Count <= 8);
+    u32 BlockCounts[8] = {};
+    u32 MaxBlockCount = 0;
+    for (u32 Lane = 0; Lane < Count; Lane++)
+    {
+        BlockCounts[Lane] = MD5Pad(Sources[Lane], Lengths[Lane]) / 64;
+        MaxBlockCount = Maximum(MaxBlockCount, BlockCounts[Lane]);
+    }
+    
+    __m256i StateA = _mm256_set1_epi32(MD5_INITIAL_A);
+    __m256i StateB = _mm256_set1_epi32((s32)MD5_INITIAL_B);
+    __m256i StateC = _mm256_set1_epi32((s32)MD5_INITIAL_C);
+    __m256i StateD = _mm256_set1_epi32(MD5_INITIAL_D);
+    __m256i AllOnes = _mm256_set1_epi32(-1);
+    
+    for (u32 BlockIndex = 0; BlockIndex < MaxBlockCount; BlockIndex++)
+    {
+        u32 *Words[8];
+        u32 ActiveMask[8];
+        for (u32 Lane = 0; Lane < 8; Lane++)
+        {
+            b32 Active = (Lane < Count && BlockIndex < BlockCounts[Lane]);
+            Words[Lane] = Active ? (u32 *)Sources[Lane] + BlockIndex*16 : (u32 *)MD5ZeroBlock;
+            ActiveMask[Lane] = Active ? 0xFFFFFFFF : 0;
+        }
+        __m256i M[16];
+        for (u32 j = 0; j < 16; j++)
+        {
+            M[j] = _mm256_setr_epi32(Words[0][j], Words[1][j], Words[2][j], Words[3][j],
+                                     Words[4][j], Words[5][j], Words[6][j], Words[7][j]);
+        }
+        
+        __m256i A = StateA;
+        __m256i B = StateB;
+        __m256i C = StateC;
+        __m256i D = StateD;
+        for (u32 i = 0; i < 64; i++)
+        {
+            __m256i F;
+            u32 g;
+            if (i <= 15)
+            {
+                F = _mm256_or_si256(_mm256_and_si256(B, C), _mm256_andnot_si256(B, D));
+                g = i;
+            }
+            else if (i <= 31)
+            {
+                F = _mm256_or_si256(_mm256_and_si256(D, B), _mm256_andnot_si256(D, C));
+                g = (5*i + 1) & 15;
+            }
+            else if (i <= 47)
+            {
+                F = _mm256_xor_si256(_mm256_xor_si256(B, C), D);
+                g = (3*i + 5) & 15;
+            }
+            else
+            {
+                F = _mm256_xor_si256(C, _mm256_or_si256(B, _mm256_xor_si256(D, AllOnes)));
+                g = (7*i) & 15;
+            }
+            F = _mm256_add_epi32(_mm256_add_epi32(F, A), _mm256_add_epi32(_mm256_set1_epi32((s32)MD5K[i]), M[g]));
+            A = D;
+            D = C;
+            C = B;
+            B = _mm256_add_epi32(B, MD5RotateLeft8(F, MD5PerRoundShifts[i]));
+        }
+        
+        __m256i Active = _mm256_loadu_si256((__m256i *)ActiveMask);
+        StateA = _mm256_add_epi32(StateA, _mm256_and_si256(Active, A));
+        StateB = _mm256_add_epi32(StateB, _mm256_and_si256(Active, B));
+        StateC = _mm256_add_epi32(StateC, _mm256_and_si256(Active, C));
+        StateD = _mm256_add_epi32(StateD, _mm256_and_si256(Active, D));
+    }
+    
+    u32 OutA[8], OutB[8], OutC[8], OutD[8];
+    _mm256_storeu_si256((__m256i *)OutA, StateA);
+    _mm256_storeu_si256((__m256i *)OutB, StateB);
+    _mm256_storeu_si256((__m256i *)OutC, StateC);
+    _mm256_storeu_si256((__m256i *)OutD, StateD);
+    for (u32 Lane = 0; Lane < Count; Lane++)
+    {
+        Results[Lane].a = OutA[Lane];
+        Results[Lane].b = OutB[Lane];
+        Results[Lane].c = OutC[Lane];
+        Results[Lane].d = OutD[Lane];
+    }
+}
+
+internal void
+MD5Multi(u8 **Sources, u32 *Lengths, u32 Count, md5_result *Results)
+{
+    // NOTE(vincent): Hashes Count independent messages, 8 or 4 at a time depending on the CPU.
+    b32 UseAVX2 = CPUSupportsAVX2();
+    u32 LaneCount = UseAVX2 ? 8 : 4;
+    for (u32 First = 0; First < Count; First += LaneCount)
+    {
+        u32 BatchCount = Minimum(Count - First, LaneCount);
+        if (BatchCount == 1)
+            Results[First] = MD5(Sources[First], Lengths[First]);
+        else if (BatchCount > 4)
+            MD5Lanes8(Sources + First, Lengths + First, BatchCount, Results + First);
+        else
+            MD5Lanes4(Sources + First, Lengths + First, BatchCount, Results + First);
+    }
+}
+
+// NOTE(vincent): Batching auth checks across threads, with flat combining. A thread that needs a hash
+// posts its message in a free slot. Whichever thread then takes the combiner lock hashes every posted message
+// with one MD5Multi() call and hands out the results, while the others spin until their result shows up
+// or the lock frees up. Under a burst of logins, one thread does the hashing of several for the price of one.
+// There are more slots than threads, so a free slot is always found.
+
+#define MD5_COMBINER_SLOT_COUNT MD5_MAX_LANES
+
+enum md5_slot_state
+{
+    MD5Slot_Free,
+    MD5Slot_Claimed,    // being filled by its owner
+    MD5Slot_Posted,     // waiting for a combiner
+    MD5Slot_Done,       // Result is ready for the owner
+};
+
+struct md5_combiner_slot
+{
+    u32 volatile State;
+    u8 *Source;
+    u32 Length;
+    md5_result Result;
+};
+
+struct md5_combiner
+{
+    u32 volatile Lock;
+    md5_combiner_slot Slots[MD5_COMBINER_SLOT_COUNT];
+    u64 Batches;            // written by the combiner only
+    u64 CombinedHashes;
+};
+
+internal md5_result
+CombinedMD5(md5_combiner *Combiner, u8 *Source, u32 Length)
+{
+    // NOTE(vincent): Same padding contract as MD5().
+    md5_combiner_slot *Slot = 0;
+    for (u32 SlotIndex = 0; !Slot; SlotIndex = (SlotIndex + 1) % MD5_COMBINER_SLOT_COUNT)
+    {
+        md5_combiner_slot *Candidate = Combiner->Slots + SlotIndex;
+        if (Candidate->State == MD5Slot_Free &&
+            AtomicCompareExchangeU32(&Candidate->State, MD5Slot_Claimed, MD5Slot_Free) == MD5Slot_Free)
+        {
+            Slot = Candidate;
+        }
+    }
+    Slot->Source = Source;
+    Slot->Length = Length;
+    CompletePreviousWritesBeforeFutureWrites;
+    Slot->State = MD5Slot_Posted;
+    
+    while (Slot->State != MD5Slot_Done)
+    {
+        if (Combiner->Lock == 0 && AtomicCompareExchangeU32(&Combiner->Lock, 1, 0) == 0)
+        {
+            u8 *Sources[MD5_COMBINER_SLOT_COUNT];
+            u32 Lengths[MD5_COMBINER_SLOT_COUNT];
+            md5_result Results[MD5_COMBINER_SLOT_COUNT];
+            md5_combiner_slot *Posted[MD5_COMBINER_SLOT_COUNT];
+            u32 Count = 0;
+            for (u32 SlotIndex = 0; SlotIndex < MD5_COMBINER_SLOT_COUNT; SlotIndex++)
+            {
+                md5_combiner_slot *Candidate = Combiner->Slots + SlotIndex;
+                if (Candidate->State == MD5Slot_Posted)
+                {
+                    CompletePreviousReadsBeforeFutureReads;
+                    Posted[Count] = Candidate;
+                    Sources[Count] = Candidate->Source;
+                    Lengths[Count] = Candidate->Length;
+                    Count++;
+                }
+            }
+            
+            MD5Multi(Sources, Lengths, Count, Results);
+            
+            for (u32 PostedIndex = 0; PostedIndex < Count; PostedIndex++)
+            {
+                Posted[PostedIndex]->Result = Results[PostedIndex];
+                CompletePreviousWritesBeforeFutureWrites;
+                Posted[PostedIndex]->State = MD5Slot_Done;
+            }
+            Combiner->Batches++;
+            Combiner->CombinedHashes += Count;
+            CompletePreviousWritesBeforeFutureWrites;
+            Combiner->Lock = 0;
+        }
+        else
+        {
+            SpinPause();
+        }
+    }
+    
+    CompletePreviousReadsBeforeFutureReads;
+    md5_result Result = Slot->Result;
+    CompletePreviousWritesBeforeFutureWrites;
+    Slot->State = MD5Slot_Free;
+    return Result;
+}
+
+
+inline b32
+MD5ResultsAreEqual(md5_result A, md5_result B)
+{
+    b32 Result = (A.a == B.a && A.b == B.b && A.c == B.c && A.d == B.d);
+    return Result;
+}
 
 internal void
 PrintMD5NoNull(char *Dest, md5_result Hash)
@@ -196,6 +540,48 @@ TestMD5()
     for (u32 SuccessIndex = 0; SuccessIndex < ArrayCount(Success); SuccessIndex++)
         Assert(Success[SuccessIndex]);
     
+    // NOTE(vincent): Every lane of the multi-buffer versions against the scalar one. The lengths cross
+    // the one and two block boundaries, so lanes run out of blocks at different times.
+    // Padding is written after the message only, so the same buffers can be hashed over and over.
+    u8 Messages[MD5_MAX_LANES][200 + 72];
+    for (u32 Round = 0; Round < 32; Round++)
+    {
+        u8 *Sources[MD5_MAX_LANES];
+        u32 Lengths[MD5_MAX_LANES];
+        md5_result Expected[MD5_MAX_LANES];
+        for (u32 Lane = 0; Lane < MD5_MAX_LANES; Lane++)
+        {
+            Sources[Lane] = Messages[Lane];
+            Lengths[Lane] = (Round*37 + Lane*23) % 200;
+            for (u32 Byte = 0; Byte < Lengths[Lane]; Byte++)
+                Messages[Lane][Byte] = (u8)(Lane*7 + Byte*13 + Round);
+            Expected[Lane] = MD5(Sources[Lane], Lengths[Lane]);
+        }
+        
+        for (u32 Count = 1; Count <= MD5_MAX_LANES; Count++)
+        {
+            md5_result Got[MD5_MAX_LANES];
+            if (Count <= 4)
+            {
+                MD5Lanes4(Sources, Lengths, Count, Got);
+                for (u32 Lane = 0; Lane < Count; Lane++)
+                    Assert(MD5ResultsAreEqual(Got[Lane], Expected[Lane]));
+            }
+            if (CPUSupportsAVX2())
+            {
+                MD5Lanes8(Sources, Lengths, Count, Got);
+                for (u32 Lane = 0; Lane < Count; Lane++)
+                    Assert(MD5ResultsAreEqual(Got[Lane], Expected[Lane]));
+            }
+            MD5Multi(Sources, Lengths, Count, Got);
+            for (u32 Lane = 0; Lane < Count; Lane++)
+                Assert(MD5ResultsAreEqual(Got[Lane], Expected[Lane]));
+        }
+        
+        md5_combiner Combiner = {};
+        md5_result Combined = CombinedMD5(&Combiner, Sources[0], Lengths[0]);
+        Assert(MD5ResultsAreEqual(Combined, Expected[0]));
+    }
 }
 
 internal char
@@ -206,8 +592,8 @@ SextetToAscii(char Sextet)
     char Output = 0;
     
     if      (Sextet <= 25)  Output = 'A' + Sextet;
-    else if (Sextet <= 51)  Output = 'a' + Sextet;
-    else if (Sextet <= 61)  Output = '0' + Sextet;
+    else if (Sextet <= 51)  Output = 'a' + Sextet - 26;
+    else if (Sextet <= 61)  Output = '0' + Sextet - 52;
     else if (Sextet == 62)  Output = '+';
     else                    Output = '/';
     
@@ -215,34 +601,36 @@ SextetToAscii(char Sextet)
     return Output;
 }
 
-internal char
-AsciiToSextet(char C)
-{
-    // NOTE(vincent): Takes an incoming base 64 ascii character and decodes it back.
-    // In case of an unexpected input, we make sure the answer is in [0,63].
-    char Result;
-    if      ('A' <= C && C <= 'Z')   Result = C - 'A';
-    else if ('a' <= C && C <= 'z')   Result = C - 'a' + 26;
-    else if ('0' <= C && C <= '9')   Result = C - '0' + 52;
-    else if (C == '+')               Result = 62;
-    else                             Result = 63;
-    
-    Assert(0 <= Result && Result <= 63);
-    return Result;
-}
-
-
+// NOTE(vincent): Sextet of every ascii character, 0xFF for characters that aren't in the Base64 alphabet.
+// '=' is not in there either, padding is handled separately.
+static constexpr u8 Base64DecodeTable[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
 
-internal void
+internal u32
 ToBase64(char *Source, char *Dest, u32 SourceLength)
 {
-    // NOTE(vincent): This is untested, probably buggy and not actually useful for our use case.
-    // We are only using base 64 decoding so far, we don't need to encode in base64.
-    // I just wrote this as a way to learn how base 64 works. 
+    // NOTE(vincent): Standard alphabet, with padding. Dest must hold 4*((SourceLength + 2)/3) bytes.
+    // Returns the number of characters written, no null terminator.
     
     u32 ByteOffset = 0;
     u32 DestOffset = 0;
-    while (ByteOffset <= SourceLength-3)
+    while (ByteOffset + 3 <= SourceLength)
     {
         u8 *Block = (u8 *)Source + ByteOffset;
         u8 Sextets[4]; 
@@ -269,7 +657,7 @@ ToBase64(char *Source, char *Dest, u32 SourceLength)
             // NOTE(vincent): Read two bytes from the source, get three sextets, add one '=' of padding.
             char Sextets[3];
             Sextets[0] = Block[0] >> 2;
-            Sextets[1] = ((Block[0] << 4) | (Block[1] >> 4)) & 63,
+            Sextets[1] = ((Block[0] << 4) | (Block[1] >> 4)) & 63;
             Sextets[2] = (Block[1] << 2) & 63;
             
             for (u32 SextetIndex = 0; SextetIndex < 3; SextetIndex++)
@@ -285,7 +673,7 @@ ToBase64(char *Source, char *Dest, u32 SourceLength)
             Assert(ByteOffset == SourceLength - 1);
             // NOTE(vincent): Read one byte from the source, get two sextets, add two '='.
             char Sextets[2];
-            Sextets[0] = (Block[0] >> 2),
+            Sextets[0] = (Block[0] >> 2);
             Sextets[1] = (Block[0] << 4) & 63;
             
             for (u32 SextetIndex = 0; SextetIndex < 2; SextetIndex++)
@@ -301,68 +689,185 @@ ToBase64(char *Source, char *Dest, u32 SourceLength)
         
     }
     
+    return DestOffset;
 }
 
+// NOTE(vincent): Strict Base64 decoding: standard alphabet, length a multiple of 4, at most two '='
+// and only at the very end, and the bits that padding leaves unused must be zero. Anything else
+// is rejected, so there is exactly one encoding of any byte string.
+//
+// The SIMD versions classify and translate 16 or 32 characters at a time with nibble lookups
+// (pshufb), then pack the sextets with multiply-adds, following Wojciech Muła and Daniel Lemire's
+// "Faster Base64 Encoding and Decoding Using AVX2 Instructions". They handle the bulk of the input
+// and always leave at least 16 characters, the padding included, to the scalar loop.
+// That also keeps their wide stores inside the decoded length.
 
-internal string
-FromBase64(string Source, char *Dest)
+enum base64_path
+{
+    Base64Path_Scalar,
+    Base64Path_SSSE3,
+    Base64Path_AVX2,
+};
+
+TARGET_SSSE3 internal b32
+FromBase64BlocksSSSE3(string Source, char *Dest, u32 *ReadCount, u32 *WriteCount)
+{
+    __m128i LookupLow = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    __m128i LookupHigh = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    __m128i LookupRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i Pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    
+    b32 Valid = true;
+    while (*ReadCount + 32 <= Source.Length)
+    {
+        __m128i Input = _mm_loadu_si128((__m128i *)(Source.Base + *ReadCount));
+        __m128i HighNibbles = _mm_and_si128(_mm_srli_epi32(Input, 4), _mm_set1_epi8(0x0F));
+        __m128i LowNibbles = _mm_and_si128(Input, _mm_set1_epi8(0x0F));
+        
+        // NOTE(vincent): A character is valid when its two lookups share no bit.
+        __m128i Classes = _mm_and_si128(_mm_shuffle_epi8(LookupLow, LowNibbles), 
+                                        _mm_shuffle_epi8(LookupHigh, HighNibbles));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(Classes, _mm_setzero_si128())) != 0xFFFF)
+        {
+            Valid = false;
+            break;
+        }
+        
+        // NOTE(vincent): Character to sextet is an offset per high nibble, except '/' which shares its
+        // high nibble with '+'.
+        __m128i IsSlash = _mm_cmpeq_epi8(Input, _mm_set1_epi8('/'));
+        __m128i Roll = _mm_shuffle_epi8(LookupRoll, _mm_add_epi8(IsSlash, HighNibbles));
+        __m128i Sextets = _mm_add_epi8(Input, Roll);
+        
+        // NOTE(vincent): 00aaaaaa 00bbbbbb 00cccccc 00dddddd -> aaaaaabb bbbbcccc ccdddddd, per 32 bits.
+        __m128i Pairs = _mm_maddubs_epi16(Sextets, _mm_set1_epi32(0x01400140));
+        __m128i Triples = _mm_madd_epi16(Pairs, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)(Dest + *WriteCount), _mm_shuffle_epi8(Triples, Pack));
+        
+        *ReadCount += 16;
+        *WriteCount += 12;
+    }
+    return Valid;
+}
+
+TARGET_AVX2 internal b32
+FromBase64BlocksAVX2(string Source, char *Dest, u32 *ReadCount, u32 *WriteCount)
 {
-    string Result;
-    Result.Base = Dest;
-    Result.Length = 0;
+    // NOTE(vincent): FromBase64BlocksSSSE3() on both 128-bit lanes, then one cross-lane permute
+    // to make the two 12-byte results contiguous.
+    __m256i LookupLow = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                         0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    __m256i LookupHigh = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    __m256i LookupRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i Pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    __m256i Gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
     
+    b32 Valid = true;
+    while (*ReadCount + 48 <= Source.Length)
+    {
+        __m256i Input = _mm256_loadu_si256((__m256i *)(Source.Base + *ReadCount));
+        __m256i HighNibbles = _mm256_and_si256(_mm256_srli_epi32(Input, 4), _mm256_set1_epi8(0x0F));
+        __m256i LowNibbles = _mm256_and_si256(Input, _mm256_set1_epi8(0x0F));
+        
+        __m256i Classes = _mm256_and_si256(_mm256_shuffle_epi8(LookupLow, LowNibbles),
+                                           _mm256_shuffle_epi8(LookupHigh, HighNibbles));
+        if ((u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Classes, _mm256_setzero_si256())) != 0xFFFFFFFF)
+        {
+            Valid = false;
+            break;
+        }
+        
+        __m256i IsSlash = _mm256_cmpeq_epi8(Input, _mm256_set1_epi8('/'));
+        __m256i Roll = _mm256_shuffle_epi8(LookupRoll, _mm256_add_epi8(IsSlash, HighNibbles));
+        __m256i Sextets = _mm256_add_epi8(Input, Roll);
+        
+        __m256i Pairs = _mm256_maddubs_epi16(Sextets, _mm256_set1_epi32(0x01400140));
+        __m256i Triples = _mm256_madd_epi16(Pairs, _mm256_set1_epi32(0x00011000));
+        __m256i Packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(Triples, Pack), Gather);
+        _mm256_storeu_si256((__m256i *)(Dest + *WriteCount), Packed);
+        
+        *ReadCount += 32;
+        *WriteCount += 24;
+    }
+    return Valid;
+}
+
+internal string
+FromBase64Path(string Source, char *Dest, base64_path Path)
+{
+    // NOTE(vincent): Dest must hold 3*(Source.Length/4) bytes. Returns a zero Base on invalid input.
+    // Use FromBase64() unless you are testing or measuring a specific path.
+    string Result = {};
     u32 ReadCount = 0;
-    while (ReadCount < Source.Length)
+    u32 WriteCount = 0;
+    b32 Valid = (Source.Length % 4 == 0);
+    
+    if (Valid && Path >= Base64Path_AVX2)
+        Valid = FromBase64BlocksAVX2(Source, Dest, &ReadCount, &WriteCount);
+    if (Valid && Path >= Base64Path_SSSE3)
+        Valid = FromBase64BlocksSSSE3(Source, Dest, &ReadCount, &WriteCount);
+    
+    while (Valid && ReadCount < Source.Length)
     {
-        u32 ChunkSize = Minimum(4, Source.Length - ReadCount);
         u8 *Chunk = (u8 *)Source.Base + ReadCount;
-        char *DestPtr = Result.Base + Result.Length;
+        b32 LastChunk = (ReadCount + 4 == Source.Length);
+        u32 PadCount = 0;
+        if (LastChunk && Chunk[3] == '=')
+            PadCount = (Chunk[2] == '=') ? 2 : 1;
         
-        u32 PadFreeSize = 0;
-        char Decoded[4];
-        while (PadFreeSize < ChunkSize && Chunk[PadFreeSize] != '=')
+        u8 Sextets[4] = {};
+        u8 Invalid = 0;
+        for (u32 Index = 0; Index < 4 - PadCount; Index++)
         {
-            Decoded[PadFreeSize] = AsciiToSextet(Chunk[PadFreeSize]);
-            PadFreeSize++;
+            Sextets[Index] = Base64DecodeTable[Chunk[Index]];
+            Invalid |= Sextets[Index];
         }
-        // '=' padding normally never happens in the first byte of a chunk.
-        // However, the program should at least not crash if it is being fed something dumb.
-        // Basically, PadFreeSize could be 0 or 1, and at that point it probably doesn't matter
-        // what we write to the dest buffer, but we shouldn't crash.
+        // NOTE(vincent): Every valid sextet is below 64, 0xFF marks the others.
+        Valid = !(Invalid & 0xC0);
         
-        switch (PadFreeSize)
+        u8 *DestPtr = (u8 *)Dest + WriteCount;
+        DestPtr[0] = (u8)((Sextets[0] << 2) | (Sextets[1] >> 4));
+        if (PadCount == 2)
         {
-            case 4:
-            {
-                u8 OutputA = (Decoded[0] << 2) | (Decoded[1] >> 4);
-                u8 OutputB = (Decoded[1] << 4) | (Decoded[2] >> 2);
-                u8 OutputC = (Decoded[2] << 6) | Decoded[3];
-                DestPtr[0] = OutputA;
-                DestPtr[1] = OutputB;
-                DestPtr[2] = OutputC;
-                Result.Length += 3;
-            } break;
-            case 3:
-            {
-                u8 OutputA = (Decoded[0] << 2) | (Decoded[1] >> 4);
-                u8 OutputB = (Decoded[1] << 4) | (Decoded[2] >> 2);
-                DestPtr[0] = OutputA;
-                DestPtr[1] = OutputB;
-                Result.Length += 2;
-            } break;
-            case 2:
-            {
-                u8 OutputA = (Decoded[0] << 2) | (Decoded[1] >> 4);
-                DestPtr[0] = OutputA;
-                Result.Length += 1;
-            } break;
-            default:
-            {
-            }
+            Valid = Valid && (Sextets[1] & 0x0F) == 0;
+            WriteCount += 1;
         }
-        ReadCount += ChunkSize;
+        else if (PadCount == 1)
+        {
+            DestPtr[1] = (u8)((Sextets[1] << 4) | (Sextets[2] >> 2));
+            Valid = Valid && (Sextets[2] & 0x03) == 0;
+            WriteCount += 2;
+        }
+        else
+        {
+            DestPtr[1] = (u8)((Sextets[1] << 4) | (Sextets[2] >> 2));
+            DestPtr[2] = (u8)((Sextets[2] << 6) | Sextets[3]);
+            WriteCount += 3;
+        }
+        ReadCount += 4;
     }
     
+    if (Valid)
+        Result = StringBaseLength(Dest, WriteCount);
+    return Result;
+}
+
+internal string
+FromBase64(string Source, char *Dest)
+{
+    // NOTE(vincent): Decodes with the widest path the CPU has. See FromBase64Path().
+    base64_path Path = CPUSupportsAVX2() ? Base64Path_AVX2 : 
+        CPUSupportsSSSE3() ? Base64Path_SSSE3 : Base64Path_Scalar;
+    string Result = FromBase64Path(Source, Dest, Path);
     return Result;
 }
 
@@ -384,5 +889,70 @@ TestFromBase64()
     
     Assert(StringsAreEqual(Jojo, Decoded2));
     
+    // NOTE(vincent): Strictness. The long ones go through the SIMD loops, with the bad character
+    // moved to every position.
+    char *Invalid[] =
+    {
+        "dXNlcjp1c2V",           // length
+        "dXNl*jp1c2Vy",          // character
+        "dXNlcjp1c2Vy====",      // too much padding
+        "dX=lcjp1c2Vy",          // padding in the middle
+        "dXM=dXNl",              // padding before the end
+        "dXN=",                  // unused bits set
+        "dW==",                  // unused bits set
+        "=AAA",
+    };
+    for (u32 InvalidIndex = 0; InvalidIndex < ArrayCount(Invalid); InvalidIndex++)
+    {
+        for (u32 Path = Base64Path_Scalar; Path <= Base64Path_AVX2; Path++)
+        {
+            if (Path == Base64Path_SSSE3 && !CPUSupportsSSSE3()) continue;
+            if (Path == Base64Path_AVX2 && !CPUSupportsAVX2()) continue;
+            Assert(FromBase64Path(StringFromLiteral(Invalid[InvalidIndex]), Dest, (base64_path)Path).Base == 0);
+        }
+    }
     
+    char Long[128];
+    for (u32 Position = 0; Position < 120; Position++)
+    {
+        for (u32 Path = Base64Path_Scalar; Path <= Base64Path_AVX2; Path++)
+        {
+            if (Path == Base64Path_SSSE3 && !CPUSupportsSSSE3()) continue;
+            if (Path == Base64Path_AVX2 && !CPUSupportsAVX2()) continue;
+            char BadCharacters[] = {'*', '=', '-', '_', ' ', 0, (char)0x80, (char)0xC1};
+            for (u32 BadIndex = 0; BadIndex < ArrayCount(BadCharacters); BadIndex++)
+            {
+                for (u32 Index = 0; Index < 120; Index++)
+                    Long[Index] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[Index % 64];
+                Long[Position] = BadCharacters[BadIndex];
+                string Decoded3 = FromBase64Path(StringBaseLength(Long, 120), Dest, (base64_path)Path);
+                Assert(Decoded3.Base == 0);
+            }
+        }
+    }
+    
+    // NOTE(vincent): Randomized round trips through ToBase64, on every path the CPU has.
+    u32 Random = 0x12345678;
+    char Original[400];
+    char Encoded3[540];
+    for (u32 Round = 0; Round < 2000; Round++)
+    {
+        Random ^= Random << 13; Random ^= Random >> 17; Random ^= Random << 5;
+        u32 Length = Random % ArrayCount(Original);
+        for (u32 Byte = 0; Byte < Length; Byte++)
+        {
+            Random ^= Random << 13; Random ^= Random >> 17; Random ^= Random << 5;
+            Original[Byte] = (char)Random;
+        }
+        u32 EncodedLength = ToBase64(Original, Encoded3, Length);
+        Assert(EncodedLength == 4*((Length + 2)/3));
+        
+        for (u32 Path = Base64Path_Scalar; Path <= Base64Path_AVX2; Path++)
+        {
+            if (Path == Base64Path_SSSE3 && !CPUSupportsSSSE3()) continue;
+            if (Path == Base64Path_AVX2 && !CPUSupportsAVX2()) continue;
+            string RoundTrip = FromBase64Path(StringBaseLength(Encoded3, EncodedLength), Dest, (base64_path)Path);
+            Assert(RoundTrip.Base && StringsAreEqual(RoundTrip, StringBaseLength(Original, Length)));
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,309 @@
+// NOTE(vincent): Replays a capture written by the server (see server_capture.cpp) against a server, usually
+// a local test one serving the same content.
+// Usage: replay_linux capture.bin [--host 127.0.0.1] [--port 80] [--speed N] [--clients N]
+// Requests start at the times they originally arrived, N times faster with --speed N, back to back with
+// --speed 0. Each one gets its own connection, like the server expects. At the end we print the latency
+// distribution and every response whose status code or length differs from the captured one.
+// A request can only start on time if a client thread is free: the "late" line says how many started
+// more than REPLAY_LATE_MICROSECONDS behind schedule. If it's high, raise --clients.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "common.h"
+#include "server_capture.cpp"
+
+#define REPLAY_DEFAULT_CLIENTS 64
+#define REPLAY_MAX_CLIENTS 1024
+#define REPLAY_LATE_MICROSECONDS 1000
+#define REPLAY_RECEIVE_TIMEOUT_SECONDS 10
+#define REPLAY_MAX_MISMATCHES_SHOWN 20
+
+internal u64
+GetMonotonicMicroseconds()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    u64 Result = (u64)Now.tv_sec*1000000 + (u64)Now.tv_nsec/1000;
+    return Result;
+}
+
+struct replay_result
+{
+    u64 Latency;           // microseconds, connect to the server closing the connection
+    u64 Late;              // microseconds behind schedule when it started
+    u64 ResponseLength;
+    u16 Status;
+    b32 Failed;            // couldn't connect or send, or the receive timed out
+};
+
+struct replay
+{
+    captured_request *Requests;   // sorted by arrival
+    replay_result *Results;       // same order
+    u32 Count;
+    volatile u32 Next;            // the next request a client takes
+    f64 Speed;                    // 0 for back to back
+    u64 StartedAt;                // microseconds, when the first request was due
+    struct addrinfo *Address;
+};
+
+internal int
+CompareArrivals(const void *A, const void *B)
+{
+    u64 ArrivedA = ((captured_request *)A)->Record.ArrivedAt;
+    u64 ArrivedB = ((captured_request *)B)->Record.ArrivedAt;
+    int Result = (ArrivedA < ArrivedB) ? -1 : (ArrivedA > ArrivedB);
+    return Result;
+}
+
+internal int
+CompareU64(const void *A, const void *B)
+{
+    u64 ValueA = *(u64 *)A;
+    u64 ValueB = *(u64 *)B;
+    int Result = (ValueA < ValueB) ? -1 : (ValueA > ValueB);
+    return Result;
+}
+
+internal void
+ReplayRequest(replay *Replay, captured_request *Request, replay_result *Result)
+{
+    u64 Start = GetMonotonicMicroseconds();
+    int Socket = socket(Replay->Address->ai_family, Replay->Address->ai_socktype, Replay->Address->ai_protocol);
+    if (Socket == -1)
+    {
+        Result->Failed = true;
+        return;
+    }
+    struct timeval Timeout = {REPLAY_RECEIVE_TIMEOUT_SECONDS, 0};
+    setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    
+    b32 Sent = (connect(Socket, Replay->Address->ai_addr, Replay->Address->ai_addrlen) == 0);
+    for (u32 At = 0; Sent && At < Request->Record.RequestLength;)
+    {
+        ssize_t Count = send(Socket, Request->Request + At, Request->Record.RequestLength - At, MSG_NOSIGNAL);
+        Sent = (Count > 0);
+        if (Sent)
+            At += (u32)Count;
+    }
+    
+    // NOTE(vincent): The server closes the connection after each response, read until it does.
+    char Buffer[65536];
+    char Head[16] = {};
+    u64 Received = 0;
+    b32 Closed = false;
+    while (Sent)
+    {
+        ssize_t Count = recv(Socket, Buffer, sizeof(Buffer), 0);
+        if (Count == -1 && errno == EINTR)
+            continue;
+        if (Count <= 0)
+        {
+            Closed = (Count == 0);
+            break;
+        }
+        for (u32 Byte = 0; Received + Byte < sizeof(Head) && Byte < Count; Byte++)
+            Head[Received + Byte] = Buffer[Byte];
+        Received += Count;
+    }
+    close(Socket);
+    
+    Result->Latency = GetMonotonicMicroseconds() - Start;
+    Result->ResponseLength = Received;
+    Result->Status = ResponseStatus(Head, Minimum(Received, sizeof(Head)));
+    Result->Failed = !Sent || !Closed;
+}
+
+internal void *
+ReplayClient(void *Data)
+{
+    replay *Replay = (replay *)Data;
+    u64 FirstArrival = Replay->Requests[0].Record.ArrivedAt;
+    for (;;)
+    {
+        u32 Index = AtomicIncrementU32(&Replay->Next) - 1;
+        if (Index >= Replay->Count)
+            break;
+        captured_request *Request = Replay->Requests + Index;
+        replay_result *Result = Replay->Results + Index;
+        
+        u64 Due = Replay->StartedAt;
+        if (Replay->Speed > 0)
+            Due += (u64)((f64)(Request->Record.ArrivedAt - FirstArrival) / Replay->Speed);
+        u64 Now = GetMonotonicMicroseconds();
+        if (Now < Due)
+        {
+            struct timespec Wake;
+            Wake.tv_sec = Due / 1000000;
+            Wake.tv_nsec = (Due % 1000000)*1000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Wake, 0) == EINTR);
+            Now = GetMonotonicMicroseconds();
+        }
+        Result->Late = (Replay->Speed > 0 && Now > Due) ? Now - Due : 0;
+        ReplayRequest(Replay, Request, Result);
+    }
+    return 0;
+}
+
+internal void
+PrintRequestLine(captured_request *Request)
+{
+    u32 Length = FindByte(Request->Request, Request->Record.RequestLength, '\r');
+    printf("%.*s", (int)Minimum(Length, 120u), Request->Request);
+}
+
+int
+main(int ArgumentCount, char **Arguments)
+{
+    char *CapturePath = 0;
+    char *Host = "127.0.0.1";
+    char *Port = "80";
+    f64 Speed = 1.0;
+    u32 ClientCount = REPLAY_DEFAULT_CLIENTS;
+    for (int ArgumentIndex = 1; ArgumentIndex < ArgumentCount; ArgumentIndex++)
+    {
+        char *Argument = Arguments[ArgumentIndex];
+        b32 HasValue = (ArgumentIndex + 1 < ArgumentCount);
+        if (StringsAreEqual(Argument, "--host") && HasValue)
+            Host = Arguments[++ArgumentIndex];
+        else if (StringsAreEqual(Argument, "--port") && HasValue)
+            Port = Arguments[++ArgumentIndex];
+        else if (StringsAreEqual(Argument, "--speed") && HasValue)
+            Speed = atof(Arguments[++ArgumentIndex]);
+        else if (StringsAreEqual(Argument, "--clients") && HasValue)
+            ClientCount = Minimum(Maximum(atoi(Arguments[++ArgumentIndex]), 1), REPLAY_MAX_CLIENTS);
+        else
+            CapturePath = Argument;
+    }
+    if (!CapturePath || Speed < 0)
+    {
+        fprintf(stderr, "Usage: replay_linux capture.bin [--host 127.0.0.1] [--port 80] [--speed N] [--clients N]\n");
+        return 2;
+    }
+    InitializeStringPath();
+    
+    int FileDescriptor = open(CapturePath, O_RDONLY | O_CLOEXEC);
+    struct stat Stat;
+    if (FileDescriptor == -1 || fstat(FileDescriptor, &Stat) != 0)
+    {
+        perror(CapturePath);
+        return 1;
+    }
+    u64 Size = (u64)Stat.st_size;
+    char *Capture = Size ? (char *)mmap(0, Size, PROT_READ, MAP_PRIVATE, FileDescriptor, 0) : 0;
+    close(FileDescriptor);
+    if (!Capture || Capture == MAP_FAILED || !IsCapture(Capture, Size))
+    {
+        fprintf(stderr, "%s isn't a capture\n", CapturePath);
+        return 1;
+    }
+    
+    replay Replay = {};
+    u64 RecordCount = Size / sizeof(capture_record);
+    u32 MaxCount = (u32)(RecordCount < 0xFFFFFFFF ? RecordCount : 0xFFFFFFFF);
+    Replay.Requests = (captured_request *)malloc(MaxCount*sizeof(captured_request) + 1);
+    b32 Truncated;
+    Replay.Count = ReadCapture(Replay.Requests, MaxCount, Capture, Size, &Truncated);
+    if (Truncated)
+        fprintf(stderr, "%s ends with a partial record, replaying the %u whole ones\n", CapturePath, Replay.Count);
+    if (!Replay.Count)
+    {
+        fprintf(stderr, "%s has no requests\n", CapturePath);
+        return 1;
+    }
+    qsort(Replay.Requests, Replay.Count, sizeof(captured_request), CompareArrivals);
+    Replay.Results = (replay_result *)calloc(Replay.Count, sizeof(replay_result));
+    Replay.Speed = Speed;
+    
+    struct addrinfo Hints = {};
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    int Error = getaddrinfo(Host, Port, &Hints, &Replay.Address);
+    if (Error)
+    {
+        fprintf(stderr, "%s:%s: %s\n", Host, Port, gai_strerror(Error));
+        return 1;
+    }
+    
+    u64 Span = Replay.Requests[Replay.Count - 1].Record.ArrivedAt - Replay.Requests[0].Record.ArrivedAt;
+    printf("Replaying %u requests captured over %.3fs against %s:%s, speed %g, %u clients\n",
+           Replay.Count, (f64)Span*1e-6, Host, Port, Speed, ClientCount);
+    
+    // NOTE(vincent): A little head start, so that the first requests aren't late because threads are starting.
+    Replay.StartedAt = GetMonotonicMicroseconds() + 10000;
+    pthread_t Clients[REPLAY_MAX_CLIENTS];
+    for (u32 ClientIndex = 0; ClientIndex < ClientCount; ClientIndex++)
+        pthread_create(Clients + ClientIndex, 0, ReplayClient, &Replay);
+    for (u32 ClientIndex = 0; ClientIndex < ClientCount; ClientIndex++)
+        pthread_join(Clients[ClientIndex], 0);
+    u64 Elapsed = GetMonotonicMicroseconds() - Replay.StartedAt;
+    
+    u64 *Latencies = (u64 *)malloc(Replay.Count*sizeof(u64));
+    u32 LatencyCount = 0;
+    u32 Failed = 0;
+    u32 Late = 0;
+    u64 MaxLate = 0;
+    u32 StatusMismatches = 0;
+    u32 LengthMismatches = 0;
+    for (u32 Index = 0; Index < Replay.Count; Index++)
+    {
+        captured_request *Request = Replay.Requests + Index;
+        replay_result *Result = Replay.Results + Index;
+        Late += (Result->Late > REPLAY_LATE_MICROSECONDS);
+        MaxLate = Maximum(MaxLate, Result->Late);
+        if (Result->Failed)
+        {
+            Failed++;
+            continue;
+        }
+        Latencies[LatencyCount++] = Result->Latency;
+        b32 StatusDiffers = (Result->Status != Request->Record.Status);
+        b32 LengthDiffers = (Result->ResponseLength != Request->Record.ResponseLength);
+        StatusMismatches += StatusDiffers;
+        LengthMismatches += LengthDiffers;
+        if ((StatusDiffers || LengthDiffers) && StatusMismatches + LengthMismatches <= REPLAY_MAX_MISMATCHES_SHOWN)
+        {
+            printf("mismatch: status %u, %llu bytes, captured %u, %llu bytes: ", Result->Status,
+                   (unsigned long long)Result->ResponseLength, Request->Record.Status,
+                   (unsigned long long)Request->Record.ResponseLength);
+            PrintRequestLine(Request);
+            printf("\n");
+        }
+    }
+    
+    printf("requests          %u in %.3fs, %.0f per second\n", Replay.Count, (f64)Elapsed*1e-6,
+           (f64)Replay.Count / ((f64)Elapsed*1e-6));
+    printf("failed            %u\n", Failed);
+    printf("late              %u, at most %.3fms behind\n", Late, (f64)MaxLate*1e-3);
+    printf("status mismatches %u\n", StatusMismatches);
+    printf("length mismatches %u\n", LengthMismatches);
+    if (LatencyCount)
+    {
+        qsort(Latencies, LatencyCount, sizeof(u64), CompareU64);
+        u32 Permilles[] = {500, 900, 990, 999};
+        printf("latency ms       ");
+        for (u32 PermilleIndex = 0; PermilleIndex < ArrayCount(Permilles); PermilleIndex++)
+        {
+            u32 Permille = Permilles[PermilleIndex];
+            u64 Latency = Latencies[(u64)(LatencyCount - 1)*Permille / 1000];
+            printf(" p%g %.3f", Permille / 10.0, (f64)Latency*1e-3);
+        }
+        printf(" max %.3f\n", (f64)Latencies[LatencyCount - 1]*1e-3);
+    }
+    
+    freeaddrinfo(Replay.Address);
+    int Result = (Failed || StatusMismatches || LengthMismatches) ? 1 : 0;
+    return Result;
+}
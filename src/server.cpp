@@ -1,19 +1,194 @@
 #include "server_config_loader.cpp"
-#include "server.h"
+#include "site_bundle.h"
+#include "server_content_watch.cpp"
+#include "server_virtual_hosts.cpp"
+#include "server_negative_cache.cpp"
+#include "server_directory_index.cpp"
+#include "server_timer_wheel.cpp"
+#include "server_admission.cpp"
+#include "server_rate_limit.cpp"
+#include "server_config_snapshot.cpp"
+#include "server_trace.cpp"
+#include "server_profiler.cpp"
+#include "server_capture.cpp"
 #include "md5_hash.cpp"
+#include "server_htpasswd.cpp"
+#include "server.h"
 #include "server_http_parsing.cpp"
 
-// TODO(vincent): profiling? I'm curious to see what's slow
 // TODO(vincent): the bonus feature
 
+// NOTE(vincent): Every status line and header block is built once and never written again, responses send
+// them straight from the server arena or the snapshot arena. They are null-terminated, for printing.
+#define STRING_OK "HTTP/1.1 200 OK\r\n\r\n"
+#define STRING_BR "HTTP/1.1 400 Bad Request\r\n\r\n"
+#define STRING_NF "HTTP/1.1 404 Not Found\r\n\r\n"
+#define STRING_UN "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"Access to the staging site\"\r\n\r\n"
+#define STRING_FB "HTTP/1.1 403 Forbidden\r\n\r\n"
+#define STRING_NM "HTTP/1.1 304 Not Modified\r\nETag: "  // followed by the ETag and CRLFCRLF
+#define STRING_MP "HTTP/1.1 301 Moved Permanently\r\nContent-Length: 0\r\nLocation: /"  // followed by the path, "/" and CRLFCRLF
+#define STRING_SU "HTTP/1.1 503 Service Unavailable\r\nRetry-After: "  // followed by STRING_SU_END
+#define STRING_SU_END "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define STRING_TM "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+internal b32
+AssignCacheKeys(server_state *State, virtual_host_table *Table)
+{
+    // NOTE(vincent): The negative and htpasswd caches key their entries by vhost. A vhost gets the key its root
+    // had in earlier snapshots, so a reload doesn't start from cold caches, and a key is never given to another
+    // root: requests still on the old snapshot may insert entries under their keys until they finish.
+    b32 Result = true;
+    for (u32 HostIndex = 0; HostIndex < Table->Count; HostIndex++)
+    {
+        virtual_host *Host = Table->Hosts + HostIndex;
+        u32 Key = 0;
+        while (Key < State->CacheRootCount && !StringsAreEqual(State->CacheRoots[Key], Host->Root))
+            Key++;
+        if (Key == State->CacheRootCount)
+        {
+            memory_arena *Arena = &State->CacheRootArena;
+            if (Key < MAX_CACHE_ROOTS && Arena->Size - Arena->Used > Host->Root.Length)
+            {
+                string *Root = State->CacheRoots + State->CacheRootCount++;
+                Root->Base = PushArray(Arena, Host->Root.Length + 1, char);
+                Root->Length = Sprint(Root->Base, Host->Root.Base);
+            }
+            else
+            {
+                fprintf(stderr, "Too many distinct vhost roots since startup, restart the server\n");
+                Result = false;
+                break;
+            }
+        }
+        Host->CacheKey = Key;
+    }
+    return Result;
+}
+
+internal u32
+LoadConfigSnapshot(server_state *State, config_snapshot *Snapshot, u32 Generation)
+{
+    // NOTE(vincent): Reads the config file and everything it points to into a free snapshot slot.
+    // Returns the error count, the caller releases the slot when it isn't 0.
+    memory_arena *Arena = &Snapshot->Arena;
+    Arena->Used = 0;
+    Snapshot->Generation = Generation;
+    ZeroBytes((char *)&Snapshot->Config, sizeof(Snapshot->Config));
+    ZeroBytes((char *)&Snapshot->Bundle, sizeof(Snapshot->Bundle));
+    ZeroBytes((char *)&Snapshot->VirtualHosts, sizeof(Snapshot->VirtualHosts));
+    Snapshot->BundleMapping = {};
+    
+    parsed_config_file_result *Config = &Snapshot->Config;
+    Assert(sizeof(DEFAULT_SERVER_PORT) <= ArrayCount(Config->PortString));
+    WriteStringLiteral(Config->PortString, DEFAULT_SERVER_PORT); // initializing to default server port number
+    u32 ErrorCount = ParseConfigFile(Config, Arena);
+    
+    Snapshot->HeaderTimeoutMilliseconds = 1000*(Config->HeaderTimeout ? Config->HeaderTimeout : 
+                                                DEFAULT_HEADER_TIMEOUT_SECONDS);
+    Snapshot->SendTimeoutMilliseconds = 1000*(Config->SendTimeout ? Config->SendTimeout : DEFAULT_SEND_TIMEOUT_SECONDS);
+    Snapshot->SendLowWatermark = Config->SendLowWatermarkSet ? Config->SendLowWatermark : DEFAULT_SEND_LOW_WATERMARK;
+    Snapshot->DrainTimeoutMilliseconds = 1000*(Config->DrainTimeout ? Config->DrainTimeout : DEFAULT_DRAIN_TIMEOUT_SECONDS);
+    Snapshot->TraceSample = Config->TraceSample;
+    Snapshot->AutoIndex = (Config->AutoIndex != 0);
+    Snapshot->ShedQueueDepth = TASK_COUNT;
+    if (Config->ShedQueueDepth && Config->ShedQueueDepth < TASK_COUNT)
+        Snapshot->ShedQueueDepth = Config->ShedQueueDepth;
+    Snapshot->ShedLatency = Config->ShedLatency;
+    Snapshot->RateLimit = Config->RateLimit;
+    Snapshot->RateBurst = Config->RateBurst;
+    
+    // NOTE(vincent): Map the site bundle if the config names one. Every file, .htpasswd included,
+    // is then served from the mapping and the Root folder is never read.
+    if (Config->BundleSet)
+    {
+        Snapshot->BundleMapping = MapEntireFileReadOnly(Config->Bundle);
+        platform_file_mapping Mapping = Snapshot->BundleMapping;
+        if (LoadSiteBundle(&Snapshot->Bundle, Mapping.Base, Mapping.Size))
+        {
+            printf("Loaded site bundle %s: %u files\n", Config->Bundle, Snapshot->Bundle.EntryCount);
+        }
+        else
+        {
+            fprintf(stderr, "Couldn't load site bundle %s\n", Config->Bundle);
+            ErrorCount++;
+        }
+    }
+    
+    ErrorCount += LoadVirtualHosts(&Snapshot->VirtualHosts, Arena, Config, &Snapshot->Bundle);
+    if (!AssignCacheKeys(State, &Snapshot->VirtualHosts))
+        ErrorCount++;
+    
+    string *Unavailable = &Snapshot->ServiceUnavailable;
+    Unavailable->Base = PushArray(Arena, sizeof(STRING_SU) + 10 + sizeof(STRING_SU_END), char);
+    Unavailable->Length = Sprint(Unavailable->Base, STRING_SU);
+    Unavailable->Length += SprintU64(Unavailable->Base + Unavailable->Length,
+                                     Config->RetryAfter ? Config->RetryAfter : DEFAULT_RETRY_AFTER_SECONDS);
+    Unavailable->Length += Sprint(Unavailable->Base + Unavailable->Length, STRING_SU_END);
+    return ErrorCount;
+}
+
+internal void
+ReleaseConfigSnapshot(config_snapshot *Snapshot)
+{
+    // NOTE(vincent): Only once no thread reads the snapshot anymore, see SnapshotIsRead().
+    virtual_host_table *Table = &Snapshot->VirtualHosts;
+    for (u32 HostIndex = 0; HostIndex < Table->Count; HostIndex++)
+    {
+        if (Table->Hosts[HostIndex].Directory.Handle != -1)
+            CloseDirectory(Table->Hosts[HostIndex].Directory);
+    }
+    if (Snapshot->BundleMapping.Base)
+        UnmapFile(Snapshot->BundleMapping);
+    Snapshot->BundleMapping = {};
+    Table->Count = 0;
+    Snapshot->Arena.Used = 0;
+}
+
+internal char **
+CollectWatchRoots(config_snapshot *Snapshot, u32 *RootCount)
+{
+    // NOTE(vincent): The folders the platform layer should watch. Two vhosts may share a root, it's listed once.
+    // Nothing to watch with a bundle.
+    *RootCount = 0;
+    char **Result = 0;
+    if (!Snapshot->Config.BundleSet)
+    {
+        Result = PushArray(&Snapshot->Arena, Snapshot->VirtualHosts.Count, char *);
+        for (u32 HostIndex = 0; HostIndex < Snapshot->VirtualHosts.Count; HostIndex++)
+        {
+            char *Root = Snapshot->VirtualHosts.Hosts[HostIndex].Root.Base;
+            b32 AlreadyWatched = false;
+            for (u32 RootIndex = 0; RootIndex < *RootCount; RootIndex++)
+                AlreadyWatched |= StringsAreEqual(Result[RootIndex], Root);
+            if (!AlreadyWatched)
+                Result[(*RootCount)++] = Root;
+        }
+    }
+    return Result;
+}
+
 internal initialize_server_memory_result
 InitializeServerMemory(server_memory *Memory, platform_work_queue *Queue, 
                        platform_add_entry *PlatformAddEntry, 
                        platform_do_next_work_entry *PlatformDoNextWorkEntry)
 {
+    InitializeStringPath();
 #if DEBUG
+    TestStringPaths();
     TestMD5();
     TestFromBase64();
+    TestCompileHtpasswd();
+    TestTimerWheel();
+    TestLatencyHistogram();
+    TestRateLimiter();
+    TestConfigPublisher();
+    TestRequestTracer();
+    TestCpuProfiler();
+    TestRequestCapture();
+    TestDirectoryIndex();
+    TestAdvanceSend();
+    TestCanonicalizeRequestPath();
+    TestParseHTTPRequest();
 #endif
     
     // NOTE(vincent): Initialize server state.
@@ -27,36 +202,66 @@ InitializeServerMemory(server_memory *Memory, platform_work_queue *Queue,
     Memory->PlatformAddEntry = PlatformAddEntry;
     Memory->PlatformDoNextWorkEntry = PlatformDoNextWorkEntry;
     
-    // NOTE(vincent): Load config file
-    parsed_config_file_result *Config = &State->Config;
-    Assert(sizeof(DEFAULT_SERVER_PORT) <= ArrayCount(Config->PortString));
-    Sprint(Config->PortString, DEFAULT_SERVER_PORT); // initializing to default server port number
-    InitResult.ParsingErrorCount = ParseConfigFile(Config, &State->Arena);
+    // NOTE(vincent): Load config file, into the first snapshot. Reloads alternate between the two.
+    for (u32 SnapshotIndex = 0; SnapshotIndex < ArrayCount(State->Snapshots); SnapshotIndex++)
+        SubArena(&State->Snapshots[SnapshotIndex].Arena, &State->Arena, CONFIG_SNAPSHOT_ARENA_SIZE);
+    SubArena(&State->CacheRootArena, &State->Arena, CACHE_ROOT_ARENA_SIZE);
+    config_snapshot *Snapshot = State->Snapshots;
+    InitResult.ParsingErrorCount = LoadConfigSnapshot(State, Snapshot, 1);
+    PublishSnapshot(&State->Publisher, Snapshot);
+    parsed_config_file_result *Config = &Snapshot->Config;
     InitResult.PortString = Config->PortString;
+    InitResult.ThreadPlacement = Config->ThreadPlacement;
+    InitResult.Backlog = Config->Backlog ? Config->Backlog : DEFAULT_LISTEN_BACKLOG;
+    InitResult.WatchRoots = CollectWatchRoots(Snapshot, &InitResult.WatchRootCount);
+    InitializeTimerWheel(&State->ConnectionTimers, GetMonotonicMilliseconds() / CONNECTION_TIMER_TICK_MILLISECONDS);
     
-    // NOTE(vincent): Push string constants tightly and null-terminate them.
-    // Note that sizeof() on a string literal counts the terminating null character,
-    // and that should be a compile-time calculation.
-#define STRING_OK "HTTP/1.1 200 OK\r\n\r\n"
-#define STRING_BR "HTTP/1.1 400 Bad Request\r\n\r\n"
-#define STRING_NF "HTTP/1.1 404 Not Found\r\n\r\n"
-#define STRING_UN "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"Access to the staging site\"\r\n\r\n"
-#define STRING_FB "HTTP/1.1 403 Forbidden\r\n\r\n"
-    State->StringOK = PushArray(&State->Arena, sizeof(STRING_OK), char);
-    State->StringBR = PushArray(&State->Arena, sizeof(STRING_BR), char);
-    State->StringNF = PushArray(&State->Arena, sizeof(STRING_NF), char);
-    State->StringUN = PushArray(&State->Arena, sizeof(STRING_UN), char);
-    State->StringFB = PushArray(&State->Arena, sizeof(STRING_FB), char);
-    Sprint(State->StringOK, STRING_OK);
-    Sprint(State->StringBR, STRING_BR);
-    Sprint(State->StringNF, STRING_NF);
-    Sprint(State->StringUN, STRING_UN);
-    Sprint(State->StringFB, STRING_FB);
-    
-    // NOTE(vincent): task_with_memory and subarena initialization
-    u32 RemainingArenaSize = State->Arena.Size - State->Arena.Used;
-    Assert(RemainingArenaSize >= Megabytes(50));
-    u32 SubArenaSize = RemainingArenaSize / ArrayCount(State->Tasks);
+    // NOTE(vincent): Past NUMBER_OF_THREADS connections in flight, the next ones wait in the work deques.
+    admission_control *Admission = &State->Admission;
+    Admission->QueueingDepth = NUMBER_OF_THREADS;
+    Admission->ShedQueueDepth = Snapshot->ShedQueueDepth;
+    Admission->ShedLatency = Snapshot->ShedLatency;
+    Admission->WindowStart = GetMonotonicMilliseconds();
+    InitializeRateLimiter(&State->RateLimiter, Snapshot->RateLimit, Snapshot->RateBurst,
+                          (u32)GetMonotonicMilliseconds()*2654435761u);
+    State->AcceptorGeneration = Snapshot->Generation;
+    
+    char *HeaderLiterals[ResponseHeader_Count] = {};
+    HeaderLiterals[ResponseHeader_OK] = STRING_OK;
+    HeaderLiterals[ResponseHeader_NotModified] = STRING_NM;
+    HeaderLiterals[ResponseHeader_BadRequest] = STRING_BR;
+    HeaderLiterals[ResponseHeader_Unauthorized] = STRING_UN;
+    HeaderLiterals[ResponseHeader_Forbidden] = STRING_FB;
+    HeaderLiterals[ResponseHeader_NotFound] = STRING_NF;
+    HeaderLiterals[ResponseHeader_TooManyRequests] = STRING_TM;
+    for (u32 HeaderIndex = 0; HeaderIndex < ResponseHeader_Count; HeaderIndex++)
+    {
+        if (HeaderLiterals[HeaderIndex])
+        {
+            string *Header = State->Headers + HeaderIndex;
+            Header->Base = PushArray(&State->Arena, StringLength(HeaderLiterals[HeaderIndex]) + 1, char);
+            Header->Length = Sprint(Header->Base, HeaderLiterals[HeaderIndex]);
+        }
+    }
+    
+    SubArena(&State->HtpasswdCache.Arena, &State->Arena, HTPASSWD_CACHE_ARENA_SIZE);
+    SubArena(&State->DirectoryIndexCache.Arena, &State->Arena, DIRECTORY_INDEX_CACHE_ARENA_SIZE);
+    
+    // NOTE(vincent): A capture that can't be created doesn't stop the server, it serves without capturing.
+    State->Capture.File.Handle = -1;
+    if (Config->CaptureSet)
+    {
+        if (StartCapture(&State->Capture, Config->Capture))
+            printf("Capturing requests to %s\n", State->Capture.Filename);
+        else
+            fprintf(stderr, "Couldn't start capturing to %s, not capturing\n", Config->Capture);
+    }
+    
+    // NOTE(vincent): task_with_memory and subarena initialization.
+    // A task only carries its receive_and_send_work to whichever thread runs it, the request itself
+    // is served out of that thread's arena, see GetThreadArena().
+    u32 SubArenaSize = TASK_ARENA_SIZE;
+    Assert(State->Arena.Size - State->Arena.Used >= SubArenaSize*ArrayCount(State->Tasks));
     for (u32 TaskIndex = 0; TaskIndex < ArrayCount(State->Tasks); TaskIndex++)
     {
         task_with_memory *Task = State->Tasks + TaskIndex;
@@ -68,6 +273,202 @@ InitializeServerMemory(server_memory *Memory, platform_work_queue *Queue,
     return InitResult;
 }
 
+// NOTE(vincent): Called by the platform layer's file watcher, from its own thread.
+// Directory and Name are null-terminated, Directory starts with a vhost root like "websites/verti".
+internal void
+ContentChanged(server_memory *Memory, content_change_type Type, char *Directory, char *Name)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    BumpContentGenerations(&State->Generations, Type, StringFromLiteral(Directory), StringFromLiteral(Name));
+#if 0
+    printf("Content changed (%d): %s/%s\n", Type, Directory, Name);
+#endif
+}
+
+internal void
+SetContentWatcherActive(server_memory *Memory, b32 Active)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    State->Generations.WatcherActive = Active;
+}
+
+// NOTE(vincent): Called by the platform layer when it's told to reload the config, from its own thread.
+// Requests keep running while the new snapshot is built. The ones that started on the old snapshot finish
+// on it, and this waits for them before the slot is reused. The port, the backlog and the thread placement
+// are only read at startup.
+internal reload_config_result
+ReloadConfig(server_memory *Memory)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    reload_config_result Result = {};
+    BeginTicketMutex(&State->ReloadMutex);
+    
+    config_snapshot *Current = State->Publisher.Current;
+    config_snapshot *Spare = State->Snapshots + (Current == State->Snapshots ? 1 : 0);
+    u32 ErrorCount = LoadConfigSnapshot(State, Spare, Current->Generation + 1);
+    if (ErrorCount)
+    {
+        fprintf(stderr, "Config reload failed with %u errors, still serving generation %u\n",
+                ErrorCount, Current->Generation);
+        ReleaseConfigSnapshot(Spare);
+        State->FailedReloads++;
+    }
+    else
+    {
+        parsed_config_file_result *Old = &Current->Config;
+        parsed_config_file_result *New = &Spare->Config;
+        if (!StringsAreEqual(Old->PortString, New->PortString) || Old->Backlog != New->Backlog ||
+            Old->ThreadPlacement != New->ThreadPlacement || !StringsAreEqual(Old->Capture, New->Capture))
+        {
+            fprintf(stderr, "Config reload: port, backlog, thread_placement and capture changes need a restart\n");
+        }
+        
+        PublishSnapshot(&State->Publisher, Spare);
+        while (SnapshotIsRead(&State->Publisher, Current))
+            SleepMilliseconds(10);
+        ReleaseConfigSnapshot(Current);
+        
+        if (Old->BundleSet || New->BundleSet)
+        {
+            // NOTE(vincent): Bundle files aren't stamped, the htpasswd entries from the old bundle must go.
+            BeginTicketMutex(&State->HtpasswdCache.Mutex);
+            ResetHtpasswdCache(&State->HtpasswdCache);
+            EndTicketMutex(&State->HtpasswdCache.Mutex);
+        }
+        
+        State->Reloads++;
+        Result.Success = true;
+        Result.WatchRoots = CollectWatchRoots(Spare, &Result.WatchRootCount);
+        printf("Reloaded the config: generation %u, %u virtual hosts\n", Spare->Generation, 
+               Spare->VirtualHosts.Count);
+    }
+    
+    EndTicketMutex(&State->ReloadMutex);
+    return Result;
+}
+
+// NOTE(vincent): Called by the platform layer once it stopped accepting, from the main thread. Connections
+// in flight, the ones still queued in the work deques included, get up to drain_timeout to finish. Returns
+// how many didn't, the platform layer exits anyway.
+internal u32
+DrainConnections(server_memory *Memory)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    u64 Start = GetMonotonicMilliseconds();
+    u64 Deadline = Start + State->Publisher.Current->DrainTimeoutMilliseconds;
+    printf("Stopped accepting, draining %u connections in flight\n", State->Admission.InFlight);
+    while (State->Admission.InFlight && GetMonotonicMilliseconds() < Deadline)
+        SleepMilliseconds(10);
+    
+    u32 Result = State->Admission.InFlight;
+    if (Result)
+        printf("Drain timeout: cutting %u connections\n", Result);
+    else
+        printf("Drained in %llu ms\n", (unsigned long long)(GetMonotonicMilliseconds() - Start));
+    // NOTE(vincent): The request log goes to stdout, which isn't line buffered when it isn't a terminal.
+    fflush(stdout);
+    return Result;
+}
+
+// NOTE(vincent): What a binary upgrade hands over to the new process besides the listening socket, so that it
+// doesn't start cold. Only the rate limiter's buckets for now: the negative and htpasswd caches are stamped
+// with content generations that mean nothing to another process. The buckets are read while the acceptor
+// may still update them, a few of them can be one request off.
+#define WARM_STATE_MAGIC 0x4d524157   // "WARM"
+struct warm_state_header
+{
+    u32 Magic;
+    u32 Size;             // the whole warm state, header included
+    u32 RateLimiterSeed;  // the buckets are where this seed hashed them
+    u32 BucketCount;
+};
+
+inline u32
+GetWarmStateSize()
+{
+    u32 Result = sizeof(warm_state_header) + RATE_LIMIT_SLOT_COUNT*sizeof(rate_bucket);
+    return Result;
+}
+
+internal void
+SaveWarmState(server_memory *Memory, void *Dest)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    warm_state_header *Header = (warm_state_header *)Dest;
+    Header->Magic = WARM_STATE_MAGIC;
+    Header->Size = GetWarmStateSize();
+    Header->RateLimiterSeed = State->RateLimiter.Seed;
+    Header->BucketCount = RATE_LIMIT_SLOT_COUNT;
+    CopyBytes((char *)State->RateLimiter.Buckets, (char *)(Header + 1), sizeof(State->RateLimiter.Buckets));
+}
+
+internal b32
+LoadWarmState(server_memory *Memory, void *Source, u64 Size)
+{
+    // NOTE(vincent): Before the first connection is accepted. A warm state from a build with another layout
+    // is ignored, the new process starts cold.
+    server_state *State = (server_state *)Memory->Storage;
+    warm_state_header *Header = (warm_state_header *)Source;
+    b32 Result = (Size == GetWarmStateSize() && Header->Magic == WARM_STATE_MAGIC && 
+                  Header->Size == Size && Header->BucketCount == RATE_LIMIT_SLOT_COUNT);
+    if (Result)
+    {
+        State->RateLimiter.Seed = Header->RateLimiterSeed;
+        CopyBytes((char *)(Header + 1), (char *)State->RateLimiter.Buckets, sizeof(State->RateLimiter.Buckets));
+    }
+    return Result;
+}
+
+internal void
+ArmConnectionTimer(server_state *State, connection_timer *Timer, connection_phase Phase, u32 TimeoutMilliseconds)
+{
+    // NOTE(vincent): Replaces whatever deadline the connection had. Rounded up to the next tick.
+    u64 Deadline = (GetMonotonicMilliseconds() + TimeoutMilliseconds + CONNECTION_TIMER_TICK_MILLISECONDS - 1) / 
+        CONNECTION_TIMER_TICK_MILLISECONDS;
+    BeginTicketMutex(&State->TimerMutex);
+    CancelTimer(&State->ConnectionTimers, &Timer->Node);
+    if (!Timer->Expired)
+    {
+        Timer->Phase = Phase;
+        ScheduleTimer(&State->ConnectionTimers, &Timer->Node, Deadline);
+    }
+    EndTicketMutex(&State->TimerMutex);
+}
+
+internal b32
+DisarmConnectionTimer(server_state *State, connection_timer *Timer)
+{
+    // NOTE(vincent): Must happen before the socket is closed, see AbortConnection(). Returns whether it expired.
+    BeginTicketMutex(&State->TimerMutex);
+    CancelTimer(&State->ConnectionTimers, &Timer->Node);
+    b32 Result = Timer->Expired;
+    EndTicketMutex(&State->TimerMutex);
+    return Result;
+}
+
+// NOTE(vincent): Called by the platform layer every CONNECTION_TIMER_TICK_MILLISECONDS, from its own thread.
+// Aborting the socket makes the blocked recv() or send() of the thread serving it return.
+internal void
+ExpireConnectionTimers(server_memory *Memory)
+{
+    server_state *State = (server_state *)Memory->Storage;
+    u64 Now = GetMonotonicMilliseconds() / CONNECTION_TIMER_TICK_MILLISECONDS;
+    BeginTicketMutex(&State->TimerMutex);
+    for (timer_node *Node = AdvanceTimerWheel(&State->ConnectionTimers, Now); Node;)
+    {
+        timer_node *Next = Node->Next;
+        connection_timer *Timer = (connection_timer *)Node;
+        Timer->Expired = true;
+        if (Timer->Phase == ConnectionPhase_ReadingHeaders)
+            State->HeaderTimeouts++;
+        else
+            State->SendTimeouts++;
+        AbortConnection(Timer->Socket);
+        Node = Next;
+    }
+    EndTicketMutex(&State->TimerMutex);
+}
+
 internal task_with_memory *
 BeginTaskWithMemory(server_state *State)
 {
@@ -95,138 +496,235 @@ EndTaskWithMemory(task_with_memory *Task)
     Task->BeingUsed = false;
 }
 
-internal string
-DecodeAuthString(memory_arena *Arena, string AuthString)
+internal htpasswd_credentials
+DecodeCredentials(server_state *State, memory_arena *Arena, string AuthString)
 {
     // We want to do the following transformation:
-    // base64(username:password) -> username:password -> username:md5(password)
-    // where the md5 part is a printable 32-byte ascii version of the md5 hash.
+    // base64(username:password) -> username:password -> username, md5(password)
+    // where the md5 part stays binary, like the digests of a compiled .htpasswd.
+    htpasswd_credentials Result = {};
+    Result.Present = true;
     
     char *Dest = PushArray(Arena, AuthString.Length + 72, char);
-    
     string Plain = FromBase64(AuthString, Dest);  // this should be less bytes than the source
+    string User = StringPrefixUntil(Plain, ':');
     
-#if 0
-    printf("Plain : ");
-    PrintString(Plain);
-    printf("\n");
-    Assert(StringsAreEqual(Plain, "user:user"));
-#endif
-    
-    string PasswordPart = StringSuffixAfter(Plain, ':');
-    
-#if 0
-    printf("PasswordPart (%d) : ", PasswordPart.Length);
-    PrintString(PasswordPart);
-    Assert(StringsAreEqual(PasswordPart, "user"));
-    printf("\n");
-#endif
-    
-    md5_result Hash = MD5((u8 *)PasswordPart.Base, PasswordPart.Length); // requires up to 72 bytes of padding
-    
-    
-    PrintMD5NoNull(PasswordPart.Base, Hash); // overwrites 32 bytes
-    
-    string DecodedString = StringBaseLength(Dest, Plain.Length - PasswordPart.Length + 32);
-    
-#if 0
-    printf("DecodedString : ");
-    PrintString(DecodedString);
-    Assert(StringsAreEqual(DecodedString, "user:ee11cbb19052e40b07aac0ca060c23ee"));
-    printf("\n");
-#endif
-    
+    // NOTE(vincent): Not valid Base64, or no colon: nothing to match against.
+    if (Plain.Base && User.Length < Plain.Length)
+    {
+        string Password = StringFromOffset(Plain, User.Length + 1);
+        // NOTE(vincent): Hashed together with whatever other auth checks are in flight, see CombinedMD5().
+        md5_result Hash = CombinedMD5(&State->MD5Combiner, (u8 *)Password.Base, 
+                                      Password.Length); // requires up to 72 bytes of padding
+        u8 *HashBytes = (u8 *)&Hash;
+        for (u32 Byte = 0; Byte < HTPASSWD_DIGEST_SIZE; Byte++)
+            Result.Digest[Byte] = HashBytes[Byte];
+        Result.User = User;
+        Result.Valid = true;
+    }
     
-    return DecodedString;
+    return Result;
+}
+
+
+internal push_read_entire_file
+ReadSiteFile(config_snapshot *Snapshot, memory_arena *Arena, virtual_host *Host, string RelativePath)
+{
+    // NOTE(vincent): RelativePath is null-terminated and relative to the vhost root, e.g. "images/a.png".
+    // With a site bundle, the result points into the mapping and nothing is pushed to the arena.
+    push_read_entire_file Result = {};
+    if (Snapshot->Bundle.Entries)
+    {
+        site_bundle_entry *Entry = FindBundleEntry(&Snapshot->Bundle, Host->BundlePrefix, RelativePath);
+        if (Entry)
+        {
+            Result.Memory = BundleEntryBody(&Snapshot->Bundle, Entry);
+            Result.Size = (size_t)Entry->BodySize;
+            Result.Success = true;
+        }
+    }
+    else
+    {
+        Result = PushReadEntireFileAt(Arena, Host->Directory, RelativePath.Base);
+    }
+    return Result;
+}
+
+internal b32
+IsLoopbackAddress(char *AddressString)
+{
+    // NOTE(vincent): AddressString comes from inet_ntop(), IPv4-mapped IPv6 addresses included.
+    b32 Result = (StringBeginsWith(StringFromLiteral(AddressString), "127.") ||
+                  StringBeginsWith(StringFromLiteral(AddressString), "::ffff:127.") ||
+                  StringsAreEqual(AddressString, "::1"));
+    return Result;
 }
 
+#define SERVER_STATUS_MAX_LENGTH 4096
+#define STRING_STATUS_HEADER "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n"
+#define STRING_TRACE_HEADER "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+
+inline u32
+SprintStatusLine(char *Dest, char *Name, u64 Value)
+{
+    u32 Length = Sprint(Dest, Name);
+    Dest[Length++] = ' ';
+    Length += SprintU64(Dest + Length, Value);
+    Dest[Length++] = '\n';
+    Dest[Length] = 0;
+    return Length;
+}
+
+internal u32
+SprintServerStatus(char *Dest, server_state *State)
+{
+    // NOTE(vincent): The whole /server-status response: "name value" lines in plain text.
+    // The counters are read without locking, a line may be one request behind another.
+    u32 Length = Sprint(Dest, STRING_STATUS_HEADER);
+    negative_cache *NegativeCache = &State->NegativeCache;
+    Length += SprintStatusLine(Dest + Length, "negative_cache_hits", NegativeCache->Hits);
+    Length += SprintStatusLine(Dest + Length, "negative_cache_misses", NegativeCache->Misses);
+    Length += SprintStatusLine(Dest + Length, "negative_cache_insertions", NegativeCache->Insertions);
+    Length += SprintStatusLine(Dest + Length, "negative_cache_evictions", NegativeCache->Evictions);
+    Length += SprintStatusLine(Dest + Length, "negative_cache_expirations", NegativeCache->Expirations);
+    htpasswd_cache *HtpasswdCache = &State->HtpasswdCache;
+    Length += SprintStatusLine(Dest + Length, "htpasswd_cache_hits", HtpasswdCache->Hits);
+    Length += SprintStatusLine(Dest + Length, "htpasswd_compiles", HtpasswdCache->Compiles);
+    Length += SprintStatusLine(Dest + Length, "htpasswd_cache_resets", HtpasswdCache->Resets);
+    directory_index_cache *DirectoryIndexCache = &State->DirectoryIndexCache;
+    Length += SprintStatusLine(Dest + Length, "directory_index_hits", DirectoryIndexCache->Hits);
+    Length += SprintStatusLine(Dest + Length, "directory_index_renders", DirectoryIndexCache->Renders);
+    Length += SprintStatusLine(Dest + Length, "directory_index_resets", DirectoryIndexCache->Resets);
+    Length += SprintStatusLine(Dest + Length, "md5_batches", State->MD5Combiner.Batches);
+    Length += SprintStatusLine(Dest + Length, "md5_batched_hashes", State->MD5Combiner.CombinedHashes);
+    platform_placement_stats Placement = GetPlacementStats(State->Queue);
+    Length += SprintStatusLine(Dest + Length, "numa_nodes", Placement.NodeCount);
+    Length += SprintStatusLine(Dest + Length, "pinned_threads", Placement.PinnedThreadCount);
+    Length += SprintStatusLine(Dest + Length, "thread_arena_local_pages", Placement.LocalPages);
+    Length += SprintStatusLine(Dest + Length, "thread_arena_remote_pages", Placement.RemotePages);
+    Length += SprintStatusLine(Dest + Length, "header_timeouts", State->HeaderTimeouts);
+    Length += SprintStatusLine(Dest + Length, "send_timeouts", State->SendTimeouts);
+    Length += SprintStatusLine(Dest + Length, "bytes_sent", State->BytesSent);
+    Length += SprintStatusLine(Dest + Length, "incomplete_responses", State->IncompleteResponses);
+    admission_control *Admission = &State->Admission;
+    Length += SprintStatusLine(Dest + Length, "connections_in_flight", Admission->InFlight);
+    Length += SprintStatusLine(Dest + Length, "latency_p50_ms", LatencyPercentile(&Admission->Total, 500));
+    Length += SprintStatusLine(Dest + Length, "latency_p99_ms", LatencyPercentile(&Admission->Total, 990));
+    Length += SprintStatusLine(Dest + Length, "latency_recent_p99_ms", Admission->RecentP99);
+    Length += SprintStatusLine(Dest + Length, "shed_queue_full", Admission->ShedQueueFull);
+    Length += SprintStatusLine(Dest + Length, "shed_slow", Admission->ShedSlow);
+    Length += SprintStatusLine(Dest + Length, "rate_limited", State->RateLimiter.Limited);
+    Length += SprintStatusLine(Dest + Length, "rate_limit_evictions", State->RateLimiter.Evictions);
+    Length += SprintStatusLine(Dest + Length, "config_generation", State->Publisher.Current->Generation);
+    Length += SprintStatusLine(Dest + Length, "config_reloads", State->Reloads);
+    Length += SprintStatusLine(Dest + Length, "config_reload_failures", State->FailedReloads);
+    Length += SprintStatusLine(Dest + Length, "content_changes", State->Generations.ChangeCount);
+    Length += SprintStatusLine(Dest + Length, "content_watcher_active", State->Generations.WatcherActive);
+    Length += SprintStatusLine(Dest + Length, "profiler_running", State->Profiler.Running);
+    Length += SprintStatusLine(Dest + Length, "capture_records", State->Capture.Records);
+    Length += SprintStatusLine(Dest + Length, "capture_errors", State->Capture.Errors);
+    return Length;
+}
 
 enum access_result
 {
     AccessResult_Unauthorized,
     AccessResult_Forbidden,
     AccessResult_Granted,
+    AccessResult_Public,      // no .htpasswd protects the file
 };
 internal access_result
-LoadHtpasswd(memory_arena *Arena, string CompletePath, u32 RootLength, string AuthString)
+HtpasswdAccessResult(htpasswd_table *Table, htpasswd_credentials *Credentials)
 {
-    access_result Result = AccessResult_Granted;
+    // NOTE(vincent): Unauthorized if no auth string given, forbidden unless it matches an entry.
+    // A .htpasswd we couldn't compile has no table and grants nobody.
+    access_result Result = AccessResult_Unauthorized;
+    if (Credentials->Present)
+        Result = (Table && HtpasswdGrantsAccess(Table, Credentials)) ? AccessResult_Granted : AccessResult_Forbidden;
+    return Result;
+}
+
+internal access_result
+LoadHtpasswd(server_state *State, config_snapshot *Snapshot, memory_arena *Arena, virtual_host *Host,
+             string RelativePath, string AuthString)
+{
+    access_result Result = AccessResult_Public;
+    htpasswd_cache *Cache = &State->HtpasswdCache;
+    content_generations *Generations = &State->Generations;
+    b32 BundleMode = (Snapshot->Bundle.Entries != 0);
     
-    string Scratch = StringBaseLength(PushArray(Arena, CompletePath.Length + 10, char), 0);
-    AppendString(&Scratch, CompletePath);
-    push_read_entire_file ReadResult = {};
+    // NOTE(vincent): The credentials are only decoded and hashed once a .htpasswd turns up for the path,
+    // so that an Authorization header on public files costs nothing. Never under the cache lock.
+    htpasswd_credentials Credentials = {};
+    b32 CredentialsDecoded = (AuthString.Base == 0);
     
-    while (!ReadResult.Memory && TruncateStringUntil(&Scratch, '/') && Scratch.Length >= RootLength)
-    {
-        AppendStringLiteralAndNull(&Scratch, ".htpasswd");
-#if 1
-        printf(Scratch.Base);
-        printf("\n");
-#endif
-        ReadResult = PushReadEntireFile(Arena, Scratch.Base);
-        TruncateStringUntil(&Scratch, '/');
-    }
+    // NOTE(vincent): Look for the closest .htpasswd in the folders of RelativePath, up to the vhost root
+    // and not above it. The root itself is tried last, with an empty prefix.
+    // Each folder is looked up in the cache first, and only read and compiled when it misses.
+    // The lock is never held during file I/O.
+    string Scratch = StringBaseLength(PushArray(Arena, RelativePath.Length + 10, char), 0);
+    AppendString(&Scratch, RelativePath);
     
-    if (ReadResult.Memory)
+    b32 ReachedRoot = false;
+    while (Result == AccessResult_Public && !ReachedRoot)
     {
-#if 0
-        printf("PROTECTED\n");
-#endif
-        // NOTE(vincent): File is protected
-        // Unauthorized if no auth string given (rule: zero is initialization), forbidden otherwise.
+        ReachedRoot = !TruncateStringUntil(&Scratch, '/');
+        string Directory = Scratch;    // "a/b/", or empty for the root
+        AppendStringLiteralAndNull(&Scratch, ".htpasswd");
         
-        Result = AuthString.Base == 0 ? AccessResult_Unauthorized : AccessResult_Forbidden;
-        if (ReadResult.Success && AuthString.Base)
+        // NOTE(vincent): Stamp before reading: a change that lands in between makes the entry stale, not wrong.
+        htpasswd_stamp Stamp = {};
+        if (!BundleMode)
         {
-            string DecodedAuthString = DecodeAuthString(Arena, AuthString);
-#if 0
-            PrintString(DecodedAuthString);
-            printf(" DECODED\n");
-#endif
-            // NOTE(vincent): Compare htpasswd entries with the decoded auth string as you parse the file
-            // and see whether there is a match.
-            
-            b32 InEntry = false;
-            string LastEntry;
-            
-            LastEntry.Base = ReadResult.Memory;
-            LastEntry.Length = 0;
-            for (u32 Byte = 0; Byte < ReadResult.Size; Byte++)
-            {
-                char *C = ReadResult.Memory + Byte;
-                if (!InEntry && !IsWhitespace(*C))
-                {
-                    InEntry = true;
-                    LastEntry.Base = C;
-                }
-                else if (InEntry && IsWhitespace(*C))
-                {
-                    InEntry = false;
-                    LastEntry.Length = (u32)(C - LastEntry.Base);
-                    if (StringsAreEqual(LastEntry, DecodedAuthString))
-                    {
-#if 0
-                        printf("SUCCESSFUL\n");
-#endif
-                        // NOTE(vincent): Successful authentication
-                        Result = AccessResult_Granted;
-                        break;
-                    }
-                }
-            }
-            printf("Forbidden by %s\n", Scratch.Base);
+            Stamp.WatcherActive = Generations->WatcherActive;
+            Stamp.Epoch = Generations->Epoch;
+            Stamp.Protection = Generations->Protection;
+            if (!Stamp.WatcherActive)
+                Stamp.File = GetFileInfoAt(Host->Directory, Scratch.Base);
         }
-        else
+        
+        b32 Cached = false;
+        BeginTicketMutex(&Cache->Mutex);
+        htpasswd_cache_entry *Entry = FindHtpasswdCacheEntry(Cache, Host->CacheKey, Directory, false);
+        if (Entry && HtpasswdStampsAreEqual(Entry->Stamp, Stamp) && Entry->Exists && !CredentialsDecoded)
         {
-            // TODO(vincent): protected but not properly loaded.
-            // Not sure whether we should do anything here.
+            // NOTE(vincent): Decode, then look again: the entry may have been dropped in the meantime.
+            EndTicketMutex(&Cache->Mutex);
+            Credentials = DecodeCredentials(State, Arena, AuthString);
+            CredentialsDecoded = true;
+            BeginTicketMutex(&Cache->Mutex);
+            Entry = FindHtpasswdCacheEntry(Cache, Host->CacheKey, Directory, false);
         }
-    }
-    else
-    {
-#if 0
-        printf("NOT PROTECTED\n");
-#endif
+        if (Entry && HtpasswdStampsAreEqual(Entry->Stamp, Stamp))
+        {
+            Cached = true;
+            Cache->Hits++;
+            if (Entry->Exists)
+                Result = HtpasswdAccessResult(Entry->Table, &Credentials);
+        }
+        EndTicketMutex(&Cache->Mutex);
+        
+        if (!Cached)
+        {
+            push_read_entire_file ReadResult = ReadSiteFile(Snapshot, Arena, Host, Scratch);
+            b32 Exists = (ReadResult.Memory != 0);
+            // NOTE(vincent): A file we failed to read for other reasons is tried again next time.
+            b32 Cacheable = ReadResult.Success || ReadResult.NotFound || (BundleMode && !Exists);
+            if (Exists && !CredentialsDecoded)
+            {
+                Credentials = DecodeCredentials(State, Arena, AuthString);
+                CredentialsDecoded = true;
+            }
+            
+            BeginTicketMutex(&Cache->Mutex);
+            htpasswd_table *Table = CacheHtpasswdFile(Cache, Arena, Host->CacheKey, Directory, Stamp,
+                                                      &ReadResult, Cacheable);
+            if (Exists)
+                Result = HtpasswdAccessResult(Table, &Credentials);
+            EndTicketMutex(&Cache->Mutex);
+        }
+        
+        TruncateStringUntil(&Scratch, '/');
     }
     
     return Result;
@@ -235,10 +733,14 @@ LoadHtpasswd(memory_arena *Arena, string CompletePath, u32 RootLength, string Au
 
 struct receive_and_send_work
 {
-    struct sockaddr IncomingAddress;
+    struct sockaddr_storage IncomingAddress;
     SOCKET ClientSocket;
     server_state *State;
     task_with_memory *Task;
+    u64 AcceptedAt;       // milliseconds, for the latency histogram
+    u32 TraceId;          // 0 when the request isn't traced
+    u64 EnqueuedAt;       // microseconds, only when it is
+    u64 ArrivedAt;        // microseconds, only when capturing
 };
 
 
@@ -250,18 +752,19 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
 {
     receive_and_send_work *Work = (receive_and_send_work *)Data;
     SOCKET ClientSocket = Work->ClientSocket;
-    struct sockaddr *IncomingAddress = &Work->IncomingAddress;
+    struct sockaddr *IncomingAddress = (struct sockaddr *)&Work->IncomingAddress;
     
-    memory_arena *Arena = &Work->Task->Arena;
-    
-    char *StringOK = Work->State->StringOK;
-    char *StringBR = Work->State->StringBR;
-    char *StringNF = Work->State->StringNF;
-    char *StringUN = Work->State->StringUN;
-    char *StringFB = Work->State->StringFB;
-    parsed_config_file_result *Config = &Work->State->Config;
-    char *Root = Config->Root;
+    memory_arena *Arena = GetThreadArena(Queue);
+    temporary_memory RequestMemory = BeginTemporaryMemory(Arena);
+    server_state *State = Work->State;
+    // NOTE(vincent): The config this request is served with from start to end, even if a reload happens meanwhile.
+    u32 ThreadIndex = GetThreadIndex(Queue);
+    config_snapshot *Snapshot = BeginSnapshotRead(&State->Publisher, ThreadIndex);
+    request_tracer *Tracer = &State->Tracer;
+    u32 TraceId = Work->TraceId;
+    u64 PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Queued, Work->EnqueuedAt);
     
+    string *Headers = State->Headers;
     char *AddressString = PushArray(Arena, INET6_ADDRSTRLEN, char);
     inet_ntop(IncomingAddress->sa_family, GetInternetAddress(IncomingAddress),
               AddressString, INET6_ADDRSTRLEN);
@@ -277,11 +780,43 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
     ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, " ");
     u32 ReceiveBufferSize = 8192;  // 8*1024 bytes
     
-    u32 LengthToSend = 0;
-    char *SendBuffer = 0;
+    response Response = {};
+    char ETag[SITE_BUNDLE_ETAG_LENGTH];   // NOTE(vincent): sent from here by 304 responses
+    
+    // NOTE(vincent): The request head may come in several packets. Keep reading until the blank line,
+    // a full buffer or the header deadline: then the timer thread aborts the socket and recv() fails.
+    // The socket timeouts only bound each single recv() or send(), they are a backstop set a second
+    // past the deadlines in case the timer thread falls behind.
+    connection_timer *Timer = &Work->Task->Timer;
+    Timer->Socket = ClientSocket;
+    Timer->Expired = false;
+    SetSocketTimeouts(ClientSocket, Snapshot->HeaderTimeoutMilliseconds + 1000, 
+                      Snapshot->SendTimeoutMilliseconds + 1000);
+    SetSendLowWatermark(ClientSocket, Snapshot->SendLowWatermark);
+    ArmConnectionTimer(State, Timer, ConnectionPhase_ReadingHeaders, Snapshot->HeaderTimeoutMilliseconds);
     
     char *ReceiveBuffer = PushArray(Arena, ReceiveBufferSize, char);
-    int BytesReceived = recv(ClientSocket, ReceiveBuffer, ReceiveBufferSize, 0);
+    int BytesReceived = 0;
+    for (;;)
+    {
+        int Received = ReceiveSome(ClientSocket, ReceiveBuffer + BytesReceived, ReceiveBufferSize - BytesReceived);
+        if (Received <= 0)
+        {
+            if (BytesReceived == 0)
+                BytesReceived = Received;
+            break;
+        }
+        BytesReceived += Received;
+        if ((u32)BytesReceived == ReceiveBufferSize || RequestHeadIsComplete(ReceiveBuffer, BytesReceived))
+            break;
+    }
+    ArmConnectionTimer(State, Timer, ConnectionPhase_Sending, Snapshot->SendTimeoutMilliseconds);
+    PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Receive, PhaseStart);
+    
+    // NOTE(vincent): Copied before ParseHTTPRequest() rewrites the path in place.
+    char *CaptureRecord = 0;
+    if (State->Capture.File.Handle != -1 && BytesReceived > 0)
+        CaptureRecord = PushCaptureRecord(Arena, ReceiveBuffer, BytesReceived);
     
     if (HandleReceiveError(BytesReceived, ClientSocket))
     {
@@ -299,8 +834,58 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
 #endif
 #endif
         
+        ToPrint.Length +=
+            SprintUntilDelimiter(PrintBuffer + ToPrint.Length, ReceiveBuffer, '\r');
+        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "\n");
+        
         http_request Request = ParseHTTPRequest(ReceiveBuffer, BytesReceived);
-        if (Request.IsValid)
+        virtual_host *Host = Request.IsValid ? FindVirtualHost(&Snapshot->VirtualHosts, Request.Host) : 0;
+        PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Parse, PhaseStart);
+        if (Request.IsValid && StringsAreEqual(Request.RequestPath, "server-status") &&
+            IsLoopbackAddress(AddressString))
+        {
+            // NOTE(vincent): Counters for whoever runs the server, on any vhost, only from the machine itself.
+            char *Status = PushArray(Arena, SERVER_STATUS_MAX_LENGTH, char);
+            u32 StatusLength = SprintServerStatus(Status, State);
+            Assert(StatusLength < SERVER_STATUS_MAX_LENGTH);
+            AppendResponse(&Response, Status, StatusLength);
+        }
+        else if (Request.IsValid && StringsAreEqual(Request.RequestPath, "server-trace") &&
+                 IsLoopbackAddress(AddressString))
+        {
+            // NOTE(vincent): The traced requests, for chrome://tracing or ui.perfetto.dev. Same rules as the status.
+            char *Trace = PushArray(Arena, sizeof(STRING_TRACE_HEADER) + GetTraceDumpMaxLength(), char);
+            u32 TraceLength = Sprint(Trace, STRING_TRACE_HEADER);
+            TraceLength += SprintTrace(Trace + TraceLength, Tracer);
+            AppendResponse(&Response, Trace, TraceLength);
+        }
+        else if (Request.IsValid && (StringsAreEqual(Request.RequestPath, "server-profile") ||
+                                     StringsAreEqual(Request.RequestPath, "server-profile/start") ||
+                                     StringsAreEqual(Request.RequestPath, "server-profile/stop")) &&
+                 IsLoopbackAddress(AddressString))
+        {
+            // NOTE(vincent): /server-profile/start and /server-profile/stop toggle the sampler,
+            // /server-profile sends what it recorded, for fold_profile.sh.
+            cpu_profiler *Profiler = &State->Profiler;
+            char *Profile = PushArray(Arena, sizeof(STRING_STATUS_HEADER) + GetProfileDumpMaxLength(), char);
+            u32 ProfileLength = Sprint(Profile, STRING_STATUS_HEADER);
+            if (StringsAreEqual(Request.RequestPath, "server-profile/start"))
+                ProfileLength += Sprint(Profile + ProfileLength, (char *)(StartProfiler(Profiler) ? "started\n" : "not supported on this platform\n"));
+            else if (StringsAreEqual(Request.RequestPath, "server-profile/stop"))
+            {
+                StopProfiler(Profiler);
+                ProfileLength += Sprint(Profile + ProfileLength, "stopped\n");
+            }
+            else
+                ProfileLength += SprintProfile(Profile + ProfileLength, Profiler);
+            AppendResponse(&Response, Profile, ProfileLength);
+        }
+        else if (Request.IsValid && !Host)
+        {
+            // 404 Not Found, we don't serve that host
+            AppendResponse(&Response, Headers[ResponseHeader_NotFound]);
+        }
+        else if (Request.IsValid)
         {
 #if 1
             ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "Isolated Request AuthString: ");
@@ -314,32 +899,25 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
             
             // TODO(vincent): maybe use Request.HttpVersion?
             
-            // NOTE(vincent): Concatenate Root, Request.Host and Request.Path into the arena
-#if 1
-            // order of concatenation: root, slash, host, path
-            u32 RootLength = StringLength(Root);
-            u32 RequestLength = Request.RequestPath.Length;
-            u32 HostLength = Request.Host.Length;
-            u32 CompletePathLength = RootLength + 1 + HostLength + RequestLength;
-            string CompletePath = StringBaseLength(PushArray(Arena, CompletePathLength + 2, char),
-                                                   CompletePathLength);
-            SprintNoNull(CompletePath.Base, Root);
-            SprintNoNull(CompletePath.Base + RootLength, "/");
-            SprintNoNull(CompletePath.Base + RootLength + 1, Request.Host);
-            Sprint(CompletePath.Base + RootLength + 1 + HostLength, Request.RequestPath);
-#else
-            // order of concatenation: root, path
-            u32 RootLength = StringLength(Root);
-            u32 RequestLength = Request.RequestPath.Length;
-            u32 CompletePathLength = RootLength + RequestLength;
-            string CompletePath = StringBaseLength(PushArray(Arena, CompletePathLength + 1, char),
-                                                   CompletePathLength);
-            SprintNoNull(CompletePath.Base, Root);
-            Sprint(CompletePath.Base + RootLength, Request.RequestPath);
-#endif
+            // NOTE(vincent): The parser already made the path canonical and relative to the vhost root.
+            string RelativePath = Request.RequestPath;
+            
+            // NOTE(vincent): Paths known not to exist skip both the htpasswd walk and the open.
+            // The bundle is already an in-memory lookup, it doesn't need this.
+            b32 UseNegativeCache = !Snapshot->Bundle.Entries;
+            negative_cache_stamp Stamp = {};
+            b32 KnownMissing = false;
+            if (UseNegativeCache)
+            {
+                Stamp = NegativeCacheStamp(&State->Generations, Host->Root, RelativePath);
+                KnownMissing = LookupNegativeCache(&State->NegativeCache, &State->Generations, Host->CacheKey,
+                                                   RelativePath, Stamp);
+            }
+            
             // NOTE(vincent): Check for Htpasswd file and get access result
-            access_result AccessResult = 
-                LoadHtpasswd(Arena, CompletePath, RootLength, Request.AuthString);
+            access_result AccessResult = KnownMissing ? AccessResult_Public :
+                LoadHtpasswd(State, Snapshot, Arena, Host, RelativePath, Request.AuthString);
+            PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Auth, PhaseStart);
             
             
             switch (AccessResult)
@@ -347,68 +925,142 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
                 case AccessResult_Unauthorized:
                 {
                     //ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "RESULT: UNAUTHORIZED\n");
-                    LengthToSend = sizeof(STRING_UN) - 1;
-                    SendBuffer = PushArray(Arena, LengthToSend, char);
-                    SprintNoNull(SendBuffer, StringUN);
+                    AppendResponse(&Response, Headers[ResponseHeader_Unauthorized]);
                 } break;
                 case AccessResult_Forbidden:
                 {
                     //ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "RESULT: FORBIDDEN\n");
-                    LengthToSend = sizeof(STRING_FB) - 1;
-                    SendBuffer = PushArray(Arena, LengthToSend, char);
-                    SprintNoNull(SendBuffer, StringFB);
+                    AppendResponse(&Response, Headers[ResponseHeader_Forbidden]);
                 } break;
                 case AccessResult_Granted:
+                case AccessResult_Public:
+                if (Snapshot->Bundle.Entries)
                 {
-                    //ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "RESULT: GRANTED\n");
-                    SendBuffer = PushArray(Arena, sizeof(STRING_OK)-1, char);
-                    SprintNoNull(SendBuffer, StringOK);
+                    // NOTE(vincent): Serve from the mapped bundle. The header block is precomputed
+                    // and the body is sent straight from the mapping.
+                    site_bundle *Bundle = &Snapshot->Bundle;
+                    site_bundle_entry *Entry = 
+                        FindBundleEntry(Bundle, Host->BundlePrefix, RelativePath);
+                    if (Entry && Request.AcceptsGzip && Entry->VariantIndex != SITE_BUNDLE_NO_VARIANT)
+                        Entry = Bundle->Entries + Entry->VariantIndex;
+                    PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Read, PhaseStart);
                     
+                    if (!Entry)
+                    {
+                        // 404 Not Found
+                        AppendResponse(&Response, Headers[ResponseHeader_NotFound]);
+                    }
+                    else
+                    {
+                        SprintETagNoNull(ETag, Entry->ETag);
+                        if (StringsAreEqual(Request.IfNoneMatch, StringBaseLength(ETag, sizeof(ETag))))
+                        {
+                            // 304 Not Modified
+                            AppendResponse(&Response, Headers[ResponseHeader_NotModified]);
+                            AppendResponse(&Response, ETag, sizeof(ETag));
+                            AppendResponse(&Response, "\r\n\r\n", 4);
+                        }
+                        else
+                        {
+                            // 200 OK, with the entry's header block precomputed by site_packer
+                            AppendResponse(&Response, BundleEntryHeader(Bundle, Entry));
+                            AppendResponse(&Response, BundleEntryBody(Bundle, Entry), Entry->BodySize);
+                        }
+                    }
+                }
+                else
+                {
+                    //ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "RESULT: GRANTED\n");
                     // NOTE(vincent): Try to load the file
-                    push_read_entire_file ReadFileResult =
-                        PushReadEntireFile(Arena, CompletePath.Base);
+                    push_read_entire_file ReadFileResult = {};
+                    if (!KnownMissing)
+                        ReadFileResult = PushReadEntireFileAt(Arena, Host->Directory, RelativePath.Base);
+                    PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Read, PhaseStart);
+                    
+                    // NOTE(vincent): A directory without its index.html, listed if the config says so.
+                    // The listing is cached against the same stamp as the missing index.html, so once both
+                    // caches are warm, the landing page of such a directory costs no system call at all.
+                    string DirectoryIndex = {};
+                    if (Snapshot->AutoIndex && Request.NamesDirectory && (KnownMissing || ReadFileResult.NotFound))
+                    {
+                        string Directory = StringBaseLength(RelativePath.Base,
+                                                            RelativePath.Length - (sizeof(DEFAULT_INDEX_FILE) - 1));
+                        DirectoryIndex = ServeDirectoryIndex(&State->DirectoryIndexCache, &State->Generations,
+                                                             Arena, Host, Directory, Stamp);
+                    }
                     
                     if (ReadFileResult.Success)
                     {
                         // 200 OK
-                        LengthToSend = (sizeof(STRING_OK) - 1) + (u32)ReadFileResult.Size;
+                        AppendResponse(&Response, Headers[ResponseHeader_OK]);
+                        AppendResponse(&Response, ReadFileResult.Memory, ReadFileResult.Size);
+                    }
+                    else if (DirectoryIndex.Base)
+                    {
+                        // 200 OK, the header block is part of the cached page
+                        AppendResponse(&Response, DirectoryIndex);
+                    }
+                    else if (ReadFileResult.IsDirectory)
+                    {
+                        // 301 Moved Permanently, from "/images" to "/images/" so that relative links in its
+                        // index.html (or its listing) resolve inside it
+                        char *Moved = PushArray(Arena, sizeof(STRING_MP) + 3*RelativePath.Length + 5, char);
+                        u32 MovedLength = SprintNoNull(Moved, STRING_MP);
+                        MovedLength += SprintPercentEncoded(Moved + MovedLength, RelativePath);
+                        MovedLength += SprintNoNull(Moved + MovedLength, "/\r\n\r\n");
+                        AppendResponse(&Response, Moved, MovedLength);
                     }
                     else
                     {
                         // 404 Not Found
-                        LengthToSend = sizeof(STRING_NF) - 1;
-                        SprintNoNull(SendBuffer, StringNF);
+                        AppendResponse(&Response, Headers[ResponseHeader_NotFound]);
                     }
+                    if (UseNegativeCache && ReadFileResult.NotFound && AccessResult == AccessResult_Public)
+                        InsertNegativeCache(&State->NegativeCache, Host->CacheKey, RelativePath, Stamp);
                 } break;
             }
         } // END if (Request.IsValid)
         else
         {
             // 400 Bad Request
-            LengthToSend = sizeof(STRING_BR) - 1;
-            SendBuffer = PushArray(Arena, LengthToSend, char);
-            SprintNoNull(SendBuffer, StringBR);
+            AppendResponse(&Response, Headers[ResponseHeader_BadRequest]);
         }
-        
-        ToPrint.Length +=
-            SprintUntilDelimiter(PrintBuffer + ToPrint.Length, ReceiveBuffer, '\r');
-        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "\n");
     } // END if (HandleReceiveError(BytesReceived))
     
     
-    int BytesSent = send(ClientSocket, SendBuffer, LengthToSend, 0);
-    if (HandleSendError(BytesSent, ClientSocket))
+    // NOTE(vincent): A blocking send only comes back short when a timeout or the connection timers cut it,
+    // or when a signal interrupts it. Keep going until everything is out, a call fails or sends nothing.
+    send_cursor Cursor = BeginSend(&Response);
+    b32 SendSucceeded = true;
+    while (SendSucceeded && Cursor.First < Cursor.Count)
     {
+        s64 Sent = SendGather(ClientSocket, Cursor.Buffers + Cursor.First, Cursor.Count - Cursor.First);
+        SendSucceeded = HandleSendError((int)Sent, ClientSocket) && Sent > 0;
+        if (SendSucceeded)
+            AdvanceSend(&Cursor, Sent);
+    }
+    PhaseStart = TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Send, PhaseStart);
+    AtomicAddU64(&State->BytesSent, Cursor.Sent);
+    if (Cursor.Sent < Cursor.Total)
+        AtomicAddU64(&State->IncompleteResponses, 1);
+
 #if 1
-        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "BytesSent: ");
-        ToPrint.Length += SprintInt(PrintBuffer + ToPrint.Length, BytesSent);
-        u32 AddressOffset = (u32)((u8 *)SendBuffer - Arena->Base);
-        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length," AddressOffset: ");
-        ToPrint.Length += SprintInt(PrintBuffer + ToPrint.Length, AddressOffset);
-        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length," Arena size: ");
-        ToPrint.Length += SprintInt(PrintBuffer + ToPrint.Length, Arena->Size);
-        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length,"\n");
+    ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "BytesSent: ");
+    ToPrint.Length += SprintU64(PrintBuffer + ToPrint.Length, Cursor.Sent);
+    ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, " of ");
+    ToPrint.Length += SprintU64(PrintBuffer + ToPrint.Length, Cursor.Total);
+    ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, " Buffers: ");
+    ToPrint.Length += SprintInt(PrintBuffer + ToPrint.Length, Response.BufferCount);
+    ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, " Arena used: ");
+    ToPrint.Length += SprintU64(PrintBuffer + ToPrint.Length, Arena->Used);
+    ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length,"\n");
 #endif
+    
+    if (DisarmConnectionTimer(State, Timer))
+    {
+        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, "Timed out while ");
+        ToPrint.Length += Sprint(PrintBuffer + ToPrint.Length, (char *)(Timer->Phase == ConnectionPhase_ReadingHeaders ?
+                                                          "reading the request\n" : "sending the response\n"));
     }
     
     Assert(ToPrint.Length < PrintBufferSize);
@@ -416,34 +1068,89 @@ PLATFORM_WORK_QUEUE_CALLBACK(ReceiveAndSend)
     puts(ToPrint.Base);
     
     ShutdownConnection(ClientSocket);
+    TracePhase(Tracer, ThreadIndex, TraceId, TracePhase_Close, PhaseStart);
+    RecordLatency(&State->Admission, GetMonotonicMilliseconds() - Work->AcceptedAt);
+    
+    if (CaptureRecord)
+    {
+        // NOTE(vincent): After the connection is closed, the client doesn't wait on the disk.
+        u16 Status = Response.BufferCount ? ResponseStatus(Response.Buffers[0].Base, Response.Buffers[0].Length) : 0;
+        FinishCaptureRecord(CaptureRecord, Work->ArrivedAt - State->Capture.StartedAt, Status, Cursor.Total);
+        AppendCaptureRecord(&State->Capture, CaptureRecord);
+    }
     
+    EndSnapshotRead(&State->Publisher, ThreadIndex);
+    EndTemporaryMemory(RequestMemory);
     EndTaskWithMemory(Work->Task);
+    // NOTE(vincent): After the task is free, so that the acceptor never admits a connection it has no task for.
+    AtomicDecrementU32(&State->Admission.InFlight);
 }
 
 internal void
 PrepareHandshaking(server_memory *Memory, struct sockaddr *IncomingAddress, SOCKET ClientSocket, platform_work_queue *Queue)
 {
     server_state *State = (server_state *)Memory->Storage;
-    task_with_memory *Task = 0;
+    u64 Now = GetMonotonicMilliseconds();
+    client_address Client = ClientAddress(IncomingAddress);
     
-    while (!Task)
-        Task = BeginTaskWithMemory(State);
-    
-    Assert(Task);  // TODO(vincent): why is this firing when we don't spinlock?
-    Assert(Task->Arena.TempCount == 1);
-    Assert(Task->Arena.Used == 0);
-    
-    receive_and_send_work *Work = PushStruct(&Task->Arena, receive_and_send_work);
-    Work->IncomingAddress = *IncomingAddress; // deep copy so that other threads don't mutate what we use
-    
-    Work->ClientSocket = ClientSocket;
-    Work->Task = Task;
-    Work->State = State;
-    Memory->PlatformAddEntry(Queue, ReceiveAndSend, Work);
-    
-    // NOTE(vincent): Not necessarily a good idea to have the main thread do work 
-    // instead of producing work entries, but this is a way you could do it:
-    if (Task->Index == ArrayCount(State->Tasks)-1)
-        Memory->PlatformDoNextWorkEntry(Queue);
+    // NOTE(vincent): Released before the work entry is added: the platform may run it on this thread.
+    u32 ThreadIndex = GetThreadIndex(Queue);
+    config_snapshot *Snapshot = BeginSnapshotRead(&State->Publisher, ThreadIndex);
+    if (Snapshot->Generation != State->AcceptorGeneration)
+    {
+        // NOTE(vincent): A reload happened. The buckets are kept, only the rates change.
+        State->Admission.ShedQueueDepth = Snapshot->ShedQueueDepth;
+        State->Admission.ShedLatency = Snapshot->ShedLatency;
+        InitializeRateLimiter(&State->RateLimiter, Snapshot->RateLimit, Snapshot->RateBurst, State->RateLimiter.Seed);
+        State->AcceptorGeneration = Snapshot->Generation;
+    }
+    u32 TraceId = TraceRequestId(&State->Tracer, Snapshot->TraceSample);
+    u64 TraceStart = TraceId ? GetMonotonicMicroseconds() : 0;
     
+    if (!TakeRateToken(&State->RateLimiter, &Client, Now))
+    {
+        // NOTE(vincent): Before admission control, so that one client over its rate doesn't get the others shed.
+        string Refusal = State->Headers[ResponseHeader_TooManyRequests];
+        RefuseConnection(ClientSocket, Refusal.Base, Refusal.Length);
+        EndSnapshotRead(&State->Publisher, ThreadIndex);
+    }
+    else if (!AdmitConnection(&State->Admission, Now))
+    {
+        // NOTE(vincent): Overloaded. A 503 now beats a request that times out in the queue,
+        // or a backlog so full that new clients wait for SYN retries.
+        RefuseConnection(ClientSocket, Snapshot->ServiceUnavailable.Base, Snapshot->ServiceUnavailable.Length);
+        EndSnapshotRead(&State->Publisher, ThreadIndex);
+    }
+    else
+    {
+        EndSnapshotRead(&State->Publisher, ThreadIndex);
+        AtomicIncrementU32(&State->Admission.InFlight);
+        task_with_memory *Task = 0;
+        
+        while (!Task)
+            Task = BeginTaskWithMemory(State);
+        
+        Assert(Task);  // TODO(vincent): why is this firing when we don't spinlock?
+        Assert(Task->Arena.TempCount == 1);
+        Assert(Task->Arena.Used == 0);
+        
+        receive_and_send_work *Work = PushStruct(&Task->Arena, receive_and_send_work);
+        // NOTE(vincent): Deep copy so that other threads don't mutate what we use. The platform layer
+        // accepts into a sockaddr_storage, a struct sockaddr is too small for IPv6 addresses.
+        Work->IncomingAddress = *(struct sockaddr_storage *)IncomingAddress;
+        
+        Work->ClientSocket = ClientSocket;
+        Work->Task = Task;
+        Work->State = State;
+        Work->AcceptedAt = Now;
+        Work->TraceId = TraceId;
+        Work->EnqueuedAt = TracePhase(&State->Tracer, ThreadIndex, TraceId, TracePhase_Accept, TraceStart);
+        Work->ArrivedAt = (State->Capture.File.Handle != -1) ? GetMonotonicMicroseconds() : 0;
+        Memory->PlatformAddEntry(Queue, ReceiveAndSend, Work);
+        
+        // NOTE(vincent): Not necessarily a good idea to have the main thread do work 
+        // instead of producing work entries, but this is a way you could do it:
+        if (Task->Index == ArrayCount(State->Tasks)-1)
+            Memory->PlatformDoNextWorkEntry(Queue);
+    }
 }
@@ -1,24 +1,164 @@
 
+// NOTE(vincent): The header blocks built at startup, see InitializeServerMemory().
+enum response_header
+{
+    ResponseHeader_OK,
+    ResponseHeader_NotModified,         // followed by the ETag and CRLFCRLF
+    ResponseHeader_BadRequest,
+    ResponseHeader_Unauthorized,
+    ResponseHeader_Forbidden,
+    ResponseHeader_NotFound,
+    ResponseHeader_TooManyRequests,
+    ResponseHeader_Count,         // the 503 depends on the config, it's in the config_snapshot
+};
+
+// NOTE(vincent): A response is a few pieces sent with one gathering call: a prebuilt header block,
+// maybe a per-request piece, and the body wherever it already is (bundle mapping or thread arena).
+#define MAX_RESPONSE_BUFFERS 4
+struct response
+{
+    platform_send_buffer Buffers[MAX_RESPONSE_BUFFERS];
+    u32 BufferCount;
+    u64 Length;
+};
+
+inline void
+AppendResponse(response *Response, char *Base, u64 Length)
+{
+    Assert(Response->BufferCount < MAX_RESPONSE_BUFFERS);
+    platform_send_buffer *Buffer = Response->Buffers + Response->BufferCount++;
+    Buffer->Base = Base;
+    Buffer->Length = Length;
+    Response->Length += Length;
+}
+
+inline void
+AppendResponse(response *Response, string String)
+{
+    AppendResponse(Response, String.Base, String.Length);
+}
+
+// NOTE(vincent): Where a response is in its sending. Resumable, so that a non-blocking caller can keep it
+// around until the socket is writable again.
+struct send_cursor
+{
+    platform_send_buffer Buffers[MAX_RESPONSE_BUFFERS];
+    u32 First;            // the first buffer with bytes left, its Base and Length already advanced
+    u32 Count;
+    u64 Sent;
+    u64 Total;
+};
+
+inline send_cursor
+BeginSend(response *Response)
+{
+    send_cursor Result = {};
+    for (u32 BufferIndex = 0; BufferIndex < Response->BufferCount; BufferIndex++)
+        Result.Buffers[BufferIndex] = Response->Buffers[BufferIndex];
+    Result.Count = Response->BufferCount;
+    Result.Total = Response->Length;
+    return Result;
+}
+
+inline void
+AdvanceSend(send_cursor *Cursor, u64 Bytes)
+{
+    Cursor->Sent += Bytes;
+    while (Cursor->First < Cursor->Count)
+    {
+        platform_send_buffer *Buffer = Cursor->Buffers + Cursor->First;
+        if (Bytes < Buffer->Length)
+        {
+            Buffer->Base += Bytes;
+            Buffer->Length -= Bytes;
+            break;
+        }
+        Bytes -= Buffer->Length;
+        Cursor->First++;
+    }
+}
+
+#if DEBUG
+internal void
+TestAdvanceSend()
+{
+    char Header[] = "header";
+    char Body[] = "the body";
+    response Response = {};
+    AppendResponse(&Response, Header, 6);
+    AppendResponse(&Response, Body, 0);
+    AppendResponse(&Response, Body, 8);
+    send_cursor Cursor = BeginSend(&Response);
+    Assert(Cursor.Total == 14 && Cursor.First == 0);
+    AdvanceSend(&Cursor, 4);
+    Assert(Cursor.First == 0 && Cursor.Buffers[0].Base == Header + 4 && Cursor.Buffers[0].Length == 2);
+    AdvanceSend(&Cursor, 5);
+    Assert(Cursor.First == 2 && Cursor.Buffers[2].Base == Body + 3 && Cursor.Buffers[2].Length == 5);
+    AdvanceSend(&Cursor, 5);
+    Assert(Cursor.First == Cursor.Count && Cursor.Sent == Cursor.Total);
+}
+#endif
+
+enum connection_phase
+{
+    ConnectionPhase_ReadingHeaders,
+    ConnectionPhase_Sending,
+};
+
+// NOTE(vincent): Deadline of the connection a task is serving. Node comes first so that the timer wheel's
+// nodes can be cast back. Everything here is only touched under server_state::TimerMutex.
+struct connection_timer
+{
+    timer_node Node;
+    SOCKET Socket;
+    connection_phase Phase;
+    b32 Expired;          // the socket was aborted
+};
+
 struct task_with_memory
 {
     b32 BeingUsed;
     memory_arena Arena;
     temporary_memory TempMemory;
     u32 Index;
+    connection_timer Timer;
 };
 
 struct server_state
 {
     memory_arena Arena;
     string ToSend;
-    parsed_config_file_result Config;
+    content_generations Generations;
+    negative_cache NegativeCache;
+    md5_combiner MD5Combiner;
+    htpasswd_cache HtpasswdCache;
+    directory_index_cache DirectoryIndexCache;
+    
+    ticket_mutex TimerMutex;
+    timer_wheel ConnectionTimers;     // ticks of CONNECTION_TIMER_TICK_MILLISECONDS
+    u64 HeaderTimeouts;
+    u64 SendTimeouts;
+    u64 BytesSent;                // actually accepted by the kernel, every response included
+    u64 IncompleteResponses;      // cut short by an error, a timeout or the client going away
+    
+    admission_control Admission;
+    rate_limiter RateLimiter;
+    u32 AcceptorGeneration;       // the snapshot the acceptor last took its limits from
+    request_tracer Tracer;
+    cpu_profiler Profiler;
+    request_capture Capture;
+    
+    config_publisher Publisher;
+    config_snapshot Snapshots[2]; // the current one, and the one the next reload builds
+    ticket_mutex ReloadMutex;
+    u64 Reloads;
+    u64 FailedReloads;
+    memory_arena CacheRootArena;
+    u32 CacheRootCount;
+    string CacheRoots[MAX_CACHE_ROOTS];   // by virtual_host::CacheKey
     
-    char *StringOK;
-    char *StringBR;
-    char *StringNF;
-    char *StringUN;
-    char *StringFB;
-    task_with_memory Tasks[NUMBER_OF_THREADS];
+    string Headers[ResponseHeader_Count];
+    task_with_memory Tasks[TASK_COUNT];
     platform_work_queue *Queue;
 };
 
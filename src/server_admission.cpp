@@ -0,0 +1,176 @@
+// NOTE(vincent): Admission control. The acceptor answers a prebuilt 503 itself, without taking a task,
+// when too many accepted connections are still in flight or when the recent p99 latency (accept to close,
+// queueing included) is over the configured limit while requests are queueing. Shedding early keeps the
+// latency of the requests we do take bounded, instead of letting the kernel backlog overflow into SYN retries.
+//
+// Latencies go into a histogram with 4 buckets per power of two of milliseconds, so a percentile is
+// within 25% of the real value. The acceptor rotates between two windows of LATENCY_WINDOW_MILLISECONDS
+// and sheds on the p99 of the last full one.
+
+#define LATENCY_BUCKET_COUNT 72         // the last bucket holds everything over about 2 minutes
+#define LATENCY_WINDOW_MILLISECONDS 1000
+
+struct latency_histogram
+{
+    u64 Counts[LATENCY_BUCKET_COUNT];
+};
+
+struct admission_control
+{
+    u32 InFlight;             // accepted and not closed yet, running or waiting in the deques
+    u32 QueueingDepth;        // in flight count at which requests start waiting for a thread
+    u32 ShedQueueDepth;
+    u32 ShedLatency;          // milliseconds, 0 to never shed on latency
+    
+    latency_histogram Windows[2];
+    u32 CurrentWindow;
+    u64 WindowStart;
+    u32 RecentP99;            // milliseconds, of the last full window
+    latency_histogram Total;
+    
+    u64 ShedQueueFull;
+    u64 ShedSlow;
+};
+
+inline u32
+LatencyBucket(u64 Milliseconds)
+{
+    // NOTE(vincent): 0-3ms get a bucket each, then [4,5) [5,6) [6,7) [7,8) [8,10) [10,12) ...
+    u32 Result = (u32)Milliseconds;
+    if (Milliseconds >= 4)
+    {
+        u32 Exponent = 2;
+        while (Exponent < 63 && (Milliseconds >> (Exponent + 1)))
+            Exponent++;
+        u32 Sub = (u32)(Milliseconds >> (Exponent - 2)) & 3;
+        Result = 4*(Exponent - 1) + Sub;
+    }
+    return Minimum(Result, LATENCY_BUCKET_COUNT - 1);
+}
+
+inline u64
+LatencyBucketEnd(u32 Bucket)
+{
+    // NOTE(vincent): First millisecond count past the bucket.
+    u64 Result = Bucket + 1;
+    if (Bucket >= 4)
+    {
+        u32 Exponent = Bucket/4 + 1;
+        Result = (u64)(5 + Bucket % 4) << (Exponent - 2);
+    }
+    return Result;
+}
+
+internal u32
+LatencyPercentile(latency_histogram *Histogram, u32 Permille)
+{
+    // NOTE(vincent): Upper bound of the bucket the percentile falls in, in milliseconds. 0 when empty.
+    u64 Total = 0;
+    for (u32 Bucket = 0; Bucket < LATENCY_BUCKET_COUNT; Bucket++)
+        Total += Histogram->Counts[Bucket];
+    
+    u32 Result = 0;
+    if (Total)
+    {
+        u64 Rank = (Total*Permille + 999) / 1000;
+        u64 Seen = 0;
+        for (u32 Bucket = 0; Bucket < LATENCY_BUCKET_COUNT; Bucket++)
+        {
+            Seen += Histogram->Counts[Bucket];
+            if (Seen >= Rank)
+            {
+                Result = (u32)LatencyBucketEnd(Bucket);
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+internal void
+RecordLatency(admission_control *Admission, u64 Milliseconds)
+{
+    // NOTE(vincent): Any thread. A count landing in a window the acceptor just cleared is lost, that's fine.
+    u32 Bucket = LatencyBucket(Milliseconds);
+    AtomicAddU64(&Admission->Windows[Admission->CurrentWindow].Counts[Bucket], 1);
+    AtomicAddU64(&Admission->Total.Counts[Bucket], 1);
+}
+
+internal void
+UpdateLatencyWindow(admission_control *Admission, u64 Now)
+{
+    // NOTE(vincent): Acceptor thread only.
+    if (Now - Admission->WindowStart >= LATENCY_WINDOW_MILLISECONDS)
+    {
+        u32 Finished = Admission->CurrentWindow;
+        Admission->CurrentWindow = Finished ^ 1;
+        Admission->WindowStart = Now;
+        Admission->RecentP99 = LatencyPercentile(Admission->Windows + Finished, 990);
+        ZeroBytes((char *)(Admission->Windows + Finished), sizeof(latency_histogram));
+    }
+}
+
+internal b32
+AdmitConnection(admission_control *Admission, u64 Now)
+{
+    // NOTE(vincent): Acceptor thread only. Without a queue, a high p99 isn't something shedding would fix.
+    UpdateLatencyWindow(Admission, Now);
+    b32 Result = true;
+    u32 InFlight = Admission->InFlight;
+    if (InFlight >= Admission->ShedQueueDepth)
+    {
+        Admission->ShedQueueFull++;
+        Result = false;
+    }
+    else if (Admission->ShedLatency && Admission->RecentP99 > Admission->ShedLatency &&
+             InFlight >= Admission->QueueingDepth)
+    {
+        Admission->ShedSlow++;
+        Result = false;
+    }
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestLatencyHistogram()
+{
+    for (u64 Milliseconds = 0; Milliseconds < 100000; Milliseconds++)
+    {
+        u32 Bucket = LatencyBucket(Milliseconds);
+        Assert(Milliseconds < LatencyBucketEnd(Bucket));
+        Assert(Bucket == 0 || Milliseconds >= LatencyBucketEnd(Bucket - 1));
+        Assert(4*LatencyBucketEnd(Bucket) <= 5*(Milliseconds + 1));
+    }
+    Assert(LatencyBucket(~0ull) == LATENCY_BUCKET_COUNT - 1);
+    
+    latency_histogram Histogram = {};
+    Assert(LatencyPercentile(&Histogram, 990) == 0);
+    for (u64 Milliseconds = 1; Milliseconds <= 1000; Milliseconds++)
+        Histogram.Counts[LatencyBucket(Milliseconds)]++;
+    u32 P50 = LatencyPercentile(&Histogram, 500);
+    u32 P99 = LatencyPercentile(&Histogram, 990);
+    Assert(500 < P50 && P50 <= 625);
+    Assert(990 < P99 && P99 <= 1024);
+    
+    admission_control Admission = {};
+    Admission.QueueingDepth = 4;
+    Admission.ShedQueueDepth = 8;
+    Admission.ShedLatency = 100;
+    Admission.InFlight = 7;
+    Assert(AdmitConnection(&Admission, 0));
+    Admission.InFlight = 8;
+    Assert(!AdmitConnection(&Admission, 0) && Admission.ShedQueueFull == 1);
+    
+    for (u32 Request = 0; Request < 100; Request++)
+        RecordLatency(&Admission, 500);
+    Admission.InFlight = 4;
+    Assert(AdmitConnection(&Admission, 0));
+    Assert(!AdmitConnection(&Admission, LATENCY_WINDOW_MILLISECONDS) && Admission.ShedSlow == 1);
+    Admission.InFlight = 3;
+    Assert(AdmitConnection(&Admission, LATENCY_WINDOW_MILLISECONDS));
+    Admission.InFlight = 4;
+    Assert(AdmitConnection(&Admission, 2*LATENCY_WINDOW_MILLISECONDS));
+    Assert(Admission.RecentP99 == 0);
+}
+#endif
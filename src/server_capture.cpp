@@ -0,0 +1,200 @@
+// NOTE(vincent): Traffic capture, for replay_linux.cpp. With capture:"file" in the config, every request
+// the server reads is appended to that file as it arrived, with when it arrived and what the server
+// answered: the status code and the response length. Replaying a capture against a test server then gives
+// latencies under production-shaped load, and any response that came out different.
+//
+// The file is the 8 bytes of CAPTURE_MAGIC, then one record per request: a capture_record, then the
+// request bytes. Each record goes out in one append, so the threads don't need a lock and records never
+// interleave. Arrival times are monotonic microseconds since the server started capturing, the records
+// are in the order requests finished, not the order they arrived.
+//
+// Connections refused by the rate limiter or the admission control never had their request read, they
+// aren't in the capture.
+//
+// An existing capture is never truncated nor appended to: after an upgrade or a restart, the old process may
+// still be writing to it, and its arrival times count from another start. The new process captures to
+// "file.1", "file.2" and so on instead, the first one that doesn't exist yet.
+
+#define CAPTURE_MAGIC "HSCAPT01"
+#define CAPTURE_MAGIC_LENGTH 8
+#define CAPTURE_MAX_SUFFIX 99
+
+struct capture_record
+{
+    u64 ArrivedAt;         // microseconds since the capture started
+    u64 ResponseLength;    // what the server meant to send, header block included
+    u32 RequestLength;     // bytes that follow this record
+    u16 Status;            // 0 when the response didn't start with a status line
+    u16 Reserved;
+};
+
+struct request_capture
+{
+    platform_append_file File;   // Handle -1 when not capturing
+    u64 StartedAt;               // microseconds, from GetMonotonicMicroseconds()
+    volatile u64 Records;
+    volatile u64 Errors;         // appends that failed, those records are lost
+    char Filename[4096 + 4];     // the configured name, maybe with a suffix
+};
+
+internal b32
+StartCapture(request_capture *Capture, char *Filename)
+{
+    Capture->File.Handle = -1;
+    u32 Length = StringLength(Filename);
+    for (u32 Suffix = 0; Capture->File.Handle == -1 && Suffix <= CAPTURE_MAX_SUFFIX; Suffix++)
+    {
+        if (Length + 4 > sizeof(Capture->Filename))
+            break;
+        Sprint(Capture->Filename, Filename);
+        if (Suffix)
+        {
+            Capture->Filename[Length] = '.';
+            SprintU64(Capture->Filename + Length + 1, Suffix);
+        }
+        Capture->File = CreateAppendOnlyFile(Capture->Filename);
+    }
+    Capture->StartedAt = GetMonotonicMicroseconds();
+    b32 Result = (Capture->File.Handle != -1 &&
+                  AppendToFile(Capture->File, (char *)CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH));
+    if (!Result)
+        Capture->File.Handle = -1;
+    return Result;
+}
+
+internal u16
+ResponseStatus(char *Response, u64 Length)
+{
+    // NOTE(vincent): The code in "HTTP/1.1 200 OK". The replay tool reads its responses with it too.
+    u16 Result = 0;
+    if (Length >= 12 && StringBeginsWith(StringBaseLength(Response, 7), "HTTP/1.") && Response[8] == ' ')
+    {
+        for (u32 Digit = 9; Digit < 12; Digit++)
+        {
+            if (Response[Digit] < '0' || Response[Digit] > '9')
+                return 0;
+            Result = (u16)(Result*10 + (Response[Digit] - '0'));
+        }
+    }
+    return Result;
+}
+
+internal char *
+PushCaptureRecord(memory_arena *Arena, char *Request, u32 RequestLength)
+{
+    // NOTE(vincent): Room for the record in front of a copy of the request, taken before parsing
+    // rewrites the buffer. FinishCaptureRecord() fills the rest in once the response is out.
+    char *Result = PushArray(Arena, sizeof(capture_record) + RequestLength, char);
+    capture_record Record = {};
+    Record.RequestLength = RequestLength;
+    memcpy(Result, &Record, sizeof(Record));
+    memcpy(Result + sizeof(Record), Request, RequestLength);
+    return Result;
+}
+
+internal void
+FinishCaptureRecord(char *Buffer, u64 ArrivedAt, u16 Status, u64 ResponseLength)
+{
+    capture_record Record;
+    memcpy(&Record, Buffer, sizeof(Record));
+    Record.ArrivedAt = ArrivedAt;
+    Record.Status = Status;
+    Record.ResponseLength = ResponseLength;
+    memcpy(Buffer, &Record, sizeof(Record));
+}
+
+internal void
+AppendCaptureRecord(request_capture *Capture, char *Buffer)
+{
+    capture_record Record;
+    memcpy(&Record, Buffer, sizeof(Record));
+    if (AppendToFile(Capture->File, Buffer, sizeof(Record) + Record.RequestLength))
+        AtomicAddU64(&Capture->Records, 1);
+    else
+        AtomicAddU64(&Capture->Errors, 1);
+}
+
+// NOTE(vincent): A capture read back, by replay_linux.cpp.
+struct captured_request
+{
+    capture_record Record;
+    char *Request;         // RequestLength bytes inside the capture, not null-terminated
+};
+
+internal u32
+ReadCapture(captured_request *Requests, u32 MaxCount, char *Capture, u64 Size, b32 *Truncated)
+{
+    // NOTE(vincent): Returns how many records were read. A server killed mid-append leaves a partial
+    // record at the end, Truncated says so.
+    u32 Result = 0;
+    *Truncated = false;
+    u64 At = CAPTURE_MAGIC_LENGTH;
+    while (At < Size && Result < MaxCount)
+    {
+        captured_request *Request = Requests + Result;
+        if (Size - At < sizeof(capture_record))
+        {
+            *Truncated = true;
+            break;
+        }
+        memcpy(&Request->Record, Capture + At, sizeof(capture_record));
+        At += sizeof(capture_record);
+        if (Size - At < Request->Record.RequestLength)
+        {
+            *Truncated = true;
+            break;
+        }
+        Request->Request = Capture + At;
+        At += Request->Record.RequestLength;
+        Result++;
+    }
+    return Result;
+}
+
+inline b32
+IsCapture(char *Capture, u64 Size)
+{
+    b32 Result = (Size >= CAPTURE_MAGIC_LENGTH && memcmp(Capture, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) == 0);
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestRequestCapture()
+{
+    Assert(ResponseStatus("HTTP/1.1 404 Not Found\r\n", 24) == 404);
+    Assert(ResponseStatus("HTTP/1.1 200", 12) == 200);
+    Assert(ResponseStatus("HTTP/1.1 20", 11) == 0);
+    Assert(ResponseStatus("HTTP/1.1 2x0 OK", 15) == 0);
+    Assert(ResponseStatus("garbage garbage", 15) == 0);
+    
+    // NOTE(vincent): Two records the way the server writes them, then a third one cut short.
+    static u8 ArenaMemory[4096];
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(ArenaMemory), ArenaMemory);
+    static char File[1024];
+    u32 Size = 0;
+    memcpy(File, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH);
+    Size += CAPTURE_MAGIC_LENGTH;
+    char *Requests[] = {"GET / HTTP/1.1\r\n\r\n", "GET /a HTTP/1.1\r\nHost: x\r\n\r\n", "GET /b"};
+    for (u32 RequestIndex = 0; RequestIndex < ArrayCount(Requests); RequestIndex++)
+    {
+        u32 Length = StringLength(Requests[RequestIndex]);
+        char *Record = PushCaptureRecord(&Arena, Requests[RequestIndex], Length);
+        FinishCaptureRecord(Record, 1000*RequestIndex, (u16)(200 + RequestIndex), 5000 + RequestIndex);
+        memcpy(File + Size, Record, sizeof(capture_record) + Length);
+        Size += sizeof(capture_record) + Length;
+    }
+    Assert(IsCapture(File, Size) && !IsCapture(File + 1, Size - 1));
+    
+    captured_request Read[4];
+    b32 Truncated;
+    Assert(ReadCapture(Read, ArrayCount(Read), File, Size, &Truncated) == 3 && !Truncated);
+    Assert(Read[1].Record.ArrivedAt == 1000 && Read[1].Record.Status == 201);
+    Assert(Read[1].Record.ResponseLength == 5001 && Read[1].Record.RequestLength == 28);
+    Assert(BytesAreEqual(Read[1].Request, Requests[1], 28));
+    Assert(ReadCapture(Read, ArrayCount(Read), File, Size - 1, &Truncated) == 2 && Truncated);
+    Assert(ReadCapture(Read, ArrayCount(Read), File, Size - 7, &Truncated) == 2 && Truncated);
+    Assert(ReadCapture(Read, 1, File, Size, &Truncated) == 1);
+}
+#endif
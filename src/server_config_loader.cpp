@@ -170,6 +170,74 @@ ScanIdentifier(push_read_entire_file Source, scanner_location *Scanner,
         //printf("ScanIdentifier root: (%u, %u)\n", Scanner->Row, Scanner->Column);
         AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_Root, 0));
     }
+    else if (StringsAreEqual(Identifier, "bundle"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_Bundle, 0));
+    }
+    else if (StringsAreEqual(Identifier, "vhost"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_VirtualHost, 0));
+    }
+    else if (StringsAreEqual(Identifier, "default"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_DefaultHost, 0));
+    }
+    else if (StringsAreEqual(Identifier, "thread_placement"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_ThreadPlacement, 0));
+    }
+    else if (StringsAreEqual(Identifier, "header_timeout"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_HeaderTimeout, 0));
+    }
+    else if (StringsAreEqual(Identifier, "send_timeout"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_SendTimeout, 0));
+    }
+    else if (StringsAreEqual(Identifier, "backlog"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_Backlog, 0));
+    }
+    else if (StringsAreEqual(Identifier, "shed_queue_depth"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_ShedQueueDepth, 0));
+    }
+    else if (StringsAreEqual(Identifier, "shed_p99"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_ShedLatency, 0));
+    }
+    else if (StringsAreEqual(Identifier, "retry_after"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_RetryAfter, 0));
+    }
+    else if (StringsAreEqual(Identifier, "rate_limit"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_RateLimit, 0));
+    }
+    else if (StringsAreEqual(Identifier, "rate_burst"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_RateBurst, 0));
+    }
+    else if (StringsAreEqual(Identifier, "send_lowat"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_SendLowWatermark, 0));
+    }
+    else if (StringsAreEqual(Identifier, "drain_timeout"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_DrainTimeout, 0));
+    }
+    else if (StringsAreEqual(Identifier, "trace_sample"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_TraceSample, 0));
+    }
+    else if (StringsAreEqual(Identifier, "capture"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_Capture, 0));
+    }
+    else if (StringsAreEqual(Identifier, "autoindex"))
+    {
+        AddToken(Source, Scanner, Tokens, TokenHint(ConfigTokenType_AutoIndex, 0));
+    }
     else
     {
         fprintf(stderr, "Unknown identifier (%u, %u)\n", Scanner->Row, Scanner->Column);
@@ -233,18 +301,10 @@ ScanToken(push_read_entire_file Source, scanner_location *Scanner, parsed_config
 }
 
 internal u32
-ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
+ParseConfigSource(parsed_config_file_result *Result, push_read_entire_file ReadFileResult)
 {
-    temporary_memory TempMem = BeginTemporaryMemory(Arena);
-    push_read_entire_file ReadFileResult = PushReadEntireFile(Arena, "config");
-    // TODO(vincent): pool this?
-    
-    if (!ReadFileResult.Memory)
-    {
-        fprintf(stderr, "Couldn't load config file.\n");
-        return 0;
-    }
-    
+    // NOTE(vincent): Returns the error count. Only reads ReadFileResult.Size bytes, the source needn't be
+    // null-terminated: the fuzz driver hands it whatever it got.
     scanner_location Scanner;
     Scanner.Start = 0;     // points to the first character in the lexeme being considered
     Scanner.Current = 0;   // points to the character being considered
@@ -272,6 +332,23 @@ ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
             case ConfigTokenType_Integer: printf("Integer (%u,%u): %u\n", T.Row, T.Column, T.Value); break;
             case ConfigTokenType_Port: printf("Port (%u,%u)\n", T.Row, T.Column); break;
             case ConfigTokenType_Root: printf("Root (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_Bundle: printf("Bundle (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_VirtualHost: printf("Vhost (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_DefaultHost: printf("Default (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_ThreadPlacement: printf("Thread placement (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_HeaderTimeout: printf("Header timeout (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_SendTimeout: printf("Send timeout (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_Backlog: printf("Backlog (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_ShedQueueDepth: printf("Shed queue depth (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_ShedLatency: printf("Shed p99 (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_RetryAfter: printf("Retry after (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_RateLimit: printf("Rate limit (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_RateBurst: printf("Rate burst (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_SendLowWatermark: printf("Send low watermark (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_DrainTimeout: printf("Drain timeout (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_TraceSample: printf("Trace sample (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_Capture: printf("Capture (%u,%u)\n", T.Row, T.Column); break;
+            case ConfigTokenType_AutoIndex: printf("Autoindex (%u,%u)\n", T.Row, T.Column); break;
             default: InvalidCodePath;
         }
     }
@@ -288,6 +365,7 @@ ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
         // so we just loop through the tokens, and overwrite the port/root field whenever we
         // get a new value for that field.
         config_token_type LastType = ConfigTokenType_Invalid;
+        b32 HaveVirtualHostName = false;  // vhost takes two strings: the host name, then its root
         for (u32 TokenIndex = 0; TokenIndex < Tokens.Count; TokenIndex++)
         {
             config_token T = Tokens.Tokens[TokenIndex];
@@ -305,13 +383,68 @@ ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
                     
                     // Remove ending slash if there is one, so that we can prefix
                     // this with http request paths easily.
-                    if (Result->Root[PrintedCount-1] == '/')
+                    if (PrintedCount > 0 && Result->Root[PrintedCount-1] == '/')
                     {
                         Result->Root[PrintedCount-1] = 0;
                     }
                     
                     Result->RootSet = true;
                 }
+                else if (LastType == ConfigTokenType_Bundle)
+                {
+                    sprintf(Result->Bundle, "%.*s", Minimum(T.Lexeme.Length, ArrayCount(Result->Bundle)-1),
+                            T.Lexeme.Base);
+                    Result->BundleSet = true;
+                }
+                else if (LastType == ConfigTokenType_VirtualHost && 
+                         Result->VirtualHostCount < ArrayCount(Result->VirtualHosts))
+                {
+                    config_virtual_host *Host = Result->VirtualHosts + Result->VirtualHostCount;
+                    if (!HaveVirtualHostName)
+                    {
+                        sprintf(Host->Name, "%.*s", Minimum(T.Lexeme.Length, ArrayCount(Host->Name)-1),
+                                T.Lexeme.Base);
+                        HaveVirtualHostName = true;
+                    }
+                    else
+                    {
+                        u32 PrintedCount = sprintf(Host->Root, "%.*s", 
+                                                   Minimum(T.Lexeme.Length, ArrayCount(Host->Root)-1),
+                                                   T.Lexeme.Base);
+                        if (PrintedCount > 1 && Host->Root[PrintedCount-1] == '/')
+                            Host->Root[PrintedCount-1] = 0;
+                        HaveVirtualHostName = false;
+                        Result->VirtualHostCount++;
+                        LastType = ConfigTokenType_Invalid;
+                    }
+                }
+                else if (LastType == ConfigTokenType_Capture)
+                {
+                    sprintf(Result->Capture, "%.*s", Minimum(T.Lexeme.Length, ArrayCount(Result->Capture)-1),
+                            T.Lexeme.Base);
+                    Result->CaptureSet = true;
+                }
+                else if (LastType == ConfigTokenType_DefaultHost)
+                {
+                    sprintf(Result->DefaultHost, "%.*s", 
+                            Minimum(T.Lexeme.Length, ArrayCount(Result->DefaultHost)-1), T.Lexeme.Base);
+                    Result->DefaultHostSet = true;
+                }
+                else if (LastType == ConfigTokenType_ThreadPlacement)
+                {
+                    if (StringsAreEqual(T.Lexeme, "none"))
+                        Result->ThreadPlacement = ThreadPlacement_None;
+                    else if (StringsAreEqual(T.Lexeme, "compact"))
+                        Result->ThreadPlacement = ThreadPlacement_Compact;
+                    else if (StringsAreEqual(T.Lexeme, "spread"))
+                        Result->ThreadPlacement = ThreadPlacement_Spread;
+                    else
+                    {
+                        fprintf(stderr, "Unknown thread placement %.*s (%u, %u), expected none, compact or spread\n",
+                                T.Lexeme.Length, T.Lexeme.Base, T.Row, T.Column);
+                        Scanner.ErrorCount++;
+                    }
+                }
                 break;
                 
                 case ConfigTokenType_Integer: 
@@ -320,10 +453,61 @@ ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
                     Result->Port = T.Value;
                     Result->PortSet = true;
                 }
+                else if (LastType == ConfigTokenType_HeaderTimeout)
+                    Result->HeaderTimeout = T.Value;
+                else if (LastType == ConfigTokenType_SendTimeout)
+                    Result->SendTimeout = T.Value;
+                else if (LastType == ConfigTokenType_Backlog)
+                    Result->Backlog = T.Value;
+                else if (LastType == ConfigTokenType_ShedQueueDepth)
+                    Result->ShedQueueDepth = T.Value;
+                else if (LastType == ConfigTokenType_ShedLatency)
+                    Result->ShedLatency = T.Value;
+                else if (LastType == ConfigTokenType_RetryAfter)
+                    Result->RetryAfter = T.Value;
+                else if (LastType == ConfigTokenType_RateLimit)
+                    Result->RateLimit = T.Value;
+                else if (LastType == ConfigTokenType_RateBurst)
+                    Result->RateBurst = T.Value;
+                else if (LastType == ConfigTokenType_SendLowWatermark)
+                {
+                    Result->SendLowWatermark = T.Value;
+                    Result->SendLowWatermarkSet = true;
+                }
+                else if (LastType == ConfigTokenType_DrainTimeout)
+                    Result->DrainTimeout = T.Value;
+                else if (LastType == ConfigTokenType_TraceSample)
+                    Result->TraceSample = T.Value;
+                else if (LastType == ConfigTokenType_AutoIndex)
+                    Result->AutoIndex = T.Value;
                 break;
                 
                 case ConfigTokenType_Port:
-                case ConfigTokenType_Root: LastType = T.Type; 
+                case ConfigTokenType_Root:
+                case ConfigTokenType_Bundle:
+                case ConfigTokenType_VirtualHost:
+                case ConfigTokenType_DefaultHost:
+                case ConfigTokenType_ThreadPlacement:
+                case ConfigTokenType_HeaderTimeout:
+                case ConfigTokenType_SendTimeout:
+                case ConfigTokenType_Backlog:
+                case ConfigTokenType_ShedQueueDepth:
+                case ConfigTokenType_ShedLatency:
+                case ConfigTokenType_RetryAfter:
+                case ConfigTokenType_RateLimit:
+                case ConfigTokenType_RateBurst:
+                case ConfigTokenType_SendLowWatermark:
+                case ConfigTokenType_DrainTimeout:
+                case ConfigTokenType_TraceSample:
+                case ConfigTokenType_Capture:
+                case ConfigTokenType_AutoIndex:
+                if (HaveVirtualHostName)
+                {
+                    fprintf(stderr, "Vhost without a root folder (%u, %u)\n", T.Row, T.Column);
+                    Scanner.ErrorCount++;
+                    HaveVirtualHostName = false;
+                }
+                LastType = T.Type; 
                 break;
                 
                 default: InvalidCodePath;
@@ -341,8 +525,39 @@ ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
             printf("Parsed and set root: %s\n", Result->Root);
         else
             printf("Didn't set the root\n");
+        if (Result->BundleSet)
+            printf("Parsed and set bundle: %s\n", Result->Bundle);
+        for (u32 HostIndex = 0; HostIndex < Result->VirtualHostCount; HostIndex++)
+            printf("Parsed vhost: %s -> %s\n", Result->VirtualHosts[HostIndex].Name, 
+                   Result->VirtualHosts[HostIndex].Root);
+        if (HaveVirtualHostName)
+        {
+            fprintf(stderr, "Vhost %s without a root folder\n", 
+                    Result->VirtualHosts[Result->VirtualHostCount].Name);
+            Scanner.ErrorCount++;
+        }
+        if (Result->DefaultHostSet)
+            printf("Parsed and set default host: %s\n", Result->DefaultHost);
+        if (Result->CaptureSet)
+            printf("Parsed and set capture: %s\n", Result->Capture);
     }
     
-    EndTemporaryMemory(TempMem);
     return Scanner.ErrorCount;
 }
+
+internal u32
+ParseConfigFile(parsed_config_file_result *Result, memory_arena *Arena)
+{
+    temporary_memory TempMem = BeginTemporaryMemory(Arena);
+    push_read_entire_file ReadFileResult = PushReadEntireFile(Arena, "config");
+    // TODO(vincent): pool this?
+    
+    u32 ErrorCount = 0;
+    if (ReadFileResult.Memory)
+        ErrorCount = ParseConfigSource(Result, ReadFileResult);
+    else
+        fprintf(stderr, "Couldn't load config file.\n");
+    
+    EndTemporaryMemory(TempMem);
+    return ErrorCount;
+}
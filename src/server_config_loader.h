@@ -1,11 +1,41 @@
 
+struct config_virtual_host
+{
+    char Name[256];      // host name as written in the config file
+    char Root[4096];     // document root, without ending slash
+};
+
 struct parsed_config_file_result
 {
     u32 Port;
     char PortString[6];   // the actual port used by Windows and Linux, it looks like
     char Root[65535];
+    char Bundle[65535];   // optional site bundle file to serve instead of the Root folder
     b32 PortSet;
     b32 RootSet;
+    b32 BundleSet;
+    
+    // NOTE(vincent): When no vhost is given, every subdirectory of Root is a virtual host named after it.
+    config_virtual_host VirtualHosts[64];
+    u32 VirtualHostCount;
+    char DefaultHost[256];
+    b32 DefaultHostSet;
+    thread_placement ThreadPlacement;   // where the platform layer pins threads, none by default
+    u32 HeaderTimeout;    // seconds, 0 for the default
+    u32 SendTimeout;      // seconds, 0 for the default
+    u32 Backlog;          // listen() backlog, 0 for the default
+    u32 ShedQueueDepth;   // connections in flight before answering 503, 0 for the whole task pool
+    u32 ShedLatency;      // milliseconds of p99 latency before answering 503, 0 to never shed on latency
+    u32 RetryAfter;       // seconds, in the 503 responses
+    u32 RateLimit;        // requests per second per client address, 0 for no limit
+    u32 RateBurst;        // requests, 0 for twice RateLimit
+    u32 SendLowWatermark; // bytes, 0 for the system default
+    b32 SendLowWatermarkSet;
+    u32 DrainTimeout;     // seconds the connections in flight get to finish when stopping, 0 for the default
+    u32 TraceSample;      // trace one request in N, 0 to trace none
+    char Capture[4096];   // file the requests get recorded to, see server_capture.cpp
+    b32 CaptureSet;
+    u32 AutoIndex;        // 1 to list directories without an index.html, see server_directory_index.cpp
 };
 
 enum config_token_type
@@ -15,6 +45,23 @@ enum config_token_type
     ConfigTokenType_Integer,
     ConfigTokenType_Port,
     ConfigTokenType_Root,
+    ConfigTokenType_Bundle,
+    ConfigTokenType_VirtualHost,
+    ConfigTokenType_DefaultHost,
+    ConfigTokenType_ThreadPlacement,
+    ConfigTokenType_HeaderTimeout,
+    ConfigTokenType_SendTimeout,
+    ConfigTokenType_Backlog,
+    ConfigTokenType_ShedQueueDepth,
+    ConfigTokenType_ShedLatency,
+    ConfigTokenType_RetryAfter,
+    ConfigTokenType_RateLimit,
+    ConfigTokenType_RateBurst,
+    ConfigTokenType_SendLowWatermark,
+    ConfigTokenType_DrainTimeout,
+    ConfigTokenType_TraceSample,
+    ConfigTokenType_Capture,
+    ConfigTokenType_AutoIndex,
     ConfigTokenType_Invalid,
 };
 
@@ -29,7 +76,7 @@ struct config_token
 
 struct parsed_config_tokens
 {
-    config_token Tokens[32];
+    config_token Tokens[512];
     u32 Count;
 };
 
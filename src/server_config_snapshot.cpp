@@ -0,0 +1,116 @@
+// NOTE(vincent): Config reloads. Everything a request needs from the config file lives in a config_snapshot:
+// the parsed file, the vhost table with its open directories, the bundle mapping and the limits.
+// A reload builds a new snapshot in the spare slot while requests keep using the current one, then
+// publishes it with one pointer store. Requests that started before keep the old snapshot until they finish.
+//
+// This is RCU with one reader slot per thread instead of reference counts, so that reading a snapshot
+// never writes to a cache line another thread reads:
+// - A reader stores the snapshot it is about to use in its slot, then checks that it is still current.
+// - The reloader publishes the new snapshot, then waits until no slot holds the old one before reusing it.
+// Each side writes first and reads the other's write after a full barrier, so either the reader sees the
+// new pointer and retries, or the reloader sees the reader's slot and waits.
+
+#define CONFIG_SNAPSHOT_ARENA_SIZE Megabytes(2)
+#define MAX_CACHE_ROOTS 1024              // distinct vhost roots over the life of the process
+#define CACHE_ROOT_ARENA_SIZE Kilobytes(256)
+
+struct config_snapshot
+{
+    u32 Generation;             // 1 for the config loaded at startup, then one more per reload
+    memory_arena Arena;         // reset when the slot is reused
+    parsed_config_file_result Config;
+    platform_file_mapping BundleMapping;
+    site_bundle Bundle;
+    virtual_host_table VirtualHosts;
+    
+    u32 HeaderTimeoutMilliseconds;
+    u32 SendTimeoutMilliseconds;
+    u32 SendLowWatermark;
+    u32 DrainTimeoutMilliseconds;
+    u32 TraceSample;
+    b32 AutoIndex;
+    u32 ShedQueueDepth;
+    u32 ShedLatency;
+    u32 RateLimit;
+    u32 RateBurst;
+    string ServiceUnavailable;  // the 503 header block, its Retry-After comes from the config
+};
+
+struct snapshot_reader
+{
+    config_snapshot *volatile Snapshot;   // 0 when the thread isn't reading one
+    u8 Pad[64 - sizeof(config_snapshot *)];
+};
+
+struct config_publisher
+{
+    config_snapshot *volatile Current;
+    snapshot_reader Readers[NUMBER_OF_THREADS];   // by GetThreadIndex()
+};
+
+internal config_snapshot *
+BeginSnapshotRead(config_publisher *Publisher, u32 ThreadIndex)
+{
+    // NOTE(vincent): Not reentrant: a thread holds at most one snapshot at a time.
+    snapshot_reader *Reader = Publisher->Readers + ThreadIndex;
+    Assert(!Reader->Snapshot);
+    config_snapshot *Result = Publisher->Current;
+    for (;;)
+    {
+        Reader->Snapshot = Result;
+        FullMemoryBarrier;
+        config_snapshot *Check = Publisher->Current;
+        if (Check == Result)
+            break;
+        Result = Check;
+    }
+    return Result;
+}
+
+inline void
+EndSnapshotRead(config_publisher *Publisher, u32 ThreadIndex)
+{
+    CompletePreviousWritesBeforeFutureWrites;
+    Publisher->Readers[ThreadIndex].Snapshot = 0;
+}
+
+internal config_snapshot *
+PublishSnapshot(config_publisher *Publisher, config_snapshot *Snapshot)
+{
+    // NOTE(vincent): Returns the snapshot that was current. It may only be reused once SnapshotIsRead()
+    // says nobody reads it anymore.
+    config_snapshot *Result = Publisher->Current;
+    CompletePreviousWritesBeforeFutureWrites;
+    Publisher->Current = Snapshot;
+    FullMemoryBarrier;
+    return Result;
+}
+
+internal b32
+SnapshotIsRead(config_publisher *Publisher, config_snapshot *Snapshot)
+{
+    b32 Result = false;
+    for (u32 ThreadIndex = 0; ThreadIndex < ArrayCount(Publisher->Readers); ThreadIndex++)
+        Result |= (Publisher->Readers[ThreadIndex].Snapshot == Snapshot);
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestConfigPublisher()
+{
+    static config_publisher Publisher;
+    static config_snapshot Snapshots[2];
+    Assert(PublishSnapshot(&Publisher, Snapshots) == 0);
+    
+    config_snapshot *Read = BeginSnapshotRead(&Publisher, 1);
+    Assert(Read == Snapshots && SnapshotIsRead(&Publisher, Snapshots));
+    Assert(PublishSnapshot(&Publisher, Snapshots + 1) == Snapshots);
+    Assert(SnapshotIsRead(&Publisher, Snapshots));
+    Assert(BeginSnapshotRead(&Publisher, NUMBER_OF_THREADS - 1) == Snapshots + 1);
+    EndSnapshotRead(&Publisher, 1);
+    Assert(!SnapshotIsRead(&Publisher, Snapshots) && SnapshotIsRead(&Publisher, Snapshots + 1));
+    EndSnapshotRead(&Publisher, NUMBER_OF_THREADS - 1);
+    Assert(!SnapshotIsRead(&Publisher, Snapshots + 1));
+}
+#endif
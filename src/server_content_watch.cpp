@@ -0,0 +1,101 @@
+// NOTE(vincent): Keeping in-memory caches coherent with the files under the websites root.
+//
+// We don't track cache entries individually here. Instead every directory gets a generation number,
+// found by hashing its path into a fixed table, and the platform layer's file watcher bumps
+// the generation of any directory it sees a change in. A cache entry remembers the generations
+// it was filled with and is stale as soon as one of them differs. Hash collisions only cause
+// spurious invalidations, never stale hits.
+//
+// - Directory generations cover the files of one directory (and the absence of files, for negative caching).
+// - The protection generation is bumped on any .htpasswd change, since one .htpasswd protects a whole subtree.
+// - The epoch is bumped when the watcher lost track of events, which invalidates everything.
+//
+// When no watcher runs (Win32 for now, or bundle mode where nothing changes), WatcherActive stays false
+// and caches have to use their own time-to-live instead.
+
+#define DIRECTORY_GENERATION_COUNT 4096   // power of two
+
+enum content_change_type
+{
+    ContentChange_File,          // one entry of a directory changed
+    ContentChange_Directory,     // anything in the directory may have changed
+    ContentChange_Everything,    // events were lost, or the watcher just (re)started
+};
+
+struct content_generations
+{
+    u32 volatile Epoch;
+    u32 volatile Protection;
+    u32 volatile Directories[DIRECTORY_GENERATION_COUNT];
+    b32 volatile WatcherActive;
+    u32 volatile ChangeCount;
+};
+
+inline u32 volatile *
+DirectoryGenerationSlot(content_generations *Generations, string Directory)
+{
+    // NOTE(vincent): Directory is spelled the way the server opens files, without a trailing slash,
+    // e.g. "websites/verti/images".
+    while (Directory.Length > 0 && Directory.Base[Directory.Length - 1] == '/')
+        Directory.Length--;
+    u32 Index = HashString(Directory) & (DIRECTORY_GENERATION_COUNT - 1);
+    return Generations->Directories + Index;
+}
+
+inline u32
+DirectoryGeneration(content_generations *Generations, string Directory)
+{
+    u32 Result = *DirectoryGenerationSlot(Generations, Directory);
+    return Result;
+}
+
+internal u32
+PathGenerationSum(content_generations *Generations, string Root, string RelativePath)
+{
+    // NOTE(vincent): Sum of the generations of every directory from Root down to the one holding RelativePath,
+    // e.g. "websites/verti", "websites/verti/a" and "websites/verti/a/b" for "a/b/c.html".
+    // Generations only go up, so the sum changes when any of them does. Watching all the ancestors matters
+    // for paths that don't exist: creating "a" only bumps the generation of the root.
+    // The hashes are built incrementally, they are the same HashString() would give on the joined paths.
+    u32 Hash = HashString(Root);
+    u32 Sum = Generations->Directories[Hash & (DIRECTORY_GENERATION_COUNT - 1)];
+    Hash = HashAppendByte(Hash, '/');
+    for (u32 Byte = 0; Byte < RelativePath.Length; Byte++)
+    {
+        if (RelativePath.Base[Byte] == '/')
+            Sum += Generations->Directories[Hash & (DIRECTORY_GENERATION_COUNT - 1)];
+        Hash = HashAppendByte(Hash, (u8)RelativePath.Base[Byte]);
+    }
+    return Sum;
+}
+
+internal void
+BumpContentGenerations(content_generations *Generations, content_change_type Type,
+                       string Directory, string Name)
+{
+    AtomicIncrementU32(&Generations->ChangeCount);
+    switch (Type)
+    {
+        case ContentChange_File:
+        {
+            AtomicIncrementU32(DirectoryGenerationSlot(Generations, Directory));
+            if (StringsAreEqual(Name, ".htpasswd"))
+                AtomicIncrementU32(&Generations->Protection);
+        } break;
+        
+        case ContentChange_Directory:
+        {
+            // NOTE(vincent): We don't know whether a .htpasswd was involved, so assume it was.
+            AtomicIncrementU32(DirectoryGenerationSlot(Generations, Directory));
+            AtomicIncrementU32(&Generations->Protection);
+        } break;
+        
+        case ContentChange_Everything:
+        {
+            AtomicIncrementU32(&Generations->Epoch);
+            AtomicIncrementU32(&Generations->Protection);
+        } break;
+        
+        InvalidDefaultCase;
+    }
+}
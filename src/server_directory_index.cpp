@@ -0,0 +1,408 @@
+// NOTE(vincent): Directory listings, with autoindex:1 in the config. A request for a directory without
+// an index.html gets a page listing that directory instead of a 404: folders first, then files, each sorted
+// by name, with their size and modification date. Names starting with a dot are left out, .htpasswd included,
+// and so are symlinks leading out of the vhost root, which wouldn't be served either.
+//
+// Listing a directory is a readdir() and a stat() per entry, so each page is rendered once, header block
+// included, and kept in a cache keyed by the directory. Entries are stamped like the negative cache's,
+// on the path of the missing index.html: the listed directory is the last one of that path, so any change
+// in it, or above it, makes the page stale. Directories we couldn't list are cached too, as an answer of 404.
+// Pages live in the cache's own arena, and the whole cache is dropped when that arena or the entry table
+// fills up, like the htpasswd cache. A page lists at most DIRECTORY_INDEX_MAX_ENTRIES entries and says how
+// many it left out, so that a cacheable page always fits in that arena: a huge directory is still read once,
+// not on every request.
+
+#define DIRECTORY_INDEX_CACHE_ENTRY_COUNT 256    // power of two
+#define DIRECTORY_INDEX_CACHE_MAX_LOAD 192       // entries in use before we drop everything
+#define DIRECTORY_INDEX_CACHE_MAX_PATH 192       // longer directories are rendered per request, not cached
+#define DIRECTORY_INDEX_CACHE_ARENA_SIZE Megabytes(2)
+#define DIRECTORY_INDEX_MAX_ENTRIES 500          // at most ~2.5KB each, see DirectoryIndexMaxLength()
+
+#define STRING_DIRECTORY_INDEX_HEADER "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nContent-Length: "
+#define DIRECTORY_INDEX_DATE_LENGTH 16           // "2024-01-31 23:59"
+
+struct directory_index_cache_entry
+{
+    u32 Hash;
+    u32 HostIndex;
+    u32 KeyLength;
+    b32 InUse;
+    negative_cache_stamp Stamp;
+    string Page;          // the whole response, in the cache arena. Base is 0 when the directory can't be listed
+    char Key[DIRECTORY_INDEX_CACHE_MAX_PATH];
+};
+
+struct directory_index_cache
+{
+    ticket_mutex Mutex;
+    memory_arena Arena;
+    u32 EntryCount;
+    directory_index_cache_entry Entries[DIRECTORY_INDEX_CACHE_ENTRY_COUNT];
+    
+    u64 Hits;
+    u64 Renders;          // directories read and rendered
+    u64 Resets;
+};
+
+internal u32
+SprintPercentEncoded(char *Dest, string Source)
+{
+    // NOTE(vincent): For hrefs and Location headers. Everything but the unreserved characters of RFC 3986
+    // and the slashes gets escaped, so at most three bytes per byte.
+    u32 Length = 0;
+    for (u32 Byte = 0; Byte < Source.Length; Byte++)
+    {
+        u8 C = (u8)Source.Base[Byte];
+        if (('a' <= C && C <= 'z') || ('A' <= C && C <= 'Z') || ('0' <= C && C <= '9') ||
+            C == '-' || C == '.' || C == '_' || C == '~' || C == '/')
+        {
+            Dest[Length++] = (char)C;
+        }
+        else
+        {
+            Dest[Length++] = '%';
+            Dest[Length++] = "0123456789ABCDEF"[C >> 4];
+            Dest[Length++] = "0123456789ABCDEF"[C & 15];
+        }
+    }
+    return Length;
+}
+
+internal u32
+SprintHTMLEscaped(char *Dest, string Source)
+{
+    // NOTE(vincent): At most six bytes per byte, for &quot;.
+    u32 Length = 0;
+    for (u32 Byte = 0; Byte < Source.Length; Byte++)
+    {
+        char C = Source.Base[Byte];
+        switch (C)
+        {
+            case '&': Length += SprintNoNull(Dest + Length, "&amp;"); break;
+            case '<': Length += SprintNoNull(Dest + Length, "&lt;"); break;
+            case '>': Length += SprintNoNull(Dest + Length, "&gt;"); break;
+            case '"': Length += SprintNoNull(Dest + Length, "&quot;"); break;
+            case '\'': Length += SprintNoNull(Dest + Length, "&#39;"); break;
+            default: Dest[Length++] = C; break;
+        }
+    }
+    return Length;
+}
+
+inline u32
+SprintPaddedDigits(char *Dest, u32 Value, u32 DigitCount)
+{
+    for (u32 Digit = DigitCount; Digit > 0; Digit--)
+    {
+        Dest[Digit - 1] = (char)('0' + Value % 10);
+        Value /= 10;
+    }
+    return DigitCount;
+}
+
+internal u32
+SprintListingDate(char *Dest, u64 Seconds)
+{
+    // NOTE(vincent): UTC, "2024-01-31 23:59". The civil date comes from the day count the way
+    // Howard Hinnant's civil_from_days() does it, with eras of 400 years starting on March 1st.
+    u64 Days = Seconds / 86400;
+    u32 SecondOfDay = (u32)(Seconds % 86400);
+    u64 Shifted = Days + 719468;
+    u64 Era = Shifted / 146097;
+    u32 DayOfEra = (u32)(Shifted - Era*146097);
+    u32 YearOfEra = (DayOfEra - DayOfEra/1460 + DayOfEra/36524 - DayOfEra/146096) / 365;
+    u32 DayOfYear = DayOfEra - (365*YearOfEra + YearOfEra/4 - YearOfEra/100);
+    u32 ShiftedMonth = (5*DayOfYear + 2) / 153;
+    u32 Day = DayOfYear - (153*ShiftedMonth + 2)/5 + 1;
+    u32 Month = ShiftedMonth < 10 ? ShiftedMonth + 3 : ShiftedMonth - 9;
+    u32 Year = (u32)(Era*400 + YearOfEra + (Month <= 2));
+    
+    u32 Length = SprintPaddedDigits(Dest, Year % 10000, 4);
+    Dest[Length++] = '-';
+    Length += SprintPaddedDigits(Dest + Length, Month, 2);
+    Dest[Length++] = '-';
+    Length += SprintPaddedDigits(Dest + Length, Day, 2);
+    Dest[Length++] = ' ';
+    Length += SprintPaddedDigits(Dest + Length, SecondOfDay / 3600, 2);
+    Dest[Length++] = ':';
+    Length += SprintPaddedDigits(Dest + Length, SecondOfDay / 60 % 60, 2);
+    Assert(Length == DIRECTORY_INDEX_DATE_LENGTH);
+    return Length;
+}
+
+internal int
+CompareDirectoryEntries(const void *A, const void *B)
+{
+    // NOTE(vincent): Folders before files, then byte order of the names.
+    platform_directory_entry *EntryA = (platform_directory_entry *)A;
+    platform_directory_entry *EntryB = (platform_directory_entry *)B;
+    if (EntryA->IsDirectory != EntryB->IsDirectory)
+        return EntryA->IsDirectory ? -1 : 1;
+    u32 Byte = 0;
+    while (EntryA->Name[Byte] && EntryA->Name[Byte] == EntryB->Name[Byte])
+        Byte++;
+    int Result = (int)(u8)EntryA->Name[Byte] - (int)(u8)EntryB->Name[Byte];
+    return Result;
+}
+
+internal u32
+SortDirectoryEntries(platform_directory_entry *Entries, u32 Count)
+{
+    // NOTE(vincent): Drops the dot files, then sorts what's left. Names are unique within a directory,
+    // so qsort() not being stable doesn't matter.
+    u32 Kept = 0;
+    for (u32 Index = 0; Index < Count; Index++)
+    {
+        if (Entries[Index].Name[0] != '.')
+            Entries[Kept++] = Entries[Index];
+    }
+    qsort(Entries, Kept, sizeof(platform_directory_entry), CompareDirectoryEntries);
+    return Kept;
+}
+
+inline u32
+DirectoryIndexMaxLength(string Directory, platform_directory_entry *Entries, u32 Count)
+{
+    // NOTE(vincent): Names are at most 255 bytes, so an entry takes at most 160 + 9*255 bytes.
+    u32 Result = 640 + 12*Directory.Length;
+    for (u32 Index = 0; Index < Count; Index++)
+        Result += 160 + 9*StringLength(Entries[Index].Name);
+    return Result;
+}
+
+internal u32
+SprintDirectoryIndex(char *Dest, string Directory, platform_directory_entry *Entries, u32 Count, u32 Unlisted)
+{
+    // NOTE(vincent): The page body. Directory is relative to the vhost root with its ending slash ("a/b/"),
+    // or empty for the root. Entries are already sorted, and Unlisted more were left out after them.
+    // Dest holds DirectoryIndexMaxLength() bytes.
+    u32 Length = SprintNoNull(Dest, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of /");
+    Length += SprintHTMLEscaped(Dest + Length, Directory);
+    Length += SprintNoNull(Dest + Length, "</title></head>\n<body>\n<h1>Index of /");
+    Length += SprintHTMLEscaped(Dest + Length, Directory);
+    Length += SprintNoNull(Dest + Length, "</h1>\n<table>\n<tr><th>Name</th><th>Size</th><th>Last modified</th></tr>\n");
+    if (Directory.Length)
+        Length += SprintNoNull(Dest + Length, "<tr><td><a href=\"../\">../</a></td><td></td><td></td></tr>\n");
+    
+    for (u32 Index = 0; Index < Count; Index++)
+    {
+        platform_directory_entry *Entry = Entries + Index;
+        string Name = StringFromLiteral(Entry->Name);
+        char *Slash = (char *)(Entry->IsDirectory ? "/" : "");
+        Length += SprintNoNull(Dest + Length, "<tr><td><a href=\"");
+        Length += SprintPercentEncoded(Dest + Length, Name);
+        Length += SprintNoNull(Dest + Length, Slash);
+        Length += SprintNoNull(Dest + Length, "\">");
+        Length += SprintHTMLEscaped(Dest + Length, Name);
+        Length += SprintNoNull(Dest + Length, Slash);
+        Length += SprintNoNull(Dest + Length, "</a></td><td>");
+        if (Entry->IsDirectory)
+            Dest[Length++] = '-';
+        else
+            Length += SprintU64(Dest + Length, Entry->Size);
+        Length += SprintNoNull(Dest + Length, "</td><td>");
+        Length += SprintListingDate(Dest + Length, Entry->ModificationTime);
+        Length += SprintNoNull(Dest + Length, "</td></tr>\n");
+    }
+    if (Unlisted)
+    {
+        Length += SprintNoNull(Dest + Length, "<tr><td colspan=\"3\">");
+        Length += SprintU64(Dest + Length, Unlisted);
+        Length += SprintNoNull(Dest + Length, " more entries not listed</td></tr>\n");
+    }
+    Length += SprintNoNull(Dest + Length, "</table>\n</body></html>\n");
+    return Length;
+}
+
+internal string
+PushDirectoryIndexPage(memory_arena *Arena, platform_directory Root, string Directory)
+{
+    // NOTE(vincent): The whole response for Directory, or a zero Base when it can't be listed.
+    string Result = {};
+    char *Path = PushArray(Arena, Directory.Length + 1, char);
+    Sprint(Path, Directory);
+    platform_directory_listing Listing = PushDirectoryListing(Arena, Root, Path, true);
+    if (Listing.Success)
+    {
+        u32 Count = SortDirectoryEntries(Listing.Entries, Listing.Count);
+        u32 Listed = Minimum(Count, DIRECTORY_INDEX_MAX_ENTRIES);
+        u32 MaxLength = DirectoryIndexMaxLength(Directory, Listing.Entries, Listed);
+        u32 HeaderMaxLength = sizeof(STRING_DIRECTORY_INDEX_HEADER) + 24;
+        if (HeaderMaxLength + MaxLength <= Arena->Size - Arena->Used)
+        {
+            // NOTE(vincent): The body goes after room for the header block, which then ends right before it.
+            char *Page = PushArray(Arena, HeaderMaxLength + MaxLength, char);
+            char *Body = Page + HeaderMaxLength;
+            u32 BodyLength = SprintDirectoryIndex(Body, Directory, Listing.Entries, Listed, Count - Listed);
+            Assert(BodyLength <= MaxLength);
+            
+            char Header[sizeof(STRING_DIRECTORY_INDEX_HEADER) + 24];
+            u32 HeaderLength = SprintNoNull(Header, STRING_DIRECTORY_INDEX_HEADER);
+            HeaderLength += SprintU64(Header + HeaderLength, BodyLength);
+            HeaderLength += SprintNoNull(Header + HeaderLength, "\r\n\r\n");
+            Result.Base = Body - HeaderLength;
+            Result.Length = HeaderLength + BodyLength;
+            memcpy(Result.Base, Header, HeaderLength);
+        }
+    }
+    return Result;
+}
+
+internal void
+ResetDirectoryIndexCache(directory_index_cache *Cache)
+{
+    for (u32 EntryIndex = 0; EntryIndex < DIRECTORY_INDEX_CACHE_ENTRY_COUNT; EntryIndex++)
+        Cache->Entries[EntryIndex].InUse = false;
+    Cache->EntryCount = 0;
+    Cache->Arena.Used = 0;
+    Cache->Resets++;
+}
+
+internal directory_index_cache_entry *
+FindDirectoryIndexCacheEntry(directory_index_cache *Cache, u32 HostIndex, string Directory, b32 Create)
+{
+    // NOTE(vincent): Open addressing, the same as FindHtpasswdCacheEntry().
+    directory_index_cache_entry *Result = 0;
+    if (Directory.Length <= DIRECTORY_INDEX_CACHE_MAX_PATH)
+    {
+        u32 Hash = HashString(Directory) ^ (HostIndex*0x9E3779B9);
+        for (u32 Probe = 0; Probe < DIRECTORY_INDEX_CACHE_ENTRY_COUNT; Probe++)
+        {
+            directory_index_cache_entry *Entry =
+                Cache->Entries + ((Hash + Probe) & (DIRECTORY_INDEX_CACHE_ENTRY_COUNT - 1));
+            if (!Entry->InUse)
+            {
+                if (Create)
+                {
+                    Entry->InUse = true;
+                    Entry->Hash = Hash;
+                    Entry->HostIndex = HostIndex;
+                    Entry->KeyLength = Directory.Length;
+                    SprintNoNull(Entry->Key, Directory);
+                    Cache->EntryCount++;
+                    Result = Entry;
+                }
+                break;
+            }
+            if (Entry->Hash == Hash && Entry->HostIndex == HostIndex &&
+                StringsAreEqual(StringBaseLength(Entry->Key, Entry->KeyLength), Directory))
+            {
+                Result = Entry;
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+inline string
+PushStringCopy(memory_arena *Arena, string Source)
+{
+    string Result = StringBaseLength(PushArray(Arena, Source.Length, char), Source.Length);
+    memcpy(Result.Base, Source.Base, Source.Length);
+    return Result;
+}
+
+internal string
+ServeDirectoryIndex(directory_index_cache *Cache, content_generations *Generations, memory_arena *Arena,
+                    virtual_host *Host, string Directory, negative_cache_stamp Stamp)
+{
+    // NOTE(vincent): Stamp was taken on Directory's index.html before it was found missing.
+    // A hit is copied out under the lock, since a reset may reuse the cache arena as soon as we release it.
+    string Result = {};
+    b32 Cached = false;
+    BeginTicketMutex(&Cache->Mutex);
+    directory_index_cache_entry *Entry = FindDirectoryIndexCacheEntry(Cache, Host->CacheKey, Directory, false);
+    if (Entry && NegativeCacheStampIsCurrent(Generations, Entry->Stamp, Stamp))
+    {
+        Cached = true;
+        Cache->Hits++;
+        if (Entry->Page.Base)
+            Result = PushStringCopy(Arena, Entry->Page);
+    }
+    EndTicketMutex(&Cache->Mutex);
+    
+    if (!Cached)
+    {
+        Result = PushDirectoryIndexPage(Arena, Host->Directory, Directory);
+        
+        BeginTicketMutex(&Cache->Mutex);
+        Cache->Renders++;
+        if (Cache->EntryCount >= DIRECTORY_INDEX_CACHE_MAX_LOAD ||
+            Result.Length > Cache->Arena.Size - Cache->Arena.Used)
+        {
+            ResetDirectoryIndexCache(Cache);
+        }
+        // NOTE(vincent): A page too big for an empty cache is served without being cached.
+        if (Result.Length <= Cache->Arena.Size)
+        {
+            Entry = FindDirectoryIndexCacheEntry(Cache, Host->CacheKey, Directory, true);
+            if (Entry)
+            {
+                Entry->Stamp = Stamp;
+                Entry->Page = Result.Base ? PushStringCopy(&Cache->Arena, Result) : Result;
+            }
+        }
+        EndTicketMutex(&Cache->Mutex);
+    }
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestDirectoryIndex()
+{
+    char Buffer[1024];
+    u32 Length = SprintPercentEncoded(Buffer, StringFromLiteral("a b/c%d~\xC3\xA9"));
+    Assert(StringsAreEqual(StringBaseLength(Buffer, Length), "a%20b/c%25d~%C3%A9"));
+    Length = SprintHTMLEscaped(Buffer, StringFromLiteral("<a href=\"x\">&'"));
+    Assert(StringsAreEqual(StringBaseLength(Buffer, Length), "&lt;a href=&quot;x&quot;&gt;&amp;&#39;"));
+    
+    Length = SprintListingDate(Buffer, 0);
+    Assert(StringsAreEqual(StringBaseLength(Buffer, Length), "1970-01-01 00:00"));
+    Length = SprintListingDate(Buffer, 951782400 + 86399);    // the end of February 29th, 2000
+    Assert(StringsAreEqual(StringBaseLength(Buffer, Length), "2000-02-29 23:59"));
+    Length = SprintListingDate(Buffer, 1704067199);
+    Assert(StringsAreEqual(StringBaseLength(Buffer, Length), "2023-12-31 23:59"));
+    
+    platform_directory_entry Entries[] =
+    {
+        {"zeta.html", 10, 0, false},
+        {".htpasswd", 20, 0, false},
+        {"images", 4096, 0, true},
+        {"Alpha.css", 30, 0, false},
+        {"a&b.txt", 1234567, 1704067199, false},
+        {"css", 4096, 0, true},
+    };
+    u32 Count = SortDirectoryEntries(Entries, ArrayCount(Entries));
+    char *Sorted[] = {"css", "images", "Alpha.css", "a&b.txt", "zeta.html"};
+    Assert(Count == ArrayCount(Sorted));
+    for (u32 Index = 0; Index < Count; Index++)
+        Assert(StringsAreEqual(Entries[Index].Name, Sorted[Index]));
+    
+    string Directory = StringFromLiteral("docs/");
+    static char Page[4096];
+    Assert(DirectoryIndexMaxLength(Directory, Entries, Count) <= sizeof(Page));
+    string Body = StringBaseLength(Page, SprintDirectoryIndex(Page, Directory, Entries, Count, 0));
+    Assert(StringContains(Body, "<title>Index of /docs/</title>"));
+    Assert(StringContains(Body, "<a href=\"../\">"));
+    Assert(StringContains(Body, "<a href=\"css/\">css/</a></td><td>-</td>"));
+    Assert(StringContains(Body, "<a href=\"a%26b.txt\">a&amp;b.txt</a></td><td>1234567</td><td>2023-12-31 23:59</td>"));
+    Assert(!StringContains(Body, "htpasswd") && !StringContains(Body, "not listed"));
+    
+    Body = StringBaseLength(Page, SprintDirectoryIndex(Page, StringFromLiteral(""), Entries, 2, Count - 2));
+    Assert(StringContains(Body, "<title>Index of /</title>") && !StringContains(Body, "../"));
+    Assert(StringContains(Body, "images/") && !StringContains(Body, "Alpha.css"));
+    Assert(StringContains(Body, "<tr><td colspan=\"3\">3 more entries not listed</td></tr>"));
+    
+    // NOTE(vincent): The biggest page we can cache has to fit in an empty cache arena.
+    static char LongestName[256];
+    static platform_directory_entry Longest[DIRECTORY_INDEX_MAX_ENTRIES];
+    memset(LongestName, 'x', 255);
+    for (u32 Index = 0; Index < ArrayCount(Longest); Index++)
+        Longest[Index].Name = LongestName;
+    string LongestDirectory = StringBaseLength(LongestName, DIRECTORY_INDEX_CACHE_MAX_PATH);
+    u32 LongestPage = DirectoryIndexMaxLength(LongestDirectory, Longest, ArrayCount(Longest));
+    Assert(sizeof(STRING_DIRECTORY_INDEX_HEADER) + 24 + LongestPage <= DIRECTORY_INDEX_CACHE_ARENA_SIZE);
+}
+#endif
@@ -0,0 +1,386 @@
+// NOTE(vincent): Compiled .htpasswd files. A .htpasswd holds whitespace-separated "user:md5hex" entries.
+// Instead of rescanning that text on every request, each file is parsed once into a hash table of users
+// with binary digests, and kept in a cache keyed by the directory it protects. Directories without
+// a .htpasswd are cached too, so the walk up to the vhost root doesn't touch the disk once warm.
+//
+// Cache entries are checked against a stamp, like the negative cache: the content generations when a watcher
+// runs, the file's size, modification time and identity otherwise. A site bundle never changes.
+// Tables live in the cache's own arena. When that arena or the entry table fills up, the whole cache
+// is dropped and refilled on demand, which is simpler than freeing tables one by one and rare in practice.
+
+#define HTPASSWD_DIGEST_SIZE 16
+#define HTPASSWD_CACHE_ENTRY_COUNT 512     // power of two
+#define HTPASSWD_CACHE_MAX_LOAD 384        // entries in use before we drop everything
+#define HTPASSWD_CACHE_MAX_PATH 192        // longer directories are compiled per request, not cached
+#define HTPASSWD_CACHE_ARENA_SIZE Megabytes(1)
+
+struct htpasswd_user
+{
+    u32 NameHash;
+    u32 NameLength;       // 0 for an empty slot
+    char *Name;
+    u8 Digest[HTPASSWD_DIGEST_SIZE];
+};
+
+struct htpasswd_table
+{
+    u32 SlotMask;         // slot count minus one, the slot count is a power of two
+    u32 UserCount;
+    htpasswd_user *Slots;
+};
+
+struct htpasswd_credentials
+{
+    string User;
+    u8 Digest[HTPASSWD_DIGEST_SIZE];   // MD5 of the password
+    b32 Present;                       // the request had an Authorization header
+    b32 Valid;                         // and it decoded to user:password
+};
+
+struct htpasswd_stamp
+{
+    b32 WatcherActive;
+    u32 Epoch;
+    u32 Protection;
+    platform_file_info File;      // only filled when no watcher runs
+};
+
+struct htpasswd_cache_entry
+{
+    u32 Hash;
+    u32 HostIndex;
+    u32 KeyLength;
+    b32 InUse;
+    htpasswd_stamp Stamp;
+    b32 Exists;                   // the directory has a .htpasswd
+    htpasswd_table *Table;        // its compiled form, 0 if that failed
+    char Key[HTPASSWD_CACHE_MAX_PATH];
+};
+
+struct htpasswd_cache
+{
+    ticket_mutex Mutex;
+    memory_arena Arena;
+    u32 EntryCount;
+    htpasswd_cache_entry Entries[HTPASSWD_CACHE_ENTRY_COUNT];
+    
+    u64 Hits;
+    u64 Compiles;         // .htpasswd files read and compiled
+    u64 Resets;
+};
+
+inline s32
+HexDigitToValue(char C)
+{
+    s32 Result = -1;
+    if ('0' <= C && C <= '9')
+        Result = C - '0';
+    else if ('a' <= C && C <= 'f')
+        Result = C - 'a' + 10;
+    else if ('A' <= C && C <= 'F')
+        Result = C - 'A' + 10;
+    return Result;
+}
+
+internal b32
+ParseHexDigest(string Hex, u8 *Digest)
+{
+    // NOTE(vincent): 32 hexits, in the order PrintMD5NoNull() prints the bytes of an md5_result.
+    b32 Valid = (Hex.Length == 2*HTPASSWD_DIGEST_SIZE);
+    for (u32 Byte = 0; Valid && Byte < HTPASSWD_DIGEST_SIZE; Byte++)
+    {
+        s32 High = HexDigitToValue(Hex.Base[2*Byte]);
+        s32 Low = HexDigitToValue(Hex.Base[2*Byte + 1]);
+        Valid = (High >= 0 && Low >= 0);
+        Digest[Byte] = (u8)(High*16 + Low);
+    }
+    return Valid;
+}
+
+internal b32
+DigestsAreEqual(u8 *A, u8 *B)
+{
+    // NOTE(vincent): Constant time, no early out: how long this takes says nothing about
+    // how many leading bytes matched.
+    u8 Difference = 0;
+    for (u32 Byte = 0; Byte < HTPASSWD_DIGEST_SIZE; Byte++)
+        Difference |= A[Byte] ^ B[Byte];
+    b32 Result = (Difference == 0);
+    return Result;
+}
+
+inline b32
+IsHtpasswdWhitespace(char C)
+{
+    b32 Result = (C == ' ' || C == '\t' || C == '\r' || C == '\n');
+    return Result;
+}
+
+internal htpasswd_table *
+CompileHtpasswd(memory_arena *Arena, char *Text, size_t Size)
+{
+    // NOTE(vincent): Returns 0 when the table doesn't fit in the arena. Entries that aren't "user:md5hex"
+    // are skipped, so a file with no valid entry compiles to an empty table that grants nobody.
+    u32 CandidateCount = 0;
+    u32 NameBytes = 0;
+    u32 Byte = 0;
+    while (Byte < Size)
+    {
+        while (Byte < Size && IsHtpasswdWhitespace(Text[Byte]))
+            Byte++;
+        u32 TokenStart = Byte;
+        while (Byte < Size && !IsHtpasswdWhitespace(Text[Byte]))
+            Byte++;
+        if (Byte > TokenStart)
+        {
+            CandidateCount++;
+            NameBytes += Byte - TokenStart;
+        }
+    }
+    
+    u32 SlotCount = 4;
+    while (SlotCount < 2*CandidateCount)
+        SlotCount *= 2;
+    NameBytes = (NameBytes + 7) & ~7;
+    u64 NeededSize = sizeof(htpasswd_table) + (u64)SlotCount*sizeof(htpasswd_user) + NameBytes;
+    if (NeededSize > Arena->Size - Arena->Used)
+        return 0;
+    
+    htpasswd_table *Table = PushStruct(Arena, htpasswd_table);
+    Table->SlotMask = SlotCount - 1;
+    Table->UserCount = 0;
+    Table->Slots = PushArray(Arena, SlotCount, htpasswd_user);
+    for (u32 SlotIndex = 0; SlotIndex < SlotCount; SlotIndex++)
+        Table->Slots[SlotIndex].NameLength = 0;
+    char *Names = PushArray(Arena, NameBytes, char);
+    
+    Byte = 0;
+    while (Byte < Size)
+    {
+        while (Byte < Size && IsHtpasswdWhitespace(Text[Byte]))
+            Byte++;
+        string Token = StringBaseLength(Text + Byte, 0);
+        while (Byte < Size && !IsHtpasswdWhitespace(Text[Byte]))
+            Byte++;
+        Token.Length = (u32)(Text + Byte - Token.Base);
+        
+        string Name = StringPrefixUntil(Token, ':');
+        u8 Digest[HTPASSWD_DIGEST_SIZE];
+        if (Name.Length > 0 && Name.Length < Token.Length &&
+            ParseHexDigest(StringFromOffset(Token, Name.Length + 1), Digest))
+        {
+            htpasswd_user *User = 0;
+            u32 Hash = HashString(Name);
+            for (u32 Probe = 0; !User; Probe++)
+            {
+                htpasswd_user *Slot = Table->Slots + ((Hash + Probe) & Table->SlotMask);
+                if (Slot->NameLength == 0)
+                    User = Slot;
+            }
+            User->NameHash = Hash;
+            User->NameLength = Name.Length;
+            User->Name = Names;
+            SprintNoNull(Names, Name);
+            Names += Name.Length;
+            for (u32 DigestByte = 0; DigestByte < HTPASSWD_DIGEST_SIZE; DigestByte++)
+                User->Digest[DigestByte] = Digest[DigestByte];
+            Table->UserCount++;
+        }
+    }
+    
+    return Table;
+}
+
+internal b32
+HtpasswdGrantsAccess(htpasswd_table *Table, htpasswd_credentials *Credentials)
+{
+    // NOTE(vincent): A user may be listed more than once, any of their digests grants access.
+    // Every digest with a matching name gets compared, there's no early out on the first match.
+    b32 Result = false;
+    if (Credentials->Valid)
+    {
+        u32 Hash = HashString(Credentials->User);
+        for (u32 Probe = 0; Probe <= Table->SlotMask; Probe++)
+        {
+            htpasswd_user *Slot = Table->Slots + ((Hash + Probe) & Table->SlotMask);
+            if (Slot->NameLength == 0)
+                break;
+            if (Slot->NameHash == Hash && StringsAreEqual(StringBaseLength(Slot->Name, Slot->NameLength), 
+                                                          Credentials->User))
+            {
+                Result |= DigestsAreEqual(Slot->Digest, Credentials->Digest);
+            }
+        }
+    }
+    return Result;
+}
+
+internal void
+ResetHtpasswdCache(htpasswd_cache *Cache)
+{
+    for (u32 EntryIndex = 0; EntryIndex < HTPASSWD_CACHE_ENTRY_COUNT; EntryIndex++)
+        Cache->Entries[EntryIndex].InUse = false;
+    Cache->EntryCount = 0;
+    Cache->Arena.Used = 0;
+    Cache->Resets++;
+}
+
+internal htpasswd_cache_entry *
+FindHtpasswdCacheEntry(htpasswd_cache *Cache, u32 HostIndex, string Directory, b32 Create)
+{
+    // NOTE(vincent): Open addressing. With Create, returns the entry to fill in when the directory isn't
+    // there yet, or 0 if the key is too long. The caller keeps EntryCount under HTPASSWD_CACHE_MAX_LOAD.
+    htpasswd_cache_entry *Result = 0;
+    if (Directory.Length <= HTPASSWD_CACHE_MAX_PATH)
+    {
+        u32 Hash = HashString(Directory) ^ (HostIndex*0x9E3779B9);
+        for (u32 Probe = 0; Probe < HTPASSWD_CACHE_ENTRY_COUNT; Probe++)
+        {
+            htpasswd_cache_entry *Entry = Cache->Entries + ((Hash + Probe) & (HTPASSWD_CACHE_ENTRY_COUNT - 1));
+            if (!Entry->InUse)
+            {
+                if (Create)
+                {
+                    Entry->InUse = true;
+                    Entry->Hash = Hash;
+                    Entry->HostIndex = HostIndex;
+                    Entry->KeyLength = Directory.Length;
+                    SprintNoNull(Entry->Key, Directory);
+                    Cache->EntryCount++;
+                    Result = Entry;
+                }
+                break;
+            }
+            if (Entry->Hash == Hash && Entry->HostIndex == HostIndex &&
+                StringsAreEqual(StringBaseLength(Entry->Key, Entry->KeyLength), Directory))
+            {
+                Result = Entry;
+                break;
+            }
+        }
+    }
+    return Result;
+}
+
+inline b32
+HtpasswdStampsAreEqual(htpasswd_stamp A, htpasswd_stamp B)
+{
+    b32 Result = (A.WatcherActive == B.WatcherActive && A.Epoch == B.Epoch && A.Protection == B.Protection &&
+                  A.File.Exists == B.File.Exists && A.File.Size == B.File.Size && 
+                  A.File.ModificationTime == B.File.ModificationTime && A.File.Identity == B.File.Identity);
+    return Result;
+}
+
+internal htpasswd_table *
+CacheHtpasswdFile(htpasswd_cache *Cache, memory_arena *Arena, u32 HostIndex, string Directory,
+                  htpasswd_stamp Stamp, push_read_entire_file *ReadResult, b32 Cacheable)
+{
+    // NOTE(vincent): Called under the cache lock with what reading Directory's .htpasswd gave, returns
+    // its compiled table. What isn't cached gets compiled into Arena, for this request only: a file too big
+    // for an empty cache, and any file under a directory too long to be a key, since no entry would
+    // reference its table and the cache arena would fill up with them.
+    if (Directory.Length > HTPASSWD_CACHE_MAX_PATH)
+        Cacheable = false;
+    
+    htpasswd_table *Table = 0;
+    if (ReadResult->Success)
+    {
+        // NOTE(vincent): When the cache is full we drop all of it.
+        Cache->Compiles++;
+        if (Cacheable)
+        {
+            if (Cache->EntryCount >= HTPASSWD_CACHE_MAX_LOAD)
+                ResetHtpasswdCache(Cache);
+            Table = CompileHtpasswd(&Cache->Arena, ReadResult->Memory, ReadResult->Size);
+            if (!Table && Cache->Arena.Used > 0)
+            {
+                ResetHtpasswdCache(Cache);
+                Table = CompileHtpasswd(&Cache->Arena, ReadResult->Memory, ReadResult->Size);
+            }
+        }
+        if (!Table)
+        {
+            Cacheable = false;
+            Table = CompileHtpasswd(Arena, ReadResult->Memory, ReadResult->Size);
+        }
+    }
+    else if (Cacheable && Cache->EntryCount >= HTPASSWD_CACHE_MAX_LOAD)
+    {
+        ResetHtpasswdCache(Cache);
+    }
+    
+    htpasswd_cache_entry *Entry = Cacheable ? FindHtpasswdCacheEntry(Cache, HostIndex, Directory, true) : 0;
+    if (Entry)
+    {
+        Entry->Stamp = Stamp;
+        Entry->Exists = (ReadResult->Memory != 0);
+        Entry->Table = Table;
+    }
+    return Table;
+}
+
+#if DEBUG
+internal void
+TestCompileHtpasswd()
+{
+    char Text[] = "user:ee11cbb19052e40b07aac0ca060c23ee\n"
+        "  admin:9E107D9D372BB6826BD81D3542A419D6\t\r\n"
+        "broken:1234 nocolon :ee11cbb19052e40b07aac0ca060c23ee\n"
+        "user:d41d8cd98f00b204e9800998ecf8427e";   // last entry without a newline, user listed twice
+    u8 Memory[4096];
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(Memory), Memory);
+    htpasswd_table *Table = CompileHtpasswd(&Arena, Text, sizeof(Text) - 1);
+    Assert(Table && Table->UserCount == 3);
+    
+    htpasswd_credentials Credentials = {};
+    Credentials.Valid = true;
+    Credentials.User = StringFromLiteral("user");
+    ParseHexDigest(StringFromLiteral("ee11cbb19052e40b07aac0ca060c23ee"), Credentials.Digest);
+    Assert(HtpasswdGrantsAccess(Table, &Credentials));
+    ParseHexDigest(StringFromLiteral("d41d8cd98f00b204e9800998ecf8427e"), Credentials.Digest);
+    Assert(HtpasswdGrantsAccess(Table, &Credentials));
+    ParseHexDigest(StringFromLiteral("9e107d9d372bb6826bd81d3542a419d6"), Credentials.Digest);
+    Assert(!HtpasswdGrantsAccess(Table, &Credentials));
+    Credentials.User = StringFromLiteral("admin");
+    Assert(HtpasswdGrantsAccess(Table, &Credentials));
+    Credentials.User = StringFromLiteral("broken");
+    Assert(!HtpasswdGrantsAccess(Table, &Credentials));
+    Credentials.User = StringFromLiteral("");
+    Assert(!HtpasswdGrantsAccess(Table, &Credentials));
+    Credentials.Valid = false;
+    Credentials.User = StringFromLiteral("admin");
+    Assert(!HtpasswdGrantsAccess(Table, &Credentials));
+    
+    // NOTE(vincent): Not enough room.
+    InitializeArena(&Arena, 64, Memory);
+    Assert(CompileHtpasswd(&Arena, Text, sizeof(Text) - 1) == 0);
+    Assert(Arena.Used == 0);
+    
+    // NOTE(vincent): A directory too long to be cached is compiled into the request's arena, the cache
+    // arena doesn't grow. A short one is cached.
+    static htpasswd_cache Cache;
+    u8 CacheMemory[4096];
+    InitializeArena(&Cache.Arena, sizeof(CacheMemory), CacheMemory);
+    InitializeArena(&Arena, sizeof(Memory), Memory);
+    char LongDirectory[HTPASSWD_CACHE_MAX_PATH + 8];
+    for (u32 Byte = 0; Byte < sizeof(LongDirectory); Byte++)
+        LongDirectory[Byte] = (Byte % 10 == 9) ? '/' : 'd';
+    push_read_entire_file ReadResult = {};
+    ReadResult.Memory = Text;
+    ReadResult.Size = sizeof(Text) - 1;
+    ReadResult.Success = true;
+    htpasswd_stamp Stamp = {};
+    for (u32 Request = 0; Request < 3; Request++)
+    {
+        Table = CacheHtpasswdFile(&Cache, &Arena, 1, StringBaseLength(LongDirectory, sizeof(LongDirectory)),
+                                  Stamp, &ReadResult, true);
+        Assert(Table && Table->UserCount == 3);
+    }
+    Assert(Cache.Arena.Used == 0 && Cache.EntryCount == 0 && Arena.Used > 0);
+    Table = CacheHtpasswdFile(&Cache, &Arena, 1, StringFromLiteral("private/"), Stamp, &ReadResult, true);
+    Assert(Table && Cache.Arena.Used > 0 && Cache.EntryCount == 1);
+    htpasswd_cache_entry *Entry = FindHtpasswdCacheEntry(&Cache, 1, StringFromLiteral("private/"), false);
+    Assert(Entry && Entry->Exists && Entry->Table == Table);
+}
+#endif
@@ -15,13 +15,147 @@ enum http_version
 struct http_request
 {
     http_method Method;
-    string RequestPath;
+    string RequestPath;    // canonical, relative to the vhost root and null-terminated, e.g. "images/a.png"
     http_version HttpVersion;
     string Host;
     string AuthString;
+    string IfNoneMatch;
+    b32 AcceptsGzip;
+    b32 NamesDirectory;    // the target was a directory, RequestPath got DEFAULT_INDEX_FILE appended
     b32 IsValid;
 };
 
+#define DEFAULT_INDEX_FILE "index.html"
+
+inline s32
+HexDigitValue(char C)
+{
+    s32 Result = -1;
+    if ('0' <= C && C <= '9')
+        Result = C - '0';
+    else if ('a' <= C && C <= 'f')
+        Result = C - 'a' + 10;
+    else if ('A' <= C && C <= 'F')
+        Result = C - 'A' + 10;
+    return Result;
+}
+
+internal string
+CanonicalizeRequestPath(string Path, u32 Capacity, b32 *NamesDirectory)
+{
+    // NOTE(vincent): Rewrites the request target in place, in one pass, into a path relative to the vhost root:
+    // "/a/./b/../c%20d.html?x=1" becomes "a/c d.html". The query string and fragment are dropped,
+    // percent escapes are decoded, empty and dot segments removed, and ".." never climbs above the root.
+    // A target naming a directory ("/", "/a/", "/a/..") gets DEFAULT_INDEX_FILE appended, and NamesDirectory set.
+    // Capacity is how many bytes we may write from Path.Base, the result is null-terminated.
+    // The write cursor never passes the read cursor, since decoding only shrinks and the leading slash goes away.
+    //
+    // We refuse (zero Base) targets that don't start with a slash, bad escapes, escaped slashes,
+    // and decoded null bytes or backslashes, which would mean something else to the OS.
+    string Result = {};
+    b32 Valid = (Path.Length > 0 && Path.Base[0] == '/');
+    char *Out = Path.Base;
+    u32 Written = 0;
+    u32 SegmentStart = 0;
+    b32 IsDirectory = true;
+    
+    for (u32 Read = 1; Valid; Read++)
+    {
+        b32 AtEnd = (Read >= Path.Length || Path.Base[Read] == '?' || Path.Base[Read] == '#');
+        char C = AtEnd ? '/' : Path.Base[Read];
+        b32 IsSeparator = (C == '/');
+        if (C == '%')
+        {
+            s32 High = Read + 2 < Path.Length ? HexDigitValue(Path.Base[Read + 1]) : -1;
+            s32 Low = Read + 2 < Path.Length ? HexDigitValue(Path.Base[Read + 2]) : -1;
+            C = (char)(High*16 + Low);
+            Read += 2;
+            Valid = (High >= 0 && Low >= 0 && C != '/');
+        }
+        if (C == 0 || C == '\\')
+            Valid = false;
+        
+        if (!IsSeparator)
+        {
+            Out[Written++] = C;
+            continue;
+        }
+        
+        // NOTE(vincent): Close the segment we just wrote.
+        u32 SegmentLength = Written - SegmentStart;
+        b32 IsDot = (SegmentLength == 1 && Out[SegmentStart] == '.');
+        b32 IsDotDot = (SegmentLength == 2 && Out[SegmentStart] == '.' && Out[SegmentStart + 1] == '.');
+        IsDirectory = (SegmentLength == 0 || IsDot || IsDotDot || !AtEnd);
+        if (IsDot || IsDotDot)
+        {
+            Written = SegmentStart;
+            if (IsDotDot && Written > 0)
+            {
+                // NOTE(vincent): Also drop the previous segment and its slash.
+                Written--;
+                while (Written > 0 && Out[Written - 1] != '/')
+                    Written--;
+            }
+        }
+        else if (SegmentLength > 0 && !AtEnd)
+        {
+            Out[Written++] = '/';
+        }
+        SegmentStart = Written;
+        
+        if (AtEnd)
+            break;
+    }
+    
+    *NamesDirectory = (Valid && IsDirectory);
+    if (Valid && IsDirectory)
+    {
+        Valid = (Written + sizeof(DEFAULT_INDEX_FILE) <= Capacity);
+        if (Valid)
+            Written += Sprint(Out + Written, DEFAULT_INDEX_FILE);
+    }
+    
+    if (Valid)
+    {
+        Out[Written] = 0;
+        Result = StringBaseLength(Out, Written);
+    }
+    return Result;
+}
+
+internal b32
+RequestHeadIsComplete(char *ReceiveBuffer, int BytesReceived)
+{
+    // NOTE(vincent): The head ends with an empty line, CRLF or bare LF. Rescanning from the start on every
+    // packet is fine, the buffer is 8KB and heads usually come in one packet.
+    b32 Result = false;
+    for (int Byte = 1; !Result && Byte < BytesReceived; Byte++)
+    {
+        if (ReceiveBuffer[Byte] == '\n')
+        {
+            Result = (ReceiveBuffer[Byte - 1] == '\n' ||
+                      (Byte >= 2 && ReceiveBuffer[Byte - 1] == '\r' && ReceiveBuffer[Byte - 2] == '\n'));
+        }
+    }
+    return Result;
+}
+
+internal string
+HeaderFieldValue(string Line, string Field)
+{
+    // NOTE(vincent): What follows "Field:" on the line, without the whitespace around it. Field is a prefix
+    // of Line that stops right before the colon.
+    string Result = StringFromOffset(Line, Field.Length + 1);
+    while (Result.Length && (Result.Base[0] == ' ' || Result.Base[0] == '\t'))
+    {
+        Result.Base++;
+        Result.Length--;
+    }
+    while (Result.Length && (Result.Base[Result.Length - 1] == ' ' || Result.Base[Result.Length - 1] == '\t'))
+        Result.Length--;
+    return Result;
+}
+
 internal http_request
 ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
 {
@@ -42,21 +176,10 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
         if (C == '\r')
         {
             u32 LineLength = ByteIndex - BOL;
+            // NOTE(vincent): Stop on the '\n', the loop steps past it. Stepping past it here too used to skip
+            // the first byte of every line, the '\r' of the blank line that ends the head included.
             ByteIndex++;
-            if (ByteIndex < BytesReceived)
-            {
-                C = ReceiveBuffer[ByteIndex];
-                if (C == '\n')
-                {
-                    ByteIndex++;
-                }
-                else
-                {
-                    FoundError = true;
-                    break;
-                }
-            }
-            else
+            if (ByteIndex >= BytesReceived || ReceiveBuffer[ByteIndex] != '\n')
             {
                 FoundError = true;
                 break;
@@ -73,7 +196,7 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
                 FoundError = true;
                 break;
             }
-            BOL = ByteIndex;
+            BOL = ByteIndex + 1;
         }
     }
     
@@ -84,7 +207,7 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
     {
         // Parse the first line. We are expecting three parts separated by individual spaces:
         // the HTTP method, the HTTP request path, and the HTTP version.
-        string FirstLineWords[3];
+        string FirstLineWords[3] = {};
         string FirstLine = RequestLines[0];
         b32 InWord = false;
         u32 WordIndex = 0;
@@ -109,7 +232,8 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
             }
         }
         
-        if (!FoundError && WordIndex == 2)
+        // NOTE(vincent): InWord, or a trailing space left the third word without a start.
+        if (!FoundError && WordIndex == 2 && InWord)
         {
             FirstLineWords[WordIndex].Length = 
                 (u32)(FirstLine.Base + FirstLine.Length - FirstLineWords[WordIndex].Base);
@@ -143,6 +267,16 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
             {
                 string Line = RequestLines[LineIndex];
                 string Field = StringPrefixUntil(Line, ':');
+                if (Field.Length == Line.Length)
+                {
+                    // NOTE(vincent): No colon, or the end of the head. Either way there's no value to read.
+                    if (Line.Length)
+                    {
+                        Result.IsValid = false;
+                        goto Goto_EndHttpParsing;
+                    }
+                    continue;
+                }
                 
                 // A few notes about this loop:
                 // - This could be inefficient if we threw a bunch of field strings to test here.
@@ -158,23 +292,160 @@ ParseHTTPRequest(char *ReceiveBuffer, int BytesReceived)
                 // when we read all the headers we wanted.
                 if (StringsAreEqual(Field, "Host"))
                 {
-                    Result.Host = StringBaseEnder(Field.Base + Field.Length + 2, '\r');
+                    Result.Host = HeaderFieldValue(Line, Field);
                     Result.IsValid = true;
                 }
                 else if (StringsAreEqual(Field, "Authorization"))
                 {
-                    string AuthString = StringBaseEnder(Field.Base + Field.Length + 2, '\r');
-                    string AuthTypeString = StringBaseEnder(AuthString.Base, ' ');
+                    string AuthString = HeaderFieldValue(Line, Field);
+                    string AuthTypeString = StringPrefixUntil(AuthString, ' ');
                     if (StringsAreEqual(AuthTypeString, "Basic"))
                     {
-                        Result.AuthString = 
-                            StringBaseEnder(AuthTypeString.Base + AuthTypeString.Length + 1, '\r');
+                        Result.AuthString = StringSuffixAfter(AuthString, ' ');
                     }
                 }
+                else if (StringsAreEqual(Field, "If-None-Match"))
+                {
+                    Result.IfNoneMatch = HeaderFieldValue(Line, Field);
+                }
+                else if (StringsAreEqual(Field, "Accept-Encoding"))
+                {
+                    string Encodings = HeaderFieldValue(Line, Field);
+                    Result.AcceptsGzip = StringContains(Encodings, "gzip");
+                }
             }
-        } // END if (!FoundError && WordIndex == 2)
+            
+            // NOTE(vincent): Canonicalize the path last, it overwrites the rest of the first line.
+            if (Result.IsValid)
+            {
+                u32 Capacity = (u32)(FirstLine.Base + FirstLine.Length + 2 - Result.RequestPath.Base);
+                Result.RequestPath = CanonicalizeRequestPath(Result.RequestPath, Capacity, &Result.NamesDirectory);
+                Result.IsValid = (Result.RequestPath.Base != 0);
+            }
+        } // END if (!FoundError && WordIndex == 2 && InWord)
     }
     
     Goto_EndHttpParsing:
     return Result;   // NOTE(vincent): Function always exits here.
 }
+
+#if DEBUG
+internal void
+TestCanonicalizeRequestPath()
+{
+    char *Cases[][2] =
+    {
+        {"/", "index.html"},
+        {"/index.html", "index.html"},
+        {"/assets/css/main.css", "assets/css/main.css"},
+        {"/a/./b/../c.html", "a/c.html"},
+        {"//a///b", "a/b"},
+        {"/a/b/", "a/b/index.html"},
+        {"/a/..", "index.html"},
+        {"/../../etc/passwd", "etc/passwd"},
+        {"/a/%2e%2E/b", "b"},
+        {"/%2e%2e/x", "x"},
+        {"/c%20d.html?x=1&y=/../z", "c d.html"},
+        {"/a.html#frag", "a.html"},
+        {"/dir/?q", "dir/index.html"},
+        {"/%41%62", "Ab"},
+        {"/a/.../b", "a/.../b"},
+        {"/a/..b", "a/..b"},
+        {"", 0},
+        {"index.html", 0},
+        {"/%", 0},
+        {"/%4", 0},
+        {"/%zz", 0},
+        {"/%00", 0},
+        {"/a%2fb", 0},
+        {"/a\\..\\b", 0},
+        {"/%5c", 0},
+    };
+    
+    char Buffer[256];
+    b32 NamesDirectory;
+    for (u32 CaseIndex = 0; CaseIndex < ArrayCount(Cases); CaseIndex++)
+    {
+        // NOTE(vincent): Mimic the request line: the canonical path may use the room of " HTTP/1.1\r\n".
+        u32 Length = Sprint(Buffer, Cases[CaseIndex][0]);
+        string Canonical = CanonicalizeRequestPath(StringBaseLength(Buffer, Length), Length + 11, &NamesDirectory);
+        if (Cases[CaseIndex][1])
+        {
+            Assert(Canonical.Base && StringsAreEqual(Canonical, Cases[CaseIndex][1]));
+            Assert(Canonical.Base[Canonical.Length] == 0);
+        }
+        else
+        {
+            Assert(Canonical.Base == 0);
+        }
+    }
+    
+    // NOTE(vincent): Only the implicit index file names a directory.
+    struct
+    {
+        char *Target;
+        b32 NamesDirectory;
+    } Directories[] = {{"/a/b/?x", true}, {"/a/..", true}, {"/a/index.html", false}, {"/a", false}};
+    for (u32 CaseIndex = 0; CaseIndex < ArrayCount(Directories); CaseIndex++)
+    {
+        u32 Length = Sprint(Buffer, Directories[CaseIndex].Target);
+        string Canonical = CanonicalizeRequestPath(StringBaseLength(Buffer, Length), Length + 11, &NamesDirectory);
+        Assert(Canonical.Base && NamesDirectory == Directories[CaseIndex].NamesDirectory);
+    }
+    
+    // NOTE(vincent): No room for the index file.
+    Sprint(Buffer, "/a/");
+    Assert(CanonicalizeRequestPath(StringBaseLength(Buffer, 3), 3, &NamesDirectory).Base == 0);
+}
+
+internal void
+TestParseHTTPRequest()
+{
+    // NOTE(vincent): Each request sits at the end of the buffer, followed by bytes a parser that reads past
+    // its lines would pick up.
+    char Buffer[512];
+    struct
+    {
+        char *Request;
+        b32 IsValid;
+        char *Host;
+        char *AuthString;
+    } Cases[] =
+    {
+        {"GET / HTTP/1.1\r\nHost: verti\r\n\r\n", true, "verti", ""},
+        {"GET / HTTP/1.1\r\nHost:verti\r\n\r\n", true, "verti", ""},
+        {"GET / HTTP/1.1\r\nHost: \tverti \r\n\r\n", true, "verti", ""},
+        {"GET / HTTP/1.1\r\nHost:\r\n\r\n", true, "", ""},
+        {"GET / HTTP/1.1\r\nHost: a\r\nAuthorization: Basic dTp1\r\n\r\n", true, "a", "dTp1"},
+        {"GET / HTTP/1.1\r\nHost: a\r\nAuthorization: Basic\r\n\r\n", true, "a", ""},
+        {"GET / HTTP/1.1\r\nHost: a\r\nAuthorization:\r\n\r\n", true, "a", ""},
+        {"GET / HTTP/1.1\r\nHost\r\n\r\n", false, 0, 0},
+        {"GET / HTTP/1.1\r\nHost: a\r\nNo colon here\r\n\r\n", false, 0, 0},
+        {"GET / HTTP/1.1 \r\nHost: a\r\n\r\n", false, 0, 0},
+        {"GET / \r\nHost: a\r\n\r\n", false, 0, 0},
+        {" GET / HTTP/1.1\r\nHost: a\r\n\r\n", true, "a", ""},
+        {"GET / HTTP/1.1\r\n", false, 0, 0},
+        {"GET / HTTP/1.1\r\nHost: a", false, 0, 0},
+        {"GET / HTTP/1.1\r\nHost: a\r", false, 0, 0},
+        {"", false, 0, 0},
+    };
+    for (u32 CaseIndex = 0; CaseIndex < ArrayCount(Cases); CaseIndex++)
+    {
+        u32 Length = StringLength(Cases[CaseIndex].Request);
+        char *Request = Buffer + sizeof(Buffer) - 64 - Length;
+        for (u32 Byte = 0; Byte < sizeof(Buffer); Byte++)
+            Buffer[Byte] = "\r\nHost: evil\r\n"[Byte % 14];
+        for (u32 Byte = 0; Byte < Length; Byte++)
+            Request[Byte] = Cases[CaseIndex].Request[Byte];
+        
+        http_request Parsed = ParseHTTPRequest(Request, (int)Length);
+        Assert(Parsed.IsValid == Cases[CaseIndex].IsValid);
+        if (Parsed.IsValid)
+        {
+            Assert(StringsAreEqual(Parsed.Host, Cases[CaseIndex].Host));
+            Assert(StringsAreEqual(Parsed.AuthString, Cases[CaseIndex].AuthString));
+            Assert(Parsed.Host.Base >= Request && Parsed.Host.Base + Parsed.Host.Length <= Request + Length);
+        }
+    }
+}
+#endif
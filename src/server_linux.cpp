@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -13,69 +14,252 @@
 #include <pthread.h>  // NOTE(vincent):  Compile and link with -pthread. semaphore.h also needs it.
 #include <semaphore.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <link.h>
 #include "common.h"
-#define BACKLOG 10         // how many pending connections the queue will hold
 
 #define INVALID_SOCKET -1  // this helps for platform-independent code compatibility with Windows
 typedef int SOCKET;        // same
 #include "server.cpp"
 
 
+#include "work_deque.h"
+
+#define LINUX_PAGE_SIZE 4096
+
+// NOTE(vincent): One deque per thread, the main thread's is index 0. Jobs go to the deque of whichever
+// thread adds them, so the accept loop fills deque 0 and the workers steal from it. A job added from
+// inside a job stays with the thread that added it unless someone idle steals it.
+struct linux_worker
+{
+    platform_work_queue *Queue;
+    u32 Index;
+    b32 Pinned;
+    u32 HomeNode;             // where the thread was when it touched its arena
+    memory_arena Arena;       // Base stays 0 until the thread has set it up
+};
+
 struct platform_work_queue
 {
-    u32 volatile NextEntryToWrite;
-    u32 volatile NextEntryToRead;
+    u32 DequeCount;
     sem_t SemaphoreHandle;
-    platform_work_queue_entry Entries[256];
+    thread_placement Placement;
+    thread_topology Topology;
+    linux_worker Workers[NUMBER_OF_THREADS];
+    work_deque Deques[NUMBER_OF_THREADS];
 };
 
+internal thread_local u32 LinuxWorkerIndex;   // zero on the main thread
+internal thread_local u64 LinuxStackLow;      // the thread's stack, for the profiler's frame walk.
+internal thread_local u64 LinuxStackHigh;     // zero on threads that aren't workers
+
 internal void
 LinuxAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
 {
-    u32 NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % ArrayCount(Queue->Entries);
-    Assert(NewNextEntryToWrite != Queue->NextEntryToWrite);
-    
-    if (NewNextEntryToWrite != Queue->NextEntryToRead)
+    platform_work_queue_entry Entry = {Callback, Data};
+    if (PushWorkDeque(Queue->Deques + LinuxWorkerIndex, Entry))
     {
-        platform_work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
-        Entry->Callback = Callback;
-        Entry->Data = Data;
-        // TODO(vincent): compiler write barrier here?
-        Queue->NextEntryToWrite = NewNextEntryToWrite;
         // increase semaphore count so that a thread blocked by sem_wait() can wake up
         sem_post(&Queue->SemaphoreHandle);
     }
+    else
+    {
+        // NOTE(vincent): Full deque: don't drop the job, do it now.
+        Callback(Queue, Data);
+    }
 }
 
 internal b32
 LinuxDoNextWorkQueueEntry(platform_work_queue *Queue)
 {
     b32 WeShouldSleep = false;
-    u32 OriginalNextEntryToRead = Queue->NextEntryToRead;
-    u32 NewNextEntryToRead = (OriginalNextEntryToRead + 1) % ArrayCount(Queue->Entries);
-    if (OriginalNextEntryToRead != Queue->NextEntryToWrite)
+    platform_work_queue_entry Entry;
+    if (TakeWork(Queue->Deques, Queue->DequeCount, LinuxWorkerIndex, &Entry))
+        Entry.Callback(Queue, Entry.Data);
+    else
+        WeShouldSleep = true;
+    
+    return WeShouldSleep;
+}
+
+internal memory_arena *
+GetThreadArena(platform_work_queue *Queue)
+{
+    memory_arena *Result = &Queue->Workers[LinuxWorkerIndex].Arena;
+    return Result;
+}
+
+internal u32
+GetThreadIndex(platform_work_queue *Queue)
+{
+    return LinuxWorkerIndex;
+}
+
+internal void
+LinuxLoadTopology(thread_topology *Topology)
+{
+    // NOTE(vincent): NUMA nodes and their CPUs from sysfs, keeping only the CPUs we're allowed to run on.
+    // Without sysfs, every allowed CPU goes in node 0.
+    cpu_set_t Allowed;
+    CPU_ZERO(&Allowed);
+    sched_getaffinity(0, sizeof(Allowed), &Allowed);
+    for (u32 Node = 0; Node < MAX_PLACEMENT_NODES; Node++)
     {
-        // That __sync function is a GCC thing. Might also work on LLVM.
-        u32 Index = __sync_val_compare_and_swap(&Queue->NextEntryToRead, OriginalNextEntryToRead, 
-                                                NewNextEntryToRead);
-        if (Index == OriginalNextEntryToRead)
+        char Path[64];
+        sprintf(Path, "/sys/devices/system/node/node%u/cpulist", Node);
+        FILE *File = fopen(Path, "r");
+        if (!File)
+            continue;
+        char List[4096];
+        size_t Size = fread(List, 1, sizeof(List) - 1, File);
+        fclose(File);
+        List[Size] = 0;
+        
+        // NOTE(vincent): Ranges like "0-3,8-11".
+        char *At = List;
+        while (IsDigit(*At))
         {
-            platform_work_queue_entry Entry = Queue->Entries[Index];
-            Entry.Callback(Queue, Entry.Data);
+            u32 First = (u32)strtoul(At, &At, 10);
+            u32 Last = First;
+            if (*At == '-')
+                Last = (u32)strtoul(At + 1, &At, 10);
+            for (u32 CPU = First; CPU <= Last && CPU < CPU_SETSIZE; CPU++)
+            {
+                if (CPU_ISSET(CPU, &Allowed))
+                    AddTopologyCPU(Topology, Node, CPU);
+            }
+            if (*At == ',')
+                At++;
         }
     }
-    else
+    
+    if (Topology->CPUCount == 0)
     {
-        WeShouldSleep = true;
+        for (u32 CPU = 0; CPU < CPU_SETSIZE; CPU++)
+        {
+            if (CPU_ISSET(CPU, &Allowed))
+                AddTopologyCPU(Topology, 0, CPU);
+        }
+    }
+}
+
+internal void
+LinuxSetUpThread(platform_work_queue *Queue, linux_worker *Worker)
+{
+    // NOTE(vincent): Runs on the thread itself, before it takes any job: pin it, then allocate and
+    // touch its arena from there.
+    pthread_attr_t Attributes;
+    if (pthread_getattr_np(pthread_self(), &Attributes) == 0)
+    {
+        void *StackBase;
+        size_t StackSize;
+        if (pthread_attr_getstack(&Attributes, &StackBase, &StackSize) == 0)
+        {
+            LinuxStackLow = (u64)StackBase;
+            LinuxStackHigh = LinuxStackLow + StackSize;
+        }
+        pthread_attr_destroy(&Attributes);
     }
     
-    return WeShouldSleep;
+    thread_topology *Topology = &Queue->Topology;
+    s32 Node = -1;
+    if (Queue->Placement != ThreadPlacement_None && Topology->CPUCount)
+    {
+        u32 Chosen = ChooseThreadCPU(Topology, Queue->Placement, Worker->Index);
+        cpu_set_t Set;
+        CPU_ZERO(&Set);
+        CPU_SET(Topology->CPUs[Chosen], &Set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0)
+        {
+            Worker->Pinned = true;
+            Node = Topology->CPUNodes[Chosen];
+            printf("Thread %u pinned to CPU %u, node %d\n", Worker->Index, Topology->CPUs[Chosen], Node);
+        }
+        else
+            fprintf(stderr, "Couldn't pin thread %u to CPU %u\n", Worker->Index, Topology->CPUs[Chosen]);
+    }
+    
+    u8 *Base = (u8 *)mmap(0, THREAD_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (Base == MAP_FAILED)
+    {
+        perror("mmap failed");
+        exit(1);
+    }
+    if (Node >= 0 && Topology->NodeCount > 1)
+    {
+        // NOTE(vincent): Preferred rather than bound: when our node runs out of memory, remote pages
+        // are better than failing.
+        unsigned long NodeMask[MAX_PLACEMENT_NODES / 64] = {};
+        NodeMask[Node / 64] |= 1UL << (Node % 64);
+        if (syscall(SYS_mbind, Base, THREAD_ARENA_SIZE, MPOL_PREFERRED, NodeMask, MAX_PLACEMENT_NODES + 1, 0) != 0)
+            perror("mbind failed");
+    }
+    
+    // NOTE(vincent): With the default policy, a page goes to the node of the CPU that first touches it.
+    for (u32 Offset = 0; Offset < THREAD_ARENA_SIZE; Offset += LINUX_PAGE_SIZE)
+        Base[Offset] = 0;
+    unsigned CPU = 0;
+    unsigned CurrentNode = 0;
+    syscall(SYS_getcpu, &CPU, &CurrentNode, 0);
+    Worker->HomeNode = Node >= 0 ? (u32)Node : CurrentNode;
+    
+    InitializeArena(&Worker->Arena, THREAD_ARENA_SIZE, Base);
+}
+
+internal platform_placement_stats
+GetPlacementStats(platform_work_queue *Queue)
+{
+    platform_placement_stats Result = {};
+    Result.NodeCount = Queue->Topology.NodeCount;
+    for (u32 WorkerIndex = 0; WorkerIndex < Queue->DequeCount; WorkerIndex++)
+    {
+        linux_worker *Worker = Queue->Workers + WorkerIndex;
+        u8 *Base = Worker->Arena.Base;
+        if (!Base)
+            continue;
+        Result.PinnedThreadCount += Worker->Pinned ? 1 : 0;
+        
+        // NOTE(vincent): move_pages() without target nodes only reports where each page is,
+        // or a negative errno for pages that aren't resident.
+        void *Pages[512];
+        int Status[512];
+        for (u32 Offset = 0; Offset < THREAD_ARENA_SIZE;)
+        {
+            u32 Count = 0;
+            for (; Count < ArrayCount(Pages) && Offset < THREAD_ARENA_SIZE; Count++, Offset += LINUX_PAGE_SIZE)
+                Pages[Count] = Base + Offset;
+            if (syscall(SYS_move_pages, 0, Count, Pages, 0, Status, 0) != 0)
+                break;
+            for (u32 PageIndex = 0; PageIndex < Count; PageIndex++)
+            {
+                if (Status[PageIndex] >= 0 && (u32)Status[PageIndex] == Worker->HomeNode)
+                    Result.LocalPages++;
+                else if (Status[PageIndex] >= 0)
+                    Result.RemotePages++;
+            }
+        }
+    }
+    return Result;
 }
 
 internal void *
 ThreadProc(void *Arg)
 {
-    platform_work_queue *Queue = (platform_work_queue *)Arg;
+    linux_worker *Worker = (linux_worker *)Arg;
+    platform_work_queue *Queue = Worker->Queue;
+    LinuxWorkerIndex = Worker->Index;
+    LinuxSetUpThread(Queue, Worker);
     for (;;)
     {
         if (LinuxDoNextWorkQueueEntry(Queue))
@@ -86,20 +270,29 @@ ThreadProc(void *Arg)
 }
 
 internal void
-LinuxMakeQueue(platform_work_queue *Queue, u32 ThreadCount)
+LinuxMakeQueue(platform_work_queue *Queue, u32 ThreadCount, thread_placement Placement)
 {
-    Queue->NextEntryToWrite = 0;
-    Queue->NextEntryToRead = 0;
+    Assert(ThreadCount < ArrayCount(Queue->Deques));
+    Queue->DequeCount = ThreadCount + 1;
+    Queue->Placement = Placement;
+    LinuxLoadTopology(&Queue->Topology);
     u32 InitialCount = 0;
     sem_init(&Queue->SemaphoreHandle, 0, InitialCount); 
     
+    // NOTE(vincent): The main thread takes jobs too, see PrepareHandshaking().
+    Queue->Workers[0].Queue = Queue;
+    LinuxSetUpThread(Queue, Queue->Workers);
+    
     for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
     {
+        linux_worker *Worker = Queue->Workers + ThreadIndex + 1;
+        Worker->Queue = Queue;
+        Worker->Index = ThreadIndex + 1;
         pthread_t ThreadID;
         pthread_create(&ThreadID,
                        0, // const pthread_attr_t *restrict attr,
                        ThreadProc,
-                       Queue);
+                       Worker);
     }
 }
 
@@ -115,6 +308,17 @@ HandleReceiveError(int BytesReceived, SOCKET ClientSocket)
     return Success;
 }
 
+internal int
+ReceiveSome(SOCKET ClientSocket, char *Buffer, u32 Size)
+{
+    int Result;
+    do
+    {
+        Result = (int)recv(ClientSocket, Buffer, Size, 0);
+    } while (Result == -1 && errno == EINTR);
+    return Result;
+}
+
 internal b32
 HandleSendError(int BytesSent, SOCKET ClientSocket)
 {
@@ -133,108 +337,1420 @@ ShutdownConnection(SOCKET ClientSocket)
     close(ClientSocket);
 }
 
-int main(void)
+internal void
+RefuseConnection(SOCKET ClientSocket, char *Response, u32 Length)
 {
-    // NOTE(vincent): Initialize threads and work queue
-    platform_work_queue Queue = {};
-    LinuxMakeQueue(&Queue, NUMBER_OF_THREADS - 1);
-    
-    // NOTE(vincent): Initializing server memory
-    server_memory ServerMemory = {};
-    void *BaseAddress = 0;
-    ServerMemory.StorageSize = SERVER_STORAGE_SIZE;
-    ServerMemory.Storage = mmap(BaseAddress, ServerMemory.StorageSize, PROT_READ | PROT_WRITE,
-                                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    if (ServerMemory.Storage == MAP_FAILED)
+    send(ClientSocket, Response, Length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(ClientSocket, SHUT_WR);
+    // NOTE(vincent): Closing with unread request bytes makes the kernel answer with a reset, and the client
+    // may then drop the response before reading it. Discard what already arrived, without waiting for more.
+    char Discard[1024];
+    for (u32 Attempt = 0; Attempt < 8 && recv(ClientSocket, Discard, sizeof(Discard), MSG_DONTWAIT) > 0; Attempt++);
+    close(ClientSocket);
+}
+
+internal s64
+SendGather(SOCKET ClientSocket, platform_send_buffer *Buffers, u32 BufferCount)
+{
+    struct iovec Vectors[8];
+    Assert(BufferCount <= ArrayCount(Vectors));
+    for (u32 BufferIndex = 0; BufferIndex < BufferCount; BufferIndex++)
     {
-        perror("mmap failed");
-        return 1;
+        Vectors[BufferIndex].iov_base = Buffers[BufferIndex].Base;
+        Vectors[BufferIndex].iov_len = Buffers[BufferIndex].Length;
     }
-    initialize_server_memory_result InitResult = 
-        InitializeServerMemory(&ServerMemory, &Queue, LinuxAddEntry, LinuxDoNextWorkQueueEntry);
-    
-    if (InitResult.ParsingErrorCount == 0)
+    struct msghdr Message = {};
+    Message.msg_iov = Vectors;
+    Message.msg_iovlen = BufferCount;
+    s64 Result;
+    do
     {
-        struct addrinfo *AddressInfo = 0;
-        struct addrinfo Hints;
-        ZeroBytes((char *)&Hints, sizeof(Hints));
-        Hints.ai_family = AF_UNSPEC;
-        Hints.ai_socktype = SOCK_STREAM;
-        Hints.ai_protocol = IPPROTO_TCP;
-        Hints.ai_flags = AI_PASSIVE;      // "use my IP"
-        
-        // Resolve the local address and port to be used by the server
-        int AddressInfoResult = getaddrinfo(0, InitResult.PortString, &Hints, &AddressInfo);
-        if (AddressInfoResult != 0) 
+        Result = sendmsg(ClientSocket, &Message, MSG_NOSIGNAL);
+    } while (Result == -1 && errno == EINTR);
+    return Result;
+}
+
+internal void
+SetSendLowWatermark(SOCKET ClientSocket, u32 Bytes)
+{
+    if (Bytes && setsockopt(ClientSocket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &Bytes, sizeof(Bytes)) == -1)
+        perror("setsockopt(TCP_NOTSENT_LOWAT) failed");
+}
+
+internal void
+SetSocketTimeouts(SOCKET ClientSocket, u32 ReceiveMilliseconds, u32 SendMilliseconds)
+{
+    struct timeval Timeout;
+    Timeout.tv_sec = ReceiveMilliseconds / 1000;
+    Timeout.tv_usec = (ReceiveMilliseconds % 1000)*1000;
+    if (setsockopt(ClientSocket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout)) == -1)
+        perror("setsockopt(SO_RCVTIMEO) failed");
+    Timeout.tv_sec = SendMilliseconds / 1000;
+    Timeout.tv_usec = (SendMilliseconds % 1000)*1000;
+    if (setsockopt(ClientSocket, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout)) == -1)
+        perror("setsockopt(SO_SNDTIMEO) failed");
+}
+
+internal void
+AbortConnection(SOCKET ClientSocket)
+{
+    shutdown(ClientSocket, SHUT_RDWR);
+}
+
+internal platform_file_mapping
+MapEntireFileReadOnly(char *Filename)
+{
+    platform_file_mapping Result = {};
+    int FileDescriptor = open(Filename, O_RDONLY | O_CLOEXEC);
+    if (FileDescriptor != -1)
+    {
+        struct stat Stat;
+        if (fstat(FileDescriptor, &Stat) == 0 && Stat.st_size > 0)
         {
-            fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(AddressInfoResult));
-            return 1;
+            void *Base = mmap(0, Stat.st_size, PROT_READ, MAP_SHARED, FileDescriptor, 0);
+            if (Base != MAP_FAILED)
+            {
+                Result.Base = Base;
+                Result.Size = (u64)Stat.st_size;
+            }
+            else
+                perror("mmap failed");
         }
-        
-        SOCKET ListenSocket = INVALID_SOCKET;
-        
-        // loop through all the results and bind to the first we can
-        struct addrinfo *P;
-        int One = 1;
-        for(P = AddressInfo; 
-            P; 
-            P = P->ai_next) 
+        // NOTE(vincent): The mapping keeps the file alive, even if it gets renamed over later on.
+        close(FileDescriptor);
+    }
+    else
+        perror(Filename);
+    return Result;
+}
+
+internal void
+UnmapFile(platform_file_mapping Mapping)
+{
+    munmap(Mapping.Base, Mapping.Size);
+}
+
+internal platform_append_file
+CreateAppendOnlyFile(char *Filename)
+{
+    // NOTE(vincent): With O_APPEND, the kernel moves to the end and writes under the file's lock,
+    // one write() never interleaves with another.
+    platform_append_file Result;
+    Result.Handle = open(Filename, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600);
+    if (Result.Handle == -1 && errno != EEXIST)
+        perror(Filename);
+    return Result;
+}
+
+internal b32
+AppendToFile(platform_append_file File, void *Data, u32 Size)
+{
+    ssize_t Written;
+    do
+        Written = write((int)File.Handle, Data, Size);
+    while (Written == -1 && errno == EINTR);
+    b32 Result = (Written == (ssize_t)Size);
+    return Result;
+}
+
+internal platform_directory
+OpenDirectory(char *Path)
+{
+    platform_directory Result;
+    Result.Handle = open(Path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    Result.Path = Path;
+    if (Result.Handle == -1)
+        perror(Path);
+    return Result;
+}
+
+internal void
+CloseDirectory(platform_directory Directory)
+{
+    if (Directory.Handle != -1)
+        close((int)Directory.Handle);
+}
+
+internal b32 volatile Openat2Unavailable;  // set once, by whichever thread sees ENOSYS first
+
+internal int
+LinuxOpenBeneath(int DirectoryHandle, const char *RelativePath, int Flags)
+{
+    // NOTE(vincent): RESOLVE_BENEATH makes the kernel refuse any resolution that leaves the directory,
+    // through "..", an absolute path or a symlink, on top of the request path canonicalization.
+    // openat2() appeared in Linux 5.6; on older kernels we fall back to openat() and rely on the canonicalization.
+    int Result = -1;
+    if (!Openat2Unavailable)
+    {
+        struct open_how How = {};
+        How.flags = (u64)Flags;
+        How.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        Result = (int)syscall(SYS_openat2, DirectoryHandle, RelativePath, &How, sizeof(How));
+        if (Result == -1 && errno == ENOSYS)
+            Openat2Unavailable = true;
+    }
+    if (Openat2Unavailable)
+        Result = openat(DirectoryHandle, RelativePath, Flags);
+    return Result;
+}
+
+internal push_read_entire_file
+PushReadEntireFileAt(memory_arena *Arena, platform_directory Directory, char *RelativePath)
+{
+    push_read_entire_file Result = {};
+    int FileDescriptor = LinuxOpenBeneath((int)Directory.Handle, RelativePath, O_RDONLY | O_CLOEXEC);
+    if (FileDescriptor != -1)
+    {
+        struct stat Stat;
+        b32 HaveStat = (fstat(FileDescriptor, &Stat) == 0);
+        Result.IsDirectory = (HaveStat && S_ISDIR(Stat.st_mode));
+        if (HaveStat && S_ISREG(Stat.st_mode))
         {
-            if ((ListenSocket = socket(P->ai_family, P->ai_socktype, P->ai_protocol)) == -1) 
+            Result.Size = (size_t)Stat.st_size;
+            u32 AvailableSize = Arena->Size - Arena->Used;
+            if (Result.Size <= AvailableSize)
             {
-                perror("socket() failed");
-                continue;
+                Result.Memory = PushArray(Arena, (u32)Result.Size, char);
+                size_t BytesRead = 0;
+                while (BytesRead < Result.Size)
+                {
+                    ssize_t ReadCount = read(FileDescriptor, Result.Memory + BytesRead, Result.Size - BytesRead);
+                    if (ReadCount <= 0)
+                    {
+                        if (ReadCount < 0 && errno == EINTR)
+                            continue;
+                        break;
+                    }
+                    BytesRead += ReadCount;
+                }
+                Result.Success = (BytesRead == Result.Size);
             }
-            
-            if (setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(int)) == -1) 
+        }
+        close(FileDescriptor);
+    }
+    else
+    {
+        Result.NotFound = (errno == ENOENT || errno == ENOTDIR);
+    }
+    return Result;
+}
+
+internal platform_file_info
+GetFileInfoAt(platform_directory Directory, char *RelativePath)
+{
+    // NOTE(vincent): O_PATH so that we get the same beneath-the-root resolution as the reads, without
+    // needing read permission.
+    platform_file_info Result = {};
+    int FileDescriptor = LinuxOpenBeneath((int)Directory.Handle, RelativePath, O_PATH | O_CLOEXEC);
+    if (FileDescriptor != -1)
+    {
+        struct stat Stat;
+        if (fstat(FileDescriptor, &Stat) == 0)
+        {
+            Result.Exists = true;
+            Result.Size = (u64)Stat.st_size;
+            Result.ModificationTime = (u64)Stat.st_mtim.tv_sec*1000000000ULL + (u64)Stat.st_mtim.tv_nsec;
+            Result.Identity = (u64)Stat.st_ino;
+        }
+        close(FileDescriptor);
+    }
+    return Result;
+}
+
+internal platform_directory_listing
+PushDirectoryListing(memory_arena *Arena, platform_directory Directory, char *RelativePath, b32 StayBeneath)
+{
+    platform_directory_listing Result = {};
+    int DirectoryHandle = LinuxOpenBeneath((int)Directory.Handle, *RelativePath ? RelativePath : ".",
+                                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *Dir = DirectoryHandle != -1 ? fdopendir(DirectoryHandle) : 0;
+    if (Dir)
+    {
+        // NOTE(vincent): Count first so that the entries are contiguous, names go after them.
+        u32 MaxCount = 0;
+        while (readdir(Dir))
+            MaxCount++;
+        rewinddir(Dir);
+        
+        if (MaxCount*sizeof(platform_directory_entry) <= Arena->Size - Arena->Used)
+        {
+            Result.Entries = PushArray(Arena, MaxCount, platform_directory_entry);
+            Result.Success = true;
+            struct dirent *Entry;
+            while ((Entry = readdir(Dir)) && Result.Count < MaxCount)
             {
-                perror("setsockopt() failed");
-                exit(1);
+                if (StringsAreEqual(Entry->d_name, ".") || StringsAreEqual(Entry->d_name, ".."))
+                    continue;
+                
+                struct stat Stat;
+                u32 NameSize = StringLength(Entry->d_name) + 1;
+                b32 Found = (fstatat(dirfd(Dir), Entry->d_name, &Stat, StayBeneath ? AT_SYMLINK_NOFOLLOW : 0) == 0);
+                if (Found && StayBeneath && S_ISLNK(Stat.st_mode))
+                {
+                    // NOTE(vincent): Resolved from Directory the way the file would be opened, so that
+                    // a link leading out of it fails here too.
+                    char Child[PATH_MAX];
+                    u32 RelativeLength = StringLength(RelativePath);
+                    Found = (RelativeLength + 1 + NameSize <= sizeof(Child));
+                    if (Found)
+                    {
+                        u32 Length = SprintNoNull(Child, RelativePath);
+                        if (Length && Child[Length - 1] != '/')
+                            Child[Length++] = '/';
+                        Sprint(Child + Length, Entry->d_name);
+                        int Target = LinuxOpenBeneath((int)Directory.Handle, Child, O_PATH | O_CLOEXEC);
+                        Found = (Target != -1 && fstat(Target, &Stat) == 0);
+                        if (Target != -1)
+                            close(Target);
+                    }
+                }
+                if (Found)
+                {
+                    if (NameSize > Arena->Size - Arena->Used)
+                    {
+                        Result.Success = false;
+                        break;
+                    }
+                    platform_directory_entry *Listed = Result.Entries + Result.Count++;
+                    Listed->Name = PushArray(Arena, NameSize, char);
+                    Sprint(Listed->Name, Entry->d_name);
+                    Listed->Size = (u64)Stat.st_size;
+                    Listed->ModificationTime = (u64)Stat.st_mtim.tv_sec;
+                    Listed->IsDirectory = S_ISDIR(Stat.st_mode);
+                }
             }
-            
-            if (bind(ListenSocket, P->ai_addr, P->ai_addrlen) == -1) 
+        }
+        closedir(Dir);  // also closes DirectoryHandle
+    }
+    else if (DirectoryHandle != -1)
+        close(DirectoryHandle);
+    return Result;
+}
+
+// NOTE(vincent): Content watcher. One thread recursively watches the websites root with inotify
+// and tells the server about every change, see server_content_watch.cpp.
+// When the kernel refuses more watches (fs.inotify.max_user_watches), the remaining directories
+// are polled instead: every WATCHER_POLL_INTERVAL_MS we hash the names, sizes and mtimes of their entries
+// and report the directory as changed when that signature moves.
+
+#define WATCHER_SLOT_COUNT 16384   // power of two, hashed on the watch descriptor
+#define WATCHER_MAX_POLLED 4096
+#define WATCHER_POLL_INTERVAL_MS 2000
+#define WATCHER_PATH_CLASS_COUNT 9   // path blocks of 32 bytes to 8KB, see LinuxAllocatePath()
+#define WATCHER_EVENT_MASK (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | \
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR)
+
+struct linux_watched_directory
+{
+    int WatchDescriptor;   // 0 for a never used slot, -1 for a removed one. inotify starts at 1.
+    char *Path;
+};
+
+struct linux_polled_directory
+{
+    char *Path;
+    u64 Signature;
+};
+
+struct linux_content_watcher
+{
+    server_memory *Memory;
+    int InotifyHandle;
+    memory_arena Arena;    // directory paths, see LinuxAllocatePath(), and the copies in Roots
+    char *FreePaths[WATCHER_PATH_CLASS_COUNT];
+    b32 LostTrack;         // some directory went unwatched, the caches stay on their time-to-live
+    char *Roots[MAX_VIRTUAL_HOSTS];
+    u32 RootCount;
+    
+    // NOTE(vincent): Roots of a reloaded config, handed over by the reload thread, see LinuxWatchNewRoots().
+    int WakeHandle;        // an eventfd
+    pthread_mutex_t PendingMutex;
+    memory_arena PendingArena;
+    char *Pending[MAX_VIRTUAL_HOSTS];
+    u32 PendingCount;
+    
+    linux_watched_directory Watched[WATCHER_SLOT_COUNT];
+    u32 PolledCount;
+    linux_polled_directory Polled[WATCHER_MAX_POLLED];
+};
+
+internal linux_watched_directory *
+LinuxFindWatch(linux_content_watcher *Watcher, int WatchDescriptor, b32 ForInsertion)
+{
+    linux_watched_directory *Result = 0;
+    linux_watched_directory *FirstRemoved = 0;
+    for (u32 Probe = 0; Probe < WATCHER_SLOT_COUNT; Probe++)
+    {
+        u32 Index = ((u32)WatchDescriptor*2654435761u + Probe) & (WATCHER_SLOT_COUNT - 1);
+        linux_watched_directory *Slot = Watcher->Watched + Index;
+        if (Slot->WatchDescriptor == WatchDescriptor)
+        {
+            Result = Slot;
+            break;
+        }
+        if (Slot->WatchDescriptor == -1 && !FirstRemoved)
+            FirstRemoved = Slot;
+        if (Slot->WatchDescriptor == 0)
+        {
+            if (ForInsertion)
+                Result = FirstRemoved ? FirstRemoved : Slot;
+            break;
+        }
+    }
+    return Result;
+}
+
+internal linux_polled_directory *
+LinuxFindPolled(linux_content_watcher *Watcher, char *Path)
+{
+    linux_polled_directory *Result = 0;
+    for (u32 Index = 0; Index < Watcher->PolledCount; Index++)
+    {
+        if (StringsAreEqual(Watcher->Polled[Index].Path, Path))
+        {
+            Result = Watcher->Polled + Index;
+            break;
+        }
+    }
+    return Result;
+}
+
+internal void
+LinuxWatcherLostTrack(linux_content_watcher *Watcher)
+{
+    // NOTE(vincent): Some directory is neither watched nor polled, so its changes would go unnoticed.
+    // The caches go back to their time-to-live for good: nothing tells us when they could trust us again.
+    if (!Watcher->LostTrack)
+        fprintf(stderr, "Content watcher: lost track of some directories, caches expire on a timer from now on\n");
+    Watcher->LostTrack = true;
+    SetContentWatcherActive(Watcher->Memory, false);
+}
+
+internal char *
+LinuxAllocatePath(linux_content_watcher *Watcher, char *Directory, char *Name)
+{
+    // NOTE(vincent): "Directory/Name", or a copy of Directory when Name is 0. Paths live in blocks of 32 bytes
+    // times a power of two, with the size class in the byte before the path. LinuxFreePath() puts them back
+    // on a free list per class, so directories that come and go reuse the memory of the ones that went.
+    u32 DirectoryLength = StringLength(Directory);
+    u32 Length = Name ? DirectoryLength + 1 + StringLength(Name) : DirectoryLength;
+    u32 Class = 0;
+    while (Class < WATCHER_PATH_CLASS_COUNT && (32u << Class) < Length + 2)
+        Class++;
+    
+    char *Block = 0;
+    if (Class < WATCHER_PATH_CLASS_COUNT)
+    {
+        Block = Watcher->FreePaths[Class];
+        if (Block)
+            memcpy(&Watcher->FreePaths[Class], Block + 1, sizeof(char *));
+        else if (Watcher->Arena.Size - Watcher->Arena.Used >= (32u << Class))
+            Block = PushArray(&Watcher->Arena, 32u << Class, char);
+    }
+    
+    char *Result = 0;
+    if (Block)
+    {
+        Block[0] = (char)Class;
+        Result = Block + 1;
+        Sprint(Result, Directory);
+        if (Name)
+        {
+            Result[DirectoryLength] = '/';
+            Sprint(Result + DirectoryLength + 1, Name);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Content watcher: out of memory for paths\n");
+        LinuxWatcherLostTrack(Watcher);
+    }
+    return Result;
+}
+
+internal void
+LinuxFreePath(linux_content_watcher *Watcher, char *Path)
+{
+    char *Block = Path - 1;
+    u32 Class = (u8)Block[0];
+    memcpy(Block + 1, &Watcher->FreePaths[Class], sizeof(char *));
+    Watcher->FreePaths[Class] = Block;
+}
+
+internal b32
+LinuxIsSubdirectory(int DirectoryHandle, struct dirent *Entry)
+{
+    b32 Result = false;
+    if (Entry->d_type == DT_DIR)
+        Result = true;
+    else if (Entry->d_type == DT_UNKNOWN)
+    {
+        struct stat Stat;
+        Result = fstatat(DirectoryHandle, Entry->d_name, &Stat, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(Stat.st_mode);
+    }
+    if (StringsAreEqual(Entry->d_name, ".") || StringsAreEqual(Entry->d_name, ".."))
+        Result = false;
+    return Result;
+}
+
+internal u64
+LinuxDirectorySignature(char *Path)
+{
+    // NOTE(vincent): Entries are summed so that the readdir order doesn't matter.
+    u64 Signature = 0;
+    DIR *Dir = opendir(Path);
+    if (Dir)
+    {
+        struct dirent *Entry;
+        while ((Entry = readdir(Dir)))
+        {
+            struct stat Stat;
+            if (fstatat(dirfd(Dir), Entry->d_name, &Stat, AT_SYMLINK_NOFOLLOW) == 0)
             {
-                close(ListenSocket);
-                perror("bind() failed");
-                continue;
+                u64 EntryHash = HashString(StringFromLiteral(Entry->d_name));
+                EntryHash ^= (u64)Stat.st_size * 0x9E3779B97F4A7C15ULL;
+                EntryHash ^= ((u64)Stat.st_mtim.tv_sec*1000000000ULL + Stat.st_mtim.tv_nsec) * 0xC2B2AE3D27D4EB4FULL;
+                EntryHash ^= (u64)Stat.st_ino << 32;
+                Signature += EntryHash;
             }
-            break;  // we break here when the three calls were successful
         }
-        
-        freeaddrinfo(AddressInfo); // all done with this structure
-        
-        if (P == 0)  
+        closedir(Dir);
+    }
+    return Signature;
+}
+
+internal void
+LinuxWatchTree(linux_content_watcher *Watcher, char *Path, b32 NotifyEach)
+{
+    // NOTE(vincent): Path comes from LinuxAllocatePath(), and the watch or polled entry takes it over.
+    // When neither does, it is freed on the way out.
+    // NotifyEach is set when the tree appeared after startup, in which case caches may hold
+    // negative entries for its files.
+    if (!Path)
+        return;
+    
+    b32 Kept = false;
+    int WatchDescriptor = inotify_add_watch(Watcher->InotifyHandle, Path, WATCHER_EVENT_MASK);
+    if (WatchDescriptor >= 0)
+    {
+        // NOTE(vincent): inotify hands back the same descriptor for a directory we already watch,
+        // which is what happens when a directory moves around inside the tree. Then we only update the path.
+        linux_watched_directory *Slot = LinuxFindWatch(Watcher, WatchDescriptor, true);
+        if (Slot)
         {
-            fprintf(stderr, "failed to bind\n");
-            if (StringsAreEqual(InitResult.PortString, "80"))
-                printf("Port is 80, maybe the OS is keeping you from listening to that port?" 
-                       " Try sudo\n");
-            exit(1);
+            if (Slot->WatchDescriptor == WatchDescriptor)
+                LinuxFreePath(Watcher, Slot->Path);
+            Slot->WatchDescriptor = WatchDescriptor;
+            Slot->Path = Path;
+            Kept = true;
         }
-        
-        if (listen(ListenSocket, BACKLOG) == -1) 
+        else
         {
-            perror("listen");
-            exit(1);
+            fprintf(stderr, "Content watcher: watch table is full, ignoring %s\n", Path);
+            inotify_rm_watch(Watcher->InotifyHandle, WatchDescriptor);
+            LinuxWatcherLostTrack(Watcher);
         }
-        
-        struct sockaddr_storage TheirAddress; // connector's address information
-        socklen_t SizeTheirAddress = sizeof(TheirAddress);
-        printf("Server: waiting for a connection on port %s\n", InitResult.PortString);
-        
-        for (;;)
-        {  
-            // Accept a client socket
-            SOCKET ClientSocket = 
-                accept(ListenSocket, (struct sockaddr *)&TheirAddress, &SizeTheirAddress);
-            if (ClientSocket == -1) 
+    }
+    else if (errno == ENOSPC)
+    {
+        if (!LinuxFindPolled(Watcher, Path))
+        {
+            if (Watcher->PolledCount < ArrayCount(Watcher->Polled))
             {
-                perror("accept failed");
-                continue;
+                if (Watcher->PolledCount == 0)
+                    fprintf(stderr, "Content watcher: out of inotify watches, polling from %s on\n", Path);
+                linux_polled_directory *Polled = Watcher->Polled + Watcher->PolledCount++;
+                Polled->Path = Path;
+                Polled->Signature = LinuxDirectorySignature(Path);
+                Kept = true;
             }
-            
-            PrepareHandshaking(&ServerMemory, (struct sockaddr *)&TheirAddress, ClientSocket, &Queue);
-        }
+            else
+            {
+                fprintf(stderr, "Content watcher: too many polled directories, ignoring %s\n", Path);
+                LinuxWatcherLostTrack(Watcher);
+            }
+        }
+    }
+    else
+    {
+        perror(Path);
+        LinuxFreePath(Watcher, Path);
+        return;
+    }
+    
+    if (NotifyEach)
+        ContentChanged(Watcher->Memory, ContentChange_Directory, Path, "");
+    
+    DIR *Dir = opendir(Path);
+    if (Dir)
+    {
+        struct dirent *Entry;
+        while ((Entry = readdir(Dir)))
+        {
+            if (LinuxIsSubdirectory(dirfd(Dir), Entry))
+                LinuxWatchTree(Watcher, LinuxAllocatePath(Watcher, Path, Entry->d_name), NotifyEach);
+        }
+        closedir(Dir);
+    }
+    
+    if (!Kept)
+        LinuxFreePath(Watcher, Path);
+}
+
+internal void
+LinuxForgetTree(linux_content_watcher *Watcher, char *Path)
+{
+    // NOTE(vincent): A directory was deleted or moved away: every path below it is stale.
+    // If it moved somewhere else inside the tree, IN_MOVED_TO watches it again under its new name.
+    string Prefix = StringFromLiteral(Path);
+    for (u32 Index = 0; Index < WATCHER_SLOT_COUNT; Index++)
+    {
+        linux_watched_directory *Slot = Watcher->Watched + Index;
+        if (Slot->WatchDescriptor > 0)
+        {
+            string SlotPath = StringFromLiteral(Slot->Path);
+            if (StringBeginsWith(SlotPath, Path) && 
+                (SlotPath.Length == Prefix.Length || SlotPath.Base[Prefix.Length] == '/'))
+            {
+                ContentChanged(Watcher->Memory, ContentChange_Directory, Slot->Path, "");
+                inotify_rm_watch(Watcher->InotifyHandle, Slot->WatchDescriptor);
+                LinuxFreePath(Watcher, Slot->Path);
+                Slot->WatchDescriptor = -1;
+            }
+        }
+    }
+    
+    for (u32 Index = 0; Index < Watcher->PolledCount;)
+    {
+        string PolledPath = StringFromLiteral(Watcher->Polled[Index].Path);
+        if (StringBeginsWith(PolledPath, Path) &&
+            (PolledPath.Length == Prefix.Length || PolledPath.Base[Prefix.Length] == '/'))
+        {
+            ContentChanged(Watcher->Memory, ContentChange_Directory, PolledPath.Base, "");
+            LinuxFreePath(Watcher, PolledPath.Base);
+            Watcher->Polled[Index] = Watcher->Polled[--Watcher->PolledCount];
+        }
+        else
+            Index++;
+    }
+}
+
+internal void
+LinuxHandleWatchEvent(linux_content_watcher *Watcher, struct inotify_event *Event)
+{
+    if (Event->mask & IN_Q_OVERFLOW)
+    {
+        ContentChanged(Watcher->Memory, ContentChange_Everything, "", "");
+        return;
+    }
+    
+    linux_watched_directory *Slot = LinuxFindWatch(Watcher, Event->wd, false);
+    if (!Slot)
+        return;
+    
+    if (Event->mask & IN_IGNORED)
+    {
+        LinuxFreePath(Watcher, Slot->Path);
+        Slot->WatchDescriptor = -1;  // the kernel dropped the watch, directory is gone
+        return;
+    }
+    
+    char *Directory = Slot->Path;
+    char *Name = Event->len ? Event->name : (char *)"";
+    if (Event->mask & IN_DELETE_SELF)
+    {
+        ContentChanged(Watcher->Memory, ContentChange_Directory, Directory, "");
+        return;
+    }
+    
+    ContentChanged(Watcher->Memory, ContentChange_File, Directory, Name);
+    if (Event->mask & IN_ISDIR)
+    {
+        if (Event->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            LinuxWatchTree(Watcher, LinuxAllocatePath(Watcher, Directory, Name), true);
+        }
+        else if (Event->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            char *Child = LinuxAllocatePath(Watcher, Directory, Name);
+            if (Child)
+            {
+                LinuxForgetTree(Watcher, Child);
+                LinuxFreePath(Watcher, Child);
+            }
+        }
+    }
+}
+
+internal void
+LinuxPollDirectories(linux_content_watcher *Watcher)
+{
+    for (u32 Index = 0; Index < Watcher->PolledCount; Index++)
+    {
+        linux_polled_directory *Polled = Watcher->Polled + Index;
+        u64 Signature = LinuxDirectorySignature(Polled->Path);
+        if (Signature != Polled->Signature)
+        {
+            Polled->Signature = Signature;
+            ContentChanged(Watcher->Memory, ContentChange_Directory, Polled->Path, "");
+            
+            // NOTE(vincent): Pick up new subdirectories. Known ones are skipped by LinuxWatchTree:
+            // inotify hands back their descriptor or they are already in the polled list.
+            DIR *Dir = opendir(Polled->Path);
+            if (Dir)
+            {
+                struct dirent *Entry;
+                while ((Entry = readdir(Dir)))
+                {
+                    if (LinuxIsSubdirectory(dirfd(Dir), Entry))
+                    {
+                        char *Child = LinuxAllocatePath(Watcher, Polled->Path, Entry->d_name);
+                        if (Child && !LinuxFindPolled(Watcher, Child))
+                            LinuxWatchTree(Watcher, Child, true);
+                        else if (Child)
+                            LinuxFreePath(Watcher, Child);
+                    }
+                }
+                closedir(Dir);
+            }
+        }
+    }
+}
+
+internal u64
+GetMonotonicMilliseconds()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (u64)Now.tv_sec*1000 + (u64)Now.tv_nsec/1000000;
+}
+
+internal u64
+GetMonotonicMicroseconds()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (u64)Now.tv_sec*1000000 + (u64)Now.tv_nsec/1000;
+}
+
+internal cpu_profiler *volatile LinuxProfiler;
+
+internal void
+LinuxProfileSignal(int Signal, siginfo_t *Info, void *Context)
+{
+    // NOTE(vincent): SIGPROF handler. Walks the frame pointers of the interrupted code, trusting only
+    // frames inside the thread's stack and further out than the previous one. Code built without
+    // frame pointers, like libc, makes the stack stop short or skip a caller, but never crash.
+    cpu_profiler *Profiler = LinuxProfiler;
+    if (!Profiler || !Profiler->Running)
+        return;
+    if (!LinuxStackHigh)
+    {
+        AtomicAddU64(&Profiler->Dropped, 1);
+        return;
+    }
+    
+    ucontext_t *Interrupted = (ucontext_t *)Context;
+#if defined(__x86_64__)
+    u64 Instruction = (u64)Interrupted->uc_mcontext.gregs[REG_RIP];
+    u64 Frame = (u64)Interrupted->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    u64 Instruction = (u64)Interrupted->uc_mcontext.pc;
+    u64 Frame = (u64)Interrupted->uc_mcontext.regs[29];
+#else
+    u64 Instruction = 0;
+    u64 Frame = 0;
+#endif
+    u64 Frames[PROFILE_MAX_DEPTH];
+    u32 Depth = 0;
+    Frames[Depth++] = Instruction;
+    while (Depth < PROFILE_MAX_DEPTH && Frame >= LinuxStackLow && Frame + 16 <= LinuxStackHigh && Frame % 8 == 0)
+    {
+        // NOTE(vincent): A frame record is the caller's frame pointer, then the return address.
+        u64 *Record = (u64 *)Frame;
+        if (!Record[1])
+            break;
+        Frames[Depth++] = Record[1];
+        if (Record[0] <= Frame)
+            break;
+        Frame = Record[0];
+    }
+    RecordProfileSample(Profiler, LinuxWorkerIndex, Frames, Depth);
+}
+
+internal int
+LinuxFindLoadBias(struct dl_phdr_info *Info, size_t Size, void *Data)
+{
+    // NOTE(vincent): The executable comes first. Returning nonzero stops the iteration.
+    *(u64 *)Data = (u64)Info->dlpi_addr;
+    return 1;
+}
+
+internal b32
+StartProfiler(cpu_profiler *Profiler)
+{
+    // NOTE(vincent): ITIMER_PROF counts the CPU time of the whole process, and the kernel signals
+    // the thread that was running when a period ran out, so busy threads get sampled the most.
+    // SA_RESTART, so that the blocking calls of the timer and watcher threads don't notice.
+    if (!LinuxProfiler)
+    {
+        dl_iterate_phdr(LinuxFindLoadBias, &Profiler->LoadBias);
+        struct sigaction Action = {};
+        Action.sa_sigaction = LinuxProfileSignal;
+        Action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&Action.sa_mask);
+        sigaction(SIGPROF, &Action, 0);
+        LinuxProfiler = Profiler;
+    }
+    Profiler->Running = true;
+    struct itimerval Timer = {};
+    Timer.it_interval.tv_usec = 1000000 / PROFILE_HZ;
+    Timer.it_value = Timer.it_interval;
+    b32 Result = (setitimer(ITIMER_PROF, &Timer, 0) == 0);
+    if (!Result)
+        Profiler->Running = false;
+    return Result;
+}
+
+internal void
+StopProfiler(cpu_profiler *Profiler)
+{
+    struct itimerval Timer = {};
+    setitimer(ITIMER_PROF, &Timer, 0);
+    Profiler->Running = false;
+}
+
+internal void
+LinuxTakePendingRoots(linux_content_watcher *Watcher)
+{
+    // NOTE(vincent): Watcher thread. Roots that went away with a reload stay watched, that's harmless.
+    pthread_mutex_lock(&Watcher->PendingMutex);
+    for (u32 PendingIndex = 0; PendingIndex < Watcher->PendingCount; PendingIndex++)
+    {
+        char *Root = Watcher->Pending[PendingIndex];
+        b32 AlreadyWatched = false;
+        for (u32 RootIndex = 0; RootIndex < Watcher->RootCount; RootIndex++)
+            AlreadyWatched |= StringsAreEqual(Watcher->Roots[RootIndex], Root);
+        if (AlreadyWatched)
+            continue;
+        
+        // NOTE(vincent): The copy in Roots stays for good, it is what tells us the root is already watched.
+        u32 Length = StringLength(Root);
+        if (Watcher->RootCount < ArrayCount(Watcher->Roots) && Watcher->Arena.Size - Watcher->Arena.Used > Length)
+        {
+            char *Copy = PushArray(&Watcher->Arena, Length + 1, char);
+            Sprint(Copy, Root);
+            Watcher->Roots[Watcher->RootCount++] = Copy;
+            LinuxWatchTree(Watcher, LinuxAllocatePath(Watcher, Copy, 0), false);
+        }
+        else
+        {
+            fprintf(stderr, "Content watcher: no room for the new root %s, not watching it\n", Root);
+            LinuxWatcherLostTrack(Watcher);
+        }
+    }
+    Watcher->PendingCount = 0;
+    Watcher->PendingArena.Used = 0;
+    pthread_mutex_unlock(&Watcher->PendingMutex);
+    
+    // NOTE(vincent): Anything may have changed in the new roots before they were watched.
+    ContentChanged(Watcher->Memory, ContentChange_Everything, "", "");
+}
+
+internal void
+LinuxWatchNewRoots(linux_content_watcher *Watcher, char **Roots, u32 RootCount)
+{
+    // NOTE(vincent): Reload thread. The roots are copied, the caller's go away with the next reload.
+    pthread_mutex_lock(&Watcher->PendingMutex);
+    for (u32 RootIndex = 0; RootIndex < RootCount; RootIndex++)
+    {
+        u32 Length = StringLength(Roots[RootIndex]);
+        memory_arena *Arena = &Watcher->PendingArena;
+        if (Watcher->PendingCount < ArrayCount(Watcher->Pending) && Arena->Size - Arena->Used > Length)
+        {
+            char *Copy = PushArray(Arena, Length + 1, char);
+            Sprint(Copy, Roots[RootIndex]);
+            Watcher->Pending[Watcher->PendingCount++] = Copy;
+        }
+    }
+    pthread_mutex_unlock(&Watcher->PendingMutex);
+    
+    u64 One = 1;
+    if (write(Watcher->WakeHandle, &One, sizeof(One)) != sizeof(One))
+        perror("Content watcher: couldn't wake the thread");
+}
+
+internal void *
+ContentWatcherThreadProc(void *Arg)
+{
+    linux_content_watcher *Watcher = (linux_content_watcher *)Arg;
+    for (u32 RootIndex = 0; RootIndex < Watcher->RootCount; RootIndex++)
+        LinuxWatchTree(Watcher, LinuxAllocatePath(Watcher, Watcher->Roots[RootIndex], 0), false);
+    SetContentWatcherActive(Watcher->Memory, !Watcher->LostTrack);
+    
+    char Buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    u64 LastPoll = GetMonotonicMilliseconds();
+    for (;;)
+    {
+        struct pollfd PollHandles[2] = {};
+        PollHandles[0].fd = Watcher->InotifyHandle;
+        PollHandles[0].events = POLLIN;
+        PollHandles[1].fd = Watcher->WakeHandle;
+        PollHandles[1].events = POLLIN;
+        int Timeout = Watcher->PolledCount ? WATCHER_POLL_INTERVAL_MS : -1;
+        int Ready = poll(PollHandles, 2, Timeout);
+        if (Ready > 0 && (PollHandles[0].revents & POLLIN))
+        {
+            ssize_t Length = read(Watcher->InotifyHandle, Buffer, sizeof(Buffer));
+            if (Length <= 0)
+            {
+                if (Length < 0 && errno == EINTR)
+                    continue;
+                perror("Content watcher: read failed");
+                break;
+            }
+            
+            for (char *At = Buffer; At < Buffer + Length;)
+            {
+                struct inotify_event *Event = (struct inotify_event *)At;
+                LinuxHandleWatchEvent(Watcher, Event);
+                At += sizeof(struct inotify_event) + Event->len;
+            }
+        }
+        else if (Ready < 0 && errno != EINTR)
+        {
+            perror("Content watcher: poll failed");
+            break;
+        }
+        
+        if (Ready > 0 && (PollHandles[1].revents & POLLIN))
+        {
+            u64 Wakes;
+            if (read(Watcher->WakeHandle, &Wakes, sizeof(Wakes)) == sizeof(Wakes))
+                LinuxTakePendingRoots(Watcher);
+        }
+        
+        u64 Now = GetMonotonicMilliseconds();
+        if (Watcher->PolledCount && Now - LastPoll >= WATCHER_POLL_INTERVAL_MS)
+        {
+            LinuxPollDirectories(Watcher);
+            LastPoll = Now;
+        }
+    }
+    
+    // NOTE(vincent): Caches fall back to their time-to-live from now on.
+    SetContentWatcherActive(Watcher->Memory, false);
+    return 0;
+}
+
+internal linux_content_watcher *
+LinuxStartContentWatcher(server_memory *Memory, char **Roots, u32 RootCount)
+{
+    // NOTE(vincent): Returns 0 when there is no watcher, caches then fall back to their time-to-live.
+    u32 PathArenaSize = (u32)Megabytes(4);
+    u32 PendingArenaSize = (u32)Kilobytes(256);
+    void *Storage = mmap(0, sizeof(linux_content_watcher) + PathArenaSize + PendingArenaSize, 
+                         PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (Storage == MAP_FAILED)
+    {
+        perror("Content watcher: mmap failed");
+        return 0;
+    }
+    
+    linux_content_watcher *Watcher = (linux_content_watcher *)Storage;
+    Watcher->Memory = Memory;
+    Watcher->InotifyHandle = inotify_init1(IN_CLOEXEC);
+    Watcher->WakeHandle = eventfd(0, EFD_CLOEXEC);
+    if (Watcher->InotifyHandle == -1 || Watcher->WakeHandle == -1)
+    {
+        perror("Content watcher: inotify_init1 or eventfd failed");
+        return 0;
+    }
+    InitializeArena(&Watcher->Arena, PathArenaSize, (u8 *)Storage + sizeof(linux_content_watcher));
+    InitializeArena(&Watcher->PendingArena, PendingArenaSize, 
+                    (u8 *)Storage + sizeof(linux_content_watcher) + PathArenaSize);
+    pthread_mutex_init(&Watcher->PendingMutex, 0);
+    
+    // NOTE(vincent): The thread starts by walking these, see ContentWatcherThreadProc().
+    Watcher->RootCount = Minimum(RootCount, ArrayCount(Watcher->Roots));
+    for (u32 RootIndex = 0; RootIndex < Watcher->RootCount; RootIndex++)
+    {
+        Watcher->Roots[RootIndex] = PushArray(&Watcher->Arena, StringLength(Roots[RootIndex]) + 1, char);
+        Sprint(Watcher->Roots[RootIndex], Roots[RootIndex]);
+    }
+    
+    pthread_t ThreadID;
+    if (pthread_create(&ThreadID, 0, ContentWatcherThreadProc, Watcher) == 0)
+    {
+        pthread_detach(ThreadID);
+    }
+    else
+    {
+        fprintf(stderr, "Content watcher: couldn't create the thread\n");
+        Watcher = 0;
+    }
+    return Watcher;
+}
+
+internal void *
+ConnectionTimerThreadProc(void *Arg)
+{
+    server_memory *Memory = (server_memory *)Arg;
+    for (;;)
+    {
+        usleep(CONNECTION_TIMER_TICK_MILLISECONDS*1000);
+        ExpireConnectionTimers(Memory);
+    }
+}
+
+internal void
+SleepMilliseconds(u32 Milliseconds)
+{
+    usleep(Milliseconds*1000);
+}
+
+// NOTE(vincent): Binary upgrades. On SIGUSR2 the server execs the binary found at its own path, hands it the
+// listening socket and the warm state over a Unix socket, and waits for it to say it's ready. Then it stops
+// accepting, lets the connections in flight finish and exits. Connections waiting in the backlog belong to the
+// socket, not to a process, so the new process accepts them: nobody gets refused during the upgrade.
+// If the new process fails to start, it exits and the old one keeps serving.
+#define UPGRADE_VARIABLE "HTTP_SERVER_UPGRADE_FD"
+#define UPGRADE_READY 'R'
+#define UPGRADE_READY_TIMEOUT_MS 30000   // after that, the new process is killed and we keep serving
+
+struct linux_signal_context
+{
+    server_memory *Memory;
+    linux_content_watcher *Watcher;   // 0 when nothing was watched at startup
+    SOCKET ListenSocket;
+    pthread_t MainThread;
+    char *ExecutablePath;
+    volatile b32 StopAccepting;
+    volatile b32 AcceptorStopped;
+};
+
+inline sigset_t
+LinuxHandledSignals()
+{
+    // NOTE(vincent): SIGHUP reloads the config, SIGUSR2 upgrades the binary, SIGTERM and SIGINT stop.
+    sigset_t Result;
+    sigemptyset(&Result);
+    sigaddset(&Result, SIGHUP);
+    sigaddset(&Result, SIGUSR2);
+    sigaddset(&Result, SIGTERM);
+    sigaddset(&Result, SIGINT);
+    return Result;
+}
+
+internal void
+LinuxWakeAcceptor(int Signal)
+{
+    // NOTE(vincent): Installed without SA_RESTART: the point is to make accept() return with EINTR.
+}
+
+internal void
+LinuxStopAccepting(linux_signal_context *Context)
+{
+    // NOTE(vincent): The signal may land while the main thread is between two accept() calls, so keep
+    // sending it until the main thread is out of its loop.
+    Context->StopAccepting = true;
+    while (!Context->AcceptorStopped)
+    {
+        pthread_kill(Context->MainThread, SIGUSR1);
+        SleepMilliseconds(10);
+    }
+}
+
+internal b32
+LinuxSendUpgradeHandles(int UpgradeHandle, SOCKET ListenSocket, int WarmHandle)
+{
+    int Handles[2] = {ListenSocket, WarmHandle};
+    u32 HandleCount = (WarmHandle != -1) ? 2 : 1;
+    char Control[CMSG_SPACE(sizeof(Handles))] = {};
+    char Byte = 0;
+    struct iovec Vector = {&Byte, 1};
+    struct msghdr Message = {};
+    Message.msg_iov = &Vector;
+    Message.msg_iovlen = 1;
+    Message.msg_control = Control;
+    Message.msg_controllen = CMSG_SPACE(HandleCount*sizeof(int));
+    struct cmsghdr *Header = CMSG_FIRSTHDR(&Message);
+    Header->cmsg_level = SOL_SOCKET;
+    Header->cmsg_type = SCM_RIGHTS;
+    Header->cmsg_len = CMSG_LEN(HandleCount*sizeof(int));
+    CopyBytes((char *)Handles, (char *)CMSG_DATA(Header), HandleCount*sizeof(int));
+    b32 Result = (sendmsg(UpgradeHandle, &Message, MSG_NOSIGNAL) == 1);
+    if (!Result)
+        perror("Upgrade: sendmsg failed");
+    return Result;
+}
+
+internal b32
+LinuxReceiveUpgradeHandles(int UpgradeHandle, SOCKET *ListenSocket, int *WarmHandle)
+{
+    int Handles[2] = {-1, -1};
+    char Control[CMSG_SPACE(sizeof(Handles))] = {};
+    char Byte;
+    struct iovec Vector = {&Byte, 1};
+    struct msghdr Message = {};
+    Message.msg_iov = &Vector;
+    Message.msg_iovlen = 1;
+    Message.msg_control = Control;
+    Message.msg_controllen = sizeof(Control);
+    b32 Result = false;
+    if (recvmsg(UpgradeHandle, &Message, MSG_CMSG_CLOEXEC) == 1)
+    {
+        struct cmsghdr *Header = CMSG_FIRSTHDR(&Message);
+        if (Header && Header->cmsg_level == SOL_SOCKET && Header->cmsg_type == SCM_RIGHTS)
+        {
+            u32 HandleCount = (u32)((Header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            CopyBytes((char *)CMSG_DATA(Header), (char *)Handles, Minimum(HandleCount, 2)*sizeof(int));
+            Result = (Handles[0] != -1);
+        }
+    }
+    *ListenSocket = Handles[0];
+    *WarmHandle = Handles[1];
+    return Result;
+}
+
+internal int
+LinuxExportWarmState(server_memory *Memory)
+{
+    // NOTE(vincent): Returns a memfd holding the warm state, or -1. The new process maps it read-only.
+    u32 Size = GetWarmStateSize();
+    int Result = memfd_create("http-server-warm-state", MFD_CLOEXEC);
+    if (Result != -1 && ftruncate(Result, Size) == 0)
+    {
+        void *Base = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Result, 0);
+        if (Base != MAP_FAILED)
+        {
+            SaveWarmState(Memory, Base);
+            munmap(Base, Size);
+        }
+    }
+    else if (Result != -1)
+    {
+        close(Result);
+        Result = -1;
+    }
+    return Result;
+}
+
+internal void
+LinuxImportWarmState(server_memory *Memory, int WarmHandle)
+{
+    struct stat Stat;
+    if (fstat(WarmHandle, &Stat) == 0 && Stat.st_size > 0)
+    {
+        void *Base = mmap(0, Stat.st_size, PROT_READ, MAP_SHARED, WarmHandle, 0);
+        if (Base != MAP_FAILED)
+        {
+            if (LoadWarmState(Memory, Base, (u64)Stat.st_size))
+                printf("Upgrade: took over the warm state\n");
+            munmap(Base, Stat.st_size);
+        }
+    }
+    close(WarmHandle);
+}
+
+internal b32
+LinuxUpgradeBinary(linux_signal_context *Context)
+{
+    // NOTE(vincent): Returns whether the new process took over the listening socket.
+    int Pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Pair) == -1)
+    {
+        perror("Upgrade: socketpair failed");
+        return false;
+    }
+    
+    // NOTE(vincent): Built before fork(): between fork() and exec() the child may only make
+    // async-signal-safe calls, and setenv() isn't one.
+    char Variable[sizeof(UPGRADE_VARIABLE) + 16];
+    u32 Length = Sprint(Variable, UPGRADE_VARIABLE "=");
+    Length += SprintU64(Variable + Length, (u64)Pair[1]);
+    Variable[Length] = 0;
+    char *Environment[1024];
+    u32 VariableCount = 0;
+    for (char **At = environ; *At && VariableCount < ArrayCount(Environment) - 2; At++)
+    {
+        if (!StringBeginsWith(StringFromLiteral(*At), UPGRADE_VARIABLE "="))
+            Environment[VariableCount++] = *At;
+    }
+    Environment[VariableCount++] = Variable;
+    Environment[VariableCount] = 0;
+    char *Arguments[] = {Context->ExecutablePath, 0};
+    
+    pid_t Child = fork();
+    if (Child == 0)
+    {
+        fcntl(Pair[1], F_SETFD, 0);   // the one descriptor the new binary inherits
+        execve(Context->ExecutablePath, Arguments, Environment);
+        _exit(127);
+    }
+    close(Pair[1]);
+    
+    b32 Result = false;
+    if (Child == -1)
+    {
+        perror("Upgrade: fork failed");
+    }
+    else
+    {
+        int WarmHandle = LinuxExportWarmState(Context->Memory);
+        if (LinuxSendUpgradeHandles(Pair[0], Context->ListenSocket, WarmHandle))
+        {
+            // NOTE(vincent): Waits until the new process is ready, exits and closes its end, or runs out of time.
+            // The signal thread can't handle anything else meanwhile, so the wait is bounded.
+            u64 Deadline = GetMonotonicMilliseconds() + UPGRADE_READY_TIMEOUT_MS;
+            struct pollfd PollHandle = {};
+            PollHandle.fd = Pair[0];
+            PollHandle.events = POLLIN;
+            int Ready = 0;
+            for (u64 Now = GetMonotonicMilliseconds(); Now < Deadline; Now = GetMonotonicMilliseconds())
+            {
+                Ready = poll(&PollHandle, 1, (int)(Deadline - Now));
+                if (Ready != -1 || errno != EINTR)
+                    break;
+            }
+            char ReadyByte = 0;
+            if (Ready == 1)
+                Result = (recv(Pair[0], &ReadyByte, 1, MSG_DONTWAIT) == 1 && ReadyByte == UPGRADE_READY);
+            else if (Ready == 0)
+                fprintf(stderr, "Upgrade: the new process wasn't ready after %u seconds\n", UPGRADE_READY_TIMEOUT_MS/1000);
+        }
+        if (WarmHandle != -1)
+            close(WarmHandle);
+        if (!Result)
+        {
+            kill(Child, SIGKILL);
+            waitpid(Child, 0, 0);
+        }
+    }
+    close(Pair[0]);
+    return Result;
+}
+
+internal void *
+LinuxSignalThreadProc(void *Arg)
+{
+    // NOTE(vincent): The signals in LinuxHandledSignals() are blocked in every thread and this one takes them
+    // synchronously, so reloads, upgrades and stops run on a normal thread instead of inside a signal handler.
+    linux_signal_context *Context = (linux_signal_context *)Arg;
+    sigset_t Signals = LinuxHandledSignals();
+    for (;;)
+    {
+        int Signal;
+        if (sigwait(&Signals, &Signal) != 0)
+            continue;
+        if (Signal == SIGHUP)
+        {
+            reload_config_result Reload = ReloadConfig(Context->Memory);
+            if (Reload.Success && Context->Watcher)
+                LinuxWatchNewRoots(Context->Watcher, Reload.WatchRoots, Reload.WatchRootCount);
+        }
+        else if (Signal == SIGTERM || Signal == SIGINT)
+        {
+            // NOTE(vincent): A second one doesn't wait for the drain.
+            if (Context->StopAccepting)
+                _exit(1);
+            LinuxStopAccepting(Context);
+        }
+        else if (Signal == SIGUSR2 && !Context->StopAccepting)
+        {
+            printf("Upgrade: starting %s\n", Context->ExecutablePath);
+            if (LinuxUpgradeBinary(Context))
+                LinuxStopAccepting(Context);
+            else
+                fprintf(stderr, "Upgrade: the new process didn't start, still serving\n");
+        }
+    }
+}
+
+internal SOCKET
+LinuxOpenListenSocket(char *PortString, u32 Backlog)
+{
+    struct addrinfo *AddressInfo = 0;
+    struct addrinfo Hints;
+    ZeroBytes((char *)&Hints, sizeof(Hints));
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    Hints.ai_protocol = IPPROTO_TCP;
+    Hints.ai_flags = AI_PASSIVE;      // "use my IP"
+    
+    // Resolve the local address and port to be used by the server
+    int AddressInfoResult = getaddrinfo(0, PortString, &Hints, &AddressInfo);
+    if (AddressInfoResult != 0) 
+    {
+        fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(AddressInfoResult));
+        exit(1);
+    }
+    
+    SOCKET ListenSocket = INVALID_SOCKET;
+    
+    // loop through all the results and bind to the first we can
+    struct addrinfo *P;
+    int One = 1;
+    for(P = AddressInfo; 
+        P; 
+        P = P->ai_next) 
+    {
+        if ((ListenSocket = socket(P->ai_family, P->ai_socktype | SOCK_CLOEXEC, P->ai_protocol)) == -1) 
+        {
+            perror("socket() failed");
+            continue;
+        }
+        
+        if (setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(int)) == -1) 
+        {
+            perror("setsockopt() failed");
+            exit(1);
+        }
+        
+        if (bind(ListenSocket, P->ai_addr, P->ai_addrlen) == -1) 
+        {
+            close(ListenSocket);
+            perror("bind() failed");
+            continue;
+        }
+        break;  // we break here when the three calls were successful
+    }
+    
+    freeaddrinfo(AddressInfo); // all done with this structure
+    
+    if (P == 0)  
+    {
+        fprintf(stderr, "failed to bind\n");
+        if (StringsAreEqual(PortString, "80"))
+            printf("Port is 80, maybe the OS is keeping you from listening to that port?" 
+                   " Try sudo\n");
+        exit(1);
+    }
+    
+    if (listen(ListenSocket, Backlog) == -1) 
+    {
+        perror("listen");
+        exit(1);
+    }
+    return ListenSocket;
+}
+
+int main(void)
+{
+    platform_work_queue Queue = {};
+    
+    // NOTE(vincent): A client that went away, or whose socket the connection timers aborted, makes send()
+    // fail with EPIPE. The default SIGPIPE would kill the whole server instead.
+    signal(SIGPIPE, SIG_IGN);
+    
+    // NOTE(vincent): Before any thread starts, so that they all inherit the mask, see LinuxSignalThreadProc().
+    sigset_t HandledSignals = LinuxHandledSignals();
+    pthread_sigmask(SIG_BLOCK, &HandledSignals, 0);
+    struct sigaction Wake = {};
+    Wake.sa_handler = LinuxWakeAcceptor;
+    sigaction(SIGUSR1, &Wake, 0);
+    
+    // NOTE(vincent): Set when an older process is handing its listening socket over to us.
+    int UpgradeHandle = -1;
+    char *UpgradeVariable = getenv(UPGRADE_VARIABLE);
+    if (UpgradeVariable)
+    {
+        UpgradeHandle = atoi(UpgradeVariable);
+        unsetenv(UPGRADE_VARIABLE);
+        fcntl(UpgradeHandle, F_SETFD, FD_CLOEXEC);
+    }
+    static char ExecutablePath[4096];
+    ssize_t PathLength = readlink("/proc/self/exe", ExecutablePath, sizeof(ExecutablePath) - 1);
+    ExecutablePath[PathLength > 0 ? PathLength : 0] = 0;
+    
+    // NOTE(vincent): Initializing server memory
+    server_memory ServerMemory = {};
+    void *BaseAddress = 0;
+    ServerMemory.StorageSize = SERVER_STORAGE_SIZE;
+    ServerMemory.Storage = mmap(BaseAddress, ServerMemory.StorageSize, PROT_READ | PROT_WRITE,
+                                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ServerMemory.Storage == MAP_FAILED)
+    {
+        perror("mmap failed");
+        return 1;
+    }
+    initialize_server_memory_result InitResult = 
+        InitializeServerMemory(&ServerMemory, &Queue, LinuxAddEntry, LinuxDoNextWorkQueueEntry);
+    
+    // NOTE(vincent): Initialize threads and work queue, once the config told us where to put them.
+    LinuxMakeQueue(&Queue, NUMBER_OF_THREADS - 1, InitResult.ThreadPlacement);
+    
+    if (InitResult.ParsingErrorCount == 0)
+    {
+        SOCKET ListenSocket = INVALID_SOCKET;
+        if (UpgradeHandle != -1)
+        {
+            // NOTE(vincent): Bound and listening already, with the old process's port and backlog.
+            int WarmHandle;
+            if (!LinuxReceiveUpgradeHandles(UpgradeHandle, &ListenSocket, &WarmHandle))
+            {
+                fprintf(stderr, "Upgrade: didn't get the listening socket\n");
+                return 1;
+            }
+            if (WarmHandle != -1)
+                LinuxImportWarmState(&ServerMemory, WarmHandle);
+        }
+        else
+        {
+            ListenSocket = LinuxOpenListenSocket(InitResult.PortString, InitResult.Backlog);
+        }
+        
+        linux_signal_context Signals = {};
+        Signals.Memory = &ServerMemory;
+        Signals.ListenSocket = ListenSocket;
+        Signals.MainThread = pthread_self();
+        Signals.ExecutablePath = ExecutablePath;
+        if (InitResult.WatchRootCount)
+            Signals.Watcher = LinuxStartContentWatcher(&ServerMemory, InitResult.WatchRoots, InitResult.WatchRootCount);
+        
+        pthread_t SignalThreadID;
+        if (pthread_create(&SignalThreadID, 0, LinuxSignalThreadProc, &Signals) == 0)
+            pthread_detach(SignalThreadID);
+        else
+            fprintf(stderr, "Couldn't create the signal thread\n");
+        
+        pthread_t TimerThreadID;
+        if (pthread_create(&TimerThreadID, 0, ConnectionTimerThreadProc, &ServerMemory) == 0)
+            pthread_detach(TimerThreadID);
+        else
+            fprintf(stderr, "Couldn't create the connection timer thread\n");
+        
+        struct sockaddr_storage TheirAddress; // connector's address information
+        socklen_t SizeTheirAddress = sizeof(TheirAddress);
+        printf("Server: waiting for a connection on port %s\n", InitResult.PortString);
+        if (UpgradeHandle != -1)
+        {
+            char Ready = UPGRADE_READY;
+            if (send(UpgradeHandle, &Ready, 1, MSG_NOSIGNAL) != 1)
+                perror("Upgrade: couldn't tell the old process");
+            close(UpgradeHandle);
+        }
+        
+        while (!Signals.StopAccepting)
+        {  
+            // Accept a client socket
+            SOCKET ClientSocket = 
+                accept4(ListenSocket, (struct sockaddr *)&TheirAddress, &SizeTheirAddress, SOCK_CLOEXEC);
+            if (ClientSocket == -1) 
+            {
+                if (errno != EINTR)
+                    perror("accept failed");
+                continue;
+            }
+            
+            PrepareHandshaking(&ServerMemory, (struct sockaddr *)&TheirAddress, ClientSocket, &Queue);
+        }
+        
+        // NOTE(vincent): Stopping, or another process accepts from the socket now. Let ours finish, then leave.
+        Signals.AcceptorStopped = true;
+        close(ListenSocket);
+        if (DrainConnections(&ServerMemory))
+            return 1;
     }
     
     return 0;
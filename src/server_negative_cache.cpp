@@ -0,0 +1,164 @@
+// NOTE(vincent): Negative lookup cache. Remembers canonical paths that don't exist, so that bots probing
+// /wp-login.php or /.env over and over get the prebuilt 404 without an htpasswd walk or a failed open.
+// Only paths that no .htpasswd protects are cached: a protected miss still has to answer 401 first.
+//
+// An entry is valid while the generations on its path, the protection generation and the epoch
+// are the ones it was inserted with (see server_content_watch.cpp). Without a watcher, entries expire
+// after NEGATIVE_CACHE_TTL_MS instead.
+//
+// The table is set-associative with LRU replacement inside a set, behind one ticket mutex:
+// the critical sections are a handful of comparisons.
+
+#define NEGATIVE_CACHE_SET_COUNT 256     // power of two
+#define NEGATIVE_CACHE_WAYS 4
+#define NEGATIVE_CACHE_MAX_PATH 192      // longer paths aren't cached
+#define NEGATIVE_CACHE_TTL_MS 2000
+
+struct negative_cache_stamp
+{
+    u32 GenerationSum;
+    u32 Epoch;
+    u32 Protection;
+    u64 Time;         // milliseconds, from GetMonotonicMilliseconds()
+};
+
+struct negative_cache_entry
+{
+    u32 Hash;
+    u32 HostIndex;
+    u32 PathLength;   // 0 for an empty entry, canonical paths are never empty
+    u64 LastUsed;
+    negative_cache_stamp Stamp;
+    char Path[NEGATIVE_CACHE_MAX_PATH];
+};
+
+struct negative_cache
+{
+    ticket_mutex Mutex;
+    u64 Clock;        // bumped on every lookup and insertion, for LRU
+    negative_cache_entry Entries[NEGATIVE_CACHE_SET_COUNT*NEGATIVE_CACHE_WAYS];
+    
+    u64 Hits;
+    u64 Misses;
+    u64 Insertions;
+    u64 Evictions;    // valid entries replaced to make room
+    u64 Expirations;  // stale entries found by a lookup
+};
+
+internal negative_cache_stamp
+NegativeCacheStamp(content_generations *Generations, string Root, string RelativePath)
+{
+    // NOTE(vincent): Take the stamp before looking at the filesystem, so that a file created in between
+    // bumps a generation after the stamp and the entry we insert is already stale.
+    negative_cache_stamp Result;
+    Result.Epoch = Generations->Epoch;
+    Result.Protection = Generations->Protection;
+    Result.GenerationSum = PathGenerationSum(Generations, Root, RelativePath);
+    Result.Time = GetMonotonicMilliseconds();
+    return Result;
+}
+
+internal b32
+NegativeCacheStampIsCurrent(content_generations *Generations, negative_cache_stamp Stored, 
+                            negative_cache_stamp Now)
+{
+    b32 Result;
+    if (Generations->WatcherActive)
+    {
+        Result = (Stored.Epoch == Now.Epoch && Stored.Protection == Now.Protection &&
+                  Stored.GenerationSum == Now.GenerationSum);
+    }
+    else
+    {
+        Result = (Now.Time - Stored.Time < NEGATIVE_CACHE_TTL_MS);
+    }
+    return Result;
+}
+
+inline u32
+NegativeCacheHash(u32 HostIndex, string Path)
+{
+    u32 Result = HashString(Path) ^ (HostIndex*0x9E3779B9);
+    return Result;
+}
+
+inline b32
+NegativeCacheEntryMatches(negative_cache_entry *Entry, u32 Hash, u32 HostIndex, string Path)
+{
+    b32 Result = (Entry->PathLength == Path.Length && Entry->Hash == Hash && Entry->HostIndex == HostIndex &&
+                  StringsAreEqual(StringBaseLength(Entry->Path, Entry->PathLength), Path));
+    return Result;
+}
+
+internal b32
+LookupNegativeCache(negative_cache *Cache, content_generations *Generations, u32 HostIndex, string Path,
+                    negative_cache_stamp Now)
+{
+    b32 Result = false;
+    u32 Hash = NegativeCacheHash(HostIndex, Path);
+    negative_cache_entry *Set = Cache->Entries + (Hash & (NEGATIVE_CACHE_SET_COUNT - 1))*NEGATIVE_CACHE_WAYS;
+    
+    BeginTicketMutex(&Cache->Mutex);
+    for (u32 Way = 0; Way < NEGATIVE_CACHE_WAYS; Way++)
+    {
+        negative_cache_entry *Entry = Set + Way;
+        if (NegativeCacheEntryMatches(Entry, Hash, HostIndex, Path))
+        {
+            if (NegativeCacheStampIsCurrent(Generations, Entry->Stamp, Now))
+            {
+                Entry->LastUsed = ++Cache->Clock;
+                Result = true;
+            }
+            else
+            {
+                Entry->PathLength = 0;
+                Cache->Expirations++;
+            }
+            break;
+        }
+    }
+    if (Result)
+        Cache->Hits++;
+    else
+        Cache->Misses++;
+    EndTicketMutex(&Cache->Mutex);
+    
+    return Result;
+}
+
+internal void
+InsertNegativeCache(negative_cache *Cache, u32 HostIndex, string Path, negative_cache_stamp Stamp)
+{
+    if (Path.Length == 0 || Path.Length > NEGATIVE_CACHE_MAX_PATH)
+        return;
+    
+    u32 Hash = NegativeCacheHash(HostIndex, Path);
+    negative_cache_entry *Set = Cache->Entries + (Hash & (NEGATIVE_CACHE_SET_COUNT - 1))*NEGATIVE_CACHE_WAYS;
+    
+    BeginTicketMutex(&Cache->Mutex);
+    // NOTE(vincent): Reuse the entry for this path if another thread raced us here,
+    // otherwise the first empty way, otherwise the least recently used one.
+    negative_cache_entry *Victim = Set;
+    for (u32 Way = 0; Way < NEGATIVE_CACHE_WAYS; Way++)
+    {
+        negative_cache_entry *Entry = Set + Way;
+        if (NegativeCacheEntryMatches(Entry, Hash, HostIndex, Path))
+        {
+            Victim = Entry;
+            break;
+        }
+        if (Victim->PathLength && (Entry->PathLength == 0 || Entry->LastUsed < Victim->LastUsed))
+            Victim = Entry;
+    }
+    if (Victim->PathLength && !NegativeCacheEntryMatches(Victim, Hash, HostIndex, Path))
+        Cache->Evictions++;
+    
+    Victim->Hash = Hash;
+    Victim->HostIndex = HostIndex;
+    Victim->PathLength = Path.Length;
+    Victim->Stamp = Stamp;
+    Victim->LastUsed = ++Cache->Clock;
+    SprintNoNull(Victim->Path, Path);
+    Cache->Insertions++;
+    EndTicketMutex(&Cache->Mutex);
+}
@@ -0,0 +1,145 @@
+// NOTE(vincent): A sampling CPU profiler built into the server, for hosts where perf can't be installed.
+// While it runs, the platform layer interrupts the threads about PROFILE_HZ times per second of CPU time
+// and walks their frame pointers. Each thread appends the stack to its own ring, from the signal handler:
+// no lock, no allocation and no call into libc. /server-profile sends the rings as stacks of addresses,
+// and fold_profile.sh turns those into folded stacks for flame graphs. The stacks are only complete in a
+// build with frame pointers, see build.sh.
+
+#define PROFILE_SAMPLES_PER_THREAD 1024   // power of two
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_HZ 99                     // not in step with the timer wheel's 100ms tick
+#define PROFILE_SAMPLE_MAX_LENGTH (PROFILE_MAX_DEPTH*19 + 8)   // "0x" and 16 hexits per frame, then " 1\n"
+
+struct profile_sample
+{
+    u32 Depth;
+    u64 Frames[PROFILE_MAX_DEPTH];   // the interrupted instruction, then the return addresses outwards
+};
+
+struct profile_ring
+{
+    volatile u64 Count;    // samples ever written, the next one goes at Count % PROFILE_SAMPLES_PER_THREAD
+    u8 Pad[64 - sizeof(u64)];
+    profile_sample Samples[PROFILE_SAMPLES_PER_THREAD];
+};
+
+struct cpu_profiler
+{
+    volatile b32 Running;
+    u64 LoadBias;          // where the executable was mapped, set by the platform layer
+    volatile u64 Dropped;  // samples that landed on threads without a ring: timer, watcher and signal threads
+    profile_ring Rings[NUMBER_OF_THREADS];   // by GetThreadIndex()
+};
+
+inline void
+RecordProfileSample(cpu_profiler *Profiler, u32 ThreadIndex, u64 *Frames, u32 Depth)
+{
+    // NOTE(vincent): Called from a signal handler, on the thread that owns the ring.
+    profile_ring *Ring = Profiler->Rings + ThreadIndex;
+    profile_sample *Sample = Ring->Samples + (Ring->Count & (PROFILE_SAMPLES_PER_THREAD - 1));
+    Sample->Depth = Depth;
+    for (u32 FrameIndex = 0; FrameIndex < Depth; FrameIndex++)
+        Sample->Frames[FrameIndex] = Frames[FrameIndex];
+    CompletePreviousWritesBeforeFutureWrites;
+    Ring->Count = Ring->Count + 1;
+}
+
+internal u32
+SprintHexAddress(char *Dest, u64 Address)
+{
+    char *Hexits = "0123456789abcdef";
+    u32 Length = Sprint(Dest, "0x");
+    u32 Shift = 60;
+    while (Shift > 0 && !(Address >> Shift))
+        Shift -= 4;
+    for (;;)
+    {
+        Dest[Length++] = Hexits[(Address >> Shift) & 0xF];
+        if (Shift == 0)
+            break;
+        Shift -= 4;
+    }
+    Dest[Length] = 0;
+    return Length;
+}
+
+internal u32
+SprintProfileSample(char *Dest, profile_sample *Sample, u64 LoadBias)
+{
+    // NOTE(vincent): One line in the folded format, outermost frame first. Return addresses point after
+    // the call, one byte back puts them on the call's line when addr2line looks them up.
+    u32 Length = 0;
+    for (u32 FrameIndex = Sample->Depth; FrameIndex > 0; FrameIndex--)
+    {
+        u64 Address = Sample->Frames[FrameIndex - 1] - LoadBias - (FrameIndex > 1 ? 1 : 0);
+        Length += SprintHexAddress(Dest + Length, Address);
+        if (FrameIndex > 1)
+            Length += Sprint(Dest + Length, ";");
+    }
+    Length += Sprint(Dest + Length, " 1\n");
+    Assert(Length < PROFILE_SAMPLE_MAX_LENGTH);
+    return Length;
+}
+
+inline u32
+GetProfileDumpMaxLength()
+{
+    u32 Result = 256 + NUMBER_OF_THREADS*PROFILE_SAMPLES_PER_THREAD*PROFILE_SAMPLE_MAX_LENGTH;
+    return Result;
+}
+
+internal u32
+SprintProfile(char *Dest, cpu_profiler *Profiler)
+{
+    // NOTE(vincent): Dest holds GetProfileDumpMaxLength() bytes. Comment lines first, then one line per sample.
+    u32 Length = Sprint(Dest, "# running ");
+    Length += SprintU64(Dest + Length, Profiler->Running ? 1 : 0);
+    Length += Sprint(Dest + Length, "\n# hz ");
+    Length += SprintU64(Dest + Length, PROFILE_HZ);
+    Length += Sprint(Dest + Length, "\n# dropped ");
+    Length += SprintU64(Dest + Length, Profiler->Dropped);
+    Length += Sprint(Dest + Length, "\n");
+    for (u32 ThreadIndex = 0; ThreadIndex < NUMBER_OF_THREADS; ThreadIndex++)
+    {
+        profile_ring *Ring = Profiler->Rings + ThreadIndex;
+        u64 End = Ring->Count;
+        u64 Begin = (End > PROFILE_SAMPLES_PER_THREAD) ? End - PROFILE_SAMPLES_PER_THREAD : 0;
+        for (u64 Index = Begin; Index < End; Index++)
+        {
+            profile_sample Sample = Ring->Samples[Index & (PROFILE_SAMPLES_PER_THREAD - 1)];
+            // NOTE(vincent): The handler went around the ring while we copied, this slot may be torn.
+            if (Ring->Count - Index > PROFILE_SAMPLES_PER_THREAD || Sample.Depth > PROFILE_MAX_DEPTH)
+                continue;
+            Length += SprintProfileSample(Dest + Length, &Sample, Profiler->LoadBias);
+        }
+    }
+    return Length;
+}
+
+#if DEBUG
+internal void
+TestCpuProfiler()
+{
+    char Address[32];
+    Assert(SprintHexAddress(Address, 0) == 3 && StringsAreEqual(Address, "0x0"));
+    Assert(SprintHexAddress(Address, 0x1a2f) == 6 && StringsAreEqual(Address, "0x1a2f"));
+    Assert(SprintHexAddress(Address, 0xFFFFFFFFFFFFFFFF) == 18);
+    
+    static cpu_profiler Profiler;
+    Profiler.LoadBias = 0x10000;
+    u64 Frames[3] = {0x11234, 0x12001, 0x13001};
+    for (u32 Sample = 0; Sample < PROFILE_SAMPLES_PER_THREAD + 2; Sample++)
+        RecordProfileSample(&Profiler, 1, Frames, 1 + Sample % 3);
+    
+    static char Dump[256 + 3*PROFILE_SAMPLES_PER_THREAD*PROFILE_SAMPLE_MAX_LENGTH];
+    u32 Length = SprintProfile(Dump, &Profiler);
+    string Output = StringBaseLength(Dump, Length);
+    Assert(StringBeginsWith(Output, "# running 0\n# hz 99\n# dropped 0\n0x"));
+    Assert(StringContains(Output, "\n0x3000;0x2000;0x1234 1\n"));
+    Assert(StringContains(Output, "\n0x2000;0x1234 1\n"));
+    u32 Lines = 0;
+    for (u32 At = 0; At < Length; At++)
+        Lines += (Dump[At] == '\n');
+    Assert(Lines == 3 + PROFILE_SAMPLES_PER_THREAD);
+}
+#endif
@@ -0,0 +1,212 @@
+// NOTE(vincent): Per-client token buckets, checked by the acceptor before a connection gets a task, so a
+// client over its rate costs one hash lookup and a prebuilt 429 instead of a parse and a file read.
+//
+// The table has a fixed number of slots keyed by binary addresses. A lookup probes RATE_LIMIT_PROBES slots
+// and, for an address that isn't there, takes over the slot that was refilled the longest time ago: that
+// bucket would be full by now anyway, so forgetting it only costs a client whose burst was already back.
+// Only the acceptor thread touches the table, so it needs no lock.
+//
+// IPv6 clients are keyed by their /64, since one host usually gets a whole /64 and could otherwise
+// walk through addresses to get fresh buckets.
+
+#define RATE_LIMIT_SLOT_COUNT 4096   // power of two
+#define RATE_LIMIT_PROBES 8
+
+struct client_address
+{
+    u8 Bytes[16];     // IPv6, IPv4 as ::ffff:a.b.c.d
+};
+
+struct rate_bucket
+{
+    client_address Address;
+    b32 Occupied;
+    u64 Tokens;       // thousandths of a request
+    u64 LastRefill;   // milliseconds, from GetMonotonicMilliseconds()
+};
+
+struct rate_limiter
+{
+    u32 Rate;         // requests per second, 0 when rate limiting is off
+    u32 Burst;        // requests
+    u32 Seed;         // so that clients can't pick addresses that collide
+    u64 Limited;
+    u64 Evictions;
+    rate_bucket Buckets[RATE_LIMIT_SLOT_COUNT];
+};
+
+internal client_address
+ClientAddress(struct sockaddr *Address)
+{
+    client_address Result = {};
+    if (Address->sa_family == AF_INET)
+    {
+        Result.Bytes[10] = 0xff;
+        Result.Bytes[11] = 0xff;
+        u8 *IPv4 = (u8 *)&((struct sockaddr_in *)Address)->sin_addr;
+        for (u32 Byte = 0; Byte < 4; Byte++)
+            Result.Bytes[12 + Byte] = IPv4[Byte];
+    }
+    else
+    {
+        u8 *IPv6 = (u8 *)&((struct sockaddr_in6 *)Address)->sin6_addr;
+        b32 IsMappedIPv4 = true;
+        for (u32 Byte = 0; Byte < 12; Byte++)
+            IsMappedIPv4 &= (IPv6[Byte] == (Byte < 10 ? 0 : 0xff));
+        u32 KeyLength = IsMappedIPv4 ? 16 : 8;
+        for (u32 Byte = 0; Byte < KeyLength; Byte++)
+            Result.Bytes[Byte] = IPv6[Byte];
+    }
+    return Result;
+}
+
+inline b32
+ClientAddressesAreEqual(client_address *A, client_address *B)
+{
+    b32 Result = true;
+    for (u32 Byte = 0; Byte < 16; Byte++)
+        Result &= (A->Bytes[Byte] == B->Bytes[Byte]);
+    return Result;
+}
+
+internal void
+InitializeRateLimiter(rate_limiter *Limiter, u32 Rate, u32 Burst, u32 Seed)
+{
+    Limiter->Rate = Rate;
+    Limiter->Burst = Burst ? Burst : 2*Rate;
+    Limiter->Seed = Seed;
+}
+
+internal b32
+TakeRateToken(rate_limiter *Limiter, client_address *Address, u64 Now)
+{
+    // NOTE(vincent): Returns whether the client may make one more request now.
+    b32 Result = true;
+    if (Limiter->Rate)
+    {
+        u32 Hash = Limiter->Seed;
+        for (u32 Byte = 0; Byte < 16; Byte++)
+            Hash = HashAppendByte(Hash, Address->Bytes[Byte]);
+        
+        rate_bucket *Bucket = 0;
+        rate_bucket *Victim = 0;
+        for (u32 Probe = 0; Probe < RATE_LIMIT_PROBES; Probe++)
+        {
+            rate_bucket *Candidate = Limiter->Buckets + ((Hash + Probe) & (RATE_LIMIT_SLOT_COUNT - 1));
+            if (Candidate->Occupied && ClientAddressesAreEqual(&Candidate->Address, Address))
+            {
+                Bucket = Candidate;
+                break;
+            }
+            if (!Victim || (Victim->Occupied && (!Candidate->Occupied || Candidate->LastRefill < Victim->LastRefill)))
+                Victim = Candidate;
+        }
+        
+        // NOTE(vincent): All in 64 bits: a client idle for an hour refills billions of thousandths.
+        u64 Capacity = 1000*(u64)Limiter->Burst;
+        if (Bucket)
+        {
+            u64 Tokens = Bucket->Tokens + (Now - Bucket->LastRefill)*Limiter->Rate;
+            Bucket->Tokens = Tokens < Capacity ? Tokens : Capacity;
+        }
+        else
+        {
+            if (Victim->Occupied)
+                Limiter->Evictions++;
+            Bucket = Victim;
+            Bucket->Address = *Address;
+            Bucket->Occupied = true;
+            Bucket->Tokens = Capacity;
+        }
+        Bucket->LastRefill = Now;
+        
+        if (Bucket->Tokens >= 1000)
+        {
+            Bucket->Tokens -= 1000;
+        }
+        else
+        {
+            Limiter->Limited++;
+            Result = false;
+        }
+    }
+    return Result;
+}
+
+#if DEBUG
+internal void
+TestRateLimiter()
+{
+    static rate_limiter LimiterStorage;
+    rate_limiter *Limiter = &LimiterStorage;
+    client_address Any = {};
+    Assert(TakeRateToken(Limiter, &Any, 0));
+    
+    InitializeRateLimiter(Limiter, 10, 5, 1234);
+    struct sockaddr_in IPv4 = {};
+    IPv4.sin_family = AF_INET;
+    IPv4.sin_addr.s_addr = htonl(0xC0A80001);   // 192.168.0.1
+    client_address A = ClientAddress((struct sockaddr *)&IPv4);
+    Assert(A.Bytes[10] == 0xff && A.Bytes[11] == 0xff && A.Bytes[12] == 192 && A.Bytes[15] == 1);
+    IPv4.sin_addr.s_addr = htonl(0xC0A80002);
+    client_address B = ClientAddress((struct sockaddr *)&IPv4);
+    
+    // NOTE(vincent): The burst, then one request every 100ms.
+    for (u32 Request = 0; Request < 5; Request++)
+        Assert(TakeRateToken(Limiter, &A, 1000));
+    Assert(!TakeRateToken(Limiter, &A, 1000));
+    Assert(TakeRateToken(Limiter, &B, 1000));
+    Assert(!TakeRateToken(Limiter, &A, 1050));
+    Assert(TakeRateToken(Limiter, &A, 1100));
+    Assert(!TakeRateToken(Limiter, &A, 1100));
+    Assert(Limiter->Limited == 3);
+    
+    // NOTE(vincent): A long pause refills up to the burst, not more.
+    for (u32 Request = 0; Request < 5; Request++)
+        Assert(TakeRateToken(Limiter, &A, 100000));
+    Assert(!TakeRateToken(Limiter, &A, 100000));
+    
+    // NOTE(vincent): So does a pause whose refill doesn't fit in 32 bits: 4294968ms (about 72 minutes)
+    // at 1000 requests per second is 4294968000 thousandths, which would wrap to less than one request.
+    InitializeRateLimiter(Limiter, 1000, 5, 1234);
+    for (u32 Request = 0; Request < 5; Request++)
+        Assert(TakeRateToken(Limiter, &B, 200000));
+    Assert(!TakeRateToken(Limiter, &B, 200000));
+    for (u32 Request = 0; Request < 5; Request++)
+        Assert(TakeRateToken(Limiter, &B, 200000 + 4294968));
+    Assert(!TakeRateToken(Limiter, &B, 200000 + 4294968));
+    
+    // NOTE(vincent): And a burst whose capacity in thousandths doesn't fit in 32 bits.
+    InitializeRateLimiter(Limiter, 1000, 4295000, 1234);
+    for (u32 Request = 0; Request < 1000; Request++)
+        Assert(TakeRateToken(Limiter, &Any, 300000));
+    InitializeRateLimiter(Limiter, 10, 5, 1234);
+    
+    // NOTE(vincent): Two addresses in one IPv6 /64 share a bucket, IPv4-mapped ones don't.
+    struct sockaddr_in6 IPv6 = {};
+    IPv6.sin6_family = AF_INET6;
+    IPv6.sin6_addr.s6_addr[0] = 0x20;
+    IPv6.sin6_addr.s6_addr[15] = 1;
+    client_address C = ClientAddress((struct sockaddr *)&IPv6);
+    IPv6.sin6_addr.s6_addr[15] = 2;
+    client_address D = ClientAddress((struct sockaddr *)&IPv6);
+    Assert(ClientAddressesAreEqual(&C, &D));
+    ZeroBytes((char *)&IPv6.sin6_addr, sizeof(IPv6.sin6_addr));
+    IPv6.sin6_addr.s6_addr[10] = 0xff;
+    IPv6.sin6_addr.s6_addr[11] = 0xff;
+    IPv6.sin6_addr.s6_addr[12] = 192;
+    IPv6.sin6_addr.s6_addr[13] = 168;
+    IPv6.sin6_addr.s6_addr[15] = 2;
+    client_address Mapped = ClientAddress((struct sockaddr *)&IPv6);
+    Assert(ClientAddressesAreEqual(&Mapped, &B));
+    
+    // NOTE(vincent): More clients than slots: the table keeps working, evicting idle buckets.
+    for (u32 Client = 0; Client < 2*RATE_LIMIT_SLOT_COUNT; Client++)
+    {
+        client_address Address = {};
+        *(u32 *)Address.Bytes = Client;
+        Assert(TakeRateToken(Limiter, &Address, 200000 + Client));
+    }
+    Assert(Limiter->Evictions > 0);
+}
+#endif
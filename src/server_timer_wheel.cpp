@@ -0,0 +1,202 @@
+// NOTE(vincent): Hierarchical timer wheel, for connection deadlines.
+//
+// Time is counted in ticks. Level 0 has one slot per tick for the next 64 ticks, level 1 one slot
+// per 64 ticks for the next 64*64, and so on. A timer goes in the lowest level that covers its deadline.
+// Whenever level 0 wraps around, the next slot of level 1 is emptied and its timers are put back
+// in, now at a lower level, and the same between the levels above. Scheduling and cancelling are O(1):
+// timers are intrusive nodes in circular lists, the slot heads being sentinels.
+//
+// The wheel doesn't lock and doesn't know what its timers are for. The caller embeds a timer_node
+// in its own struct, serializes the calls, and handles what AdvanceTimerWheel() returns.
+// A blocking server advances it from a timer thread; an event loop would advance it after each poll().
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_MAX_DELTA ((1ULL << (TIMER_WHEEL_LEVELS*TIMER_WHEEL_SLOT_BITS)) - 1)
+
+struct timer_node
+{
+    timer_node *Next;
+    timer_node *Prev;      // 0 when the timer isn't scheduled
+    u64 Deadline;          // in ticks
+};
+
+struct timer_wheel
+{
+    u64 Current;           // next tick to process: every timer with a deadline before it has expired
+    u32 ScheduledCount;
+    timer_node Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+internal void
+InitializeTimerWheel(timer_wheel *Wheel, u64 Now)
+{
+    Wheel->Current = Now;
+    Wheel->ScheduledCount = 0;
+    for (u32 Level = 0; Level < TIMER_WHEEL_LEVELS; Level++)
+    {
+        for (u32 SlotIndex = 0; SlotIndex < TIMER_WHEEL_SLOTS; SlotIndex++)
+        {
+            timer_node *Sentinel = &Wheel->Slots[Level][SlotIndex];
+            Sentinel->Next = Sentinel;
+            Sentinel->Prev = Sentinel;
+        }
+    }
+}
+
+inline b32
+TimerIsScheduled(timer_node *Node)
+{
+    b32 Result = (Node->Prev != 0);
+    return Result;
+}
+
+internal void
+InsertTimer(timer_wheel *Wheel, timer_node *Node)
+{
+    u64 Delta = Node->Deadline - Wheel->Current;
+    u32 Level = 0;
+    while (Level < TIMER_WHEEL_LEVELS - 1 && Delta >> ((Level + 1)*TIMER_WHEEL_SLOT_BITS))
+        Level++;
+    u32 SlotIndex = (u32)(Node->Deadline >> (Level*TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+    
+    timer_node *Sentinel = &Wheel->Slots[Level][SlotIndex];
+    Node->Next = Sentinel;
+    Node->Prev = Sentinel->Prev;
+    Sentinel->Prev->Next = Node;
+    Sentinel->Prev = Node;
+}
+
+internal void
+ScheduleTimer(timer_wheel *Wheel, timer_node *Node, u64 Deadline)
+{
+    // NOTE(vincent): Deadlines already passed fire on the next advance, deadlines too far away are clamped.
+    Assert(!TimerIsScheduled(Node));
+    if (Deadline < Wheel->Current)
+        Deadline = Wheel->Current;
+    if (Deadline - Wheel->Current > TIMER_WHEEL_MAX_DELTA)
+        Deadline = Wheel->Current + TIMER_WHEEL_MAX_DELTA;
+    Node->Deadline = Deadline;
+    InsertTimer(Wheel, Node);
+    Wheel->ScheduledCount++;
+}
+
+internal void
+CancelTimer(timer_wheel *Wheel, timer_node *Node)
+{
+    // NOTE(vincent): Fine to call on a timer that isn't scheduled, or that already expired.
+    if (TimerIsScheduled(Node))
+    {
+        Node->Prev->Next = Node->Next;
+        Node->Next->Prev = Node->Prev;
+        Node->Next = 0;
+        Node->Prev = 0;
+        Wheel->ScheduledCount--;
+    }
+}
+
+internal u32
+CascadeTimers(timer_wheel *Wheel, u32 Level)
+{
+    // NOTE(vincent): Moves the timers of the current slot of Level down. Returns that slot's index,
+    // zero meaning the level above has to cascade too.
+    u32 SlotIndex = (u32)(Wheel->Current >> (Level*TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+    timer_node *Sentinel = &Wheel->Slots[Level][SlotIndex];
+    timer_node *Node = Sentinel->Next;
+    Sentinel->Next = Sentinel;
+    Sentinel->Prev = Sentinel;
+    while (Node != Sentinel)
+    {
+        timer_node *Next = Node->Next;
+        InsertTimer(Wheel, Node);
+        Node = Next;
+    }
+    return SlotIndex;
+}
+
+internal timer_node *
+AdvanceTimerWheel(timer_wheel *Wheel, u64 Now)
+{
+    // NOTE(vincent): Processes every tick up to and including Now. Returns the expired timers as a list
+    // linked through Next, they are unscheduled by then.
+    timer_node *Expired = 0;
+    while (Wheel->Current <= Now)
+    {
+        u32 SlotIndex = (u32)Wheel->Current & (TIMER_WHEEL_SLOTS - 1);
+        for (u32 Level = 1; SlotIndex == 0 && Level < TIMER_WHEEL_LEVELS; Level++)
+            SlotIndex = CascadeTimers(Wheel, Level);
+        
+        timer_node *Sentinel = &Wheel->Slots[0][Wheel->Current & (TIMER_WHEEL_SLOTS - 1)];
+        while (Sentinel->Next != Sentinel)
+        {
+            timer_node *Node = Sentinel->Next;
+            Assert(Node->Deadline == Wheel->Current);
+            CancelTimer(Wheel, Node);
+            Node->Next = Expired;
+            Expired = Node;
+        }
+        Wheel->Current++;
+    }
+    return Expired;
+}
+
+#if DEBUG
+internal void
+TestTimerWheel()
+{
+    // NOTE(vincent): Random deadlines across every level, some cancelled, some rescheduled. Each timer
+    // must expire exactly once, on its deadline tick, unless cancelled.
+    u32 const TimerCount = 2000;
+    static timer_wheel Wheel;
+    static timer_node Nodes[TimerCount];
+    static u64 Deadlines[TimerCount];
+    static b32 Fired[TimerCount];
+    u64 Start = 123456789;
+    InitializeTimerWheel(&Wheel, Start);
+    
+    u32 Random = 0x1234567;
+    for (u32 Index = 0; Index < TimerCount; Index++)
+    {
+        Random = Random*1664525 + 1013904223;
+        u32 Range = (Index % 4 == 0) ? 64 : (Index % 4 == 1) ? 4096 : (Index % 4 == 2) ? 262144 : 1000000;
+        Deadlines[Index] = Start + (Random >> 8) % Range;
+        Nodes[Index] = {};
+        Fired[Index] = false;
+        ScheduleTimer(&Wheel, Nodes + Index, Deadlines[Index]);
+    }
+    for (u32 Index = 0; Index < TimerCount; Index += 7)
+        CancelTimer(&Wheel, Nodes + Index);
+    
+    u64 Now = Start;
+    u32 FiredCount = 0;
+    while (Wheel.ScheduledCount)
+    {
+        Now += 1 + (Now % 13);
+        for (timer_node *Node = AdvanceTimerWheel(&Wheel, Now); Node;)
+        {
+            timer_node *Next = Node->Next;
+            u32 Index = (u32)(Node - Nodes);
+            Assert(Index % 7 != 0 && !Fired[Index]);
+            Assert(Node->Deadline == Deadlines[Index] && Deadlines[Index] <= Now && Deadlines[Index] > Now - 14);
+            Fired[Index] = true;
+            FiredCount++;
+            // NOTE(vincent): Reschedule a few from inside the expiry loop, like a connection moving to its next phase.
+            if (Index % 5 == 1 && Deadlines[Index] < Start + 500000)
+            {
+                Deadlines[Index] += 500000;
+                Fired[Index] = false;
+                FiredCount--;
+                ScheduleTimer(&Wheel, Node, Deadlines[Index]);
+            }
+            Node = Next;
+        }
+    }
+    Assert(FiredCount == TimerCount - (TimerCount + 6)/7);
+    
+    // NOTE(vincent): Past deadlines fire on the next advance.
+    timer_node Late = {};
+    ScheduleTimer(&Wheel, &Late, 0);
+    Assert(AdvanceTimerWheel(&Wheel, Wheel.Current) == &Late);
+}
+#endif
@@ -0,0 +1,190 @@
+// NOTE(vincent): Request tracing. One request in trace_sample gets each phase of its life timestamped:
+// the acceptor's work, the wait in the work deques, then recv, parse, auth, read, send and close on the
+// thread that served it. /server-trace dumps the events in the Chrome trace format, which chrome://tracing
+// and ui.perfetto.dev open: queueing delay and service time show up side by side on a timeline.
+//
+// Each thread writes only to its own ring of events, so recording takes no lock and no atomic. A dump
+// reads the rings while they're written: it skips the events that may have been overwritten meanwhile.
+
+#define TRACE_EVENTS_PER_THREAD 4096   // power of two
+#define TRACE_EVENT_MAX_LENGTH 160     // one event in the JSON output
+
+enum trace_phase
+{
+    TracePhase_Accept,     // rate limit, admission, task and enqueue, on the acceptor
+    TracePhase_Queued,     // enqueued to dequeued, an async slice since requests overlap there
+    TracePhase_Receive,
+    TracePhase_Parse,      // request line and headers, then the vhost lookup
+    TracePhase_Auth,       // .htpasswd walk
+    TracePhase_Read,       // file open and read, or bundle lookup
+    TracePhase_Send,
+    TracePhase_Close,
+    TracePhase_Count,
+};
+
+struct trace_event
+{
+    u64 Start;             // microseconds, from GetMonotonicMicroseconds()
+    u32 Duration;          // microseconds
+    u32 RequestId;
+    trace_phase Phase;
+};
+
+struct trace_ring
+{
+    volatile u64 Count;    // events ever written, the next one goes at Count % TRACE_EVENTS_PER_THREAD
+    u8 Pad[64 - sizeof(u64)];
+    trace_event Events[TRACE_EVENTS_PER_THREAD];
+};
+
+struct request_tracer
+{
+    u32 NextRequestId;     // acceptor only
+    trace_ring Rings[NUMBER_OF_THREADS];   // by GetThreadIndex()
+};
+
+internal u32
+TraceRequestId(request_tracer *Tracer, u32 SampleEvery)
+{
+    // NOTE(vincent): Acceptor thread only. 0 for a request that isn't traced.
+    u32 Id = ++Tracer->NextRequestId;
+    if (Id == 0)
+        Id = ++Tracer->NextRequestId;
+    u32 Result = (SampleEvery && Id % SampleEvery == 0) ? Id : 0;
+    return Result;
+}
+
+inline void
+RecordTraceEvent(request_tracer *Tracer, u32 ThreadIndex, u32 RequestId, trace_phase Phase, u64 Start, u64 End)
+{
+    trace_ring *Ring = Tracer->Rings + ThreadIndex;
+    trace_event *Event = Ring->Events + (Ring->Count & (TRACE_EVENTS_PER_THREAD - 1));
+    Event->Start = Start;
+    // NOTE(vincent): Clamped in 64 bits, a phase longer than 2^32 ticks saturates instead of wrapping.
+    u64 Duration = End - Start;
+    Event->Duration = (u32)(Duration < 0xFFFFFFFF ? Duration : 0xFFFFFFFF);
+    Event->RequestId = RequestId;
+    Event->Phase = Phase;
+    CompletePreviousWritesBeforeFutureWrites;
+    Ring->Count = Ring->Count + 1;
+}
+
+inline u64
+TracePhase(request_tracer *Tracer, u32 ThreadIndex, u32 RequestId, trace_phase Phase, u64 Start)
+{
+    // NOTE(vincent): Ends the phase that began at Start and returns when the next one begins.
+    // Costs nothing but a branch when the request isn't traced.
+    u64 Result = 0;
+    if (RequestId)
+    {
+        Result = GetMonotonicMicroseconds();
+        RecordTraceEvent(Tracer, ThreadIndex, RequestId, Phase, Start, Result);
+    }
+    return Result;
+}
+
+internal char *TracePhaseNames[TracePhase_Count] =
+{
+    "accept", "queued", "recv", "parse", "auth", "read", "send", "close",
+};
+
+internal u32
+SprintTraceEvent(char *Dest, trace_event *Event, u32 ThreadIndex)
+{
+    u32 Length = 0;
+    if (Event->Phase == TracePhase_Queued)
+    {
+        // NOTE(vincent): A begin and an end with the request as id, on a track of their own.
+        for (u32 Edge = 0; Edge < 2; Edge++)
+        {
+            Length += Sprint(Dest + Length, (char *)(Edge ? ",\n{\"ph\":\"e\"" : "{\"ph\":\"b\""));
+            Length += Sprint(Dest + Length, ",\"cat\":\"queue\",\"name\":\"queued\",\"pid\":1,\"id\":");
+            Length += SprintU64(Dest + Length, Event->RequestId);
+            Length += Sprint(Dest + Length, ",\"ts\":");
+            Length += SprintU64(Dest + Length, Event->Start + (Edge ? Event->Duration : 0));
+            Length += Sprint(Dest + Length, "}");
+        }
+    }
+    else
+    {
+        Length += Sprint(Dest + Length, "{\"ph\":\"X\",\"cat\":\"request\",\"name\":\"");
+        Length += Sprint(Dest + Length, TracePhaseNames[Event->Phase]);
+        Length += Sprint(Dest + Length, "\",\"pid\":1,\"tid\":");
+        Length += SprintU64(Dest + Length, ThreadIndex);
+        Length += Sprint(Dest + Length, ",\"ts\":");
+        Length += SprintU64(Dest + Length, Event->Start);
+        Length += Sprint(Dest + Length, ",\"dur\":");
+        Length += SprintU64(Dest + Length, Event->Duration);
+        Length += Sprint(Dest + Length, ",\"args\":{\"request\":");
+        Length += SprintU64(Dest + Length, Event->RequestId);
+        Length += Sprint(Dest + Length, "}}");
+    }
+    Assert(Length < TRACE_EVENT_MAX_LENGTH);
+    return Length;
+}
+
+inline u32
+GetTraceDumpMaxLength()
+{
+    u32 Result = 64 + NUMBER_OF_THREADS*TRACE_EVENTS_PER_THREAD*TRACE_EVENT_MAX_LENGTH;
+    return Result;
+}
+
+internal u32
+SprintTrace(char *Dest, request_tracer *Tracer)
+{
+    // NOTE(vincent): Dest holds GetTraceDumpMaxLength() bytes. The events stay in the rings, a later dump
+    // shows them again along with the new ones.
+    u32 Length = Sprint(Dest, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    b32 First = true;
+    for (u32 ThreadIndex = 0; ThreadIndex < NUMBER_OF_THREADS; ThreadIndex++)
+    {
+        trace_ring *Ring = Tracer->Rings + ThreadIndex;
+        u64 End = Ring->Count;
+        u64 Begin = (End > TRACE_EVENTS_PER_THREAD) ? End - TRACE_EVENTS_PER_THREAD : 0;
+        for (u64 Index = Begin; Index < End; Index++)
+        {
+            trace_event Event = Ring->Events[Index & (TRACE_EVENTS_PER_THREAD - 1)];
+            // NOTE(vincent): The writer went around the ring while we copied, this slot may be torn.
+            if (Ring->Count - Index > TRACE_EVENTS_PER_THREAD)
+                continue;
+            if (!First)
+                Length += Sprint(Dest + Length, ",\n");
+            First = false;
+            Length += SprintTraceEvent(Dest + Length, &Event, ThreadIndex);
+        }
+    }
+    Length += Sprint(Dest + Length, "\n]}\n");
+    return Length;
+}
+
+#if DEBUG
+internal void
+TestRequestTracer()
+{
+    static request_tracer Tracer;
+    Assert(TraceRequestId(&Tracer, 0) == 0);
+    Assert(TraceRequestId(&Tracer, 2) == 2);
+    Assert(TraceRequestId(&Tracer, 2) == 0);
+    Assert(TracePhase(&Tracer, 0, 0, TracePhase_Parse, 0) == 0 && Tracer.Rings[0].Count == 0);
+    
+    // NOTE(vincent): A full ring keeps the latest events.
+    for (u32 Event = 0; Event < TRACE_EVENTS_PER_THREAD + 3; Event++)
+        RecordTraceEvent(&Tracer, 1, Event + 1, TracePhase_Send, 1000 + Event, 1010 + Event);
+    RecordTraceEvent(&Tracer, 2, 7, TracePhase_Queued, 500, 800);
+    Assert(Tracer.Rings[1].Events[0].RequestId == TRACE_EVENTS_PER_THREAD + 1);
+    
+    static char Dump[64 + 3*TRACE_EVENTS_PER_THREAD*TRACE_EVENT_MAX_LENGTH];
+    u32 Length = SprintTrace(Dump, &Tracer);
+    Assert(Length < sizeof(Dump));
+    string Output = StringBaseLength(Dump, Length);
+    Assert(StringBeginsWith(Output, "{\"displayTimeUnit\""));
+    Assert(StringContains(Output, "{\"ph\":\"b\",\"cat\":\"queue\",\"name\":\"queued\",\"pid\":1,\"id\":7,\"ts\":500}"));
+    Assert(StringContains(Output, "{\"ph\":\"e\",\"cat\":\"queue\",\"name\":\"queued\",\"pid\":1,\"id\":7,\"ts\":800}"));
+    Assert(StringContains(Output, "\"name\":\"send\",\"pid\":1,\"tid\":1,\"ts\":1003,\"dur\":10,\"args\":{\"request\":4}}"));
+    Assert(!StringContains(Output, "\"args\":{\"request\":3}}"));
+    
+    RecordTraceEvent(&Tracer, 3, 9, TracePhase_Send, 1000, 1000 + 0x100000005ull);
+    Assert(Tracer.Rings[3].Events[0].Duration == 0xFFFFFFFF);
+}
+#endif
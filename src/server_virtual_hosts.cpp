@@ -0,0 +1,227 @@
+// NOTE(vincent): Virtual hosts. The table is built once at startup, either from the vhost entries of
+// the config file or from the subdirectories of the root folder, and requests find their document root
+// with one hash lookup on the Host header instead of building Root/Host/Path strings.
+
+#define MAX_VIRTUAL_HOSTS 256
+#define VIRTUAL_HOST_SLOT_COUNT 1024   // power of two, at least twice MAX_VIRTUAL_HOSTS
+#define MAX_HOST_NAME_LENGTH 255
+
+struct virtual_host
+{
+    string Name;              // lowercase, no port
+    string Root;              // null-terminated, no ending slash
+    string BundlePrefix;      // bundle mode: where this host's files are in the bundle, e.g. "verti"
+    platform_directory Directory;
+    u32 CacheKey;             // keys this host's cache entries, the same across reloads for the same Root
+};
+
+struct virtual_host_table
+{
+    u32 Count;
+    virtual_host Hosts[MAX_VIRTUAL_HOSTS];
+    u16 Slots[VIRTUAL_HOST_SLOT_COUNT];  // index into Hosts plus one, zero for an empty slot
+    virtual_host *Default;               // serves requests for unknown hosts, may be 0
+};
+
+internal string
+NormalizeHostName(char *Dest, string Host)
+{
+    // NOTE(vincent): "Verti:8080" and "verti." both become "verti". Dest must hold MAX_HOST_NAME_LENGTH bytes.
+    // IPv6 literals keep their brackets: "[::1]:8080" becomes "[::1]".
+    u32 Length = Host.Length;
+    if (Length > 0 && Host.Base[0] == '[')
+    {
+        u32 Closing = StringPrefixUntil(Host, ']').Length;
+        if (Closing < Length)
+            Length = Closing + 1;
+    }
+    else
+    {
+        Length = StringPrefixUntil(Host, ':').Length;
+    }
+    if (Length > 0 && Host.Base[Length - 1] == '.')
+        Length--;
+    Length = Minimum(Length, MAX_HOST_NAME_LENGTH);
+    
+    for (u32 Index = 0; Index < Length; Index++)
+    {
+        char C = Host.Base[Index];
+        Dest[Index] = ('A' <= C && C <= 'Z') ? C - 'A' + 'a' : C;
+    }
+    return StringBaseLength(Dest, Length);
+}
+
+internal virtual_host *
+FindVirtualHost(virtual_host_table *Table, string Host)
+{
+    char Buffer[MAX_HOST_NAME_LENGTH];
+    string Name = NormalizeHostName(Buffer, Host);
+    
+    virtual_host *Result = 0;
+    u32 Hash = HashString(Name);
+    for (u32 Probe = 0; Probe < VIRTUAL_HOST_SLOT_COUNT; Probe++)
+    {
+        u16 Slot = Table->Slots[(Hash + Probe) & (VIRTUAL_HOST_SLOT_COUNT - 1)];
+        if (Slot == 0)
+            break;
+        virtual_host *Candidate = Table->Hosts + Slot - 1;
+        if (StringsAreEqual(Candidate->Name, Name))
+        {
+            Result = Candidate;
+            break;
+        }
+    }
+    
+    if (!Result)
+        Result = Table->Default;
+    return Result;
+}
+
+internal virtual_host *
+AddVirtualHost(virtual_host_table *Table, memory_arena *Arena, string Name, string Root)
+{
+    // NOTE(vincent): Name and Root are copied into the arena. Returns 0 on a full table or a duplicate name.
+    virtual_host *Result = 0;
+    if (Table->Count < MAX_VIRTUAL_HOSTS)
+    {
+        char *NameBase = PushArray(Arena, MAX_HOST_NAME_LENGTH, char);
+        string Normalized = NormalizeHostName(NameBase, Name);
+        u32 Hash = HashString(Normalized);
+        for (u32 Probe = 0; Probe < VIRTUAL_HOST_SLOT_COUNT; Probe++)
+        {
+            u16 *Slot = Table->Slots + ((Hash + Probe) & (VIRTUAL_HOST_SLOT_COUNT - 1));
+            if (*Slot == 0)
+            {
+                Result = Table->Hosts + Table->Count++;
+                *Slot = (u16)Table->Count;
+                break;
+            }
+            if (StringsAreEqual(Table->Hosts[*Slot - 1].Name, Normalized))
+                break;
+        }
+        
+        if (Result)
+        {
+            Result->Name = Normalized;
+            Result->Root = StringBaseLength(PushArray(Arena, Root.Length + 1, char), Root.Length);
+            Sprint(Result->Root.Base, Root);
+            Result->BundlePrefix = Result->Root;
+            Result->Directory.Handle = -1;
+            Result->Directory.Path = Result->Root.Base;
+        }
+    }
+    return Result;
+}
+
+internal u32
+LoadVirtualHosts(virtual_host_table *Table, memory_arena *Arena, parsed_config_file_result *Config,
+                 site_bundle *Bundle)
+{
+    // NOTE(vincent): Returns an error count like ParseConfigFile does.
+    u32 ErrorCount = 0;
+    b32 BundleMode = (Bundle->Entries != 0);
+    string ConfigRoot = StringFromLiteral(Config->Root);
+    
+    if (Config->VirtualHostCount)
+    {
+        for (u32 HostIndex = 0; HostIndex < Config->VirtualHostCount; HostIndex++)
+        {
+            config_virtual_host *Configured = Config->VirtualHosts + HostIndex;
+            virtual_host *Host = AddVirtualHost(Table, Arena, StringFromLiteral(Configured->Name),
+                                                StringFromLiteral(Configured->Root));
+            if (!Host)
+            {
+                fprintf(stderr, "Vhost %s is a duplicate, or there are too many vhosts\n", Configured->Name);
+                ErrorCount++;
+            }
+            else if (StringBeginsWith(Host->Root, Config->Root) && Host->Root.Length > ConfigRoot.Length &&
+                     Host->Root.Base[ConfigRoot.Length] == '/')
+            {
+                // NOTE(vincent): The bundle was packed from the root folder, so its paths don't have that prefix.
+                Host->BundlePrefix = StringFromOffset(Host->Root, ConfigRoot.Length + 1);
+            }
+        }
+    }
+    else if (BundleMode)
+    {
+        // NOTE(vincent): One host per top-level folder of the bundle. Paths are sorted, so all the paths
+        // of one folder are next to each other.
+        string Previous = {};
+        for (u32 EntryIndex = 0; EntryIndex < Bundle->EntryCount; EntryIndex++)
+        {
+            string Path = BundleEntryPath(Bundle, Bundle->Entries + EntryIndex);
+            string Folder = StringPrefixUntil(Path, '/');
+            if (Folder.Length == Path.Length || StringsAreEqual(Folder, Previous))
+                continue;
+            Previous = Folder;
+            
+            string Root = StringBaseLength(PushArray(Arena, ConfigRoot.Length + 1 + Folder.Length, char), 0);
+            AppendString(&Root, ConfigRoot);
+            AppendStringLiteral(&Root, "/");
+            AppendString(&Root, Folder);
+            virtual_host *Host = AddVirtualHost(Table, Arena, Folder, Root);
+            if (Host)
+                Host->BundlePrefix = Folder;
+        }
+    }
+    else
+    {
+        // NOTE(vincent): One host per subdirectory of the root folder, like "websites/verti" for Host: verti.
+        platform_directory RootDirectory = OpenDirectory(Config->Root);
+        platform_directory_listing Listing = {};
+        if (RootDirectory.Handle != -1)
+        {
+            Listing = PushDirectoryListing(Arena, RootDirectory, "", false);
+            CloseDirectory(RootDirectory);
+        }
+        if (!Listing.Success)
+        {
+            fprintf(stderr, "Couldn't list the root folder \"%s\" to find virtual hosts\n", Config->Root);
+            ErrorCount++;
+        }
+        for (u32 EntryIndex = 0; EntryIndex < Listing.Count; EntryIndex++)
+        {
+            platform_directory_entry *Entry = Listing.Entries + EntryIndex;
+            if (Entry->IsDirectory)
+            {
+                string Name = StringFromLiteral(Entry->Name);
+                string Root = StringBaseLength(PushArray(Arena, ConfigRoot.Length + 1 + Name.Length, char), 0);
+                AppendString(&Root, ConfigRoot);
+                AppendStringLiteral(&Root, "/");
+                AppendString(&Root, Name);
+                if (!AddVirtualHost(Table, Arena, Name, Root))
+                    fprintf(stderr, "Skipping folder %s: too many virtual hosts\n", Entry->Name);
+            }
+        }
+    }
+    
+    if (!BundleMode)
+    {
+        for (u32 HostIndex = 0; HostIndex < Table->Count; HostIndex++)
+        {
+            virtual_host *Host = Table->Hosts + HostIndex;
+            Host->Directory = OpenDirectory(Host->Root.Base);
+            if (Host->Directory.Handle == -1)
+                ErrorCount++;
+        }
+    }
+    
+    if (Config->DefaultHostSet)
+    {
+        Table->Default = FindVirtualHost(Table, StringFromLiteral(Config->DefaultHost));
+        if (!Table->Default)
+        {
+            fprintf(stderr, "Default host %s is not a vhost\n", Config->DefaultHost);
+            ErrorCount++;
+        }
+    }
+    
+    for (u32 HostIndex = 0; HostIndex < Table->Count; HostIndex++)
+    {
+        virtual_host *Host = Table->Hosts + HostIndex;
+        printf("Virtual host: %.*s -> %s%s\n", Host->Name.Length, Host->Name.Base, Host->Root.Base,
+               Host == Table->Default ? " (default)" : "");
+    }
+    
+    return ErrorCount;
+}
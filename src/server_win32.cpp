@@ -17,76 +17,193 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <psapi.h>
 #include "common.h"
 #include "server.cpp"
 #pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Psapi.lib")
 
 
+#include "work_deque.h"
+
+#define WIN32_PAGE_SIZE 4096
+
+// NOTE(vincent): Same scheme as the Linux layer: one deque per thread, the main thread's is index 0,
+// jobs go to the deque of the thread that adds them and idle threads steal.
+struct win32_worker
+{
+    platform_work_queue *Queue;
+    u32 Index;
+    b32 Pinned;
+    u32 HomeNode;             // where the thread was when it touched its arena
+    memory_arena Arena;       // Base stays 0 until the thread has set it up
+};
+
 struct platform_work_queue
 {
-    u32 volatile NextEntryToWrite;
-    u32 volatile NextEntryToRead;
+    u32 DequeCount;
     HANDLE SemaphoreHandle;
-    platform_work_queue_entry Entries[256];
+    thread_placement Placement;
+    thread_topology Topology;
+    win32_worker Workers[NUMBER_OF_THREADS];
+    work_deque Deques[NUMBER_OF_THREADS];
 };
 
+internal thread_local u32 Win32WorkerIndex;   // zero on the main thread
+
 internal void
 Win32AddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
 {
-    u32 NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % ArrayCount(Queue->Entries);
-    Assert(NewNextEntryToWrite != Queue->NextEntryToWrite);
-    
-    if (NewNextEntryToWrite != Queue->NextEntryToRead)
+    platform_work_queue_entry Entry = {Callback, Data};
+    if (PushWorkDeque(Queue->Deques + Win32WorkerIndex, Entry))
     {
-        platform_work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
-        Entry->Callback = Callback;
-        Entry->Data = Data;
-        //_WriteBarrier(); // TODO(vincent): hmmmm... why would you use that?
-        Queue->NextEntryToWrite = NewNextEntryToWrite;
         // increase semaphore count so a thread can wake up
         ReleaseSemaphore(Queue->SemaphoreHandle, 1, 0); 
     }
-    
+    else
+    {
+        // NOTE(vincent): Full deque: don't drop the job, do it now.
+        Callback(Queue, Data);
+    }
 }
 
 internal b32
 Win32DoNextWorkQueueEntry(platform_work_queue *Queue)
 {
-    // Many threads may be executing this function simultaneously.
-    // Queue is subject to concurrent modifications so we have to be careful.
-    // Entries in the work queue are laid out in a circular buffer.
+    // Many threads may be executing this function simultaneously, see work_deque.h.
     b32 WeShouldSleep = false;
-    u32 OriginalNextEntryToRead = Queue->NextEntryToRead; // read this once and try to work with that
-    u32 NewNextEntryToRead = (OriginalNextEntryToRead + 1) % ArrayCount(Queue->Entries);
-    if (OriginalNextEntryToRead != Queue->NextEntryToWrite) // if read pointer hasn't caught up 
+    platform_work_queue_entry Entry;
+    if (TakeWork(Queue->Deques, Queue->DequeCount, Win32WorkerIndex, &Entry))
+        Entry.Callback(Queue, Entry.Data);
+    else
+        WeShouldSleep = true; // this thread found that there is no work left to do
+    
+    return WeShouldSleep;
+}
+
+internal memory_arena *
+GetThreadArena(platform_work_queue *Queue)
+{
+    memory_arena *Result = &Queue->Workers[Win32WorkerIndex].Arena;
+    return Result;
+}
+
+internal u32
+GetThreadIndex(platform_work_queue *Queue)
+{
+    return Win32WorkerIndex;
+}
+
+internal void
+Win32LoadTopology(thread_topology *Topology)
+{
+    // NOTE(vincent): Only the first processor group, that's the 64 CPUs SetThreadAffinityMask can address.
+    DWORD_PTR ProcessMask = 0;
+    DWORD_PTR SystemMask = 0;
+    GetProcessAffinityMask(GetCurrentProcess(), &ProcessMask, &SystemMask);
+    ULONG HighestNode = 0;
+    GetNumaHighestNodeNumber(&HighestNode);
+    for (u32 Node = 0; Node <= HighestNode && Node < MAX_PLACEMENT_NODES; Node++)
+    {
+        ULONGLONG NodeMask = 0;
+        if (GetNumaNodeProcessorMask((UCHAR)Node, &NodeMask))
+        {
+            for (u32 CPU = 0; CPU < 64; CPU++)
+            {
+                if ((NodeMask & ProcessMask) & (1ULL << CPU))
+                    AddTopologyCPU(Topology, Node, CPU);
+            }
+        }
+    }
+}
+
+internal void
+Win32SetUpThread(platform_work_queue *Queue, win32_worker *Worker)
+{
+    // NOTE(vincent): Runs on the thread itself, before it takes any job: pin it, then allocate and
+    // touch its arena from there.
+    thread_topology *Topology = &Queue->Topology;
+    s32 Node = -1;
+    if (Queue->Placement != ThreadPlacement_None && Topology->CPUCount)
     {
-        // Atomically increment the queue's NextEntryToRead iff somebody else hasn't already done it.
-        u32 Index = InterlockedCompareExchange((LONG volatile *)&Queue->NextEntryToRead, 
-                                               NewNextEntryToRead, OriginalNextEntryToRead);
-        // Index is the old value of Queue->NextEntryToRead, 
-        // so we are successfully the ones to have done the incrementation 
-        // iff Index == OriginalNextEntryToRead, 
-        // and in that case we are the thread that should do that entry's work.
-        if (Index == OriginalNextEntryToRead)
+        u32 Chosen = ChooseThreadCPU(Topology, Queue->Placement, Worker->Index);
+        if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Topology->CPUs[Chosen]))
         {
-            platform_work_queue_entry Entry = Queue->Entries[Index];
-            Entry.Callback(Queue, Entry.Data);
-            //InterlockedIncrement((LONG volatile *) &Queue->Completioncount);
-            // Other people may be retrieving other entries simultaneously so this should also be atomic.
+            Worker->Pinned = true;
+            Node = Topology->CPUNodes[Chosen];
+            printf("Thread %u pinned to CPU %u, node %d\n", Worker->Index, Topology->CPUs[Chosen], Node);
         }
+        else
+            printf("Couldn't pin thread %u to CPU %u: %d\n", Worker->Index, Topology->CPUs[Chosen], GetLastError());
     }
+    
+    u8 *Base = 0;
+    if (Node >= 0)
+        Base = (u8 *)VirtualAllocExNuma(GetCurrentProcess(), 0, THREAD_ARENA_SIZE, MEM_RESERVE | MEM_COMMIT,
+                                        PAGE_READWRITE, (DWORD)Node);
     else
+        Base = (u8 *)VirtualAlloc(0, THREAD_ARENA_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!Base)
     {
-        WeShouldSleep = true; // this thread found that there is no work left to do
+        printf("Couldn't allocate the arena of thread %u: %d\n", Worker->Index, GetLastError());
+        exit(1);
     }
     
-    return WeShouldSleep;
+    // NOTE(vincent): Pages go to the node of the CPU that first touches them, unless VirtualAllocExNuma said otherwise.
+    for (u32 Offset = 0; Offset < THREAD_ARENA_SIZE; Offset += WIN32_PAGE_SIZE)
+        Base[Offset] = 0;
+    USHORT CurrentNode = 0;
+    PROCESSOR_NUMBER Processor;
+    GetCurrentProcessorNumberEx(&Processor);
+    GetNumaProcessorNodeEx(&Processor, &CurrentNode);
+    Worker->HomeNode = Node >= 0 ? (u32)Node : CurrentNode;
+    
+    InitializeArena(&Worker->Arena, THREAD_ARENA_SIZE, Base);
+}
+
+internal platform_placement_stats
+GetPlacementStats(platform_work_queue *Queue)
+{
+    platform_placement_stats Result = {};
+    Result.NodeCount = Queue->Topology.NodeCount;
+    for (u32 WorkerIndex = 0; WorkerIndex < Queue->DequeCount; WorkerIndex++)
+    {
+        win32_worker *Worker = Queue->Workers + WorkerIndex;
+        u8 *Base = Worker->Arena.Base;
+        if (!Base)
+            continue;
+        Result.PinnedThreadCount += Worker->Pinned ? 1 : 0;
+        
+        // NOTE(vincent): QueryWorkingSetEx() tells the node of every resident page.
+        PSAPI_WORKING_SET_EX_INFORMATION Pages[512];
+        for (u32 Offset = 0; Offset < THREAD_ARENA_SIZE;)
+        {
+            u32 Count = 0;
+            for (; Count < ArrayCount(Pages) && Offset < THREAD_ARENA_SIZE; Count++, Offset += WIN32_PAGE_SIZE)
+                Pages[Count].VirtualAddress = Base + Offset;
+            if (!QueryWorkingSetEx(GetCurrentProcess(), Pages, Count*sizeof(Pages[0])))
+                break;
+            for (u32 PageIndex = 0; PageIndex < Count; PageIndex++)
+            {
+                PSAPI_WORKING_SET_EX_BLOCK Attributes = Pages[PageIndex].VirtualAttributes;
+                if (Attributes.Valid && Attributes.Node == Worker->HomeNode)
+                    Result.LocalPages++;
+                else if (Attributes.Valid)
+                    Result.RemotePages++;
+            }
+        }
+    }
+    return Result;
 }
 
 DWORD WINAPI
 ThreadProc(LPVOID lpParameter)
 {
-    platform_work_queue *Queue = (platform_work_queue *)lpParameter;
+    win32_worker *Worker = (win32_worker *)lpParameter;
+    platform_work_queue *Queue = Worker->Queue;
+    Win32WorkerIndex = Worker->Index;
+    Win32SetUpThread(Queue, Worker);
     for (;;)
     {
         if (Win32DoNextWorkQueueEntry(Queue))
@@ -97,16 +214,26 @@ ThreadProc(LPVOID lpParameter)
 }
 
 internal void
-Win32MakeQueue(platform_work_queue *Queue, u32 ThreadCount)
+Win32MakeQueue(platform_work_queue *Queue, u32 ThreadCount, thread_placement Placement)
 {
-    Queue->NextEntryToWrite = 0;
-    Queue->NextEntryToRead = 0;
+    Assert(ThreadCount < ArrayCount(Queue->Deques));
+    Queue->DequeCount = ThreadCount + 1;
+    Queue->Placement = Placement;
+    Win32LoadTopology(&Queue->Topology);
     u32 InitialCount = 0;
     Queue->SemaphoreHandle = CreateSemaphoreEx(0, InitialCount, ThreadCount, 0, 0, SEMAPHORE_ALL_ACCESS);
+    
+    // NOTE(vincent): The main thread takes jobs too, see PrepareHandshaking().
+    Queue->Workers[0].Queue = Queue;
+    Win32SetUpThread(Queue, Queue->Workers);
+    
     for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
     {
+        win32_worker *Worker = Queue->Workers + ThreadIndex + 1;
+        Worker->Queue = Queue;
+        Worker->Index = ThreadIndex + 1;
         DWORD ThreadID;
-        HANDLE ThreadHandle = CreateThread(0, 0, ThreadProc, Queue, 0, &ThreadID);
+        HANDLE ThreadHandle = CreateThread(0, 0, ThreadProc, Worker, 0, &ThreadID);
         CloseHandle(ThreadHandle);
     }
 }
@@ -125,6 +252,13 @@ HandleReceiveError(int BytesReceived, SOCKET ClientSocket)
     return Success;
 }
 
+internal int
+ReceiveSome(SOCKET ClientSocket, char *Buffer, u32 Size)
+{
+    int Result = recv(ClientSocket, Buffer, (int)Size, 0);
+    return Result;
+}
+
 internal b32
 HandleSendError(int BytesSent, SOCKET ClientSocket)
 {
@@ -158,11 +292,338 @@ ShutdownConnection(SOCKET ClientSocket)
     closesocket(ClientSocket);
 }
 
+internal u64
+GetMonotonicMilliseconds()
+{
+    u64 Result = GetTickCount64();
+    return Result;
+}
+
+internal u64
+GetMonotonicMicroseconds()
+{
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Counter;
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Counter);
+    u64 Seconds = (u64)Counter.QuadPart / (u64)Frequency.QuadPart;
+    u64 Remainder = (u64)Counter.QuadPart % (u64)Frequency.QuadPart;
+    u64 Result = Seconds*1000000 + Remainder*1000000 / (u64)Frequency.QuadPart;
+    return Result;
+}
+
+internal b32
+StartProfiler(cpu_profiler *Profiler)
+{
+    // TODO(vincent): Sample with SuspendThread() and GetThreadContext() from a thread of our own.
+    return false;
+}
+
+internal void
+StopProfiler(cpu_profiler *Profiler)
+{
+}
+
+internal void
+RefuseConnection(SOCKET ClientSocket, char *Response, u32 Length)
+{
+    u_long NonBlocking = 1;
+    ioctlsocket(ClientSocket, FIONBIO, &NonBlocking);
+    send(ClientSocket, Response, Length, 0);
+    shutdown(ClientSocket, SD_SEND);
+    // NOTE(vincent): Closing with unread request bytes resets the connection, and the client may then drop
+    // the response before reading it. Discard what already arrived, without waiting for more.
+    char Discard[1024];
+    for (u32 Attempt = 0; Attempt < 8 && recv(ClientSocket, Discard, sizeof(Discard), 0) > 0; Attempt++);
+    closesocket(ClientSocket);
+}
+
+internal s64
+SendGather(SOCKET ClientSocket, platform_send_buffer *Buffers, u32 BufferCount)
+{
+    WSABUF Vectors[8];
+    Assert(BufferCount <= ArrayCount(Vectors));
+    for (u32 BufferIndex = 0; BufferIndex < BufferCount; BufferIndex++)
+    {
+        Vectors[BufferIndex].buf = Buffers[BufferIndex].Base;
+        Vectors[BufferIndex].len = (ULONG)Buffers[BufferIndex].Length;
+    }
+    DWORD BytesSent = 0;
+    s64 Result = -1;
+    if (WSASend(ClientSocket, Vectors, BufferCount, &BytesSent, 0, 0, 0) == 0)
+        Result = BytesSent;
+    return Result;
+}
+
+internal void
+SetSendLowWatermark(SOCKET ClientSocket, u32 Bytes)
+{
+    // NOTE(vincent): Windows has no TCP_NOTSENT_LOWAT. It sizes the send backlog itself (ideal send backlog).
+}
+
+internal void
+SetSocketTimeouts(SOCKET ClientSocket, u32 ReceiveMilliseconds, u32 SendMilliseconds)
+{
+    DWORD Timeout = ReceiveMilliseconds;
+    if (setsockopt(ClientSocket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&Timeout, sizeof(Timeout)) == SOCKET_ERROR)
+        printf("setsockopt(SO_RCVTIMEO) failed: %d\n", WSAGetLastError());
+    Timeout = SendMilliseconds;
+    if (setsockopt(ClientSocket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&Timeout, sizeof(Timeout)) == SOCKET_ERROR)
+        printf("setsockopt(SO_SNDTIMEO) failed: %d\n", WSAGetLastError());
+}
+
+internal void
+AbortConnection(SOCKET ClientSocket)
+{
+    shutdown(ClientSocket, SD_BOTH);
+}
+
+DWORD WINAPI
+ConnectionTimerThreadProc(LPVOID lpParameter)
+{
+    server_memory *Memory = (server_memory *)lpParameter;
+    for (;;)
+    {
+        Sleep(CONNECTION_TIMER_TICK_MILLISECONDS);
+        ExpireConnectionTimers(Memory);
+    }
+}
+
+internal u64
+Win32GetConfigWriteTime()
+{
+    u64 Result = 0;
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if (GetFileAttributesExA("config", GetFileExInfoStandard, &Data))
+        Result = ((u64)Data.ftLastWriteTime.dwHighDateTime << 32) | Data.ftLastWriteTime.dwLowDateTime;
+    return Result;
+}
+
+// NOTE(vincent): There is no SIGHUP here, the config is reloaded when its file changes. Editors often
+// write the file in several steps, so we wait for it to stay the same for one interval first.
+#define WIN32_CONFIG_POLL_MILLISECONDS 1000
+DWORD WINAPI
+ConfigWatchThreadProc(LPVOID lpParameter)
+{
+    server_memory *Memory = (server_memory *)lpParameter;
+    u64 Loaded = Win32GetConfigWriteTime();
+    u64 Seen = Loaded;
+    for (;;)
+    {
+        Sleep(WIN32_CONFIG_POLL_MILLISECONDS);
+        u64 WriteTime = Win32GetConfigWriteTime();
+        if (WriteTime && WriteTime == Seen && WriteTime != Loaded)
+        {
+            ReloadConfig(Memory);
+            Loaded = WriteTime;
+        }
+        Seen = WriteTime;
+    }
+}
+
+internal platform_file_mapping
+MapEntireFileReadOnly(char *Filename)
+{
+    platform_file_mapping Result = {};
+    HANDLE FileHandle = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (FileHandle != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER FileSize;
+        if (GetFileSizeEx(FileHandle, &FileSize) && FileSize.QuadPart > 0)
+        {
+            HANDLE MappingHandle = CreateFileMappingA(FileHandle, 0, PAGE_READONLY, 0, 0, 0);
+            if (MappingHandle)
+            {
+                Result.Base = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+                if (Result.Base)
+                    Result.Size = (u64)FileSize.QuadPart;
+                // NOTE(vincent): The view keeps the mapping object alive.
+                CloseHandle(MappingHandle);
+            }
+        }
+        CloseHandle(FileHandle);
+    }
+    if (!Result.Base)
+        printf("Couldn't map %s: %d\n", Filename, GetLastError());
+    return Result;
+}
+
+internal void
+UnmapFile(platform_file_mapping Mapping)
+{
+    UnmapViewOfFile(Mapping.Base);
+}
+
+internal platform_append_file
+CreateAppendOnlyFile(char *Filename)
+{
+    // NOTE(vincent): Opened with FILE_APPEND_DATA only, every WriteFile() goes to the end of the file.
+    platform_append_file Result;
+    HANDLE FileHandle = CreateFileA(Filename, FILE_APPEND_DATA, FILE_SHARE_READ, 0,
+                                    CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+    Result.Handle = (FileHandle != INVALID_HANDLE_VALUE) ? (s64)FileHandle : -1;
+    if (Result.Handle == -1 && GetLastError() != ERROR_FILE_EXISTS)
+        printf("Couldn't create %s: %d\n", Filename, GetLastError());
+    return Result;
+}
+
+internal b32
+AppendToFile(platform_append_file File, void *Data, u32 Size)
+{
+    DWORD Written = 0;
+    b32 Result = (WriteFile((HANDLE)File.Handle, Data, Size, &Written, 0) && Written == Size);
+    return Result;
+}
+
+internal void
+SleepMilliseconds(u32 Milliseconds)
+{
+    Sleep(Milliseconds);
+}
+
+internal platform_directory
+OpenDirectory(char *Path)
+{
+    platform_directory Result;
+    DWORD Attributes = GetFileAttributesA(Path);
+    b32 IsDirectory = (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY));
+    Result.Handle = IsDirectory ? 0 : -1;
+    Result.Path = Path;
+    if (!IsDirectory)
+        printf("Couldn't open directory %s\n", Path);
+    return Result;
+}
+
+internal void
+CloseDirectory(platform_directory Directory)
+{
+    // NOTE(vincent): Nothing was opened, we only kept the path.
+}
+
+internal char *
+Win32PushJoinedPath(memory_arena *Arena, platform_directory Directory, char *RelativePath, char *Suffix)
+{
+    u32 Length = StringLength(Directory.Path) + 1 + StringLength(RelativePath) + StringLength(Suffix);
+    char *Result = PushArray(Arena, Length + 1, char);
+    u32 At = SprintNoNull(Result, Directory.Path);
+    Result[At++] = '/';
+    At += SprintNoNull(Result + At, RelativePath);
+    Sprint(Result + At, Suffix);
+    return Result;
+}
+
+internal push_read_entire_file
+PushReadEntireFileAt(memory_arena *Arena, platform_directory Directory, char *RelativePath)
+{
+    // NOTE(vincent): No openat() equivalent here, so we pay for the path concatenation.
+    char *Path = Win32PushJoinedPath(Arena, Directory, RelativePath, "");
+    push_read_entire_file Result = PushReadEntireFile(Arena, Path);
+    if (!Result.Success)
+    {
+        DWORD Attributes = GetFileAttributesA(Path);
+        Result.IsDirectory = (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY));
+    }
+    return Result;
+}
+
+internal platform_file_info
+GetFileInfoAt(platform_directory Directory, char *RelativePath)
+{
+    platform_file_info Result = {};
+    char Path[MAX_PATH];
+    u32 DirectoryLength = StringLength(Directory.Path);
+    if (DirectoryLength + 1 + StringLength(RelativePath) < MAX_PATH)
+    {
+        u32 At = SprintNoNull(Path, Directory.Path);
+        Path[At++] = '/';
+        Sprint(Path + At, RelativePath);
+        WIN32_FILE_ATTRIBUTE_DATA Data;
+        if (GetFileAttributesExA(Path, GetFileExInfoStandard, &Data))
+        {
+            Result.Exists = true;
+            Result.Size = ((u64)Data.nFileSizeHigh << 32) | Data.nFileSizeLow;
+            Result.ModificationTime = ((u64)Data.ftLastWriteTime.dwHighDateTime << 32) | 
+                Data.ftLastWriteTime.dwLowDateTime;
+        }
+    }
+    return Result;
+}
+
+internal platform_directory_listing
+PushDirectoryListing(memory_arena *Arena, platform_directory Directory, char *RelativePath, b32 StayBeneath)
+{
+    platform_directory_listing Result = {};
+    char *Pattern = Win32PushJoinedPath(Arena, Directory, RelativePath, *RelativePath ? "/*" : "*");
+    
+    WIN32_FIND_DATAA FindData;
+    u32 MaxCount = 0;
+    HANDLE FindHandle = FindFirstFileA(Pattern, &FindData);
+    if (FindHandle != INVALID_HANDLE_VALUE)
+    {
+        do { MaxCount++; } while (FindNextFileA(FindHandle, &FindData));
+        FindClose(FindHandle);
+        
+        Result.Entries = PushArray(Arena, MaxCount, platform_directory_entry);
+        Result.Success = true;
+        FindHandle = FindFirstFileA(Pattern, &FindData);
+        if (FindHandle != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                if (StringsAreEqual(FindData.cFileName, ".") || StringsAreEqual(FindData.cFileName, ".."))
+                    continue;
+                if (Result.Count == MaxCount)
+                    break;
+                // NOTE(vincent): We can't tell where a link or junction leads without opening it, leave them out.
+                if (StayBeneath && (FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                    continue;
+                platform_directory_entry *Listed = Result.Entries + Result.Count++;
+                Listed->Name = PushArray(Arena, StringLength(FindData.cFileName) + 1, char);
+                Sprint(Listed->Name, FindData.cFileName);
+                Listed->Size = ((u64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+                u64 FileTime = ((u64)FindData.ftLastWriteTime.dwHighDateTime << 32) | 
+                    FindData.ftLastWriteTime.dwLowDateTime;
+                // NOTE(vincent): FILETIME counts 100ns intervals since 1601.
+                Listed->ModificationTime = FileTime / 10000000ULL - 11644473600ULL;
+                Listed->IsDirectory = (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            } while (FindNextFileA(FindHandle, &FindData));
+            FindClose(FindHandle);
+        }
+    }
+    return Result;
+}
+
+// NOTE(vincent): Ctrl+C, Ctrl+Break and closing the console stop the server gracefully. Closing the listening
+// socket makes the main thread's accept() fail, then it drains the connections in flight.
+struct win32_stop
+{
+    SOCKET ListenSocket;
+    volatile b32 StopAccepting;
+    volatile b32 Drained;
+};
+internal win32_stop Win32Stop;
+
+BOOL WINAPI
+Win32ConsoleControlHandler(DWORD ControlType)
+{
+    if (!Win32Stop.StopAccepting)
+    {
+        Win32Stop.StopAccepting = true;
+        closesocket(Win32Stop.ListenSocket);
+    }
+    // NOTE(vincent): The process ends as soon as this returns for these, Windows gives us about 5 seconds.
+    if (ControlType == CTRL_CLOSE_EVENT || ControlType == CTRL_LOGOFF_EVENT || ControlType == CTRL_SHUTDOWN_EVENT)
+    {
+        while (!Win32Stop.Drained)
+            Sleep(10);
+    }
+    return TRUE;
+}
+
 int main() 
 {
-    // NOTE(vincent): Initialize threads and work queue
     platform_work_queue Queue = {};
-    Win32MakeQueue(&Queue, NUMBER_OF_THREADS - 1);
     
     // NOTE(vincent): Initializing server memory
     server_memory ServerMemory = {};
@@ -173,6 +634,8 @@ int main()
     initialize_server_memory_result InitResult =
         InitializeServerMemory(&ServerMemory, &Queue, Win32AddEntry, Win32DoNextWorkQueueEntry);
     
+    // NOTE(vincent): Initialize threads and work queue, once the config told us where to put them.
+    Win32MakeQueue(&Queue, NUMBER_OF_THREADS - 1, InitResult.ThreadPlacement);
     
     if (InitResult.ParsingErrorCount == 0)
     {
@@ -232,7 +695,7 @@ int main()
         
         freeaddrinfo(AddressInfo);
         
-        if (listen(ListenSocket, SOMAXCONN) == SOCKET_ERROR) 
+        if (listen(ListenSocket, InitResult.Backlog) == SOCKET_ERROR) 
         {
             printf( "Listen failed with error: %ld\n", WSAGetLastError());
             closesocket(ListenSocket);
@@ -240,6 +703,16 @@ int main()
             return 5;
         }
         
+        Win32Stop.ListenSocket = ListenSocket;
+        SetConsoleCtrlHandler(Win32ConsoleControlHandler, TRUE);
+        
+        DWORD TimerThreadID;
+        HANDLE TimerThreadHandle = CreateThread(0, 0, ConnectionTimerThreadProc, &ServerMemory, 0, &TimerThreadID);
+        CloseHandle(TimerThreadHandle);
+        DWORD ConfigThreadID;
+        HANDLE ConfigThreadHandle = CreateThread(0, 0, ConfigWatchThreadProc, &ServerMemory, 0, &ConfigThreadID);
+        CloseHandle(ConfigThreadHandle);
+        
         struct sockaddr_storage TheirAddress; // connector's address information
         int SizeTheirAddress = sizeof(TheirAddress);
         printf("\nServer: waiting for a connection on port %s\n", InitResult.PortString);
@@ -252,6 +725,8 @@ int main()
             
             if (ClientSocket == INVALID_SOCKET) 
             {
+                if (Win32Stop.StopAccepting)
+                    break;
                 printf("accept failed: %d\n", WSAGetLastError());
                 closesocket(ListenSocket);
                 //WSACleanup();
@@ -261,6 +736,9 @@ int main()
                 PrepareHandshaking(&ServerMemory, (struct sockaddr *)&TheirAddress, ClientSocket, &Queue);
         }
         
+        DrainConnections(&ServerMemory);
+        Win32Stop.Drained = true;
+        
         //WSACleanup(); 
         // NOTE(vincent): I think we don't need to ever call WSACleanup() anywhere.
         // when we call WSACleanup(), the server can't really run anymore, so you might as well
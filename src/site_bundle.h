@@ -0,0 +1,206 @@
+// NOTE(vincent): A site bundle is one file holding every file under the websites root,
+// produced offline by site_packer (see site_packer.cpp) and mapped read-only by the server at startup.
+// Layout, all integers little-endian:
+//
+// site_bundle_header
+// site_bundle_entry[EntryCount], sorted by path, byte-wise
+// strings: entry paths and precomputed HTTP header blocks
+// file bodies, each aligned to SITE_BUNDLE_BODY_ALIGNMENT
+//
+// Paths are relative to the websites root and have no leading slash, e.g. "verti/index.html".
+// Deploying a new bundle is a matter of writing it next to the old one and rename()ing it over.
+
+#define SITE_BUNDLE_MAGIC 0x4c444e42  // "BNDL" in memory order
+#define SITE_BUNDLE_VERSION 1
+#define SITE_BUNDLE_BODY_ALIGNMENT 16
+#define SITE_BUNDLE_NO_VARIANT 0xFFFFFFFF
+
+struct site_bundle_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 EntryCount;
+    u32 EntriesOffset;
+    u64 TotalSize;
+};
+
+enum site_bundle_encoding
+{
+    SiteBundleEncoding_Identity,
+    SiteBundleEncoding_Gzip,
+};
+
+struct site_bundle_entry
+{
+    u32 PathOffset;
+    u32 PathLength;
+    u32 HeaderOffset;    // "HTTP/1.1 200 OK\r\n" ... "\r\n\r\n", ready to send as is
+    u32 HeaderLength;
+    u64 BodyOffset;
+    u64 BodySize;
+    u64 ETag;            // also printed in the header block as a quoted 16-hexit string
+    u32 VariantIndex;    // entry of a precompressed variant of this file, or SITE_BUNDLE_NO_VARIANT
+    u32 Encoding;        // site_bundle_encoding
+};
+
+struct site_bundle
+{
+    u8 *Base;
+    u64 Size;
+    u32 EntryCount;
+    site_bundle_entry *Entries;
+};
+
+inline string
+BundleEntryPath(site_bundle *Bundle, site_bundle_entry *Entry)
+{
+    string Result = StringBaseLength((char *)Bundle->Base + Entry->PathOffset, Entry->PathLength);
+    return Result;
+}
+
+inline string
+BundleEntryHeader(site_bundle *Bundle, site_bundle_entry *Entry)
+{
+    string Result = StringBaseLength((char *)Bundle->Base + Entry->HeaderOffset, Entry->HeaderLength);
+    return Result;
+}
+
+inline char *
+BundleEntryBody(site_bundle *Bundle, site_bundle_entry *Entry)
+{
+    char *Result = (char *)Bundle->Base + Entry->BodyOffset;
+    return Result;
+}
+
+#define SITE_BUNDLE_ETAG_LENGTH 18
+
+internal u32
+SprintETagNoNull(char *Dest, u64 ETag)
+{
+    // NOTE(vincent): Quoted, 16 lowercase hexits, most significant first. Always SITE_BUNDLE_ETAG_LENGTH bytes.
+    *Dest++ = '"';
+    for (s32 Shift = 60; Shift >= 0; Shift -= 4)
+    {
+        u32 Hexit = (u32)(ETag >> Shift) & 0xF;
+        *Dest++ = (char)(Hexit < 10 ? Hexit + '0' : Hexit - 10 + 'a');
+    }
+    *Dest = '"';
+    return SITE_BUNDLE_ETAG_LENGTH;
+}
+
+internal s32
+CompareBundlePaths(string A, string B)
+{
+    // NOTE(vincent): Byte-wise comparison, shorter string first when one is a prefix of the other.
+    // The packer sorts with the exact same rule.
+    u32 Count = Minimum(A.Length, B.Length);
+    for (u32 Byte = 0; Byte < Count; Byte++)
+    {
+        u8 ByteA = (u8)A.Base[Byte];
+        u8 ByteB = (u8)B.Base[Byte];
+        if (ByteA != ByteB)
+            return ByteA < ByteB ? -1 : 1;
+    }
+    if (A.Length == B.Length)
+        return 0;
+    return A.Length < B.Length ? -1 : 1;
+}
+
+internal s32
+CompareBundlePaths(string A, string Directory, string Name)
+{
+    // NOTE(vincent): Same as comparing A with Directory + "/" + Name, or just Name when Directory is empty,
+    // without building that string.
+    u32 BLength = Directory.Length ? Directory.Length + 1 + Name.Length : Name.Length;
+    u32 Count = Minimum(A.Length, BLength);
+    for (u32 Byte = 0; Byte < Count; Byte++)
+    {
+        u8 ByteA = (u8)A.Base[Byte];
+        u8 ByteB;
+        if (!Directory.Length)
+            ByteB = (u8)Name.Base[Byte];
+        else if (Byte < Directory.Length)
+            ByteB = (u8)Directory.Base[Byte];
+        else if (Byte == Directory.Length)
+            ByteB = '/';
+        else
+            ByteB = (u8)Name.Base[Byte - Directory.Length - 1];
+        
+        if (ByteA != ByteB)
+            return ByteA < ByteB ? -1 : 1;
+    }
+    if (A.Length == BLength)
+        return 0;
+    return A.Length < BLength ? -1 : 1;
+}
+
+internal b32
+LoadSiteBundle(site_bundle *Bundle, void *Base, u64 Size)
+{
+    // NOTE(vincent): Validate everything once here, so that lookups never have to bounds check.
+    b32 Valid = false;
+    site_bundle_header *Header = (site_bundle_header *)Base;
+    if (Base && Size >= sizeof(site_bundle_header) &&
+        Header->Magic == SITE_BUNDLE_MAGIC && Header->Version == SITE_BUNDLE_VERSION &&
+        Header->TotalSize == Size &&
+        Header->EntriesOffset >= sizeof(site_bundle_header) &&
+        (u64)Header->EntriesOffset + (u64)Header->EntryCount*sizeof(site_bundle_entry) <= Size)
+    {
+        Bundle->Base = (u8 *)Base;
+        Bundle->Size = Size;
+        Bundle->EntryCount = Header->EntryCount;
+        Bundle->Entries = (site_bundle_entry *)(Bundle->Base + Header->EntriesOffset);
+        
+        Valid = true;
+        for (u32 EntryIndex = 0; EntryIndex < Bundle->EntryCount; EntryIndex++)
+        {
+            site_bundle_entry *Entry = Bundle->Entries + EntryIndex;
+            if ((u64)Entry->PathOffset + Entry->PathLength > Size ||
+                (u64)Entry->HeaderOffset + Entry->HeaderLength > Size ||
+                Entry->BodyOffset > Size || Entry->BodySize > Size - Entry->BodyOffset ||
+                (Entry->VariantIndex != SITE_BUNDLE_NO_VARIANT &&
+                 Entry->VariantIndex >= Bundle->EntryCount))
+            {
+                Valid = false;
+                break;
+            }
+            if (EntryIndex > 0 &&
+                CompareBundlePaths(BundleEntryPath(Bundle, Entry - 1), BundleEntryPath(Bundle, Entry)) >= 0)
+            {
+                Valid = false;  // binary search relies on strictly increasing paths
+                break;
+            }
+        }
+    }
+    
+    if (!Valid)
+    {
+        site_bundle Empty = {};
+        *Bundle = Empty;
+    }
+    return Valid;
+}
+
+internal site_bundle_entry *
+FindBundleEntry(site_bundle *Bundle, string Directory, string Name)
+{
+    site_bundle_entry *Result = 0;
+    u32 Low = 0;
+    u32 High = Bundle->EntryCount;
+    while (Low < High)
+    {
+        u32 Middle = Low + (High - Low) / 2;
+        site_bundle_entry *Entry = Bundle->Entries + Middle;
+        s32 Comparison = CompareBundlePaths(BundleEntryPath(Bundle, Entry), Directory, Name);
+        if (Comparison == 0)
+        {
+            Result = Entry;
+            break;
+        }
+        if (Comparison < 0)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+    return Result;
+}
@@ -0,0 +1,380 @@
+// NOTE(vincent): Offline tool that packs a websites root folder into a single site bundle file.
+// Usage: site_packer <websites root> <output bundle>
+// The bundle is written to <output bundle>.tmp first and then rename()d over the output,
+// so a server can be pointed at a path that always holds a complete bundle.
+//
+// Precompressed variants are not produced here since we don't link against a compression library.
+// Instead, if the tree contains both foo.css and foo.css.gz, foo.css.gz is registered as
+// the gzip variant of foo.css and the server will pick it for clients that accept gzip.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "site_bundle.h"
+
+struct packer_file
+{
+    string Path;          // relative to the root, no leading slash
+    u64 Size;
+    u64 ETag;
+    u32 VariantIndex;
+    u32 OriginalIndex;    // for a variant, the file it stands for; itself otherwise
+    u32 Encoding;
+    string ContentType;
+};
+
+struct packer_state
+{
+    memory_arena Arena;   // paths and the file table
+    packer_file *Files;
+    u32 FileCount;
+    u32 MaxFileCount;
+    string Root;
+    u32 ErrorCount;
+};
+
+internal string
+GuessContentType(string Path)
+{
+    // NOTE(vincent): Only the types that actually show up in the websites we host.
+    struct extension_type
+    {
+        const char *Extension;
+        const char *Type;
+    };
+    extension_type Table[] =
+    {
+        {".html", "text/html; charset=utf-8"},
+        {".htm", "text/html; charset=utf-8"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".svg", "image/svg+xml"},
+        {".ico", "image/x-icon"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".ttf", "font/ttf"},
+        {".eot", "application/vnd.ms-fontobject"},
+        {".gz", "application/gzip"},
+    };
+    
+    string Result = StringFromLiteral("application/octet-stream");
+    for (u32 Index = 0; Index < ArrayCount(Table); Index++)
+    {
+        string Extension = StringFromLiteral(Table[Index].Extension);
+        if (Path.Length >= Extension.Length &&
+            StringsAreEqual(StringFromOffset(Path, Path.Length - Extension.Length), Extension))
+        {
+            Result = StringFromLiteral(Table[Index].Type);
+            break;
+        }
+    }
+    return Result;
+}
+
+internal u64
+HashFNV1a(u8 *Bytes, u64 Count)
+{
+    u64 Hash = 0xcbf29ce484222325ULL;
+    for (u64 Byte = 0; Byte < Count; Byte++)
+    {
+        Hash ^= Bytes[Byte];
+        Hash *= 0x100000001b3ULL;
+    }
+    return Hash;
+}
+
+internal void
+CollectFiles(packer_state *Packer, char *Directory, u32 DirectoryLength)
+{
+    // NOTE(vincent): Directory is a null-terminated path that starts with the root,
+    // with enough room after it to append a child name.
+    DIR *Dir = opendir(Directory);
+    if (!Dir)
+    {
+        perror(Directory);
+        Packer->ErrorCount++;
+        return;
+    }
+    
+    struct dirent *DirEntry;
+    while ((DirEntry = readdir(Dir)))
+    {
+        if (StringsAreEqual(DirEntry->d_name, ".") || StringsAreEqual(DirEntry->d_name, ".."))
+            continue;
+        
+        u32 NameLength = StringLength(DirEntry->d_name);
+        u32 ChildLength = DirectoryLength + 1 + NameLength;
+        char *Child = PushArray(&Packer->Arena, ChildLength + 1, char);
+        SprintNoNull(Child, StringBaseLength(Directory, DirectoryLength));
+        Child[DirectoryLength] = '/';
+        Sprint(Child + DirectoryLength + 1, DirEntry->d_name);
+        
+        struct stat Stat;
+        if (stat(Child, &Stat) == -1)
+        {
+            perror(Child);
+            Packer->ErrorCount++;
+        }
+        else if (S_ISDIR(Stat.st_mode))
+        {
+            CollectFiles(Packer, Child, ChildLength);
+        }
+        else if (S_ISREG(Stat.st_mode))
+        {
+            if (Packer->FileCount < Packer->MaxFileCount)
+            {
+                packer_file *File = Packer->Files + Packer->FileCount++;
+                File->Path = StringFromOffset(StringBaseLength(Child, ChildLength), Packer->Root.Length + 1);
+                File->Size = (u64)Stat.st_size;
+                File->VariantIndex = SITE_BUNDLE_NO_VARIANT;
+                File->Encoding = SiteBundleEncoding_Identity;
+                File->ContentType = GuessContentType(File->Path);
+            }
+            else
+            {
+                fprintf(stderr, "Too many files (max is %u)\n", Packer->MaxFileCount);
+                Packer->ErrorCount++;
+            }
+        }
+    }
+    closedir(Dir);
+}
+
+internal void
+SortFiles(packer_file *Files, u32 Count)
+{
+    // NOTE(vincent): Insertion sort. Websites have a few thousand files at most and this runs offline.
+    for (u32 Index = 1; Index < Count; Index++)
+    {
+        packer_file File = Files[Index];
+        u32 Slot = Index;
+        while (Slot > 0 && CompareBundlePaths(Files[Slot - 1].Path, File.Path) > 0)
+        {
+            Files[Slot] = Files[Slot - 1];
+            Slot--;
+        }
+        Files[Slot] = File;
+    }
+}
+
+internal u32
+SprintHeaderBlock(char *Dest, packer_file *File, packer_file *Original)
+{
+    // NOTE(vincent): Dest may be 0, in which case we only measure.
+    char Scratch[512];
+    char *C = Scratch;
+    C += SprintNoNull(C, "HTTP/1.1 200 OK\r\nContent-Length: ");
+    char Digits[32];
+    sprintf(Digits, "%llu", (unsigned long long)File->Size);
+    C += SprintNoNull(C, Digits);
+    C += SprintNoNull(C, "\r\nContent-Type: ");
+    C += SprintNoNull(C, Original->ContentType);
+    if (File->Encoding == SiteBundleEncoding_Gzip)
+        C += SprintNoNull(C, "\r\nContent-Encoding: gzip");
+    if (File->Encoding == SiteBundleEncoding_Gzip || Original->VariantIndex != SITE_BUNDLE_NO_VARIANT)
+        C += SprintNoNull(C, "\r\nVary: Accept-Encoding");
+    C += SprintNoNull(C, "\r\nETag: ");
+    C += SprintETagNoNull(C, File->ETag);
+    C += SprintNoNull(C, "\r\n\r\n");
+    
+    u32 Length = (u32)(C - Scratch);
+    Assert(Length < sizeof(Scratch));
+    if (Dest)
+        SprintNoNull(Dest, StringBaseLength(Scratch, Length));
+    return Length;
+}
+
+inline u64
+AlignUp(u64 Value, u64 Alignment)
+{
+    return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+int main(int ArgCount, char **Args)
+{
+    InitializeStringPath();
+    if (ArgCount != 3)
+    {
+        fprintf(stderr, "Usage: %s <websites root> <output bundle>\n", Args[0]);
+        return 1;
+    }
+    
+    packer_state Packer = {};
+    u32 ArenaSize = (u32)Megabytes(64);
+    void *ArenaMemory = mmap(0, ArenaSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ArenaMemory == MAP_FAILED)
+    {
+        perror("mmap failed");
+        return 1;
+    }
+    InitializeArena(&Packer.Arena, ArenaSize, ArenaMemory);
+    Packer.MaxFileCount = 65536;
+    Packer.Files = PushArray(&Packer.Arena, Packer.MaxFileCount, packer_file);
+    
+    // NOTE(vincent): Strip trailing slashes from the root, like the config loader does.
+    u32 RootLength = StringLength(Args[1]);
+    while (RootLength > 1 && Args[1][RootLength - 1] == '/')
+        RootLength--;
+    char *Root = PushArray(&Packer.Arena, RootLength + 1, char);
+    Sprint(Root, StringBaseLength(Args[1], RootLength));
+    Packer.Root = StringBaseLength(Root, RootLength);
+    
+    CollectFiles(&Packer, Root, RootLength);
+    if (Packer.ErrorCount)
+        return 1;
+    SortFiles(Packer.Files, Packer.FileCount);
+    for (u32 FileIndex = 0; FileIndex < Packer.FileCount; FileIndex++)
+        Packer.Files[FileIndex].OriginalIndex = FileIndex;
+    
+    // NOTE(vincent): Pair foo.gz with foo. The list is sorted so we can binary search it.
+    for (u32 FileIndex = 0; FileIndex < Packer.FileCount; FileIndex++)
+    {
+        packer_file *File = Packer.Files + FileIndex;
+        string Suffix = StringFromLiteral(".gz");
+        if (File->Path.Length > Suffix.Length &&
+            StringsAreEqual(StringFromOffset(File->Path, File->Path.Length - Suffix.Length), Suffix))
+        {
+            string OriginalPath = StringBaseLength(File->Path.Base, File->Path.Length - Suffix.Length);
+            u32 Low = 0;
+            u32 High = Packer.FileCount;
+            while (Low < High)
+            {
+                u32 Middle = Low + (High - Low) / 2;
+                s32 Comparison = CompareBundlePaths(Packer.Files[Middle].Path, OriginalPath);
+                if (Comparison == 0)
+                {
+                    Packer.Files[Middle].VariantIndex = FileIndex;
+                    File->OriginalIndex = Middle;
+                    File->Encoding = SiteBundleEncoding_Gzip;
+                    break;
+                }
+                if (Comparison < 0)
+                    Low = Middle + 1;
+                else
+                    High = Middle;
+            }
+        }
+    }
+    
+    // NOTE(vincent): Measure the bundle. ETags aren't known yet but header blocks have a fixed-size ETag.
+    u64 EntriesOffset = AlignUp(sizeof(site_bundle_header), 8);
+    u64 StringsOffset = EntriesOffset + (u64)Packer.FileCount*sizeof(site_bundle_entry);
+    u64 StringsSize = 0;
+    u64 BodiesSize = 0;
+    for (u32 FileIndex = 0; FileIndex < Packer.FileCount; FileIndex++)
+    {
+        packer_file *File = Packer.Files + FileIndex;
+        packer_file *Original = Packer.Files + File->OriginalIndex;
+        StringsSize += File->Path.Length + SprintHeaderBlock(0, File, Original);
+        BodiesSize = AlignUp(BodiesSize, SITE_BUNDLE_BODY_ALIGNMENT) + File->Size;
+    }
+    u64 BodiesOffset = AlignUp(StringsOffset + StringsSize, SITE_BUNDLE_BODY_ALIGNMENT);
+    u64 TotalSize = BodiesOffset + BodiesSize;
+    if (StringsOffset + StringsSize > 0xFFFFFFFF)
+    {
+        fprintf(stderr, "Too many paths, string table doesn't fit in 4GB\n");
+        return 1;
+    }
+    
+    u8 *Bundle = (u8 *)mmap(0, TotalSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (Bundle == MAP_FAILED)
+    {
+        perror("mmap failed");
+        return 1;
+    }
+    
+    // NOTE(vincent): Bodies first so that the ETags are known when we print the header blocks.
+    u64 BodyCursor = BodiesOffset;
+    site_bundle_entry *Entries = (site_bundle_entry *)(Bundle + EntriesOffset);
+    for (u32 FileIndex = 0; FileIndex < Packer.FileCount; FileIndex++)
+    {
+        packer_file *File = Packer.Files + FileIndex;
+        site_bundle_entry *Entry = Entries + FileIndex;
+        BodyCursor = AlignUp(BodyCursor, SITE_BUNDLE_BODY_ALIGNMENT);
+        
+        char *Path = PushArray(&Packer.Arena, Packer.Root.Length + 1 + File->Path.Length + 1, char);
+        u32 PathLength = SprintNoNull(Path, Packer.Root);
+        Path[PathLength++] = '/';
+        Sprint(Path + PathLength, File->Path);
+        FILE *Handle = fopen(Path, "rb");
+        if (!Handle || fread(Bundle + BodyCursor, 1, File->Size, Handle) != File->Size)
+        {
+            fprintf(stderr, "Couldn't read %s\n", Path);
+            return 1;
+        }
+        fclose(Handle);
+        
+        File->ETag = HashFNV1a(Bundle + BodyCursor, File->Size);
+        Entry->BodyOffset = BodyCursor;
+        Entry->BodySize = File->Size;
+        Entry->ETag = File->ETag;
+        Entry->VariantIndex = File->VariantIndex;
+        Entry->Encoding = File->Encoding;
+        BodyCursor += File->Size;
+    }
+    Assert(BodyCursor == TotalSize);
+    
+    u64 StringCursor = StringsOffset;
+    for (u32 FileIndex = 0; FileIndex < Packer.FileCount; FileIndex++)
+    {
+        packer_file *File = Packer.Files + FileIndex;
+        site_bundle_entry *Entry = Entries + FileIndex;
+        packer_file *Original = Packer.Files + File->OriginalIndex;  // variants advertise the original type
+        
+        Entry->PathOffset = (u32)StringCursor;
+        Entry->PathLength = SprintNoNull((char *)Bundle + StringCursor, File->Path);
+        StringCursor += Entry->PathLength;
+        
+        Entry->HeaderOffset = (u32)StringCursor;
+        Entry->HeaderLength = SprintHeaderBlock((char *)Bundle + StringCursor, File, Original);
+        StringCursor += Entry->HeaderLength;
+    }
+    Assert(StringCursor == StringsOffset + StringsSize);
+    
+    site_bundle_header *Header = (site_bundle_header *)Bundle;
+    Header->Magic = SITE_BUNDLE_MAGIC;
+    Header->Version = SITE_BUNDLE_VERSION;
+    Header->EntryCount = Packer.FileCount;
+    Header->EntriesOffset = (u32)EntriesOffset;
+    Header->TotalSize = TotalSize;
+    
+    site_bundle Check = {};
+    if (!LoadSiteBundle(&Check, Bundle, TotalSize))
+    {
+        fprintf(stderr, "Produced an invalid bundle, not writing it\n");
+        return 1;
+    }
+    
+    u32 OutputLength = StringLength(Args[2]);
+    char *TempName = PushArray(&Packer.Arena, OutputLength + 5, char);
+    Sprint(TempName, Args[2]);
+    Sprint(TempName + OutputLength, ".tmp");
+    FILE *Output = fopen(TempName, "wb");
+    if (!Output || fwrite(Bundle, 1, TotalSize, Output) != TotalSize || fclose(Output) != 0)
+    {
+        perror(TempName);
+        return 1;
+    }
+    if (rename(TempName, Args[2]) == -1)
+    {
+        perror("rename failed");
+        return 1;
+    }
+    
+    printf("Packed %u files (%llu bytes) into %s\n", Packer.FileCount,
+           (unsigned long long)TotalSize, Args[2]);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// NOTE(vincent): Chase-Lev work-stealing deque, shared by the platform layers' work queues.
+// Every thread that runs jobs owns one deque. The owner pushes and pops at the bottom without
+// any atomic read-modify-write, except when it takes the very last job. Idle threads steal from
+// the top of other deques with a compare-exchange. So a thread only writes to another thread's
+// cache lines when it has nothing to do.
+//
+// The ring has a fixed size: a push on a full deque fails and the caller has to deal with the job.
+// Top and Bottom only grow (Bottom dips by one during a pop), s64 won't wrap.
+// See "Correct and Efficient Work-Stealing for Weak Memory Models", Lê et al., 2013, for the
+// ordering arguments. On x86 the only fence needed is the one between the store and the load in the pop.
+
+#define WORK_DEQUE_SIZE 256   // power of two
+
+struct work_deque
+{
+    s64 volatile Top;         // thieves take from here
+    u8 TopPad[56];
+    s64 volatile Bottom;      // the owner pushes and pops here
+    u8 BottomPad[56];
+    platform_work_queue_entry Entries[WORK_DEQUE_SIZE];
+};
+
+enum work_steal_result
+{
+    WorkSteal_Empty,
+    WorkSteal_Success,
+    WorkSteal_Lost,           // another thread took that entry first, the deque may still have more
+};
+
+internal b32
+PushWorkDeque(work_deque *Deque, platform_work_queue_entry Entry)
+{
+    // NOTE(vincent): Owner only.
+    b32 Result = false;
+    s64 Bottom = Deque->Bottom;
+    s64 Top = Deque->Top;
+    if (Bottom - Top < WORK_DEQUE_SIZE)
+    {
+        Deque->Entries[Bottom & (WORK_DEQUE_SIZE - 1)] = Entry;
+        CompletePreviousWritesBeforeFutureWrites;
+        Deque->Bottom = Bottom + 1;
+        Result = true;
+    }
+    return Result;
+}
+
+internal b32
+PopWorkDeque(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    // NOTE(vincent): Owner only. Takes the most recently pushed entry.
+    b32 Result = false;
+    s64 Bottom = Deque->Bottom - 1;
+    Deque->Bottom = Bottom;
+    // NOTE(vincent): Thieves must see the lowered Bottom before we read Top, or a thief and us
+    // could both take the last entry. This is the store-load ordering x86 doesn't give for free.
+    FullMemoryBarrier;
+    s64 Top = Deque->Top;
+    if (Top <= Bottom)
+    {
+        *Entry = Deque->Entries[Bottom & (WORK_DEQUE_SIZE - 1)];
+        Result = true;
+        if (Top == Bottom)
+        {
+            // NOTE(vincent): Last entry, race the thieves for it.
+            Result = (AtomicCompareExchangeS64(&Deque->Top, Top + 1, Top) == Top);
+            Deque->Bottom = Bottom + 1;
+        }
+    }
+    else
+    {
+        Deque->Bottom = Bottom + 1;
+    }
+    return Result;
+}
+
+internal work_steal_result
+StealWorkDeque(work_deque *Deque, platform_work_queue_entry *Entry)
+{
+    // NOTE(vincent): Any thread. Takes the oldest entry.
+    work_steal_result Result = WorkSteal_Empty;
+    s64 Top = Deque->Top;
+    CompletePreviousReadsBeforeFutureReads;
+    s64 Bottom = Deque->Bottom;
+    if (Top < Bottom)
+    {
+        // NOTE(vincent): Read the entry before claiming it: once Top moves, the owner may overwrite the slot.
+        *Entry = Deque->Entries[Top & (WORK_DEQUE_SIZE - 1)];
+        Result = (AtomicCompareExchangeS64(&Deque->Top, Top + 1, Top) == Top) ? WorkSteal_Success : WorkSteal_Lost;
+    }
+    return Result;
+}
+
+internal b32
+TakeWork(work_deque *Deques, u32 DequeCount, u32 OwnIndex, platform_work_queue_entry *Entry)
+{
+    // NOTE(vincent): Own deque first, then steal, starting with the next thread so that thieves spread out.
+    // Returns false only after seeing every deque empty.
+    b32 Result = PopWorkDeque(Deques + OwnIndex, Entry);
+    b32 Lost = true;
+    while (!Result && Lost)
+    {
+        Lost = false;
+        for (u32 Offset = 1; !Result && Offset < DequeCount; Offset++)
+        {
+            work_steal_result Steal = StealWorkDeque(Deques + (OwnIndex + Offset) % DequeCount, Entry);
+            Result = (Steal == WorkSteal_Success);
+            Lost |= (Steal == WorkSteal_Lost);
+        }
+    }
+    return Result;
+}